@@ -1,159 +1,107 @@
 #include "AudioLoader.h"
-#include "AudioProcessor.h"
+#include "AudioStream.h"
 #include "../core/Constants.h"
+#include "../utils/Log.h"
+#include "../utils/Metrics.h"
 #include <filesystem>
 #include <algorithm>
 #include <iostream>
 #include <stdexcept>
-
-#define DR_WAV_IMPLEMENTATION
-#define DR_MP3_IMPLEMENTATION  
-#define DR_FLAC_IMPLEMENTATION
-#include "../../lib/dr_libs/dr_wav.h"
-#include "../../lib/dr_libs/dr_mp3.h"
-#include "../../lib/dr_libs/dr_flac.h"
+#include <cstdint>
 
 namespace AudioFingerprinting {
 
-std::vector<double> loadWavFile(const std::string& filename) {
-    unsigned int channels;
-    unsigned int sampleRate;
-    drwav_uint64 totalPCMFrameCount;
-    
-    float* pSampleData = drwav_open_file_and_read_pcm_frames_f32(
-        filename.c_str(), &channels, &sampleRate, &totalPCMFrameCount, nullptr);
-    
-    if (pSampleData == nullptr) {
-        throw std::runtime_error("Failed to load WAV file: " + filename);
+void printStreamInfo(const AudioStream& stream) {
+    if (!logEnabled(LogLevel::Debug)) {
+        return;
     }
     
-    std::cout << "  WAV info: " << channels << " channels, " 
-              << sampleRate << " Hz, " << totalPCMFrameCount << " frames" << std::endl;
-    
-    // Convert to double vector
-    size_t totalSamples = totalPCMFrameCount * channels;
-    std::vector<double> audioData;
-    audioData.reserve(totalSamples);
-    
-    for (size_t i = 0; i < totalSamples; i++) {
-        audioData.push_back(static_cast<double>(pSampleData[i]));
+    {
+        LogLine info(LogLevel::Debug);
+        info.stream() << "  " << audioFormatName(stream.format()) << " info: " << stream.sourceChannels() << " channels, " 
+                      << stream.sourceSampleRate() << " Hz";
+        if (stream.sourceFrames() > 0) {
+            info.stream() << ", " << stream.sourceFrames() << " frames";
+        }
     }
     
-    drwav_free(pSampleData, nullptr);
-    
-    // Convert stereo to mono if necessary
-    if (channels == 2) {
-        std::cout << "  Converting stereo to mono" << std::endl;
-        audioData = stereoToMono(audioData);
+    if (stream.sourceChannels() > 1) {
+        AF_LOG(Debug) << "  Converting " << (stream.sourceChannels() == 2 ? "stereo" : "multichannel") 
+                      << " to mono";
     }
     
-    // Resample if necessary
-    if (static_cast<int>(sampleRate) != SAMPLE_RATE) {
-        std::cout << "  Resampling from " << sampleRate << " Hz to " << SAMPLE_RATE << " Hz" << std::endl;
-        audioData = resample(audioData, static_cast<int>(sampleRate), SAMPLE_RATE);
+    if (static_cast<int>(stream.sourceSampleRate()) != SAMPLE_RATE) {
+        AF_LOG(Debug) << "  Resampling from " << stream.sourceSampleRate() << " Hz to " << SAMPLE_RATE << " Hz";
     }
-    
-    return audioData;
 }
 
-std::vector<double> loadMp3File(const std::string& filename) {
-    drmp3_config config;
-    drmp3_uint64 totalPCMFrameCount;
-    
-    float* pSampleData = drmp3_open_file_and_read_pcm_frames_f32(
-        filename.c_str(), &config, &totalPCMFrameCount, nullptr);
-    
-    if (pSampleData == nullptr) {
-        throw std::runtime_error("Failed to load MP3 file: " + filename);
+size_t readStream(AudioStream& stream, std::vector<double>& audio, size_t maxSamples) {
+    ScopedStageTimer timer(Stage::Decode);
+    size_t total = 0;
+    while (total < maxSamples) {
+        size_t want = std::min(maxSamples - total, static_cast<size_t>(AUDIO_BLOCK_FRAMES));
+        size_t got = stream.read(audio, want);
+        if (got == 0) break;
+        total += got;
     }
+    return total;
+}
+
+// Drains an opened stream into one mono buffer
+static std::vector<double> drainStream(AudioStream& stream) {
+    printStreamInfo(stream);
     
-    std::cout << "  MP3 info: " << config.channels << " channels, " 
-              << config.sampleRate << " Hz, " << totalPCMFrameCount << " frames" << std::endl;
-    
-    size_t totalSamples = totalPCMFrameCount * config.channels;
     std::vector<double> audioData;
-    audioData.reserve(totalSamples);
-    
-    for (size_t i = 0; i < totalSamples; i++) {
-        audioData.push_back(static_cast<double>(pSampleData[i]));
-    }
-    
-    drmp3_free(pSampleData, nullptr);
-    
-    if (config.channels == 2) {
-        std::cout << "  Converting stereo to mono" << std::endl;
-        audioData = stereoToMono(audioData);
-    }
-    
-    if (static_cast<int>(config.sampleRate) != SAMPLE_RATE) {
-        std::cout << "  Resampling from " << config.sampleRate << " Hz to " << SAMPLE_RATE << " Hz" << std::endl;
-        audioData = resample(audioData, static_cast<int>(config.sampleRate), SAMPLE_RATE);
-    }
+    audioData.reserve(static_cast<size_t>(stream.expectedSamples()));
+    readStream(stream, audioData, SIZE_MAX);
     
     return audioData;
 }
 
-std::vector<double> loadFlacFile(const std::string& filename) {
-    unsigned int channels;
-    unsigned int sampleRate;
-    drflac_uint64 totalPCMFrameCount;
-    
-    float* pSampleData = drflac_open_file_and_read_pcm_frames_f32(
-        filename.c_str(), &channels, &sampleRate, &totalPCMFrameCount, nullptr);
-    
-    if (pSampleData == nullptr) {
-        throw std::runtime_error("Failed to load FLAC file: " + filename);
+static std::vector<double> loadWithStream(const std::string& filename, AudioFormat format) {
+    AudioStream stream;
+    if (!stream.open(filename, format)) {
+        throw std::runtime_error(std::string("Failed to load ") + audioFormatName(format) + " file: " + filename);
     }
     
-    std::cout << "  FLAC info: " << channels << " channels, " 
-              << sampleRate << " Hz, " << totalPCMFrameCount << " frames" << std::endl;
-    
-    size_t totalSamples = totalPCMFrameCount * channels;
-    std::vector<double> audioData;
-    audioData.reserve(totalSamples);
-    
-    for (size_t i = 0; i < totalSamples; i++) {
-        audioData.push_back(static_cast<double>(pSampleData[i]));
-    }
-    
-    drflac_free(pSampleData, nullptr);
-    
-    if (channels == 2) {
-        std::cout << "  Converting stereo to mono" << std::endl;
-        audioData = stereoToMono(audioData);
-    }
-    
-    if (static_cast<int>(sampleRate) != SAMPLE_RATE) {
-        std::cout << "  Resampling from " << sampleRate << " Hz to " << SAMPLE_RATE << " Hz" << std::endl;
-        audioData = resample(audioData, static_cast<int>(sampleRate), SAMPLE_RATE);
-    }
-    
-    return audioData;
+    return drainStream(stream);
+}
+
+std::vector<double> loadWavFile(const std::string& filename) {
+    return loadWithStream(filename, AudioFormat::WAV);
+}
+
+std::vector<double> loadMp3File(const std::string& filename) {
+    return loadWithStream(filename, AudioFormat::MP3);
+}
+
+std::vector<double> loadFlacFile(const std::string& filename) {
+    return loadWithStream(filename, AudioFormat::FLAC);
 }
 
 std::vector<double> loadAudioFile(const std::string& filename) {
-    std::string extension = std::filesystem::path(filename).extension().string();
-    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-    
     try {
-        if (extension == ".wav") {
-            return loadWavFile(filename);
-        } else if (extension == ".mp3") {
-            return loadMp3File(filename);
-        } else if (extension == ".flac") {
-            return loadFlacFile(filename);
-        } else {
-            throw std::runtime_error("Unsupported audio format: " + extension);
+        AudioFormat format = audioFormatFromFilename(filename);
+        if (format == AudioFormat::UNKNOWN) {
+            throw std::runtime_error("Unsupported audio format: " + std::filesystem::path(filename).extension().string());
         }
+        return loadWithStream(filename, format);
     } catch (const std::exception& e) {
         throw std::runtime_error("Error loading " + filename + ": " + e.what());
     }
 }
 
+std::vector<double> loadAudioBuffer(const void* data, size_t size, AudioFormat format) {
+    AudioStream stream;
+    if (!stream.openMemory(data, size, format)) {
+        throw std::runtime_error("Failed to decode audio buffer (" + std::to_string(size) + " bytes)");
+    }
+    
+    return drainStream(stream);
+}
+
 bool isSupportedFormat(const std::string& filename) {
-    std::string extension = std::filesystem::path(filename).extension().string();
-    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-    return extension == ".wav" || extension == ".mp3" || extension == ".flac";
+    return audioFormatFromFilename(filename) != AudioFormat::UNKNOWN;
 }
 
-} // namespace AudioFingerprinting
\ No newline at end of file
+} // namespace AudioFingerprinting
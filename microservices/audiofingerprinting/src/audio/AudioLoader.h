@@ -1,17 +1,27 @@
 #ifndef AUDIO_LOADER_H
 #define AUDIO_LOADER_H
 
+#include "AudioStream.h"
 #include <string>
 #include <vector>
+#include <cstddef>
 
 namespace AudioFingerprinting {
 
+// Whole-file loaders (mono, SAMPLE_RATE); prefer AudioStream for long tracks
 std::vector<double> loadWavFile(const std::string& filename);
 std::vector<double> loadMp3File(const std::string& filename);
 std::vector<double> loadFlacFile(const std::string& filename);
 std::vector<double> loadAudioFile(const std::string& filename);
+
+// Decodes an encoded file held in memory; the format is sniffed when UNKNOWN
+std::vector<double> loadAudioBuffer(const void* data, size_t size, AudioFormat format = AudioFormat::UNKNOWN);
 bool isSupportedFormat(const std::string& filename);
 
+// Streaming helpers
+void printStreamInfo(const AudioStream& stream);
+size_t readStream(AudioStream& stream, std::vector<double>& audio, size_t maxSamples);
+
 } // namespace AudioFingerprinting
 
 #endif
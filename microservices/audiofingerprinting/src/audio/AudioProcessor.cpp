@@ -1,26 +1,62 @@
 #include "AudioProcessor.h"
+#include "FFTPlanCache.h"
+#include "Resampler.h"
+#include "../utils/ThreadPool.h"
+#include "../utils/Metrics.h"
 #include <algorithm>
 #include <iostream>
 
 namespace AudioFingerprinting {
 
+namespace {
+
+// FFTW buffers owned by the calling thread, so pool workers can run the
+// shared plan concurrently
+struct FrameBuffers {
+    float* in = nullptr;
+    fftwf_complex* out = nullptr;
+    int size = 0;
+    
+    void reserve(int fftSize) {
+        if (size == fftSize) return;
+        release();
+        in = fftwf_alloc_real(fftSize);
+        out = fftwf_alloc_complex(fftSize / 2 + 1);
+        size = fftSize;
+    }
+    
+    void release() {
+        fftwf_free(in);
+        fftwf_free(out);
+        in = nullptr;
+        out = nullptr;
+        size = 0;
+    }
+    
+    ~FrameBuffers() { release(); }
+};
+
+thread_local FrameBuffers frameBuffers;
+
+} // namespace
+
 AudioProcessor::AudioProcessor() {
-    fftSize = static_cast<int>(SAMPLE_RATE * FFT_WINDOW_SIZE);
+    fftSize = FFT_SIZE;
     
     // Pre-allocate buffers
-    windowBuffer.resize(fftSize);
-    hammingWindow = generateHammingWindow(fftSize);
-    
-    // Initialize FFTW
-    fftw_in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * fftSize);
-    fftw_out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * fftSize);
-    fftw_plan_forward = fftw_plan_dft_1d(fftSize, fftw_in, fftw_out, FFTW_FORWARD, FFTW_MEASURE);
+    std::vector<double> window = generateHammingWindow(fftSize);
+    hammingWindow.assign(window.begin(), window.end());
+    
+    // Initialize FFTW (input is purely real, so only fftSize / 2 + 1 bins are computed).
+    // The plan is measured once per process; this instance only owns its buffers.
+    fftw_in = fftwf_alloc_real(fftSize);
+    fftw_out = fftwf_alloc_complex(fftSize / 2 + 1);
+    fftw_plan_forward = FFTPlanCache::instance().realForward(fftSize);
 }
 
 AudioProcessor::~AudioProcessor() {
-    fftw_destroy_plan(fftw_plan_forward);
-    fftw_free(fftw_in);
-    fftw_free(fftw_out);
+    fftwf_free(fftw_in);
+    fftwf_free(fftw_out);
 }
 
 std::vector<double> AudioProcessor::generateHammingWindow(int length) {
@@ -32,21 +68,19 @@ std::vector<double> AudioProcessor::generateHammingWindow(int length) {
     return window;
 }
 
-std::vector<std::complex<double>> AudioProcessor::computeFFT(const std::vector<double>& input) {
-    // Copy input to FFTW buffer with windowing
-    for (size_t i = 0; i < static_cast<size_t>(fftSize) && i < input.size(); i++) {
-        fftw_in[i][0] = input[i] * hammingWindow[i];  // Real part with window
-        fftw_in[i][1] = 0.0;                          // Imaginary part
-    }
-    
-    // Pad with zeros if input is smaller
-    for (size_t i = input.size(); i < static_cast<size_t>(fftSize); i++) {
-        fftw_in[i][0] = 0.0;
-        fftw_in[i][1] = 0.0;
+void AudioProcessor::transformFrame(const double* samples, size_t count, float* in, fftwf_complex* out) const {
+    // Copy input to FFTW buffer with windowing, zero padding short input
+    size_t n = std::min(count, static_cast<size_t>(fftSize));
+    for (size_t i = 0; i < n; i++) {
+        in[i] = static_cast<float>(samples[i]) * hammingWindow[i];
     }
+    std::fill(in + n, in + fftSize, 0.0f);
     
-    // Execute FFT
-    fftw_execute(fftw_plan_forward);
+    fftwf_execute_dft_r2c(fftw_plan_forward, in, out);
+}
+
+std::vector<std::complex<double>> AudioProcessor::computeFFT(const std::vector<double>& input) {
+    transformFrame(input.data(), input.size(), fftw_in, fftw_out);
     
     // Convert to std::complex
     std::vector<std::complex<double>> result(fftSize / 2 + 1);
@@ -58,15 +92,21 @@ std::vector<std::complex<double>> AudioProcessor::computeFFT(const std::vector<d
 }
 
 SpectrogramResult AudioProcessor::computeSpectrogramOptimized(const std::vector<double>& audio) {
+    return computeSpectrogramOptimized(audio.data(), audio.size(), 0);
+}
+
+SpectrogramResult AudioProcessor::computeSpectrogramOptimized(const double* audio, size_t count, size_t firstFrame) {
+    ScopedStageTimer timer(Stage::Spectrogram);
     int nperseg = fftSize;
     int noverlap = nperseg / 2;
     int step = nperseg - noverlap;
     
     // Calculate number of time segments
-    int numSegments = (audio.size() - noverlap) / step;
+    int numSegments = count > static_cast<size_t>(noverlap)
+        ? static_cast<int>((count - noverlap) / step) : 0;
     int freqBins = nperseg / 2 + 1;
     
-    std::vector<std::vector<double>> spectrogram(freqBins, std::vector<double>(numSegments));
+    PowerMatrix spectrogram(freqBins, numSegments);
     std::vector<double> frequencies(freqBins);
     std::vector<double> times(numSegments);
     
@@ -79,29 +119,30 @@ SpectrogramResult AudioProcessor::computeSpectrogramOptimized(const std::vector<
     // Generate time array
     const double timeStep = static_cast<double>(step) / SAMPLE_RATE;
     for (int i = 0; i < numSegments; i++) {
-        times[i] = i * timeStep;
+        times[i] = (firstFrame + i) * timeStep;
     }
     
-    // Process each segment
-    for (int seg = 0; seg < numSegments; seg++) {
-        int start = seg * step;
+    // Frames are independent: split them across the shared pool, each thread
+    // writing its own frames of the one spectrogram with its own FFTW buffers
+    ThreadPool::shared().parallelFor(numSegments, STFT_FRAMES_PER_TASK, [&](size_t begin, size_t end) {
+        FrameBuffers& buffers = frameBuffers;
+        buffers.reserve(fftSize);
         
-        // Extract segment
-        std::vector<double> segment(nperseg, 0.0);
-        int copySize = std::min(nperseg, static_cast<int>(audio.size() - start));
-        std::copy(audio.begin() + start, audio.begin() + start + copySize, segment.begin());
-        
-        // Compute FFT
-        auto fft = computeFFT(segment);
-        
-        // Calculate power spectrum
-        for (int i = 0; i < freqBins; i++) {
-            double magnitude = std::abs(fft[i]);
-            spectrogram[i][seg] = magnitude * magnitude;
+        for (size_t seg = begin; seg < end; seg++) {
+            size_t start = seg * step;
+            transformFrame(audio + start, count - start, buffers.in, buffers.out);
+            
+            // Calculate power spectrum straight into the frame's row
+            float* power = spectrogram.frame(seg);
+            for (int i = 0; i < freqBins; i++) {
+                float re = buffers.out[i][0];
+                float im = buffers.out[i][1];
+                power[i] = re * re + im * im;
+            }
         }
-    }
+    });
     
-    return SpectrogramResult(frequencies, times, spectrogram);
+    return SpectrogramResult(std::move(frequencies), std::move(times), std::move(spectrogram));
 }
 
 std::vector<double> resample(const std::vector<double>& input, int originalSampleRate, int targetSampleRate) {
@@ -109,22 +150,18 @@ std::vector<double> resample(const std::vector<double>& input, int originalSampl
         return input;
     }
     
-    double ratio = static_cast<double>(originalSampleRate) / targetSampleRate;
-    size_t outputSize = static_cast<size_t>(input.size() / ratio);
+    // Same filter as the decoders, fed in blocks so the float copy stays small
+    Resampler resampler(originalSampleRate, 1, targetSampleRate);
     std::vector<double> output;
-    output.reserve(outputSize);
+    output.reserve(Resampler::outputLength(input.size(), originalSampleRate, targetSampleRate));
     
-    for (size_t i = 0; i < outputSize; i++) {
-        double sourceIndex = static_cast<double>(i) * ratio;
-        size_t index = static_cast<size_t>(sourceIndex);
-        
-        if (index < input.size() - 1) {
-            double fraction = sourceIndex - static_cast<double>(index);
-            output.push_back(input[index] * (1.0 - fraction) + input[index + 1] * fraction);
-        } else if (index < input.size()) {
-            output.push_back(input[index]);
-        }
+    std::vector<float> block;
+    for (size_t pos = 0; pos < input.size(); pos += AUDIO_BLOCK_FRAMES) {
+        size_t count = std::min(input.size() - pos, static_cast<size_t>(AUDIO_BLOCK_FRAMES));
+        block.assign(input.begin() + pos, input.begin() + pos + count);
+        resampler.process(block.data(), count, output);
     }
+    resampler.finish(output);
     
     return output;
 }
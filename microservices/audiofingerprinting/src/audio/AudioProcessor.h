@@ -12,20 +12,30 @@ namespace AudioFingerprinting {
 
 class AudioProcessor {
 private:
-    std::vector<double> windowBuffer;
-    std::vector<double> hammingWindow;
-    fftw_complex *fftw_in;
-    fftw_complex *fftw_out;
-    fftw_plan fftw_plan_forward;
+    std::vector<float> hammingWindow;
+    float *fftw_in;                 // fftSize real samples (computeFFT)
+    fftwf_complex *fftw_out;        // fftSize / 2 + 1 bins
+    fftwf_plan fftw_plan_forward;   // Real-to-complex, shared via FFTPlanCache
     int fftSize;
     
+    // Windows one frame into `in` and runs the plan into `out`
+    void transformFrame(const double* samples, size_t count, float* in, fftwf_complex* out) const;
+    
 public:
     AudioProcessor();
     ~AudioProcessor();
     
+    AudioProcessor(const AudioProcessor&) = delete;
+    AudioProcessor& operator=(const AudioProcessor&) = delete;
+    
     std::vector<double> generateHammingWindow(int length);
     std::vector<std::complex<double>> computeFFT(const std::vector<double>& input);
     SpectrogramResult computeSpectrogramOptimized(const std::vector<double>& audio);
+    
+    // Spectrogram of `count` samples starting at STFT frame firstFrame of the
+    // track (times are track-relative). Frames are computed in parallel on
+    // ThreadPool::shared(): the audio is only read, never copied.
+    SpectrogramResult computeSpectrogramOptimized(const double* audio, size_t count, size_t firstFrame = 0);
 };
 
 // Utility functions
@@ -0,0 +1,243 @@
+#include "AudioStream.h"
+#include "../core/Constants.h"
+#include <filesystem>
+#include <algorithm>
+#include <iostream>
+
+#define DR_WAV_IMPLEMENTATION
+#define DR_MP3_IMPLEMENTATION
+#define DR_FLAC_IMPLEMENTATION
+#include "../../lib/dr_libs/dr_wav.h"
+#include "../../lib/dr_libs/dr_mp3.h"
+#include "../../lib/dr_libs/dr_flac.h"
+
+namespace AudioFingerprinting {
+
+AudioFormat audioFormatFromFilename(const std::string& filename) {
+    std::string extension = std::filesystem::path(filename).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if (extension == ".wav") return AudioFormat::WAV;
+    if (extension == ".mp3") return AudioFormat::MP3;
+    if (extension == ".flac") return AudioFormat::FLAC;
+    return AudioFormat::UNKNOWN;
+}
+
+const char* audioFormatName(AudioFormat format) {
+    switch (format) {
+        case AudioFormat::WAV: return "WAV";
+        case AudioFormat::MP3: return "MP3";
+        case AudioFormat::FLAC: return "FLAC";
+        default: return "unknown";
+    }
+}
+
+AudioFormat audioFormatFromContent(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    if (bytes == nullptr || size < 4) {
+        return AudioFormat::UNKNOWN;
+    }
+
+    auto startsWith = [bytes](const char* magic) {
+        return std::equal(magic, magic + 4, bytes, [](char m, unsigned char b) {
+            return static_cast<unsigned char>(m) == b;
+        });
+    };
+
+    if (startsWith("RIFF") || startsWith("RF64") || startsWith("riff")) return AudioFormat::WAV;
+    if (startsWith("fLaC")) return AudioFormat::FLAC;
+    if (bytes[0] == 'I' && bytes[1] == 'D' && bytes[2] == '3') return AudioFormat::MP3;
+    if (bytes[0] == 0xFF && (bytes[1] & 0xE0) == 0xE0) return AudioFormat::MP3;
+    return AudioFormat::UNKNOWN;
+}
+
+// Keeps the dr_libs types out of the header
+struct AudioStream::Decoder {
+    AudioFormat format = AudioFormat::UNKNOWN;
+    drwav wav;
+    drmp3 mp3;
+    drflac* flac = nullptr;
+
+    ~Decoder() {
+        switch (format) {
+            case AudioFormat::WAV: drwav_uninit(&wav); break;
+            case AudioFormat::MP3: drmp3_uninit(&mp3); break;
+            case AudioFormat::FLAC: drflac_close(flac); break;
+            default: break;
+        }
+    }
+
+    uint64_t readFrames(uint64_t frames, float* out) {
+        switch (format) {
+            case AudioFormat::WAV: return drwav_read_pcm_frames_f32(&wav, frames, out);
+            case AudioFormat::MP3: return drmp3_read_pcm_frames_f32(&mp3, frames, out);
+            case AudioFormat::FLAC: return drflac_read_pcm_frames_f32(flac, frames, out);
+            default: return 0;
+        }
+    }
+};
+
+AudioStream::AudioStream()
+    : sourceFormat(AudioFormat::UNKNOWN), channels(0), sampleRate(0), totalFrames(0),
+      readyPos(0), inputDone(true) {}
+
+AudioStream::~AudioStream() {
+    close();
+}
+
+bool AudioStream::open(const std::string& filename) {
+    return open(filename, audioFormatFromFilename(filename));
+}
+
+bool AudioStream::open(const std::string& filename, AudioFormat format) {
+    close();
+
+    auto dec = std::make_unique<Decoder>();
+    bool opened = false;
+
+    switch (format) {
+        case AudioFormat::WAV:
+            opened = drwav_init_file(&dec->wav, filename.c_str(), nullptr);
+            break;
+        case AudioFormat::MP3:
+            opened = drmp3_init_file(&dec->mp3, filename.c_str(), nullptr);
+            break;
+        case AudioFormat::FLAC:
+            dec->flac = drflac_open_file(filename.c_str(), nullptr);
+            opened = dec->flac != nullptr;
+            break;
+        default:
+            break;
+    }
+
+    return opened && start(std::move(dec), format);
+}
+
+bool AudioStream::openMemory(const void* data, size_t size, AudioFormat format) {
+    close();
+
+    if (format == AudioFormat::UNKNOWN) {
+        format = audioFormatFromContent(data, size);
+    }
+
+    auto dec = std::make_unique<Decoder>();
+    bool opened = false;
+
+    switch (format) {
+        case AudioFormat::WAV:
+            opened = drwav_init_memory(&dec->wav, data, size, nullptr);
+            break;
+        case AudioFormat::MP3:
+            opened = drmp3_init_memory(&dec->mp3, data, size, nullptr);
+            break;
+        case AudioFormat::FLAC:
+            dec->flac = drflac_open_memory(data, size, nullptr);
+            opened = dec->flac != nullptr;
+            break;
+        default:
+            break;
+    }
+
+    return opened && start(std::move(dec), format);
+}
+
+bool AudioStream::start(std::unique_ptr<Decoder> dec, AudioFormat format) {
+    // From here on the decoder destructor uninitializes whatever was opened
+    dec->format = format;
+
+    switch (format) {
+        case AudioFormat::WAV:
+            channels = dec->wav.channels;
+            sampleRate = dec->wav.sampleRate;
+            totalFrames = dec->wav.totalPCMFrameCount;
+            break;
+        case AudioFormat::MP3:
+            channels = dec->mp3.channels;
+            sampleRate = dec->mp3.sampleRate;
+            totalFrames = 0; // Only known after a full scan
+            break;
+        case AudioFormat::FLAC:
+            channels = dec->flac->channels;
+            sampleRate = dec->flac->sampleRate;
+            totalFrames = dec->flac->totalPCMFrameCount;
+            break;
+        default:
+            return false;
+    }
+
+    // Also rejects absurd header values before a filter bank is sized from them
+    if (!Resampler::supportsSource(sampleRate, channels)) {
+        close();
+        return false;
+    }
+
+    decoder = std::move(dec);
+    sourceFormat = format;
+    decodeBuffer.resize(static_cast<size_t>(AUDIO_BLOCK_FRAMES) * channels);
+    resampler = std::make_unique<Resampler>(sampleRate, channels);
+    ready.clear();
+    readyPos = 0;
+    inputDone = false;
+
+    return true;
+}
+
+void AudioStream::close() {
+    decoder.reset();
+    sourceFormat = AudioFormat::UNKNOWN;
+    channels = 0;
+    sampleRate = 0;
+    totalFrames = 0;
+    resampler.reset();
+    ready.clear();
+    readyPos = 0;
+    inputDone = true;
+}
+
+uint64_t AudioStream::expectedSamples() const {
+    if (totalFrames == 0) {
+        return 0;
+    }
+    return Resampler::outputLength(totalFrames, sampleRate);
+}
+
+bool AudioStream::decodeBlock() {
+    uint64_t frames = decoder->readFrames(AUDIO_BLOCK_FRAMES, decodeBuffer.data());
+
+    if (frames == 0) {
+        inputDone = true;
+        resampler->finish(ready);
+        return false;
+    }
+
+    resampler->process(decodeBuffer.data(), static_cast<size_t>(frames), ready);
+    return true;
+}
+
+size_t AudioStream::read(std::vector<double>& dest, size_t maxSamples) {
+    if (!decoder) {
+        return 0;
+    }
+
+    size_t produced = 0;
+    while (produced < maxSamples) {
+        if (readyPos == ready.size()) {
+            ready.clear();
+            readyPos = 0;
+            if (inputDone) {
+                break;
+            }
+            decodeBlock();
+            continue;
+        }
+
+        size_t take = std::min(maxSamples - produced, ready.size() - readyPos);
+        dest.insert(dest.end(), ready.begin() + readyPos, ready.begin() + readyPos + take);
+        readyPos += take;
+        produced += take;
+    }
+
+    return produced;
+}
+
+} // namespace AudioFingerprinting
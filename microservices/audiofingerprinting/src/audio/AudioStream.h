@@ -0,0 +1,84 @@
+#ifndef AUDIO_STREAM_H
+#define AUDIO_STREAM_H
+
+#include "Resampler.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+enum class AudioFormat {
+    UNKNOWN,
+    WAV,
+    MP3,
+    FLAC
+};
+
+AudioFormat audioFormatFromFilename(const std::string& filename);
+const char* audioFormatName(AudioFormat format);
+
+// Recognizes WAV (RIFF/RF64/W64), FLAC and MP3 (ID3 tag or frame sync) headers
+AudioFormat audioFormatFromContent(const void* data, size_t size);
+
+// Pull-based decoder that yields mono audio at SAMPLE_RATE.
+//
+// Frames are decoded incrementally with the dr_libs read_pcm_frames_f32
+// readers and go through the Resampler, which downmixes and resamples them
+// in one pass, so memory use is bounded by the block size rather than by
+// the track length.
+class AudioStream {
+public:
+    AudioStream();
+    ~AudioStream();
+
+    AudioStream(const AudioStream&) = delete;
+    AudioStream& operator=(const AudioStream&) = delete;
+
+    // Opens by extension, or with an explicit format
+    bool open(const std::string& filename);
+    bool open(const std::string& filename, AudioFormat format);
+    
+    // Decodes an encoded file held in memory, sniffing the format when it is
+    // UNKNOWN. The buffer is not copied and must outlive the stream.
+    bool openMemory(const void* data, size_t size, AudioFormat format = AudioFormat::UNKNOWN);
+    void close();
+    bool isOpen() const { return decoder != nullptr; }
+
+    // Appends up to maxSamples mono samples to dest; returns 0 at end of stream
+    size_t read(std::vector<double>& dest, size_t maxSamples);
+
+    // Source properties (sourceFrames is 0 when the container doesn't say)
+    AudioFormat format() const { return sourceFormat; }
+    unsigned int sourceChannels() const { return channels; }
+    unsigned int sourceSampleRate() const { return sampleRate; }
+    uint64_t sourceFrames() const { return totalFrames; }
+
+    // Output samples the stream will produce, or 0 if unknown
+    uint64_t expectedSamples() const;
+
+private:
+    struct Decoder;
+    std::unique_ptr<Decoder> decoder;
+
+    AudioFormat sourceFormat;
+    unsigned int channels;
+    unsigned int sampleRate;
+    uint64_t totalFrames;
+
+    // Interleaved frames of the last read, and the output not yet returned
+    std::vector<float> decodeBuffer;
+    std::unique_ptr<Resampler> resampler;
+    std::vector<double> ready;
+    size_t readyPos;
+    bool inputDone;
+
+    bool start(std::unique_ptr<Decoder> dec, AudioFormat format);
+    bool decodeBlock();
+};
+
+} // namespace AudioFingerprinting
+
+#endif
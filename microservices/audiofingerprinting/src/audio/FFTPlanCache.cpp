@@ -0,0 +1,79 @@
+#include "FFTPlanCache.h"
+#include <filesystem>
+#include <iostream>
+
+namespace AudioFingerprinting {
+
+FFTPlanCache& FFTPlanCache::instance() {
+    static FFTPlanCache cache;
+    return cache;
+}
+
+FFTPlanCache::~FFTPlanCache() {
+    for (auto& entry : plans) {
+        fftwf_destroy_plan(entry.second);
+    }
+}
+
+fftwf_plan FFTPlanCache::realForward(int size) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = plans.find(size);
+    if (it != plans.end()) {
+        return it->second;
+    }
+
+    // Measuring overwrites the arrays, so plan on scratch buffers. fftwf_alloc
+    // alignment lets the plan run on any other fftwf_alloc'd buffers.
+    float* in = fftwf_alloc_real(size);
+    fftwf_complex* out = fftwf_alloc_complex(size / 2 + 1);
+
+    fftwf_plan plan = fftwf_plan_dft_r2c_1d(size, in, out, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+    if (plan == nullptr) {
+        plan = fftwf_plan_dft_r2c_1d(size, in, out, FFTW_MEASURE);
+        wisdomChanged = true;
+    }
+
+    fftwf_free(in);
+    fftwf_free(out);
+
+    plans[size] = plan;
+    return plan;
+}
+
+std::string FFTPlanCache::defaultWisdomPathFor(const std::string& dbPath) {
+    return dbPath + ".fftw-wisdom";
+}
+
+bool FFTPlanCache::importWisdom(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (path.empty() || !std::filesystem::exists(path)) {
+        return false;
+    }
+
+    if (!fftwf_import_wisdom_from_filename(path.c_str())) {
+        std::cerr << "Ignoring unreadable FFTW wisdom: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool FFTPlanCache::exportWisdom(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (path.empty() || !wisdomChanged) {
+        return true;
+    }
+
+    if (!fftwf_export_wisdom_to_filename(path.c_str())) {
+        std::cerr << "Failed to save FFTW wisdom: " << path << std::endl;
+        return false;
+    }
+
+    wisdomChanged = false;
+    return true;
+}
+
+} // namespace AudioFingerprinting
@@ -0,0 +1,50 @@
+#ifndef FFT_PLAN_CACHE_H
+#define FFT_PLAN_CACHE_H
+
+#include <fftw3.h>
+#include <string>
+#include <map>
+#include <mutex>
+
+namespace AudioFingerprinting {
+
+// Process-wide registry of single-precision real-to-complex FFTW plans,
+// keyed by transform size.
+//
+// FFTW's planner is not thread-safe and FFTW_MEASURE is slow, while
+// executing a plan on other arrays (fftwf_execute_dft_r2c) is safe from any
+// thread. Plans are therefore measured once, under a lock, and shared by
+// every AudioProcessor; each processor brings its own fftwf_alloc'd buffers.
+// Wisdom can be persisted so a restarted process doesn't measure again.
+class FFTPlanCache {
+private:
+    std::mutex mutex; // Serializes all planner and wisdom calls
+    std::map<int, fftwf_plan> plans;
+    bool wisdomChanged = false;
+
+    FFTPlanCache() = default;
+    ~FFTPlanCache();
+
+public:
+    FFTPlanCache(const FFTPlanCache&) = delete;
+    FFTPlanCache& operator=(const FFTPlanCache&) = delete;
+
+    static FFTPlanCache& instance();
+
+    // Plan for `size` real samples in, size / 2 + 1 bins out. Created with
+    // FFTW_MEASURE on first use and kept for the lifetime of the process.
+    fftwf_plan realForward(int size);
+
+    // Wisdom file kept beside the database
+    static std::string defaultWisdomPathFor(const std::string& dbPath);
+
+    // Missing or unreadable files are not an error: plans are measured instead
+    bool importWisdom(const std::string& path);
+
+    // Writes only when plans were measured since the last import or export
+    bool exportWisdom(const std::string& path);
+};
+
+} // namespace AudioFingerprinting
+
+#endif
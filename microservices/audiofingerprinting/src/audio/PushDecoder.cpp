@@ -0,0 +1,263 @@
+#include "PushDecoder.h"
+#include "../core/Constants.h"
+#include "../utils/Metrics.h"
+#include <algorithm>
+#include <cstring>
+
+// Declarations only; the implementation is compiled in AudioStream.cpp
+#include "../../lib/dr_libs/dr_mp3.h"
+
+namespace AudioFingerprinting {
+
+namespace {
+
+// Largest WAV header accepted before the data chunk
+const size_t MAX_WAV_HEADER_BYTES = 1 << 20;
+
+// Bytes buffered before an MP3 frame is decoded: the decoder syncs on a run
+// of consecutive frame headers, as in dr_mp3's own pull reader
+const size_t MP3_MIN_BUFFERED_BYTES = 16384;
+
+uint16_t readLE16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t readLE32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Same scale as drwav_s16_to_f32 / drmp3_s16_to_f32
+inline float s16ToFloat(int16_t sample) {
+    return sample * 0.000030517578125f;
+}
+
+} // namespace
+
+struct PushDecoder::Mp3Decoder {
+    drmp3dec decoder;
+    drmp3_int16 frame[DRMP3_MAX_SAMPLES_PER_FRAME];
+    std::vector<float> samples;
+
+    Mp3Decoder() { drmp3dec_init(&decoder); }
+};
+
+PushDecoder::PushDecoder(AudioFormat format, const PcmFormat& pcmFormat)
+    : container(format), pcm(pcmFormat), headerDone(format == AudioFormat::UNKNOWN) {
+    if (format == AudioFormat::MP3) {
+        mp3 = std::make_unique<Mp3Decoder>();
+        pcm.sampleRate = 0;
+        pcm.channels = 0;
+    } else if (format == AudioFormat::FLAC) {
+        fail("FLAC cannot be decoded incrementally");
+    } else if (format == AudioFormat::UNKNOWN && (pcm.channels == 0 || pcm.sampleRate == 0)) {
+        fail("PCM streams need a sample rate and channel count");
+    } else if (format == AudioFormat::UNKNOWN && !Resampler::supportsSource(pcm.sampleRate, pcm.channels)) {
+        fail("Unsupported PCM sample rate or channel count");
+    }
+}
+
+PushDecoder::~PushDecoder() = default;
+
+bool PushDecoder::fail(const std::string& message) {
+    if (errorMessage.empty()) {
+        errorMessage = message;
+    }
+    input.clear();
+    return false;
+}
+
+bool PushDecoder::push(const void* data, size_t size, std::vector<double>& dest) {
+    ScopedStageTimer timer(Stage::Decode);
+    if (!errorMessage.empty()) {
+        return false;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    input.insert(input.end(), bytes, bytes + size);
+
+    if (container == AudioFormat::MP3) {
+        decodeMp3(false, dest);
+    } else {
+        if (!headerDone && !parseWavHeader()) {
+            return errorMessage.empty();
+        }
+        decodePcm(dest);
+    }
+    return errorMessage.empty();
+}
+
+void PushDecoder::finish(std::vector<double>& dest) {
+    if (!errorMessage.empty()) {
+        return;
+    }
+    if (container == AudioFormat::MP3) {
+        decodeMp3(true, dest);
+    }
+    if (resampler && errorMessage.empty()) {
+        resampler->finish(dest);
+    }
+}
+
+// Returns true once the data chunk has been reached; false while more of the
+// header is needed or after fail()
+bool PushDecoder::parseWavHeader() {
+    if (input.size() < 12) {
+        return false;
+    }
+    if (std::memcmp(input.data(), "RIFF", 4) != 0 || std::memcmp(input.data() + 8, "WAVE", 4) != 0) {
+        return fail("Not a RIFF/WAVE stream");
+    }
+
+    bool haveFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= input.size()) {
+        const uint8_t* chunk = input.data() + pos;
+        uint32_t chunkSize = readLE32(chunk + 4);
+
+        if (std::memcmp(chunk, "data", 4) == 0) {
+            if (!haveFormat) {
+                return fail("WAV data chunk before the fmt chunk");
+            }
+            // Streamed WAVs often carry a placeholder size, so everything after is data
+            input.erase(input.begin(), input.begin() + pos + 8);
+            headerDone = true;
+            return true;
+        }
+
+        size_t chunkEnd = pos + 8 + chunkSize + (chunkSize & 1);
+        if (chunkEnd > MAX_WAV_HEADER_BYTES) {
+            return fail("WAV header too large");
+        }
+        if (chunkEnd > input.size()) {
+            return false;
+        }
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunkSize < 16) {
+                return fail("Malformed WAV fmt chunk");
+            }
+            const uint8_t* fmt = chunk + 8;
+            uint16_t tag = readLE16(fmt);
+            if (tag == 0xFFFE && chunkSize >= 26) {
+                tag = readLE16(fmt + 24); // WAVE_FORMAT_EXTENSIBLE sub-format
+            }
+            uint16_t bits = readLE16(fmt + 14);
+
+            if (tag == 1 && bits == 16) {
+                pcm.encoding = PcmEncoding::S16LE;
+            } else if (tag == 3 && bits == 32) {
+                pcm.encoding = PcmEncoding::F32LE;
+            } else {
+                return fail("Unsupported WAV sample format (16-bit PCM or 32-bit float expected)");
+            }
+            pcm.channels = readLE16(fmt + 2);
+            pcm.sampleRate = readLE32(fmt + 4);
+            if (pcm.channels == 0 || pcm.sampleRate == 0) {
+                return fail("Malformed WAV fmt chunk");
+            }
+            if (!Resampler::supportsSource(pcm.sampleRate, pcm.channels)) {
+                return fail("Unsupported WAV sample rate or channel count");
+            }
+            haveFormat = true;
+        }
+
+        pos = chunkEnd;
+    }
+
+    return false;
+}
+
+void PushDecoder::decodePcm(std::vector<double>& dest) {
+    const size_t sampleBytes = pcm.encoding == PcmEncoding::S16LE ? 2 : 4;
+    const size_t frameBytes = sampleBytes * pcm.channels;
+    const size_t frames = input.size() / frameBytes;
+    if (frames == 0) {
+        return;
+    }
+
+    std::vector<float> samples(frames * pcm.channels);
+    const uint8_t* in = input.data();
+    for (size_t i = 0; i < samples.size(); i++, in += sampleBytes) {
+        if (pcm.encoding == PcmEncoding::S16LE) {
+            samples[i] = s16ToFloat(static_cast<int16_t>(readLE16(in)));
+        } else {
+            uint32_t bits = readLE32(in);
+            std::memcpy(&samples[i], &bits, sizeof(float));
+        }
+    }
+
+    addFrames(samples.data(), frames, pcm.channels, dest);
+
+    // Keep a partial frame for the next push
+    input.erase(input.begin(), input.begin() + frames * frameBytes);
+}
+
+void PushDecoder::decodeMp3(bool flush, std::vector<double>& dest) {
+    size_t pos = 0;
+    while (pos < input.size() && (flush || input.size() - pos >= MP3_MIN_BUFFERED_BYTES)) {
+        drmp3dec_frame_info info;
+        int frames = drmp3dec_decode_frame(&mp3->decoder, input.data() + pos,
+                                           static_cast<int>(input.size() - pos), mp3->frame, &info);
+        if (info.frame_bytes <= 0) {
+            break; // No frame in what is buffered yet
+        }
+        pos += static_cast<size_t>(info.frame_bytes);
+
+        // Zero frames with consumed bytes is skipped data (tags, garbage)
+        if (frames <= 0 || info.channels <= 0) {
+            continue;
+        }
+        unsigned int frameRate = static_cast<unsigned int>(info.sample_rate);
+        if (frameRate != pcm.sampleRate) {
+            // The header is untrusted too: it sizes the resampler's filter bank
+            if (!Resampler::supportsSource(frameRate, static_cast<unsigned int>(info.channels))) {
+                fail("Unsupported MP3 sample rate or channel count");
+                return;
+            }
+
+            // A rate change (spliced streams) flushes the old rate's
+            // resampler and starts a new one on the frame's layout
+            if (resampler) {
+                resampler->finish(dest);
+                resampler.reset();
+            }
+            pcm.sampleRate = frameRate;
+            pcm.channels = static_cast<unsigned int>(info.channels);
+        }
+
+        size_t count = static_cast<size_t>(frames) * info.channels;
+        mp3->samples.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            mp3->samples[i] = s16ToFloat(mp3->frame[i]);
+        }
+        addFrames(mp3->samples.data(), static_cast<size_t>(frames), static_cast<unsigned int>(info.channels), dest);
+    }
+
+    input.erase(input.begin(), input.begin() + pos);
+}
+
+void PushDecoder::addFrames(const float* in, size_t frames, unsigned int frameChannels, std::vector<double>& dest) {
+    if (!resampler) {
+        resampler = std::make_unique<Resampler>(pcm.sampleRate, frameChannels);
+    }
+    if (frameChannels == resampler->sourceChannels()) {
+        resampler->process(in, frames, dest);
+        return;
+    }
+
+    // MP3 frames may change their channel count mid-stream: each frame's
+    // mean goes into every channel of the layout the stream started with
+    unsigned int channels = resampler->sourceChannels();
+    remixed.resize(frames * channels);
+    for (size_t i = 0; i < frames; i++) {
+        float sum = 0.0f;
+        for (unsigned int c = 0; c < frameChannels; c++) {
+            sum += in[i * frameChannels + c];
+        }
+        std::fill(remixed.begin() + i * channels, remixed.begin() + (i + 1) * channels, sum / frameChannels);
+    }
+    resampler->process(remixed.data(), frames, dest);
+}
+
+} // namespace AudioFingerprinting
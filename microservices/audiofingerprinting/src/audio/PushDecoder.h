@@ -0,0 +1,83 @@
+#ifndef PUSH_DECODER_H
+#define PUSH_DECODER_H
+
+#include "AudioStream.h"
+#include "Resampler.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+enum class PcmEncoding {
+    S16LE,
+    F32LE
+};
+
+// Layout of raw PCM, for streams without a container header
+struct PcmFormat {
+    PcmEncoding encoding = PcmEncoding::S16LE;
+    unsigned int sampleRate = 44100;
+    unsigned int channels = 1;
+};
+
+// Push-based counterpart of AudioStream for audio that arrives in pieces
+// (HTTP chunks, capture callbacks). Bytes go in as they come and mono
+// samples at SAMPLE_RATE come out as soon as they can be formed, through
+// the same Resampler as AudioStream.
+//
+// Raw PCM is laid out as given; WAV headers are parsed as they arrive and
+// the data that follows is PCM; MP3 frames go through the dr_mp3 low-level
+// decoder, and a change of their sample rate restarts the resampler at the
+// new one. Rates and layouts Resampler::supportsSource refuses fail the
+// stream, whichever header they come from. FLAC has no push decoder and is
+// rejected.
+class PushDecoder {
+public:
+    // format is WAV, MP3, or UNKNOWN for raw PCM in the pcm layout
+    explicit PushDecoder(AudioFormat format, const PcmFormat& pcm = PcmFormat());
+    ~PushDecoder();
+
+    PushDecoder(const PushDecoder&) = delete;
+    PushDecoder& operator=(const PushDecoder&) = delete;
+
+    // Appends the samples these bytes complete to dest; false once the
+    // stream turns out to be malformed or unsupported (see error())
+    bool push(const void* data, size_t size, std::vector<double>& dest);
+
+    // End of input: decodes what is still buffered and flushes the resampler
+    void finish(std::vector<double>& dest);
+
+    const std::string& error() const { return errorMessage; }
+
+    // Source layout, known once the header (or first MP3 frame) has arrived
+    unsigned int sourceChannels() const { return pcm.channels; }
+    unsigned int sourceSampleRate() const { return pcm.sampleRate; }
+
+private:
+    struct Mp3Decoder;
+    std::unique_ptr<Mp3Decoder> mp3;
+
+    AudioFormat container;
+    PcmFormat pcm;
+    bool headerDone;
+    std::string errorMessage;
+
+    std::vector<uint8_t> input;   // Bytes received but not yet decoded
+
+    // Created with the first decoded frames, once the source layout is known
+    std::unique_ptr<Resampler> resampler;
+    std::vector<float> remixed;
+
+    bool fail(const std::string& message);
+    bool parseWavHeader();
+    void decodePcm(std::vector<double>& dest);
+    void decodeMp3(bool flush, std::vector<double>& dest);
+    void addFrames(const float* frames, size_t count, unsigned int frameChannels, std::vector<double>& dest);
+};
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -0,0 +1,302 @@
+#include "Resampler.h"
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AF_RESAMPLER_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AF_RESAMPLER_NEON 1
+#endif
+
+namespace AudioFingerprinting {
+
+namespace {
+
+// Irregular ratios (L above this) use the nearest of this many phases
+const uint64_t MAX_PHASES = 1024;
+
+// About 70 dB of stopband attenuation
+const double KAISER_BETA = 7.0;
+
+double besselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50 && term > sum * 1e-12; ++k) {
+        double factor = x / (2.0 * k);
+        term *= factor * factor;
+        sum += term;
+    }
+    return sum;
+}
+
+using DotKernel = float (*)(const float* a, const float* b, size_t count);
+
+float dotScalar(const float* a, const float* b, size_t count) {
+    float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+    for (; i < count; ++i) {
+        acc[0] += a[i] * b[i];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+#ifdef AF_RESAMPLER_X86
+// Compiled for AVX2 regardless of the build flags; only called when the CPU has it
+__attribute__((target("avx2,fma")))
+float dotAvx2(const float* a, const float* b, size_t count) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    float result = _mm_cvtss_f32(sum);
+    for (; i < count; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+#endif
+
+#ifdef AF_RESAMPLER_NEON
+float dotNeon(const float* a, const float* b, size_t count) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+
+    float32x4_t acc = vaddq_f32(acc0, acc1);
+    float32x2_t half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    float result = vget_lane_f32(vpadd_f32(half, half), 0);
+    for (; i < count; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+#endif
+
+DotKernel selectKernel() {
+#if defined(AF_RESAMPLER_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return dotAvx2;
+    }
+#elif defined(AF_RESAMPLER_NEON)
+    return dotNeon;
+#endif
+    return dotScalar;
+}
+
+} // namespace
+
+// Coefficients of every phase, laid out to match the interleaved input
+struct Resampler::Bank {
+    uint64_t up = 1;        // L
+    uint64_t down = 1;      // M
+    uint64_t phases = 1;    // Steps per input frame; irregular ratios also get a row at 1
+    size_t taps = 0;        // Per phase and channel, a multiple of 8
+    size_t halfTaps = 0;
+    std::vector<float> coefficients; // rows x taps x channels
+
+    uint64_t rows() const { return phases == up ? phases : phases + 1; }
+
+    // Coefficients for an output time remainder / up of a frame past an input frame
+    const float* phase(uint64_t remainder, size_t channels) const {
+        uint64_t index = phases == up ? remainder : (remainder * phases + up / 2) / up;
+        return coefficients.data() + index * taps * channels;
+    }
+};
+
+bool Resampler::supportsSource(unsigned int sourceRate, unsigned int channels) {
+    return sourceRate >= MIN_SOURCE_SAMPLE_RATE && sourceRate <= MAX_SOURCE_SAMPLE_RATE &&
+           channels >= 1 && channels <= MAX_SOURCE_CHANNELS;
+}
+
+std::shared_ptr<const Resampler::Bank> Resampler::bankFor(unsigned int sourceRate, unsigned int targetRate,
+                                                          unsigned int channels) {
+    struct CachedBank {
+        std::shared_ptr<const Bank> bank;
+        uint64_t lastUse = 0;
+    };
+    static std::mutex mutex;
+    static std::map<std::tuple<unsigned int, unsigned int, unsigned int>, CachedBank> banks;
+    static uint64_t uses = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& cached = banks[std::make_tuple(sourceRate, targetRate, channels)];
+    cached.lastUse = ++uses;
+    if (cached.bank) {
+        return cached.bank;
+    }
+
+    // Resamplers already holding an evicted bank keep it alive until they finish
+    if (banks.size() > static_cast<size_t>(RESAMPLER_CACHED_BANKS)) {
+        auto oldest = std::min_element(banks.begin(), banks.end(), [](const auto& a, const auto& b) {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        banks.erase(oldest);
+    }
+
+    auto bank = std::make_shared<Bank>();
+    uint64_t divisor = std::gcd(static_cast<uint64_t>(sourceRate), static_cast<uint64_t>(targetRate));
+    bank->up = targetRate / divisor;
+    bank->down = sourceRate / divisor;
+    bank->phases = std::min(bank->up, MAX_PHASES);
+
+    // Cutoff in cycles per input sample. The filter widens with the
+    // decimation factor, keeping the transition band the same share of the
+    // output band as at 2:1.
+    double scale = std::min(1.0, static_cast<double>(bank->up) / bank->down);
+    double cutoff = 0.5 * RESAMPLER_CUTOFF * scale;
+    size_t taps = static_cast<size_t>(std::ceil(RESAMPLER_TAPS * std::max(1.0, 0.5 / scale)));
+    bank->taps = (taps + 7) / 8 * 8;
+    bank->halfTaps = bank->taps / 2;
+
+    // Tap i of a phase weighs input frame first + i, at distance u from the output time
+    const double pi = std::acos(-1.0);
+    const double half = static_cast<double>(bank->halfTaps);
+    bank->coefficients.resize(bank->rows() * bank->taps * channels);
+    std::vector<double> row(bank->taps);
+    for (uint64_t p = 0; p < bank->rows(); ++p) {
+        double fraction = static_cast<double>(p) / bank->phases;
+        double sum = 0.0;
+        for (size_t i = 0; i < bank->taps; ++i) {
+            double u = fraction + (half - 1.0) - static_cast<double>(i);
+            double x = 2.0 * cutoff * u;
+            double sinc = x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+            double edge = u / half;
+            double window = edge * edge < 1.0
+                ? besselI0(KAISER_BETA * std::sqrt(1.0 - edge * edge)) / besselI0(KAISER_BETA)
+                : 0.0;
+            row[i] = 2.0 * cutoff * sinc * window;
+            sum += row[i];
+        }
+
+        // Unity gain at DC in every phase, split evenly over the channels
+        float* out = bank->coefficients.data() + p * bank->taps * channels;
+        for (size_t i = 0; i < bank->taps; ++i) {
+            float coefficient = static_cast<float>(row[i] / (sum * channels));
+            std::fill(out + i * channels, out + (i + 1) * channels, coefficient);
+        }
+    }
+
+    cached.bank = bank;
+    return bank;
+}
+
+Resampler::Resampler(unsigned int sourceRate, unsigned int channels, unsigned int targetRate)
+    : rate(sourceRate), target(targetRate), channels(channels), finished(false),
+      historyBase(0), inputFrames(0), outputIndex(0) {
+    if (sourceRate != targetRate) {
+        bank = bankFor(sourceRate, targetRate, channels);
+        // Zero frames stand in for the input before the first frame
+        historyBase = -static_cast<int64_t>(bank->halfTaps - 1);
+        history.assign((bank->halfTaps - 1) * channels, 0.0f);
+    }
+}
+
+Resampler::~Resampler() = default;
+
+uint64_t Resampler::outputLength(uint64_t inputFrames, unsigned int sourceRate, unsigned int targetRate) {
+    uint64_t divisor = std::gcd(static_cast<uint64_t>(sourceRate), static_cast<uint64_t>(targetRate));
+    return inputFrames * (targetRate / divisor) / (sourceRate / divisor);
+}
+
+void Resampler::process(const float* in, size_t count, std::vector<double>& dest) {
+    if (finished || count == 0) {
+        return;
+    }
+    inputFrames += count;
+
+    if (!bank) {
+        // Downmix only: stereo keeps the former (l + r) * 0.5 arithmetic
+        if (channels == 1) {
+            dest.insert(dest.end(), in, in + count);
+        } else if (channels == 2) {
+            for (size_t i = 0; i < count; i++) {
+                dest.push_back((static_cast<double>(in[2 * i]) + static_cast<double>(in[2 * i + 1])) * 0.5);
+            }
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                double sum = 0.0;
+                for (unsigned int c = 0; c < channels; c++) {
+                    sum += static_cast<double>(in[i * channels + c]);
+                }
+                dest.push_back(sum / channels);
+            }
+        }
+        return;
+    }
+
+    history.insert(history.end(), in, in + count * channels);
+    produce(dest, std::numeric_limits<uint64_t>::max());
+}
+
+void Resampler::finish(std::vector<double>& dest) {
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    if (bank) {
+        // Zero frames stand in for the input after the last frame
+        history.resize(history.size() + (bank->halfTaps + 1) * channels, 0.0f);
+        produce(dest, outputLength(inputFrames, rate, target));
+    }
+}
+
+void Resampler::produce(std::vector<double>& dest, uint64_t limit) {
+    static const DotKernel dot = selectKernel();
+
+    const size_t width = bank->taps * channels;
+    const int64_t available = historyBase + static_cast<int64_t>(history.size() / channels);
+
+    // First input frame under output sample n's filter
+    auto firstFrame = [this](uint64_t n) {
+        return static_cast<int64_t>(n * bank->down / bank->up) - static_cast<int64_t>(bank->halfTaps - 1);
+    };
+
+    for (; outputIndex < limit; ++outputIndex) {
+        int64_t first = firstFrame(outputIndex);
+        if (first + static_cast<int64_t>(bank->taps) > available) {
+            break;
+        }
+
+        const float* frames = history.data() + static_cast<size_t>(first - historyBase) * channels;
+        dest.push_back(dot(frames, bank->phase(outputIndex * bank->down % bank->up, channels), width));
+    }
+
+    // Drop input no later output reaches, once it outgrows a block
+    size_t consumed = static_cast<size_t>(std::max<int64_t>(firstFrame(outputIndex) - historyBase, 0));
+    if (consumed >= static_cast<size_t>(AUDIO_BLOCK_FRAMES)) {
+        history.erase(history.begin(), history.begin() + consumed * channels);
+        historyBase += static_cast<int64_t>(consumed);
+    }
+}
+
+} // namespace AudioFingerprinting
@@ -0,0 +1,77 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include "../core/Constants.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+// Polyphase resampler from interleaved source frames to mono at the target
+// rate (SAMPLE_RATE unless given), with the downmix folded into the filter.
+//
+// The rate ratio is reduced to L/M (44100 -> 22050 is 1/2, 48000 -> 22050
+// is 147/320) and a Kaiser-windowed sinc cutting off at RESAMPLER_CUTOFF of
+// the output Nyquist rate is precomputed for each of the L phases. Every
+// tap is stored once per channel and scaled by 1/channels, so an output
+// sample is a single dot product over the interleaved input: no separate
+// downmix pass or buffer. The dot product runs on AVX2/FMA or NEON when the
+// CPU has them. Filter banks are built once per (rate, channels) and
+// shared; the RESAMPLER_CACHED_BANKS most recently used are kept.
+//
+// Input already at the target rate is only downmixed, with the former
+// (l + r) * 0.5 arithmetic. Output length is floor(frames * L / M), as before.
+class Resampler {
+public:
+    Resampler(unsigned int sourceRate, unsigned int channels, unsigned int targetRate = SAMPLE_RATE);
+    ~Resampler();
+
+    Resampler(const Resampler&) = delete;
+    Resampler& operator=(const Resampler&) = delete;
+
+    // Appends the output samples these frames complete to dest
+    void process(const float* frames, size_t count, std::vector<double>& dest);
+
+    // End of input: appends the samples held back for the filter's look-ahead
+    void finish(std::vector<double>& dest);
+
+    unsigned int sourceRate() const { return rate; }
+    unsigned int sourceChannels() const { return channels; }
+
+    // Whether a source can be resampled: MIN_SOURCE_SAMPLE_RATE to
+    // MAX_SOURCE_SAMPLE_RATE and 1 to MAX_SOURCE_CHANNELS channels. The
+    // bank grows with the rate ratio and the channel count, and both come
+    // from untrusted headers, so decoders check this before constructing.
+    static bool supportsSource(unsigned int sourceRate, unsigned int channels);
+
+    // Output samples for inputFrames source frames at sourceRate
+    static uint64_t outputLength(uint64_t inputFrames, unsigned int sourceRate,
+                                 unsigned int targetRate = SAMPLE_RATE);
+
+private:
+    struct Bank;
+    std::shared_ptr<const Bank> bank; // Null when no rate conversion is needed
+
+    static std::shared_ptr<const Bank> bankFor(unsigned int sourceRate, unsigned int targetRate,
+                                               unsigned int channels);
+
+    unsigned int rate;
+    unsigned int target;
+    unsigned int channels;
+    bool finished;
+
+    // Interleaved input from frame historyBase on; frames before the first
+    // one and after the last are zeros
+    std::vector<float> history;
+    int64_t historyBase;
+    uint64_t inputFrames;
+    uint64_t outputIndex;
+
+    void produce(std::vector<double>& dest, uint64_t limit);
+};
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -2,25 +2,37 @@
 
 namespace AudioFingerprinting {
 
-const int SAMPLE_RATE = 22050;
-const double FFT_WINDOW_SIZE = 0.046; // seconds
+// STFT work split (the geometry itself is constexpr in Constants.h)
+const int STFT_FRAMES_PER_TASK = 128;    // Spectrogram frames per thread pool task
 
-// OPTIMIZED: More selective peak detection
-const int PEAK_BOX_SIZE = 20;  // Increased from 15 for better peak isolation
-const double POINT_EFFICIENCY = 0.3; // Reduced from 0.8 - fewer but better peaks
+// Streaming decode
+const int AUDIO_BLOCK_FRAMES = 8192;     // Source frames decoded per read
+const int RESAMPLER_TAPS = 64;           // Flat to 8 kHz at 44.1 kHz, about 70 dB down past 11.6 kHz
+const double RESAMPLER_CUTOFF = 0.9;     // About 9.9 kHz at SAMPLE_RATE
+const int RESAMPLER_CACHED_BANKS = 8;    // Common rates (44.1, 48, 32, 96 kHz) in mono and stereo
+const unsigned int MIN_SOURCE_SAMPLE_RATE = 8000;
+const unsigned int MAX_SOURCE_SAMPLE_RATE = 192000; // At most about 1 MB of coefficients per channel
+const unsigned int MAX_SOURCE_CHANNELS = 8;         // 7.1
+const int STREAM_SEGMENT_SECONDS = 60;   // Audio analysed per segment of a long track
+const double LIVE_PEAK_BLOCK_SECONDS = 1.0; // Live audio analysed per peak-picking step
 
-// OPTIMIZED: Smaller, more focused target zone
-const double TARGET_T = 0.5; // Reduced from 1.0 seconds
-const double TARGET_F = 500.0; // Reduced from 1000.0 Hz
-const double TARGET_START = 0.02; // Reduced from 0.05 seconds
+// Matching
+const int MIN_SONG_MATCHES = 5;          // Matching rows a song needs to be a candidate
+const int TOP_MATCHES_SHOWN = 10;        // Candidates ranked and reported per query
+const double PROGRESSIVE_BATCH_SECONDS = 2.0; // Query audio matched per progressive step
+const int EARLY_EXIT_MIN_SCORE = 10;     // Leader score needed to stop early
+const int EARLY_EXIT_SCORE_MARGIN = 6;   // Lead over the runner-up needed to stop early
 
-// NEW: Hash collision reduction parameters
-const int MIN_PEAK_AMPLITUDE_RATIO = 4; // Peak must be 4x stronger than neighbors
-const int MAX_PEAKS_PER_SECOND = 15;     // Limit to 15 peaks per second max
-const int HASH_BITS = 40;                // Use 40-bit hashes (vs 32-bit)
-const double MIN_FREQUENCY_HZ = 300.0;   // Ignore frequencies below 300Hz
-const double MAX_FREQUENCY_HZ = 8000.0;  // Ignore frequencies above 8kHz
-const int TARGET_ZONE_POINTS = 5;        // Max 5 target points per anchor
-const double PEAK_DECAY_THRESHOLD = 0.7; // Temporal peak filtering
+// Bulk registration pipeline
+const int INGEST_BATCH_SONGS = 16;       // Songs written per transaction
+const int INGEST_QUEUE_DEPTH = 2;        // Fingerprinted songs buffered per worker
+
+// Segmented hash index
+const int INDEX_FLUSH_POSTINGS = 1 << 20; // About 8 MB of postings per segment
+const int INDEX_MAX_SEGMENTS = 8;        // Segment files tolerated before compaction
+const double INDEX_BASE_MERGE_FRACTION = 0.25; // Smaller segments are only merged with each other
+const int INDEX_REFRESH_SECONDS = 5;     // How often servers look for new segments
+const int INDEX_FILTER_BITS_PER_KEY = 10; // About 1% of absent hashes pass the filter
+const int INDEX_STOP_HASH_POSTINGS = 20000; // Hashes more common than this are skipped
 
 } // namespace AudioFingerprinting
\ No newline at end of file
@@ -1,25 +1,61 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
+#include <cstdint>
+#include <cmath>
+
 namespace AudioFingerprinting {
 
-// Settings
-extern const int SAMPLE_RATE;
-extern const double FFT_WINDOW_SIZE;
-extern const int PEAK_BOX_SIZE;
-extern const double POINT_EFFICIENCY;
-extern const double TARGET_T;
-extern const double TARGET_F;
-extern const double TARGET_START;
-
-// NEW: Optimized fingerprinting parameters
-extern const int MIN_PEAK_AMPLITUDE_RATIO;   // Minimum peak strength ratio
-extern const int MAX_PEAKS_PER_SECOND;       // Limit peaks per time window
-extern const int HASH_BITS;                  // Bit size for hash (reduce collisions)
-extern const double MIN_FREQUENCY_HZ;        // Ignore low frequencies
-extern const double MAX_FREQUENCY_HZ;        // Ignore high frequencies
-extern const int TARGET_ZONE_POINTS;         // Limit target zone size
-extern const double PEAK_DECAY_THRESHOLD;    // Peak temporal filtering
+// Settings. Peak picking and hashing parameters are per profile
+// (FingerprintProfile.h); the STFT geometry below is common to all of
+// them, since stored offsets are frame indices.
+constexpr int SAMPLE_RATE = 22050;
+constexpr double FFT_WINDOW_SIZE = 0.046;    // seconds
+
+// Derived STFT geometry
+constexpr int FFT_SIZE = static_cast<int>(SAMPLE_RATE * FFT_WINDOW_SIZE); // Samples per analysis window
+constexpr int HOP_SIZE = FFT_SIZE - FFT_SIZE / 2; // Samples between consecutive frames (50% overlap)
+extern const int STFT_FRAMES_PER_TASK;       // Spectrogram frames per thread pool task
+
+// Streaming decode
+extern const int AUDIO_BLOCK_FRAMES;         // Source frames decoded per read
+extern const int RESAMPLER_TAPS;             // Filter taps per output sample when halving the rate
+extern const double RESAMPLER_CUTOFF;        // Anti-alias cutoff as a fraction of the output Nyquist rate
+extern const int RESAMPLER_CACHED_BANKS;     // Filter banks kept for reuse, least recently used dropped
+extern const unsigned int MIN_SOURCE_SAMPLE_RATE; // Source rates accepted by the decoders...
+extern const unsigned int MAX_SOURCE_SAMPLE_RATE; // ...bounding the filter bank a header can ask for
+extern const unsigned int MAX_SOURCE_CHANNELS;    // Source channels accepted by the decoders
+extern const int STREAM_SEGMENT_SECONDS;     // Audio analysed per segment of a long track
+extern const double LIVE_PEAK_BLOCK_SECONDS; // Live audio analysed per peak-picking step
+
+// Matching
+extern const int MIN_SONG_MATCHES;           // Matching rows a song needs to be a candidate
+extern const int TOP_MATCHES_SHOWN;          // Candidates ranked and reported per query
+extern const double PROGRESSIVE_BATCH_SECONDS; // Query audio matched per progressive step
+extern const int EARLY_EXIT_MIN_SCORE;       // Leader score needed to stop early
+extern const int EARLY_EXIT_SCORE_MARGIN;    // Lead over the runner-up needed to stop early
+
+// Bulk registration pipeline
+extern const int INGEST_BATCH_SONGS;         // Songs written per transaction
+extern const int INGEST_QUEUE_DEPTH;         // Fingerprinted songs buffered per worker
+
+// Segmented hash index
+extern const int INDEX_FLUSH_POSTINGS;       // Unflushed postings that trigger a segment flush
+extern const int INDEX_MAX_SEGMENTS;         // Segment files tolerated before compaction
+extern const double INDEX_BASE_MERGE_FRACTION; // Segment postings, as a share of the base's, that fold into it
+extern const int INDEX_REFRESH_SECONDS;      // How often servers look for new segments
+extern const int INDEX_FILTER_BITS_PER_KEY;  // Membership filter bits per indexed hash
+extern const int INDEX_STOP_HASH_POSTINGS;   // Default cap on a query hash's postings; 0 disables it
+
+// Offset <-> STFT frame index conversion (used by the hash index)
+inline uint32_t secondsToFrame(double seconds) {
+    if (seconds <= 0.0) return 0;
+    return static_cast<uint32_t>(std::lround(seconds * SAMPLE_RATE / HOP_SIZE));
+}
+
+inline double frameToSeconds(uint32_t frame) {
+    return static_cast<double>(frame) * HOP_SIZE / SAMPLE_RATE;
+}
 
 } // namespace AudioFingerprinting
 
@@ -0,0 +1,114 @@
+#ifndef FINGERPRINT_PROFILE_H
+#define FINGERPRINT_PROFILE_H
+
+#include "Constants.h"
+#include <cstdint>
+#include <string>
+
+namespace AudioFingerprinting {
+
+// Fingerprint profiles: the peak picking, target zone and hashing
+// parameters as compile-time constants. The detector and the hasher are
+// templated on the profile, so each one gets its own hot loops with the
+// box size, zone capacity and thresholds folded in.
+//
+// A database records the tag of the catalog profile its hashes were made
+// with. Registration and, by default, queries use that profile. Its query
+// companion picks more anchors from a short clip but shares the hash layout
+// (zone geometry and pair quantization), so its hashes meet the catalog's;
+// queries use it only when dense queries are enabled.
+//
+// A tag also covers the decoding front end. catalog-v1 databases were
+// registered through the linear resampler; v2 fingerprints audio resampled
+// by the polyphase filter (Resampler.h), whose peaks land differently, so
+// a v1 catalog is refused and has to be registered again.
+
+// Target zone geometry of the v1 hash layout
+struct HashLayoutV1 {
+    static constexpr double TARGET_T = 0.5;      // Zone length, seconds
+    static constexpr double TARGET_F = 500.0;    // Zone height around the anchor, Hz
+    static constexpr double TARGET_START = 0.02; // Gap between the anchor and its zone, seconds
+    static constexpr int HASH_BITS = 40;         // 14-bit frequencies, 12-bit time delta
+};
+
+// Registration: few, well separated peaks per song
+struct CatalogProfile : HashLayoutV1 {
+    static constexpr const char* TAG = "catalog-v2";
+    static constexpr uint32_t FILE_ID = 2;               // Recorded in index and pack headers
+    static constexpr int PEAK_BOX_SIZE = 20;             // Neighbourhood a peak must dominate
+    static constexpr double POINT_EFFICIENCY = 0.3;      // Peaks kept per PEAK_BOX_SIZE^2 cells
+    static constexpr int MIN_PEAK_AMPLITUDE_RATIO = 4;   // Peak strength over its neighbours' mean
+    static constexpr int MAX_PEAKS_PER_SECOND = 15;      // Limit peaks per time window
+    static constexpr double MIN_FREQUENCY_HZ = 300.0;    // Ignore low frequencies
+    static constexpr double MAX_FREQUENCY_HZ = 8000.0;   // Ignore high frequencies
+    static constexpr int TARGET_ZONE_POINTS = 5;         // Strongest zone peaks paired per anchor
+    static constexpr double ANCHOR_FRACTION = 0.8;       // Share of the peaks used as anchors
+};
+
+// Recognition: the same box and band, more of the peaks kept and every
+// one anchored. A wider zone selection keeps the catalog's pairs when the
+// extra peaks outrank them.
+struct QueryProfile : HashLayoutV1 {
+    static constexpr const char* TAG = "query-v2";
+    static constexpr int PEAK_BOX_SIZE = CatalogProfile::PEAK_BOX_SIZE;
+    static constexpr double POINT_EFFICIENCY = 0.5;
+    static constexpr int MIN_PEAK_AMPLITUDE_RATIO = CatalogProfile::MIN_PEAK_AMPLITUDE_RATIO;
+    static constexpr int MAX_PEAKS_PER_SECOND = 25;
+    static constexpr double MIN_FREQUENCY_HZ = CatalogProfile::MIN_FREQUENCY_HZ;
+    static constexpr double MAX_FREQUENCY_HZ = CatalogProfile::MAX_FREQUENCY_HZ;
+    static constexpr int TARGET_ZONE_POINTS = 8;
+    static constexpr double ANCHOR_FRACTION = 1.0;
+};
+
+// Tag of databases registered before the polyphase resampler. They are
+// recorded with it so the profile check can refuse them.
+constexpr const char* LEGACY_CATALOG_TAG = "catalog-v1";
+
+// Runtime selector of the profile structs
+enum class FingerprintProfile { Catalog, Query };
+
+// The catalog and query profiles a database's tag stands for; false when
+// this build has no profile with that tag
+inline bool profilesForTag(const std::string& tag, FingerprintProfile& catalog, FingerprintProfile& query) {
+    if (tag == CatalogProfile::TAG) {
+        catalog = FingerprintProfile::Catalog;
+        query = FingerprintProfile::Query;
+        return true;
+    }
+    return false;
+}
+
+// Tag of a runtime profile, as recorded in a database and reported by a node
+inline const char* profileTag(FingerprintProfile profile) {
+    return profile == FingerprintProfile::Query ? QueryProfile::TAG : CatalogProfile::TAG;
+}
+
+// Id recorded in the headers of index and pack files made with a catalog
+// profile; 0 for a profile hashes are never stored with
+inline uint32_t profileFileId(FingerprintProfile catalog) {
+    return catalog == FingerprintProfile::Catalog ? CatalogProfile::FILE_ID : 0;
+}
+
+// Whether a file header's id says it was made with the catalog profile.
+// Files written before profiles were recorded carry 0 and catalog-v1 files
+// carry 1; both predate the polyphase resampler and are refused.
+inline bool fileIdMatches(uint32_t id, FingerprintProfile catalog) {
+    if (catalog != FingerprintProfile::Catalog) {
+        return false;
+    }
+    return id == profileFileId(catalog);
+}
+
+// Calls visit(CatalogProfile()) or visit(QueryProfile()); the one runtime
+// branch in front of a specialized loop
+template <typename Visitor>
+auto visitProfile(FingerprintProfile profile, Visitor&& visit) {
+    if (profile == FingerprintProfile::Query) {
+        return visit(QueryProfile());
+    }
+    return visit(CatalogProfile());
+}
+
+} // namespace AudioFingerprinting
+
+#endif
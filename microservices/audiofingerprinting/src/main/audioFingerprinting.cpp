@@ -2,27 +2,63 @@
 #include <filesystem>
 #include <chrono>
 #include <thread>
-#include <fftw3.h>
 #include <iomanip>
 #include <cstdlib>  // for getenv
 #include <cstring>  // for strlen
+#include <cstdio>   // for std::remove
+#include <fstream>
+#include <sstream>
 
 #include "../audio/AudioLoader.h"
 #include "../processing/HashGenerator.h"
 #include "../storage/Storage.h"
 #include "../recognition/Recognition.h"
+#include "../recognition/StreamingRecognizer.h"
+#include "../audio/PushDecoder.h"
+#include "../utils/Log.h"
 
 void printUsage(const std::string& programName) {
     std::cout << "Usage: " << programName << " [command] [options]" << std::endl;
     std::cout << "\nCommands:" << std::endl;
     std::cout << "  register <directory>   - Register all songs in directory" << std::endl;
     std::cout << "  recognize <file>       - Recognize a song from file" << std::endl;
+    std::cout << "  recognize-dir <dir>    - Recognize every clip in a directory as one batch" << std::endl;
+    std::cout << "  recognize-live <file>  - Recognize a file fed in small chunks, as a live stream" << std::endl;
     std::cout << "  stats                  - Show database statistics" << std::endl;
     std::cout << "  fingerprint <file>     - Generate fingerprints (no database)" << std::endl;
+    std::cout << "  build-index            - Build the memory-mapped hash index from the database" << std::endl;
+    std::cout << "  migrate                - Upgrade a legacy database to the current schema" << std::endl;
+    std::cout << "  export <pack>          - Write the database's fingerprints to a portable pack file" << std::endl;
+    std::cout << "  import <pack>          - Add the songs of a pack file to the database" << std::endl;
     std::cout << "\nOptions:" << std::endl;
     std::cout << "  --workers <num>        - Number of worker threads (default: auto)" << std::endl;
     std::cout << "  --db <path>           - Database path (default: from DB_PATH env or fingerprints.db)" << std::endl;
-    std::cout << "  --optimized           - Use optimized fingerprinting algorithm" << std::endl;
+    std::cout << "  --index <path>        - Hash index path (default: <db>.idx)" << std::endl;
+    std::cout << "  --progressive         - Recognize: stop matching once one song clearly leads" << std::endl;
+    std::cout << "  --dense-queries       - Recognize: fingerprint clips with the denser query profile" << std::endl;
+    std::cout << "  --rate <hz>           - recognize-live: sample rate of .pcm input (default: 44100)" << std::endl;
+    std::cout << "  --channels <num>      - recognize-live: channel count of .pcm input (default: 1)" << std::endl;
+    std::cout << "  --log-level <level>   - error, warn, info or debug (default: AF_LOG_LEVEL or info)" << std::endl;
+    std::cout << "  --shard-dbs <a,b,...> - register/import/stats: route hash rows to these shard databases," << std::endl;
+    std::cout << "                          keeping only song info in --db (the catalog)" << std::endl;
+    std::cout << "  --stop-hash-postings <n> - recognize/stats: skip query hashes with more postings" << std::endl;
+    std::cout << "                          than n, 0 keeps them all (default: "
+              << AudioFingerprinting::INDEX_STOP_HASH_POSTINGS << ")" << std::endl;
+    std::cout << "  --keep-song-keys      - import: keep the exported song keys (seeding a shard or replica)" << std::endl;
+    std::cout << "  --shard <i/n>         - import: keep only the rows of shard i of n, under the exported" << std::endl;
+    std::cout << "                          song keys (loading one shard node from a whole catalog's pack)" << std::endl;
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
 }
 
 std::string getDefaultDatabasePath() {
@@ -38,10 +74,6 @@ std::string getDefaultDatabasePath() {
 
 int main(int argc, char* argv[]) {
     try {
-        // Initialize FFTW threads
-        fftw_init_threads();
-        fftw_plan_with_nthreads(std::thread::hardware_concurrency());
-        
         if (argc < 2) {
             printUsage(argv[0]);
             return 1;
@@ -50,7 +82,15 @@ int main(int argc, char* argv[]) {
         std::string command = argv[1];
         std::string dbPath = getDefaultDatabasePath();  // Use environment-aware default
         int numWorkers = std::thread::hardware_concurrency();
-        bool useOptimized = false;
+        std::string indexPath;
+        AudioFingerprinting::RecognitionOptions recognitionOptions;
+        AudioFingerprinting::PcmFormat pcmFormat;
+        std::vector<std::string> shardDbs;
+        uint64_t stopHashPostings = AudioFingerprinting::INDEX_STOP_HASH_POSTINGS;
+        bool keepSongKeys = false;
+        bool denseQueries = false;
+        uint32_t importShard = 0;
+        uint32_t importShardCount = 0;
         
         // Parse options
         for (int i = 2; i < argc; i++) {
@@ -59,17 +99,54 @@ int main(int argc, char* argv[]) {
                 numWorkers = std::stoi(argv[++i]);
             } else if (arg == "--db" && i + 1 < argc) {
                 dbPath = argv[++i];
-            } else if (arg == "--optimized") {
-                useOptimized = true;
+            } else if (arg == "--index" && i + 1 < argc) {
+                indexPath = argv[++i];
+            } else if (arg == "--progressive") {
+                recognitionOptions.progressive = true;
+            } else if (arg == "--dense-queries") {
+                denseQueries = true;
+            } else if (arg == "--rate" && i + 1 < argc) {
+                pcmFormat.sampleRate = std::stoi(argv[++i]);
+            } else if (arg == "--channels" && i + 1 < argc) {
+                pcmFormat.channels = std::stoi(argv[++i]);
+            } else if (arg == "--shard-dbs" && i + 1 < argc) {
+                shardDbs = splitList(argv[++i]);
+            } else if (arg == "--stop-hash-postings" && i + 1 < argc) {
+                stopHashPostings = std::stoull(argv[++i]);
+            } else if (arg == "--keep-song-keys") {
+                keepSongKeys = true;
+            } else if (arg == "--shard" && i + 1 < argc) {
+                std::string spec = argv[++i];
+                size_t slash = spec.find('/');
+                try {
+                    importShard = static_cast<uint32_t>(std::stoul(spec.substr(0, slash)));
+                    importShardCount = slash == std::string::npos ? 0 : static_cast<uint32_t>(std::stoul(spec.substr(slash + 1)));
+                } catch (const std::exception&) {
+                    importShardCount = 0;
+                }
+                if (importShardCount == 0 || importShard >= importShardCount) {
+                    std::cerr << "Error: --shard takes <i/n> with i < n, got: " << spec << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--log-level" && i + 1 < argc) {
+                AudioFingerprinting::LogLevel level;
+                if (!AudioFingerprinting::parseLogLevel(argv[++i], level)) {
+                    std::cerr << "Error: Unknown log level: " << argv[i] << std::endl;
+                    return 1;
+                }
+                AudioFingerprinting::setLogLevel(level);
             }
         }
         
         std::cout << "Audio Fingerprinting System" << std::endl;
         std::cout << "Using " << numWorkers << " worker threads" << std::endl;
         std::cout << "Database: " << dbPath << std::endl;
-        std::cout << "Algorithm: " << (useOptimized ? "Optimized" : "Standard") << std::endl;
         std::cout << std::string(50, '=') << std::endl;
         
+        if (indexPath.empty()) {
+            indexPath = AudioFingerprinting::HashIndex::defaultPathFor(dbPath);
+        }
+        
         if (command == "register") {
             if (argc < 3) {
                 std::cerr << "Error: Please specify a directory to register" << std::endl;
@@ -84,12 +161,20 @@ int main(int argc, char* argv[]) {
             }
             
             AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
             if (!recognizer.initializeDatabase()) {
                 std::cerr << "Error: Failed to initialize database" << std::endl;
                 return 1;
             }
+            if (!shardDbs.empty() && !recognizer.attachShardDatabases(shardDbs)) {
+                std::cerr << "Error: Failed to open shard databases" << std::endl;
+                return 1;
+            }
             
             std::cout << "Registering songs from: " << directory << std::endl;
+            if (!shardDbs.empty()) {
+                std::cout << "Routing hashes to " << shardDbs.size() << " shards" << std::endl;
+            }
             
             auto startTime = std::chrono::high_resolution_clock::now();
             bool success = recognizer.registerDirectory(directory, numWorkers);
@@ -119,14 +204,18 @@ int main(int argc, char* argv[]) {
             }
             
             AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
+            recognizer.setStopHashLimit(stopHashPostings);
+            recognizer.setDenseQueries(denseQueries);
             if (!recognizer.initializeDatabase()) {
                 std::cerr << "Error: Failed to initialize database" << std::endl;
                 return 1;
             }
             
             auto startTime = std::chrono::high_resolution_clock::now();
-            AudioFingerprinting::SongInfo result = recognizer.recognizeSong(filename);
+            AudioFingerprinting::RecognitionResult recognition = recognizer.recognize(filename, recognitionOptions);
             auto endTime = std::chrono::high_resolution_clock::now();
+            const AudioFingerprinting::SongInfo& result = recognition.song;
             
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
             
@@ -140,6 +229,136 @@ int main(int argc, char* argv[]) {
                 std::cout << "Album:  " << result.album << std::endl;
                 std::cout << "Title:  " << result.title << std::endl;
                 std::cout << "Song ID: " << result.songId << std::endl;
+                std::cout << "Confidence: " << std::fixed << std::setprecision(2) << recognition.confidence 
+                          << std::defaultfloat << std::endl;
+            } else {
+                std::cout << "✗ No match found in database" << std::endl;
+            }
+            
+            std::cout << "Recognition time: " << duration.count() << " ms" << std::endl;
+            
+        } else if (command == "recognize-dir") {
+            if (argc < 3) {
+                std::cerr << "Error: Please specify a directory of clips to recognize" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+            
+            std::string directory = argv[2];
+            if (!std::filesystem::exists(directory)) {
+                std::cerr << "Error: Directory does not exist: " << directory << std::endl;
+                return 1;
+            }
+            
+            std::vector<std::string> files = AudioFingerprinting::SongRecognizer::getSupportedFiles(directory);
+            if (files.empty()) {
+                std::cerr << "Error: No supported audio files found in: " << directory << std::endl;
+                return 1;
+            }
+            
+            AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
+            recognizer.setStopHashLimit(stopHashPostings);
+            recognizer.setDenseQueries(denseQueries);
+            if (!recognizer.initializeDatabase()) {
+                std::cerr << "Error: Failed to initialize database" << std::endl;
+                return 1;
+            }
+            
+            auto startTime = std::chrono::high_resolution_clock::now();
+            std::vector<AudioFingerprinting::RecognitionResult> results =
+                recognizer.recognizeFiles(files, recognitionOptions, numWorkers);
+            auto endTime = std::chrono::high_resolution_clock::now();
+            
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            
+            std::cout << std::string(50, '=') << std::endl;
+            std::cout << "BATCH RECOGNITION RESULTS" << std::endl;
+            std::cout << std::string(50, '=') << std::endl;
+            
+            size_t matched = 0;
+            for (size_t i = 0; i < files.size(); ++i) {
+                const AudioFingerprinting::RecognitionResult& recognition = results[i];
+                std::cout << std::filesystem::path(files[i]).filename().string() << ": ";
+                if (!recognition.song.songId.empty()) {
+                    matched++;
+                    std::cout << "✓ " << recognition.song.artist << " - " << recognition.song.title
+                              << " (Score: " << recognition.score << ", Confidence: " << std::fixed
+                              << std::setprecision(2) << recognition.confidence << std::defaultfloat << ")" << std::endl;
+                } else {
+                    std::cout << "✗ No match found in database" << std::endl;
+                }
+            }
+            
+            std::cout << "Matched " << matched << " of " << files.size() << " clips" << std::endl;
+            std::cout << "Recognition time: " << duration.count() << " ms" << std::endl;
+            
+        } else if (command == "recognize-live") {
+            if (argc < 3) {
+                std::cerr << "Error: Please specify a file to stream" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+            
+            std::string filename = argv[2];
+            std::ifstream input(filename, std::ios::binary);
+            if (!input) {
+                std::cerr << "Error: Cannot open file: " << filename << std::endl;
+                return 1;
+            }
+            
+            AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
+            recognizer.setStopHashLimit(stopHashPostings);
+            recognizer.setDenseQueries(denseQueries);
+            if (!recognizer.initializeDatabase()) {
+                std::cerr << "Error: Failed to initialize database" << std::endl;
+                return 1;
+            }
+            
+            // WAV and MP3 by extension, anything else is raw 16-bit PCM (--rate, --channels)
+            AudioFingerprinting::PushDecoder decoder(AudioFingerprinting::audioFormatFromFilename(filename), pcmFormat);
+            AudioFingerprinting::StreamingRecognizer live(recognizer, recognitionOptions);
+            
+            // Feed the file the way a network stream would arrive
+            auto startTime = std::chrono::high_resolution_clock::now();
+            std::vector<char> chunk(4096);
+            std::vector<double> samples;
+            bool matched = false;
+            
+            while (!matched && input) {
+                input.read(chunk.data(), chunk.size());
+                samples.clear();
+                if (!decoder.push(chunk.data(), static_cast<size_t>(input.gcount()), samples)) {
+                    std::cerr << "Error: " << decoder.error() << std::endl;
+                    return 1;
+                }
+                matched = live.push(samples.data(), samples.size());
+            }
+            
+            if (!matched) {
+                samples.clear();
+                decoder.finish(samples);
+                live.push(samples.data(), samples.size());
+            }
+            const AudioFingerprinting::RecognitionResult& recognition = live.finish();
+            auto endTime = std::chrono::high_resolution_clock::now();
+            
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            
+            std::cout << std::string(50, '=') << std::endl;
+            std::cout << "LIVE RECOGNITION RESULT" << std::endl;
+            std::cout << std::string(50, '=') << std::endl;
+            
+            if (!recognition.song.songId.empty()) {
+                std::cout << "✓ Match found!" << std::endl;
+                std::cout << "Artist: " << recognition.song.artist << std::endl;
+                std::cout << "Title:  " << recognition.song.title << std::endl;
+                std::cout << "Song ID: " << recognition.song.songId << std::endl;
+                std::cout << "Confidence: " << std::fixed << std::setprecision(2) << recognition.confidence 
+                          << std::defaultfloat << std::endl;
+                std::cout << "Audio needed: " << std::fixed << std::setprecision(1) << recognition.secondsUsed
+                          << " s" << (recognition.earlyExit ? "" : " (whole stream)") << std::defaultfloat << std::endl;
             } else {
                 std::cout << "✗ No match found in database" << std::endl;
             }
@@ -148,13 +367,109 @@ int main(int argc, char* argv[]) {
             
         } else if (command == "stats") {
             AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
+            recognizer.setStopHashLimit(stopHashPostings);
             if (!recognizer.initializeDatabase()) {
                 std::cerr << "Error: Failed to initialize database" << std::endl;
                 return 1;
             }
+            if (!shardDbs.empty() && !recognizer.attachShardDatabases(shardDbs)) {
+                std::cerr << "Error: Failed to open shard databases" << std::endl;
+                return 1;
+            }
             
             recognizer.printDatabaseStats();
             
+        } else if (command == "build-index") {
+            AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
+            if (!recognizer.initializeDatabase()) {
+                std::cerr << "Error: Failed to initialize database" << std::endl;
+                return 1;
+            }
+            
+            std::cout << "Building hash index: " << indexPath << std::endl;
+            
+            auto startTime = std::chrono::high_resolution_clock::now();
+            bool success = recognizer.buildHashIndex();
+            auto endTime = std::chrono::high_resolution_clock::now();
+            
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            
+            if (!success) {
+                std::cerr << "Error: Failed to build hash index" << std::endl;
+                return 1;
+            }
+            
+            std::cout << "Hash index built in " << duration.count() << " ms" << std::endl;
+            
+        } else if (command == "export" || command == "import") {
+            if (argc < 3) {
+                std::cerr << "Error: Please specify a pack file to " << command << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+            
+            std::string packPath = argv[2];
+            if (command == "import" && !std::filesystem::exists(packPath)) {
+                std::cerr << "Error: File does not exist: " << packPath << std::endl;
+                return 1;
+            }
+            
+            AudioFingerprinting::SongRecognizer recognizer(dbPath);
+            recognizer.setIndexPath(indexPath);
+            if (!recognizer.initializeDatabase()) {
+                std::cerr << "Error: Failed to initialize database" << std::endl;
+                return 1;
+            }
+            if (importShardCount > 0 && !shardDbs.empty()) {
+                std::cerr << "Error: --shard loads one shard database; --shard-dbs routes to all of them" << std::endl;
+                return 1;
+            }
+            if (command == "import" && !shardDbs.empty() && !recognizer.attachShardDatabases(shardDbs)) {
+                std::cerr << "Error: Failed to open shard databases" << std::endl;
+                return 1;
+            }
+            
+            auto startTime = std::chrono::high_resolution_clock::now();
+            bool success = command == "export" ? recognizer.exportPack(packPath)
+                                               : recognizer.importPack(packPath, keepSongKeys, importShard, importShardCount);
+            auto endTime = std::chrono::high_resolution_clock::now();
+            
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            
+            if (!success) {
+                std::cerr << "Error: Failed to " << command << " fingerprint pack: " << packPath << std::endl;
+                return 1;
+            }
+            
+            std::cout << (command == "export" ? "Export" : "Import") << " completed in "
+                      << duration.count() << " ms" << std::endl;
+            if (command == "import") {
+                recognizer.printDatabaseStats();
+            }
+            
+        } else if (command == "migrate") {
+            // Skip SongRecognizer: initializeDatabase() refuses legacy databases
+            AudioFingerprinting::Database database(dbPath);
+            
+            auto startTime = std::chrono::high_resolution_clock::now();
+            bool success = database.migrateLegacySchema();
+            auto endTime = std::chrono::high_resolution_clock::now();
+            
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            
+            if (!success) {
+                std::cerr << "Error: Failed to migrate database" << std::endl;
+                return 1;
+            }
+            
+            // Any existing index was built from the old layout
+            std::remove(indexPath.c_str());
+            
+            std::cout << "Migration finished in " << duration.count() << " ms" << std::endl;
+            std::cout << "Run 'build-index' to rebuild the hash index" << std::endl;
+            
         } else if (command == "fingerprint") {
             if (argc < 3) {
                 std::cerr << "Error: Please specify a file to fingerprint" << std::endl;
@@ -172,12 +487,8 @@ int main(int argc, char* argv[]) {
             
             auto startTime = std::chrono::high_resolution_clock::now();
             
-            std::vector<AudioFingerprinting::HashResult> hashes;
-            if (useOptimized) {
-                hashes = AudioFingerprinting::fingerprintFileParallelOptimized(filename);
-            } else {
-                hashes = AudioFingerprinting::fingerprintFileParallel(filename);
-            }
+            std::vector<AudioFingerprinting::HashResult> hashes =
+                AudioFingerprinting::fingerprintFileParallelOptimized(filename);
             
             auto endTime = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
@@ -186,22 +497,14 @@ int main(int argc, char* argv[]) {
             std::cout << "FINGERPRINT RESULT" << std::endl;
             std::cout << std::string(50, '=') << std::endl;
             std::cout << "Generated " << hashes.size() << " hashes in " << duration.count() << " ms" << std::endl;
-            std::cout << "Algorithm: " << (useOptimized ? "Optimized" : "Standard") << std::endl;
+            std::cout << "Profile: " << AudioFingerprinting::profileTag(AudioFingerprinting::FingerprintProfile::Catalog)
+                      << std::endl;
             
             if (!hashes.empty()) {
                 std::cout << "\nSample hashes:" << std::endl;
                 for (size_t i = 0; i < std::min(size_t(10), hashes.size()); i++) {
                     std::cout << "  " << hashes[i].toString() << std::endl;
                 }
-                
-                if (useOptimized) {
-                    std::cout << "\nOptimization benefits:" << std::endl;
-                    std::cout << "  • Frequency range: 300-8000 Hz (ignoring noise)" << std::endl;
-                    std::cout << "  • Peak quality filtering: 4x amplitude threshold" << std::endl;
-                    std::cout << "  • Temporal limiting: max 15 peaks/second" << std::endl;
-                    std::cout << "  • Hash deduplication: no duplicate hashes" << std::endl;
-                    std::cout << "  • Expected reduction: ~70% fewer hashes vs standard" << std::endl;
-                }
             }
             
         } else {
@@ -210,9 +513,6 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         
-        // Cleanup FFTW
-        fftw_cleanup_threads();
-        
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
@@ -0,0 +1,580 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+#include <array>
+#include <limits>
+#include <sstream>
+#include <nlohmann/json.hpp>
+
+#include "../audio/AudioLoader.h"
+#include "../audio/AudioProcessor.h"
+#include "../processing/HashGenerator.h"
+#include "../processing/PeakDetection.h"
+#include "../storage/Storage.h"
+#include "../recognition/Recognition.h"
+#include "../utils/Log.h"
+#include "../utils/Metrics.h"
+
+using json = nlohmann::json;
+using namespace AudioFingerprinting;
+
+namespace {
+
+// Source rate of the synthetic tracks, so decoding also exercises resampling
+const int SOURCE_SAMPLE_RATE = 44100;
+
+struct BenchOptions {
+    std::vector<int> catalogSizes = {1000, 10000, 100000};
+    std::vector<double> snrsDb = {std::numeric_limits<double>::infinity(), 10.0, 3.0};
+    int tracks = 20;             // Fully fingerprinted tracks that queries are cut from
+    double trackSeconds = 30.0;
+    double clipSeconds = 12.0;   // Query length; fingerprinting skips anything under 10 s
+    int fillerHashes = 1000;     // Hashes per decoy song padding the catalog
+    int iterations = 5;          // Repetitions per microbenchmark
+    bool useIndex = false;       // Recognize through the memory-mapped hash index
+    bool denseQueries = false;   // Fingerprint queries with the query profile (SongRecognizer::setDenseQueries)
+    bool runMicro = true;
+    bool runCatalogs = true;
+    bool keepWorkDir = false;
+    uint32_t seed = 1;
+    std::string workDir;
+    std::string outPath;
+};
+
+void printUsage(const std::string& programName) {
+    std::cout << "Usage: " << programName << " [options]" << std::endl;
+    std::cout << "\nOptions:" << std::endl;
+    std::cout << "  --catalogs <n,n,...>   - Catalog sizes to sweep, in songs (default: 1000,10000,100000)" << std::endl;
+    std::cout << "  --tracks <num>         - Fingerprinted tracks queries are cut from (default: 20)" << std::endl;
+    std::cout << "  --track-seconds <s>    - Length of each synthetic track (default: 30)" << std::endl;
+    std::cout << "  --clip-seconds <s>     - Length of each query clip (default: 12)" << std::endl;
+    std::cout << "  --snr <db,db,...>      - Query noise levels, inf for clean (default: inf,10,3)" << std::endl;
+    std::cout << "  --filler-hashes <num>  - Hashes per decoy song padding the catalog (default: 1000)" << std::endl;
+    std::cout << "  --iterations <num>     - Repetitions per microbenchmark (default: 5)" << std::endl;
+    std::cout << "  --index                - Recognize through the hash index instead of SQLite" << std::endl;
+    std::cout << "  --dense-queries        - Fingerprint queries with the denser query profile" << std::endl;
+    std::cout << "  --micro-only           - Only run the stage microbenchmarks" << std::endl;
+    std::cout << "  --catalog-only         - Only run the catalog sweeps" << std::endl;
+    std::cout << "  --seed <num>           - Seed for the synthetic audio (default: 1)" << std::endl;
+    std::cout << "  --work <dir>           - Scratch directory (default: <tmp>/audentify-bench)" << std::endl;
+    std::cout << "  --keep                 - Keep the scratch databases" << std::endl;
+    std::cout << "  --out <file>           - Write the JSON report to a file (default: stdout)" << std::endl;
+}
+
+template <typename T>
+std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(static_cast<T>(std::stod(item)));
+        }
+    }
+    return values;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+json summarize(std::vector<double> ms) {
+    json summary;
+    summary["runs"] = ms.size();
+    if (ms.empty()) {
+        return summary;
+    }
+    std::sort(ms.begin(), ms.end());
+    auto percentile = [&ms](double p) {
+        return ms[std::min(ms.size() - 1, static_cast<size_t>(p * (ms.size() - 1) + 0.5))];
+    };
+    summary["minMs"] = ms.front();
+    summary["medianMs"] = percentile(0.5);
+    summary["p95Ms"] = percentile(0.95);
+    summary["maxMs"] = ms.back();
+    summary["meanMs"] = std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+    return summary;
+}
+
+// Runs fn `iterations` times; fn(i) returns nothing and is timed whole
+template <typename Fn>
+json timeRuns(int iterations, Fn fn) {
+    std::vector<double> ms;
+    for (int i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn(i);
+        ms.push_back(elapsedMs(start));
+    }
+    return summarize(ms);
+}
+
+// A synthetic song: a melody of short harmonic notes over faint noise. The
+// same seed always gives the same track, so query clips can be regenerated.
+std::vector<double> synthesizeTrack(uint32_t seed, double seconds, int sampleRate) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> pitch(std::log(220.0), std::log(2000.0));
+    std::uniform_real_distribution<double> noteLength(0.12, 0.4);
+    std::uniform_real_distribution<double> level(0.3, 1.0);
+    std::normal_distribution<double> noise(0.0, 0.003);
+    
+    size_t total = static_cast<size_t>(seconds * sampleRate);
+    std::vector<double> audio(total);
+    
+    // Two independent voices, so notes overlap and start off each other's beat
+    for (int voice = 0; voice < 2; voice++) {
+        size_t pos = 0;
+        while (pos < total) {
+            size_t length = std::min(total - pos, static_cast<size_t>(noteLength(rng) * sampleRate));
+            double f0 = std::exp(pitch(rng));
+            double amp = level(rng);
+            
+            for (size_t n = 0; n < length; n++) {
+                double t = static_cast<double>(n) / sampleRate;
+                double envelope = std::min(1.0, t * 200.0) * std::exp(-3.0 * t);
+                double sample = 0.0;
+                for (int harmonic = 1; harmonic <= 3; harmonic++) {
+                    sample += std::sin(2.0 * M_PI * f0 * harmonic * t) / harmonic;
+                }
+                audio[pos + n] += 0.15 * amp * envelope * sample;
+            }
+            pos += length;
+        }
+    }
+    
+    for (double& sample : audio) {
+        sample += noise(rng);
+    }
+    return audio;
+}
+
+// Cuts seconds of audio starting at offset and adds white noise at snrDb
+std::vector<double> makeQueryClip(const std::vector<double>& track, int sampleRate, double offset,
+                                  double seconds, double snrDb, std::mt19937& rng) {
+    size_t begin = std::min(track.size(), static_cast<size_t>(offset * sampleRate));
+    size_t end = std::min(track.size(), begin + static_cast<size_t>(seconds * sampleRate));
+    std::vector<double> clip(track.begin() + begin, track.begin() + end);
+    
+    if (std::isfinite(snrDb) && !clip.empty()) {
+        double power = 0.0;
+        for (double sample : clip) {
+            power += sample * sample;
+        }
+        double rms = std::sqrt(power / clip.size());
+        std::normal_distribution<double> noise(0.0, rms / std::pow(10.0, snrDb / 20.0));
+        for (double& sample : clip) {
+            sample += noise(rng);
+        }
+    }
+    return clip;
+}
+
+// 16-bit PCM WAV with every channel carrying the same mono signal
+std::string encodeWav(const std::vector<double>& mono, int sampleRate, int channels) {
+    auto put16 = [](std::string& out, uint16_t v) { out.push_back(v & 0xFF); out.push_back(v >> 8); };
+    auto put32 = [&put16](std::string& out, uint32_t v) { put16(out, v & 0xFFFF); put16(out, v >> 16); };
+    
+    uint32_t dataBytes = static_cast<uint32_t>(mono.size() * channels * 2);
+    std::string out;
+    out.reserve(44 + dataBytes);
+    out += "RIFF";
+    put32(out, 36 + dataBytes);
+    out += "WAVEfmt ";
+    put32(out, 16);
+    put16(out, 1);
+    put16(out, static_cast<uint16_t>(channels));
+    put32(out, static_cast<uint32_t>(sampleRate));
+    put32(out, static_cast<uint32_t>(sampleRate * channels * 2));
+    put16(out, static_cast<uint16_t>(channels * 2));
+    put16(out, 16);
+    out += "data";
+    put32(out, dataBytes);
+    
+    for (double sample : mono) {
+        auto value = static_cast<int16_t>(std::lround(std::max(-1.0, std::min(1.0, sample)) * 32767.0));
+        for (int c = 0; c < channels; c++) {
+            put16(out, static_cast<uint16_t>(value));
+        }
+    }
+    return out;
+}
+
+bool writeFile(const std::string& path, const std::string& contents) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(contents.data(), contents.size());
+    return static_cast<bool>(out);
+}
+
+SongInfo benchSongInfo(const std::string& kind, int number) {
+    return SongInfo("Bench", kind, kind + " " + std::to_string(number), "bench-" + kind + "-" + std::to_string(number));
+}
+
+// Stage totals from the metrics registry, to split a sweep's time by stage
+struct StageSnapshot {
+    std::array<uint64_t, static_cast<size_t>(Stage::COUNT)> counts{};
+    std::array<double, static_cast<size_t>(Stage::COUNT)> seconds{};
+    
+    static StageSnapshot take() {
+        StageSnapshot snapshot;
+        for (size_t s = 0; s < snapshot.counts.size(); s++) {
+            snapshot.counts[s] = Metrics::stageCount(static_cast<Stage>(s));
+            snapshot.seconds[s] = Metrics::stageSeconds(static_cast<Stage>(s));
+        }
+        return snapshot;
+    }
+};
+
+json stageBreakdown(const StageSnapshot& before, const StageSnapshot& after, size_t queries) {
+    json stages;
+    for (size_t s = 0; s < before.counts.size(); s++) {
+        uint64_t calls = after.counts[s] - before.counts[s];
+        if (calls == 0) {
+            continue;
+        }
+        double seconds = after.seconds[s] - before.seconds[s];
+        stages[Metrics::stageName(static_cast<Stage>(s))] = {
+            {"calls", calls},
+            {"msPerQuery", queries > 0 ? seconds * 1000.0 / queries : 0.0}
+        };
+    }
+    return stages;
+}
+
+json runMicrobenchmarks(const BenchOptions& options) {
+    json micro;
+    std::vector<double> source = synthesizeTrack(options.seed, options.trackSeconds, SOURCE_SAMPLE_RATE);
+    
+    std::string wavPath = (std::filesystem::path(options.workDir) / "micro_track.wav").string();
+    writeFile(wavPath, encodeWav(source, SOURCE_SAMPLE_RATE, 2));
+    
+    std::vector<double> audio;
+    micro["loadAudioFile"] = timeRuns(options.iterations, [&](int) { audio = loadAudioFile(wavPath); });
+    micro["loadAudioFile"]["samples"] = audio.size();
+    
+    std::vector<double> resampled;
+    micro["resample"] = timeRuns(options.iterations, [&](int) {
+        resampled = resample(source, SOURCE_SAMPLE_RATE, SAMPLE_RATE);
+    });
+    
+    AudioProcessor processor;
+    SpectrogramResult spec({}, {}, PowerMatrix());
+    micro["computeSpectrogramOptimized"] = timeRuns(options.iterations, [&](int) {
+        spec = processor.computeSpectrogramOptimized(audio);
+    });
+    micro["computeSpectrogramOptimized"]["frames"] = spec.times.size();
+    
+    std::vector<Peak> peaks;
+    micro["findPeaksOptimizedEnhanced"] = timeRuns(options.iterations, [&](int) {
+        peaks = findPeaksOptimizedEnhanced(spec);
+    });
+    micro["findPeaksOptimizedEnhanced"]["peaks"] = peaks.size();
+    
+    std::vector<HashResult> hashes;
+    micro["hashPointsOptimized"] = timeRuns(options.iterations, [&](int) { hashes = hashPointsOptimized(peaks); });
+    micro["hashPointsOptimized"]["hashes"] = hashes.size();
+    
+    // The same stages specialized for queries: denser peaks and anchors
+    std::vector<Peak> queryPeaks;
+    micro["findPeaksQueryProfile"] = timeRuns(options.iterations, [&](int) {
+        queryPeaks = findPeaksOptimizedEnhanced(spec, FingerprintProfile::Query);
+    });
+    micro["findPeaksQueryProfile"]["peaks"] = queryPeaks.size();
+    
+    std::vector<HashResult> queryHashes;
+    micro["hashPointsQueryProfile"] = timeRuns(options.iterations, [&](int) {
+        queryHashes = hashPointsOptimized(queryPeaks, FingerprintProfile::Query);
+    });
+    micro["hashPointsQueryProfile"]["hashes"] = queryHashes.size();
+    
+    if (hashes.empty()) {
+        AF_LOG(Warn) << "Synthetic track produced no hashes; skipping database benchmarks";
+        return micro;
+    }
+    
+    std::string dbPath = (std::filesystem::path(options.workDir) / "micro.db").string();
+    std::filesystem::remove(dbPath);
+    Database db(dbPath);
+    if (!db.open()) {
+        AF_LOG(Error) << "Could not open " << dbPath;
+        return micro;
+    }
+    
+    micro["storeSong"] = timeRuns(options.iterations, [&](int i) { db.storeSong(hashes, benchSongInfo("micro", i)); });
+    
+    MatchMap matches;
+    micro["getMatches"] = timeRuns(options.iterations, [&](int) { matches = db.getMatches(hashes); });
+    micro["getMatches"]["songs"] = matches.size();
+    
+    return micro;
+}
+
+// A hash a real peak pair could produce: anchor and target in the kept
+// frequency band, the target inside the anchor's target zone
+long decoyHash(std::mt19937& rng) {
+    using Profile = CatalogProfile;
+    std::uniform_real_distribution<double> anchorHz(Profile::MIN_FREQUENCY_HZ, Profile::MAX_FREQUENCY_HZ);
+    std::uniform_real_distribution<double> offsetHz(-Profile::TARGET_F * 0.5, Profile::TARGET_F * 0.5);
+    std::uniform_real_distribution<double> delta(Profile::TARGET_START, Profile::TARGET_START + Profile::TARGET_T);
+    
+    Peak anchor;
+    Peak target;
+    anchor.frequency = anchorHz(rng);
+    target.frequency = std::max(0.0, anchor.frequency + offsetHz(rng));
+    target.time = delta(rng);
+    return static_cast<long>(hashPointPairEnhanced(anchor, target));
+}
+
+struct CatalogTrack {
+    SongInfo info;
+    std::vector<double> audio;   // At SOURCE_SAMPLE_RATE
+};
+
+json runCatalogSweeps(const BenchOptions& options) {
+    json sweeps = json::array();
+    std::mt19937 rng(options.seed);
+    
+    std::string dbPath = (std::filesystem::path(options.workDir) / "catalog.db").string();
+    std::filesystem::remove(dbPath);
+    std::filesystem::remove(HashIndex::defaultPathFor(dbPath));
+    
+    // Tracks the queries come from, fingerprinted through the real pipeline
+    std::vector<CatalogTrack> tracks;
+    std::vector<PendingSong> pending;
+    auto registerStart = std::chrono::steady_clock::now();
+    for (int t = 0; t < options.tracks; t++) {
+        CatalogTrack track;
+        track.info = benchSongInfo("track", t);
+        track.audio = synthesizeTrack(options.seed + 1000 + t, options.trackSeconds, SOURCE_SAMPLE_RATE);
+        
+        std::string wav = encodeWav(track.audio, SOURCE_SAMPLE_RATE, 2);
+        PendingSong song;
+        song.info = track.info;
+        song.hashes = fingerprintBufferOptimized(wav.data(), wav.size(), AudioFormat::WAV);
+        
+        if (song.hashes.empty()) {
+            AF_LOG(Warn) << "Track " << t << " produced no hashes";
+            continue;
+        }
+        pending.push_back(std::move(song));
+        tracks.push_back(std::move(track));
+    }
+    double fingerprintMs = elapsedMs(registerStart);
+    
+    if (pending.empty()) {
+        AF_LOG(Error) << "No track could be fingerprinted";
+        return sweeps;
+    }
+    
+    auto db = std::make_unique<Database>(dbPath);
+    if (!db->open() || !db->storeSongs(pending)) {
+        AF_LOG(Error) << "Could not store the benchmark tracks in " << dbPath;
+        return sweeps;
+    }
+    pending.clear();
+    
+    std::vector<int> sizes = options.catalogSizes;
+    std::sort(sizes.begin(), sizes.end());
+    
+    int catalogSongs = static_cast<int>(tracks.size());
+    int nextFiller = 0;
+    uint32_t maxFrame = secondsToFrame(options.trackSeconds);
+    
+    for (int size : sizes) {
+        json sweep;
+        sweep["catalogSongs"] = std::max(size, catalogSongs);
+        
+        // Decoys share the query's hash space but not its timing: lookups
+        // return realistic posting lists, yet no decoy lines up with a query
+        if (!db) {
+            db = std::make_unique<Database>(dbPath);
+            db->open();
+        }
+        auto fillStart = std::chrono::steady_clock::now();
+        int added = 0;
+        std::uniform_int_distribution<uint32_t> pickFrame(0, maxFrame);
+        while (catalogSongs < size) {
+            int batchSongs = std::min(size - catalogSongs, 256);
+            std::vector<PendingSong> batch(batchSongs);
+            for (auto& song : batch) {
+                song.info = benchSongInfo("filler", nextFiller++);
+                song.hashes.reserve(options.fillerHashes);
+                for (int h = 0; h < options.fillerHashes; h++) {
+                    song.hashes.emplace_back(decoyHash(rng), pickFrame(rng));
+                }
+            }
+            if (!db->storeSongs(batch)) {
+                AF_LOG(Error) << "Failed to store decoy songs";
+                return sweeps;
+            }
+            catalogSongs += batchSongs;
+            added += batchSongs;
+        }
+        double fillMs = elapsedMs(fillStart);
+        sweep["registration"] = {
+            {"decoySongsAdded", added},
+            {"decoyMs", fillMs},
+            {"decoySongsPerSecond", fillMs > 0 ? added * 1000.0 / fillMs : 0.0}
+        };
+        db->checkpointDb();
+        db.reset();   // The recognizer opens its own connections
+        
+        SongRecognizer recognizer(dbPath);
+        recognizer.setDenseQueries(options.denseQueries);
+        if (!recognizer.initializeDatabase()) {
+            AF_LOG(Error) << "Could not open " << dbPath << " for recognition";
+            return sweeps;
+        }
+        if (options.useIndex) {
+            auto indexStart = std::chrono::steady_clock::now();
+            if (!recognizer.buildHashIndex()) {
+                AF_LOG(Error) << "Could not build the hash index";
+                return sweeps;
+            }
+            sweep["indexBuildMs"] = elapsedMs(indexStart);
+        }
+        sweep["lookupPath"] = options.useIndex ? "index" : "sqlite";
+        sweep["queryProfile"] = profileTag(recognizer.getQueryProfile());
+        
+        json noiseLevels = json::array();
+        for (double snrDb : options.snrsDb) {
+            std::vector<double> latencies;
+            int correct = 0;
+            int wrong = 0;
+            std::uniform_real_distribution<double> pickOffset(0.0, std::max(0.0, options.trackSeconds - options.clipSeconds));
+            
+            StageSnapshot before = StageSnapshot::take();
+            for (const auto& track : tracks) {
+                std::vector<double> clip = makeQueryClip(track.audio, SOURCE_SAMPLE_RATE, pickOffset(rng),
+                                                         options.clipSeconds, snrDb, rng);
+                std::string wav = encodeWav(clip, SOURCE_SAMPLE_RATE, 1);
+                
+                auto start = std::chrono::steady_clock::now();
+                RecognitionResult result = recognizer.recognizeBuffer(wav.data(), wav.size(), AudioFormat::WAV,
+                                                                      RecognitionOptions());
+                latencies.push_back(elapsedMs(start));
+                
+                if (result.song.songId == track.info.songId) {
+                    correct++;
+                } else if (!result.song.songId.empty()) {
+                    wrong++;
+                }
+            }
+            StageSnapshot after = StageSnapshot::take();
+            
+            json level;
+            level["snrDb"] = std::isfinite(snrDb) ? json(snrDb) : json("inf");
+            level["queries"] = tracks.size();
+            level["recall"] = tracks.empty() ? 0.0 : static_cast<double>(correct) / tracks.size();
+            level["wrongMatches"] = wrong;
+            level["latency"] = summarize(latencies);
+            level["stages"] = stageBreakdown(before, after, tracks.size());
+            noiseLevels.push_back(level);
+        }
+        sweep["queries"] = noiseLevels;
+        sweeps.push_back(sweep);
+        
+        std::cerr << "Catalog of " << catalogSongs << " songs done" << std::endl;
+    }
+    
+    if (!sweeps.empty()) {
+        sweeps[0]["trackFingerprintMs"] = fingerprintMs;
+    }
+    return sweeps;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        BenchOptions options;
+        options.workDir = (std::filesystem::temp_directory_path() / "audentify-bench").string();
+        setLogLevel(LogLevel::Warn);   // Per-query pipeline lines would drown the report
+        
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--catalogs" && i + 1 < argc) {
+                options.catalogSizes = parseList<int>(argv[++i]);
+            } else if (arg == "--tracks" && i + 1 < argc) {
+                options.tracks = std::stoi(argv[++i]);
+            } else if (arg == "--track-seconds" && i + 1 < argc) {
+                options.trackSeconds = std::stod(argv[++i]);
+            } else if (arg == "--clip-seconds" && i + 1 < argc) {
+                options.clipSeconds = std::stod(argv[++i]);
+            } else if (arg == "--snr" && i + 1 < argc) {
+                options.snrsDb = parseList<double>(argv[++i]);
+            } else if (arg == "--filler-hashes" && i + 1 < argc) {
+                options.fillerHashes = std::stoi(argv[++i]);
+            } else if (arg == "--iterations" && i + 1 < argc) {
+                options.iterations = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--index") {
+                options.useIndex = true;
+            } else if (arg == "--dense-queries") {
+                options.denseQueries = true;
+            } else if (arg == "--micro-only") {
+                options.runCatalogs = false;
+            } else if (arg == "--catalog-only") {
+                options.runMicro = false;
+            } else if (arg == "--seed" && i + 1 < argc) {
+                options.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            } else if (arg == "--work" && i + 1 < argc) {
+                options.workDir = argv[++i];
+            } else if (arg == "--keep") {
+                options.keepWorkDir = true;
+            } else if (arg == "--out" && i + 1 < argc) {
+                options.outPath = argv[++i];
+            } else if (arg == "--help") {
+                printUsage(argv[0]);
+                return 0;
+            } else {
+                std::cerr << "Error: Unknown option " << arg << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        
+        std::filesystem::create_directories(options.workDir);
+        
+        json report;
+        report["config"] = {
+            {"sampleRate", SAMPLE_RATE},
+            {"sourceSampleRate", SOURCE_SAMPLE_RATE},
+            {"tracks", options.tracks},
+            {"trackSeconds", options.trackSeconds},
+            {"clipSeconds", options.clipSeconds},
+            {"fillerHashes", options.fillerHashes},
+            {"iterations", options.iterations},
+            {"seed", options.seed}
+        };
+        
+        if (options.runMicro) {
+            std::cerr << "Running stage microbenchmarks" << std::endl;
+            report["micro"] = runMicrobenchmarks(options);
+        }
+        if (options.runCatalogs) {
+            std::cerr << "Running catalog sweeps" << std::endl;
+            report["catalogs"] = runCatalogSweeps(options);
+        }
+        
+        if (!options.keepWorkDir) {
+            std::filesystem::remove_all(options.workDir);
+        }
+        
+        std::string text = report.dump(2) + "\n";
+        if (options.outPath.empty()) {
+            std::cout << text;
+        } else if (!writeFile(options.outPath, text)) {
+            std::cerr << "Error: Could not write " << options.outPath << std::endl;
+            return 1;
+        }
+        return 0;
+    
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
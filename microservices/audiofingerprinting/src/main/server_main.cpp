@@ -3,17 +3,40 @@
 #include <filesystem>
 #include <chrono>
 #include <thread>
-#include <fftw3.h>
 #include <nlohmann/json.hpp>
 #include <curl/curl.h>
 #include <regex>
 #include <algorithm>
 #include <cctype>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <unordered_map>
+#include <sstream>
 
 #include "../recognition/Recognition.h"
+#include "../recognition/StreamingRecognizer.h"
+#include "../audio/PushDecoder.h"
+#include "../utils/Log.h"
+#include "../utils/Metrics.h"
+#include "../utils/ThreadPool.h"
 
 using json = nlohmann::json;
 
+// Spotify/YouTube enrichment cache
+static const int ENRICHMENT_CACHE_TTL_SECONDS = 6 * 60 * 60; // Default lifetime of a song's links
+static const int ENRICHMENT_MISS_TTL_SECONDS = 5 * 60;       // Lifetime of a lookup that found nothing
+static const size_t ENRICHMENT_CACHE_MAX_SONGS = 4096;
+static const size_t ENRICHMENT_WORKERS = 4;                  // Threads running Spotify/YouTube requests
+static const size_t ENRICHMENT_QUEUE_DEPTH = 32;             // Songs waiting for one before lookups are skipped
+
+// Recognition executor: decode, FFT and matching run on a fixed set of
+// workers, not on the connection threads
+static const size_t RECOGNITION_QUEUE_DEPTH = 64;        // Requests waiting for a worker before 429s
+static const int RECOGNITION_RETRY_AFTER_SECONDS = 1;
+static const size_t SPARE_CONNECTION_THREADS = 8;        // Serve health, stats and metrics under full load
+static const size_t LIVE_STREAM_LIMIT = 32;              // Live streams open at once before 429s
+
 // Base64 encoding implementation
 static const std::string base64_chars = 
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
@@ -68,7 +91,7 @@ std::map<std::string, std::string> parseEnvFile(const std::string& filePath) {
     
     std::ifstream file(filePath);
     if (!file.is_open()) {
-        std::cout << "Warning: .env file not found at " << filePath << std::endl;
+        AF_LOG(Warn) << ".env file not found at " << filePath;
         return env;
     }
     
@@ -203,6 +226,21 @@ struct MatchedSong {
     MatchedSong() : similarity(0.0), isMatch(false) {}
 };
 
+// Enrichment knobs set through PUT /config. In lazy mode a recognition
+// response does not wait for the lookups; clients collect the links from
+// GET /enrichment/<songId> once they are ready.
+struct EnrichmentOptions {
+    bool lazy = false;
+    int cacheTtlSeconds = ENRICHMENT_CACHE_TTL_SECONDS;
+};
+
+// One song's Spotify/YouTube lookup, shared by every request that needs it
+// while it is in flight and cached once it completes
+struct EnrichmentEntry {
+    std::shared_future<json> enrichment;
+    std::chrono::steady_clock::time_point created;
+};
+
 class AudioFingerprintingServer {
 private:
     std::unique_ptr<AudioFingerprinting::SongRecognizer> recognizer;
@@ -210,49 +248,282 @@ private:
     std::string tempDir;
     std::string envPath;
     APICredentials apiCreds;
+    std::mutex credentialsMutex;   // Guards apiCreds
+    std::mutex spotifyTokenMutex;  // Serializes token refreshes
+    
+    // Easy handles are kept between requests so their connections stay open;
+    // the share handle lets them reuse each other's DNS answers and TLS sessions
+    CURLSH* curlShare = nullptr;
+    std::mutex curlShareLocks[CURL_LOCK_DATA_LAST];
+    std::vector<CURL*> idleCurlHandles;
+    std::mutex curlHandlesMutex;
+    
+    // Coordinator mode: shard node base URLs in shard order, with keep-alive
+    // clients pooled per node the same way as the curl handles
+    std::vector<std::string> shardNodes;
+    std::vector<std::vector<std::unique_ptr<httplib::Client>>> idleShardClients;
+    std::mutex shardClientsMutex;
+    
+    // Enrichment by songId, refetched once older than the configured TTL
+    EnrichmentOptions enrichmentOptions;
+    std::unordered_map<std::string, EnrichmentEntry> enrichmentCache;
+    std::mutex enrichmentMutex;  // Guards enrichmentOptions and enrichmentCache
+    
+    // Lookups and their side requests run here, so a burst of new songs
+    // cannot start an unbounded number of threads
+    std::unique_ptr<AudioFingerprinting::ThreadPool> enrichmentPool;
+    
+    // Runs request on a free enrichment worker, or on the calling thread when
+    // none is free. Only idle workers are used, so a lookup never waits for a
+    // request queued behind other songs.
+    template <typename T>
+    std::future<T> startEnrichmentRequest(std::function<T()> request) {
+        auto task = std::make_shared<std::packaged_task<T()>>(std::move(request));
+        std::future<T> result = task->get_future();
+        if (!enrichmentPool->trySubmit([task]() { (*task)(); }, 0)) {
+            (*task)();
+        }
+        return result;
+    }
+    
+    // Reloads the hash index when registrations in other processes flush segments
+    std::thread indexRefresher;
+    std::mutex refresherMutex;
+    std::condition_variable refresherWake;
+    bool stopping = false;  // Guarded by refresherMutex
     
-    // Helper to save uploaded file temporarily
-    std::string saveUploadedFile(const std::string& fileData, const std::string& filename) {
-        if (!std::filesystem::exists(tempDir)) {
-            std::filesystem::create_directories(tempDir);
+    void refreshIndexLoop() {
+        std::unique_lock<std::mutex> lock(refresherMutex);
+        while (!refresherWake.wait_for(lock, std::chrono::seconds(AudioFingerprinting::INDEX_REFRESH_SECONDS),
+                                       [this]() { return stopping; })) {
+            lock.unlock();
+            if (recognizer->refreshHashIndex()) {
+                AF_LOG(Debug) << "Picked up new hash index segments";
+            }
+            lock.lock();
         }
+    }
+    
+    // CPU-bound recognition work; a full queue turns requests away at once
+    // instead of letting them wait past their clients' timeouts
+    std::unique_ptr<AudioFingerprinting::ThreadPool> recognitionPool;
+    size_t recognitionWorkers = std::max(1u, std::thread::hardware_concurrency());
+    size_t recognitionQueueDepth = RECOGNITION_QUEUE_DEPTH;
+    
+    // Runs work on a recognition worker and waits for it, rethrowing what it
+    // throws. False when the queue is full; queueWaitMs is the time the
+    // request waited for a worker and workMs the time the work took on it.
+    template <typename Work>
+    bool runRecognitionTask(Work work, double& queueWaitMs, int64_t& workMs) {
+        auto enqueued = std::chrono::steady_clock::now();
+        auto task = std::make_shared<std::packaged_task<void()>>([&work, &queueWaitMs, &workMs, enqueued]() {
+            auto started = std::chrono::steady_clock::now();
+            double waited = std::chrono::duration<double>(started - enqueued).count();
+            AudioFingerprinting::Metrics::observe(AudioFingerprinting::Stage::QueueWait, waited);
+            queueWaitMs = waited * 1000.0;
+            work();
+            workMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+        });
+        std::future<void> done = task->get_future();
         
-        auto now = std::chrono::system_clock::now();
-        auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-        std::string tempFilename = tempDir + "/" + std::to_string(timestamp) + "_" + filename;
+        if (!recognitionPool->trySubmit([task]() { (*task)(); }, recognitionQueueDepth)) {
+            AudioFingerprinting::Metrics::add(AudioFingerprinting::Counter::RejectedRequests);
+            return false;
+        }
+        done.get();
+        return true;
+    }
+    
+    // Live streams wait for their next chunk on their connection thread and
+    // only decode and match it on a recognition worker. They are capped by a
+    // count of their own too, so they cannot take the connection threads
+    // queued work and the rest of the API were given.
+    size_t liveStreamLimit = LIVE_STREAM_LIMIT;
+    std::atomic<size_t> liveStreams{0};
+    
+    // Held for the lifetime of an admitted live stream
+    struct LiveStreamSlot {
+        std::atomic<size_t>& streams;
+        ~LiveStreamSlot() { streams--; }
+    };
+    
+    bool admitLiveStream() {
+        size_t open = liveStreams.load();
+        while (open < liveStreamLimit) {
+            if (liveStreams.compare_exchange_weak(open, open + 1)) {
+                return true;
+            }
+        }
+        AudioFingerprinting::Metrics::add(AudioFingerprinting::Counter::RejectedRequests);
+        return false;
+    }
+    
+    void rejectOverloaded(httplib::Response& res) {
+        json error;
+        error["success"] = false;
+        error["error"] = "Server is busy, retry shortly";
         
-        std::ofstream file(tempFilename, std::ios::binary);
-        if (!file) {
-            throw std::runtime_error("Failed to create temporary file");
+        res.set_header("Retry-After", std::to_string(RECOGNITION_RETRY_AFTER_SECONDS));
+        res.set_content(error.dump(2) + "\n", "application/json");
+        res.status = 429;
+    }
+    
+    // Recognition knobs set through PUT /config; handlers take a copy per request
+    AudioFingerprinting::RecognitionOptions recognitionOptions;
+    std::mutex optionsMutex;
+    
+    AudioFingerprinting::RecognitionOptions currentRecognitionOptions() {
+        std::lock_guard<std::mutex> lock(optionsMutex);
+        return recognitionOptions;
+    }
+    
+    json recognitionOptionsToJson(const AudioFingerprinting::RecognitionOptions& options) {
+        json result;
+        result["progressive"] = options.progressive;
+        result["batchSeconds"] = options.batchSeconds;
+        result["minScore"] = options.minScore;
+        result["scoreMargin"] = options.scoreMargin;
+        return result;
+    }
+    
+    // Recognition fields added to every recognition response
+    void addRecognitionDetails(json& response, const AudioFingerprinting::RecognitionResult& result) {
+        response["score"] = result.score;
+        response["matchCount"] = result.matchCount;
+        response["confidence"] = result.confidence;
+        response["audioSecondsUsed"] = result.secondsUsed;
+        response["earlyExit"] = result.earlyExit;
+    }
+    
+    APICredentials currentCredentials() {
+        std::lock_guard<std::mutex> lock(credentialsMutex);
+        return apiCreds;
+    }
+    
+    static void lockCurlShare(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+        static_cast<AudioFingerprintingServer*>(userptr)->curlShareLocks[data].lock();
+    }
+    
+    static void unlockCurlShare(CURL*, curl_lock_data data, void* userptr) {
+        static_cast<AudioFingerprintingServer*>(userptr)->curlShareLocks[data].unlock();
+    }
+    
+    CURL* acquireCurlHandle() {
+        {
+            std::lock_guard<std::mutex> lock(curlHandlesMutex);
+            if (!idleCurlHandles.empty()) {
+                CURL* curl = idleCurlHandles.back();
+                idleCurlHandles.pop_back();
+                curl_easy_reset(curl); // Clears options, keeps open connections
+                return curl;
+            }
+        }
+        return curl_easy_init();
+    }
+    
+    void releaseCurlHandle(CURL* curl) {
+        std::lock_guard<std::mutex> lock(curlHandlesMutex);
+        idleCurlHandles.push_back(curl);
+    }
+    
+    std::unique_ptr<httplib::Client> acquireShardClient(uint32_t shard) {
+        {
+            std::lock_guard<std::mutex> lock(shardClientsMutex);
+            auto& idle = idleShardClients[shard];
+            if (!idle.empty()) {
+                std::unique_ptr<httplib::Client> client = std::move(idle.back());
+                idle.pop_back();
+                return client;
+            }
+        }
+        auto client = std::make_unique<httplib::Client>(shardNodes[shard]);
+        client->set_keep_alive(true);
+        client->set_connection_timeout(2, 0);
+        client->set_read_timeout(10, 0);
+        return client;
+    }
+    
+    void releaseShardClient(uint32_t shard, std::unique_ptr<httplib::Client> client) {
+        std::lock_guard<std::mutex> lock(shardClientsMutex);
+        idleShardClients[shard].push_back(std::move(client));
+    }
+    
+    // One shard's part of a lookup: POST /shard/match on the node owning it
+    bool lookupShard(uint32_t shard, const std::vector<AudioFingerprinting::HashResult>& hashes,
+                     std::vector<AudioFingerprinting::ScoreBin>& bins) {
+        json request;
+        request["hashes"] = json::array();
+        for (const auto& hash : hashes) {
+            request["hashes"].push_back({hash.hash, hash.offsetFrame});
         }
         
-        file.write(fileData.c_str(), fileData.size());
-        file.close();
+        std::unique_ptr<httplib::Client> client = acquireShardClient(shard);
+        auto response = client->Post("/shard/match", request.dump(), "application/json");
+        if (!response || response->status != 200) {
+            AF_LOG(Warn) << "Shard " << shard << " (" << shardNodes[shard] << ") lookup failed"
+                         << (response ? " with status " + std::to_string(response->status) : std::string());
+            return false; // The client is dropped with its broken connection
+        }
+        releaseShardClient(shard, std::move(client));
         
-        return tempFilename;
+        try {
+            json result = json::parse(response->body);
+            if (result.value("fingerprintProfile", "") != fingerprintProfileTag()) {
+                AF_LOG(Warn) << "Shard " << shard << " (" << shardNodes[shard] << ") uses fingerprint profile '"
+                             << result.value("fingerprintProfile", "") << "', not '" << fingerprintProfileTag() << "'";
+                return false;
+            }
+            for (const auto& bin : result["bins"]) {
+                bins.push_back({bin[0].get<uint32_t>(), bin[1].get<int32_t>(), bin[2].get<uint32_t>()});
+            }
+        } catch (const std::exception& e) {
+            AF_LOG(Warn) << "Shard " << shard << " sent a malformed response: " << e.what();
+            return false;
+        }
+        return true;
     }
     
-    void cleanupTempFile(const std::string& filepath) {
-        try {
-            if (std::filesystem::exists(filepath)) {
-                std::filesystem::remove(filepath);
+    // Refuses shard nodes whose database was made with another fingerprint
+    // profile; a node that is not up yet is checked on every lookup instead
+    bool checkShardProfiles() {
+        for (size_t shard = 0; shard < shardNodes.size(); ++shard) {
+            std::unique_ptr<httplib::Client> client = acquireShardClient(static_cast<uint32_t>(shard));
+            auto response = client->Get("/health");
+            if (!response || response->status != 200) {
+                AF_LOG(Warn) << "Shard node " << shardNodes[shard] << " is not reachable";
+                continue;
+            }
+            releaseShardClient(static_cast<uint32_t>(shard), std::move(client));
+            
+            std::string profile;
+            try {
+                profile = json::parse(response->body).value("fingerprintProfile", "");
+            } catch (const std::exception&) {
+            }
+            if (profile != fingerprintProfileTag()) {
+                AF_LOG(Error) << "Shard node " << shardNodes[shard] << " uses fingerprint profile '" << profile
+                              << "', this catalog '" << fingerprintProfileTag() << "'";
+                return false;
             }
-        } catch (...) {
-            // Ignore cleanup errors
         }
+        return true;
     }
     
     // HTTP request helper
     HTTPResponse makeHTTPRequest(const std::string& url, const std::vector<std::string>& headers = {}, 
                                 const std::string& postData = "", const std::string& method = "GET") {
         HTTPResponse response;
-        CURL* curl = curl_easy_init();
+        CURL* curl = acquireCurlHandle();
         
         if (!curl) {
             response.responseCode = -1;
             return response;
         }
         
+        if (curlShare) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, curlShare);
+        }
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // Requests run on several threads
         curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
@@ -280,38 +551,40 @@ private:
             curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.responseCode);
         } else {
             response.responseCode = -1;
-            std::cerr << "CURL error: " << curl_easy_strerror(res) << std::endl;
+            AF_LOG(Warn) << "CURL error: " << curl_easy_strerror(res);
         }
         
         if (headerList) {
             curl_slist_free_all(headerList);
         }
-        curl_easy_cleanup(curl);
+        releaseCurlHandle(curl);
         
         return response;
     }
     
     // URL encode helper
     std::string urlEncode(const std::string& str) {
-        CURL* curl = curl_easy_init();
+        CURL* curl = acquireCurlHandle();
         if (!curl) return str;
         
         char* encoded = curl_easy_escape(curl, str.c_str(), str.length());
         std::string result(encoded);
         curl_free(encoded);
-        curl_easy_cleanup(curl);
+        releaseCurlHandle(curl);
         
         return result;
     }
     
     // Spotify API methods
+    // Fetches a token with the current client credentials; callers hold spotifyTokenMutex
     bool refreshSpotifyToken() {
-        if (!apiCreds.hasSpotify()) {
-            std::cout << "Spotify credentials not available" << std::endl;
+        APICredentials creds = currentCredentials();
+        if (!creds.hasSpotify()) {
+            AF_LOG(Debug) << "Spotify credentials not available";
             return false;
         }
         
-        std::string auth = apiCreds.spotifyClientId + ":" + apiCreds.spotifyClientSecret;
+        std::string auth = creds.spotifyClientId + ":" + creds.spotifyClientSecret;
         std::string encodedAuth = base64_encode(auth);
         
         std::vector<std::string> headers = {
@@ -327,36 +600,44 @@ private:
         if (response.responseCode == 200) {
             try {
                 json tokenResponse = json::parse(response.data);
-                apiCreds.spotifyAccessToken = tokenResponse["access_token"];
                 int expiresIn = tokenResponse["expires_in"];
+                
+                std::lock_guard<std::mutex> lock(credentialsMutex);
+                apiCreds.spotifyAccessToken = tokenResponse["access_token"];
                 apiCreds.spotifyTokenExpiry = std::chrono::system_clock::now() + 
                                             std::chrono::seconds(expiresIn - 300); // 5 min buffer
-                std::cout << "Spotify token refreshed successfully" << std::endl;
+                AF_LOG(Debug) << "Spotify token refreshed successfully";
                 return true;
             } catch (const std::exception& e) {
-                std::cerr << "Failed to parse Spotify token response: " << e.what() << std::endl;
+                AF_LOG(Warn) << "Failed to parse Spotify token response: " << e.what();
                 return false;
             }
         }
         
-        std::cerr << "Failed to refresh Spotify token. HTTP " << response.responseCode << std::endl;
+        AF_LOG(Warn) << "Failed to refresh Spotify token. HTTP " << response.responseCode;
         return false;
     }
     
-    bool ensureSpotifyToken() {
-        auto now = std::chrono::system_clock::now();
-        if (apiCreds.spotifyAccessToken.empty() || now >= apiCreds.spotifyTokenExpiry) {
-            return refreshSpotifyToken();
+    // Returns a valid access token, refreshing it first when needed; empty when unavailable
+    std::string spotifyToken() {
+        std::lock_guard<std::mutex> refreshLock(spotifyTokenMutex);
+        APICredentials creds = currentCredentials();
+        if (creds.spotifyAccessToken.empty() || std::chrono::system_clock::now() >= creds.spotifyTokenExpiry) {
+            if (!refreshSpotifyToken()) {
+                return "";
+            }
+            creds = currentCredentials();
         }
-        return true;
+        return creds.spotifyAccessToken;
     }
     
     // Enhanced Spotify search - Step 1: Find songs by name
     MatchedSong findBestSpotifyTrack(const std::string& artist, const std::string& title) {
         MatchedSong result;
         
-        if (!ensureSpotifyToken()) {
-            std::cout << "Spotify token not available" << std::endl;
+        std::string token = spotifyToken();
+        if (token.empty()) {
+            AF_LOG(Debug) << "Spotify token not available";
             return result;
         }
         
@@ -366,7 +647,7 @@ private:
                          "&type=track&limit=20";
         
         std::vector<std::string> headers = {
-            "Authorization: Bearer " + apiCreds.spotifyAccessToken
+            "Authorization: Bearer " + token
         };
         
         HTTPResponse response = makeHTTPRequest(url, headers);
@@ -406,15 +687,15 @@ private:
                         result.similarity = bestSimilarity;
                         result.isMatch = true;
                         
-                        std::cout << "Found Spotify track: " << result.spotifyTrackName 
-                                  << " (Similarity: " << bestSimilarity << ")" << std::endl;
+                        AF_LOG(Debug) << "Found Spotify track: " << result.spotifyTrackName 
+                                      << " (Similarity: " << bestSimilarity << ")";
                     }
                 }
             } catch (const std::exception& e) {
-                std::cerr << "Spotify track search parsing error: " << e.what() << std::endl;
+                AF_LOG(Warn) << "Spotify track search parsing error: " << e.what();
             }
         } else {
-            std::cerr << "Spotify track search failed. HTTP " << response.responseCode << std::endl;
+            AF_LOG(Warn) << "Spotify track search failed. HTTP " << response.responseCode;
         }
         
         return result;
@@ -429,9 +710,15 @@ private:
         std::string url = "https://api.spotify.com/v1/albums/" + matchedSong.spotifyAlbumId + "/tracks";
         
         std::vector<std::string> headers = {
-            "Authorization: Bearer " + apiCreds.spotifyAccessToken
+            "Authorization: Bearer " + spotifyToken()
         };
         
+        // Album metadata is fetched alongside the track listing
+        std::string albumId = matchedSong.spotifyAlbumId;
+        std::future<json> albumInfoRequest = startEnrichmentRequest<json>([this, albumId] {
+            return getSpotifyAlbumInfo(albumId);
+        });
+        
         HTTPResponse response = makeHTTPRequest(url, headers);
         
         if (response.responseCode == 200) {
@@ -443,7 +730,7 @@ private:
                 albumTracks["albumId"] = matchedSong.spotifyAlbumId;
                 
                 // Get album info for metadata
-                json albumInfo = getSpotifyAlbumInfo(matchedSong.spotifyAlbumId);
+                json albumInfo = albumInfoRequest.get();
                 if (!albumInfo.is_null()) {
                     albumTracks["albumUrl"] = albumInfo["external_urls"]["spotify"];
                     albumTracks["releaseDate"] = albumInfo["release_date"];
@@ -489,16 +776,16 @@ private:
                     albumTracks["tracks"].push_back(trackInfo);
                 }
                 
-                std::cout << "Retrieved album tracks for: " << matchedSong.spotifyAlbumName 
-                          << " (Identified track: " << matchedSong.spotifyTrackName << ")" << std::endl;
+                AF_LOG(Debug) << "Retrieved album tracks for: " << matchedSong.spotifyAlbumName 
+                              << " (Identified track: " << matchedSong.spotifyTrackName << ")";
                 
                 return albumTracks;
                 
             } catch (const std::exception& e) {
-                std::cerr << "Spotify album tracks parsing error: " << e.what() << std::endl;
+                AF_LOG(Warn) << "Spotify album tracks parsing error: " << e.what();
             }
         } else {
-            std::cerr << "Spotify album tracks request failed. HTTP " << response.responseCode << std::endl;
+            AF_LOG(Warn) << "Spotify album tracks request failed. HTTP " << response.responseCode;
         }
         
         return nullptr;
@@ -509,7 +796,7 @@ private:
         std::string url = "https://api.spotify.com/v1/albums/" + albumId;
         
         std::vector<std::string> headers = {
-            "Authorization: Bearer " + apiCreds.spotifyAccessToken
+            "Authorization: Bearer " + spotifyToken()
         };
         
         HTTPResponse response = makeHTTPRequest(url, headers);
@@ -518,19 +805,22 @@ private:
             try {
                 return json::parse(response.data);
             } catch (const std::exception& e) {
-                std::cerr << "Spotify album info parsing error: " << e.what() << std::endl;
+                AF_LOG(Warn) << "Spotify album info parsing error: " << e.what();
             }
         }
         
         return nullptr;
     }
     
-    // Enhanced YouTube search with cross-verification
-    json searchYouTubeVideoEnhanced(const std::string& artist, const std::string& title, const MatchedSong& spotifyMatch) {
+    // Enhanced YouTube search with cross-verification. The searches run while the
+    // Spotify lookup is still in flight; only ranking the videos waits for it.
+    json searchYouTubeVideoEnhanced(const std::string& artist, const std::string& title,
+                                    const std::shared_future<MatchedSong>& spotifyMatch) {
         json result;
         
-        if (!apiCreds.hasYouTube()) {
-            std::cout << "YouTube API key not available, skipping video search" << std::endl;
+        APICredentials creds = currentCredentials();
+        if (!creds.hasYouTube()) {
+            AF_LOG(Debug) << "YouTube API key not available, skipping video search";
             return result;
         }
         
@@ -550,7 +840,7 @@ private:
                              "&maxResults=15" // Get more results for better matching
                              "&order=relevance"
                              "&q=" + query +
-                             "&key=" + apiCreds.youtubeApiKey;
+                             "&key=" + creds.youtubeApiKey;
             
             HTTPResponse response = makeHTTPRequest(url);
             
@@ -561,7 +851,7 @@ private:
                         
                         // Find the best video that matches our Spotify track
                         json bestVideo = findBestMatchingYouTubeVideo(youtubeResponse["items"], 
-                                                                    artist, title, spotifyMatch);
+                                                                    artist, title, spotifyMatch.get());
                         
                         if (!bestVideo.is_null()) {
                             json youtubeInfo;
@@ -579,18 +869,18 @@ private:
                             }
                             
                             result["youtube"] = youtubeInfo;
-                            std::cout << "Found matching YouTube video: " << youtubeInfo["title"] << std::endl;
+                            AF_LOG(Debug) << "Found matching YouTube video: " << youtubeInfo["title"];
                             return result;
                         }
                     }
                 } catch (const std::exception& e) {
-                    std::cerr << "YouTube API parsing error: " << e.what() << std::endl;
+                    AF_LOG(Warn) << "YouTube API parsing error: " << e.what();
                 }
             } else if (response.responseCode == 403) {
-                std::cerr << "YouTube API quota exceeded" << std::endl;
+                AF_LOG(Warn) << "YouTube API quota exceeded";
                 break;
             } else {
-                std::cerr << "YouTube API request failed. HTTP " << response.responseCode << std::endl;
+                AF_LOG(Warn) << "YouTube API request failed. HTTP " << response.responseCode;
             }
         }
         
@@ -640,6 +930,156 @@ private:
         return bestVideo;
     }
     
+    // Runs one song's lookups: the Spotify track search and the YouTube search
+    // are issued together, and the album listing follows the Spotify match
+    json fetchEnrichment(const AudioFingerprinting::SongInfo& songInfo) {
+        json enrichment = json::object();
+        
+        try {
+            auto spotifyPromise = std::make_shared<std::promise<MatchedSong>>();
+            std::shared_future<MatchedSong> spotifyMatch = spotifyPromise->get_future().share();
+            
+            std::future<json> spotifyRequest = startEnrichmentRequest<json>([this, songInfo, spotifyPromise] {
+                MatchedSong match;
+                try {
+                    match = findBestSpotifyTrack(songInfo.artist, songInfo.title);
+                } catch (const std::exception& e) {
+                    AF_LOG(Warn) << "Spotify track search failed: " << e.what();
+                }
+                spotifyPromise->set_value(match);
+                
+                return match.isMatch ? getSpotifyAlbumTracksEnhanced(match, songInfo.title) : json(nullptr);
+            });
+            
+            json youtubeResult = searchYouTubeVideoEnhanced(songInfo.artist, songInfo.title, spotifyMatch);
+            if (youtubeResult.contains("youtube")) {
+                enrichment["youtube"] = youtubeResult["youtube"];
+            }
+            
+            json spotifyAlbum = spotifyRequest.get();
+            if (!spotifyAlbum.is_null()) {
+                enrichment["spotify"] = spotifyAlbum;
+            }
+        } catch (const std::exception& e) {
+            AF_LOG(Warn) << "Enrichment failed for " << songInfo.songId << ": " << e.what();
+        }
+        
+        return enrichment;
+    }
+    
+    static bool isEnrichmentReady(const EnrichmentEntry& entry) {
+        return entry.enrichment.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+    
+    // Lookups that found nothing may have failed transiently, so they expire sooner
+    static bool isEnrichmentExpired(const EnrichmentEntry& entry, const EnrichmentOptions& options,
+                                    std::chrono::steady_clock::time_point now) {
+        if (!isEnrichmentReady(entry)) {
+            return false;
+        }
+        int ttl = options.cacheTtlSeconds;
+        if (entry.enrichment.get().empty()) {
+            ttl = std::min(ttl, ENRICHMENT_MISS_TTL_SECONDS);
+        }
+        return now - entry.created >= std::chrono::seconds(ttl);
+    }
+    
+    // Makes room for one more song; callers hold enrichmentMutex. In-flight
+    // lookups are never evicted, so later requests for the song still share them.
+    void evictEnrichment(const EnrichmentOptions& options, std::chrono::steady_clock::time_point now) {
+        for (auto it = enrichmentCache.begin(); it != enrichmentCache.end();) {
+            if (isEnrichmentExpired(it->second, options, now)) {
+                it = enrichmentCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        
+        while (enrichmentCache.size() >= ENRICHMENT_CACHE_MAX_SONGS) {
+            auto oldest = enrichmentCache.end();
+            for (auto it = enrichmentCache.begin(); it != enrichmentCache.end(); ++it) {
+                if (isEnrichmentReady(it->second) &&
+                    (oldest == enrichmentCache.end() || it->second.created < oldest->second.created)) {
+                    oldest = it;
+                }
+            }
+            if (oldest == enrichmentCache.end()) {
+                break;
+            }
+            enrichmentCache.erase(oldest);
+        }
+    }
+    
+    // Cached or in-flight enrichment for the song, starting a lookup when there
+    // is none. While the enrichment queue is full no lookup is started: the
+    // song keeps its expired links if it has any, else gets none this time.
+    std::shared_future<json> enrichmentFor(const AudioFingerprinting::SongInfo& songInfo,
+                                           const EnrichmentOptions& options) {
+        std::lock_guard<std::mutex> lock(enrichmentMutex);
+        auto now = std::chrono::steady_clock::now();
+        
+        auto it = enrichmentCache.find(songInfo.songId);
+        if (it != enrichmentCache.end() && !isEnrichmentExpired(it->second, options, now)) {
+            return it->second.enrichment;
+        }
+        if (it == enrichmentCache.end()) {
+            evictEnrichment(options, now);
+        }
+        
+        auto lookup = std::make_shared<std::packaged_task<json()>>([this, songInfo] {
+            return fetchEnrichment(songInfo);
+        });
+        EnrichmentEntry entry;
+        entry.enrichment = lookup->get_future().share();
+        entry.created = now;
+        
+        if (!enrichmentPool->trySubmit([lookup]() { (*lookup)(); }, ENRICHMENT_QUEUE_DEPTH)) {
+            AF_LOG(Debug) << "Enrichment queue full, skipping lookup for " << songInfo.songId;
+            if (it != enrichmentCache.end()) {
+                return it->second.enrichment;
+            }
+            std::promise<json> none;
+            none.set_value(json::object());
+            return none.get_future().share();
+        }
+        
+        enrichmentCache[songInfo.songId] = entry;
+        return entry.enrichment;
+    }
+    
+    EnrichmentOptions currentEnrichmentOptions() {
+        std::lock_guard<std::mutex> lock(enrichmentMutex);
+        return enrichmentOptions;
+    }
+    
+    json enrichmentOptionsToJson(const EnrichmentOptions& options) {
+        json result;
+        result["lazy"] = options.lazy;
+        result["cacheTtlSeconds"] = options.cacheTtlSeconds;
+        return result;
+    }
+    
+    // Drops finished lookups, e.g. after the API credentials change
+    void clearEnrichmentCache() {
+        std::lock_guard<std::mutex> lock(enrichmentMutex);
+        for (auto it = enrichmentCache.begin(); it != enrichmentCache.end();) {
+            if (isEnrichmentReady(it->second)) {
+                it = enrichmentCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    static void addEnrichment(json& response, const json& enrichment) {
+        if (enrichment.contains("youtube")) {
+            response["youtube"] = enrichment["youtube"];
+        }
+        if (enrichment.contains("spotify")) {
+            response["spotify"] = enrichment["spotify"];
+        }
+    }
+    
     // Enhanced song info to JSON conversion with new workflow
     json songInfoToJsonEnhanced(const AudioFingerprinting::SongInfo& songInfo) {
         json response;
@@ -652,21 +1092,18 @@ private:
             response["title"] = songInfo.title;
             response["songId"] = songInfo.songId;
             
-            // Step 1: Find the best matching Spotify track
-            MatchedSong spotifyMatch = findBestSpotifyTrack(songInfo.artist, songInfo.title);
-            
-            // Step 2: Get YouTube video that matches the same song
-            json youtubeResult = searchYouTubeVideoEnhanced(songInfo.artist, songInfo.title, spotifyMatch);
-            if (youtubeResult.contains("youtube")) {
-                response["youtube"] = youtubeResult["youtube"];
-            }
+            // Spotify and YouTube links come from the cache, or from a lookup
+            // this request starts or joins
+            EnrichmentOptions options = currentEnrichmentOptions();
+            std::shared_future<json> enrichment = enrichmentFor(songInfo, options);
             
-            // Step 3: Get full album using the matched Spotify track's album
-            if (spotifyMatch.isMatch) {
-                json spotifyAlbum = getSpotifyAlbumTracksEnhanced(spotifyMatch, songInfo.title);
-                if (!spotifyAlbum.is_null()) {
-                    response["spotify"] = spotifyAlbum;
-                }
+            if (options.lazy && enrichment.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                response["enrichment"] = {
+                    {"status", "pending"},
+                    {"url", "/enrichment/" + songInfo.songId}
+                };
+            } else {
+                addEnrichment(response, enrichment.get());
             }
             
         } else {
@@ -684,23 +1121,89 @@ public:
         recognizer = std::make_unique<AudioFingerprinting::SongRecognizer>(dbPath);
         curl_global_init(CURL_GLOBAL_DEFAULT);
         
+        // Connections themselves are not shared: libcurl does not support using
+        // one connection cache from concurrent threads. Each pooled easy handle
+        // keeps its own, and new connections resume the shared TLS sessions.
+        curlShare = curl_share_init();
+        if (curlShare) {
+            curl_share_setopt(curlShare, CURLSHOPT_LOCKFUNC, lockCurlShare);
+            curl_share_setopt(curlShare, CURLSHOPT_UNLOCKFUNC, unlockCurlShare);
+            curl_share_setopt(curlShare, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        }
+        
         // Store env path for later use
         this->envPath = envPath;
     }
     
+    void setIndexPath(const std::string& path) {
+        recognizer->setIndexPath(path);
+    }
+    
+    void setStopHashLimit(uint64_t postings) {
+        recognizer->setStopHashLimit(postings);
+    }
+    
+    void setDenseQueries(bool enabled) {
+        recognizer->setDenseQueries(enabled);
+    }
+    
+    // Takes effect in initialize()
+    void setRecognitionExecutor(size_t workers, size_t queueDepth, size_t liveStreamCap) {
+        recognitionWorkers = std::max<size_t>(workers, 1);
+        recognitionQueueDepth = queueDepth;
+        liveStreamLimit = liveStreamCap;
+    }
+    
+    // Connection threads needed so that every running and queued recognition
+    // and every live stream holds one and the rest of the API still answers
+    size_t connectionThreads() const {
+        return recognitionWorkers + recognitionQueueDepth + liveStreamLimit + SPARE_CONNECTION_THREADS;
+    }
+    
+    // Serve recognitions as a coordinator over these shard nodes; this
+    // server's own database is then the catalog holding song info only
+    void setShardNodes(const std::vector<std::string>& nodes) {
+        shardNodes = nodes;
+        idleShardClients.clear();
+        idleShardClients.resize(nodes.size());
+        recognizer->setShardLookup(static_cast<uint32_t>(nodes.size()),
+            [this](uint32_t shard, const std::vector<AudioFingerprinting::HashResult>& hashes,
+                   std::vector<AudioFingerprinting::ScoreBin>& bins) {
+                return lookupShard(shard, hashes, bins);
+            });
+    }
+    
     ~AudioFingerprintingServer() {
-        fftw_cleanup_threads();
+        if (indexRefresher.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(refresherMutex);
+                stopping = true;
+            }
+            refresherWake.notify_all();
+            indexRefresher.join();
+        }
+        
+        // Stopping the pool finishes lookups still queued or in flight
+        enrichmentPool.reset();
+        
+        for (CURL* curl : idleCurlHandles) {
+            curl_easy_cleanup(curl);
+        }
+        if (curlShare) {
+            curl_share_cleanup(curlShare);
+        }
         curl_global_cleanup();
     }
     
     bool initialize() {
-        // Initialize FFTW threads
-        fftw_init_threads();
-        fftw_plan_with_nthreads(std::thread::hardware_concurrency());
-        
-        // Initialize database
+        // Initialize database (also prepares the shared FFT plans)
         if (!recognizer->initializeDatabase()) {
-            std::cerr << "Failed to initialize database" << std::endl;
+            AF_LOG(Error) << "Failed to initialize database";
+            return false;
+        }
+        if (!checkShardProfiles()) {
             return false;
         }
         
@@ -711,7 +1214,7 @@ public:
             // Use specified env path
             envVars = parseEnvFile(envPath);
             if (!envVars.empty()) {
-                std::cout << "Loaded .env from: " << envPath << std::endl;
+                AF_LOG(Info) << "Loaded .env from: " << envPath;
             }
         } else {
             // Try multiple locations for .env file
@@ -725,7 +1228,7 @@ public:
             for (const auto& path : envPaths) {
                 envVars = parseEnvFile(path);
                 if (!envVars.empty()) {
-                    std::cout << "Loaded .env from: " << path << std::endl;
+                    AF_LOG(Info) << "Loaded .env from: " << path;
                     break;
                 }
             }
@@ -746,6 +1249,11 @@ public:
         std::cout << "YouTube API: " << (apiCreds.hasYouTube() ? "Enabled" : "Disabled") << std::endl;
         std::cout << "Spotify API: " << (apiCreds.hasSpotify() ? "Enabled" : "Disabled") << std::endl;
         
+        recognitionPool = std::make_unique<AudioFingerprinting::ThreadPool>(recognitionWorkers);
+        enrichmentPool = std::make_unique<AudioFingerprinting::ThreadPool>(ENRICHMENT_WORKERS);
+        std::cout << "Recognition workers: " << recognitionWorkers << " (queue depth " << recognitionQueueDepth << ")" << std::endl;
+        
+        indexRefresher = std::thread(&AudioFingerprintingServer::refreshIndexLoop, this);
         return true;
     }
     
@@ -763,23 +1271,88 @@ public:
             
             json config = json::parse(req.body);
             
-            if (config.contains("youtubeApiKey")) {
-                apiCreds.youtubeApiKey = config["youtubeApiKey"];
+            if (config.contains("youtubeApiKey") || config.contains("spotifyClientId") ||
+                config.contains("spotifyClientSecret")) {
+                {
+                    std::lock_guard<std::mutex> lock(credentialsMutex);
+                    if (config.contains("youtubeApiKey")) {
+                        apiCreds.youtubeApiKey = config["youtubeApiKey"];
+                    }
+                    if (config.contains("spotifyClientId")) {
+                        apiCreds.spotifyClientId = config["spotifyClientId"];
+                    }
+                    if (config.contains("spotifyClientSecret")) {
+                        apiCreds.spotifyClientSecret = config["spotifyClientSecret"];
+                        // Clear existing token to force refresh
+                        apiCreds.spotifyAccessToken.clear();
+                    }
+                }
+                // Links found with the old credentials are looked up again
+                clearEnrichmentCache();
             }
-            if (config.contains("spotifyClientId")) {
-                apiCreds.spotifyClientId = config["spotifyClientId"];
+            
+            AudioFingerprinting::RecognitionOptions options = currentRecognitionOptions();
+            if (config.contains("recognition")) {
+                const json& recognition = config["recognition"];
+                
+                if (recognition.contains("progressive")) {
+                    options.progressive = recognition["progressive"].get<bool>();
+                }
+                if (recognition.contains("batchSeconds")) {
+                    options.batchSeconds = recognition["batchSeconds"].get<double>();
+                }
+                if (recognition.contains("minScore")) {
+                    options.minScore = recognition["minScore"].get<int>();
+                }
+                if (recognition.contains("scoreMargin")) {
+                    options.scoreMargin = recognition["scoreMargin"].get<int>();
+                }
+                
+                if (options.batchSeconds <= 0.0 || options.minScore < 1 || options.scoreMargin < 0) {
+                    json error;
+                    error["success"] = false;
+                    error["error"] = "Invalid recognition settings: batchSeconds must be > 0, minScore >= 1, scoreMargin >= 0";
+                    res.set_content(error.dump(2) + "\n", "application/json");
+                    res.status = 400;
+                    return;
+                }
+                
+                std::lock_guard<std::mutex> lock(optionsMutex);
+                recognitionOptions = options;
             }
-            if (config.contains("spotifyClientSecret")) {
-                apiCreds.spotifyClientSecret = config["spotifyClientSecret"];
-                // Clear existing token to force refresh
-                apiCreds.spotifyAccessToken.clear();
+            
+            EnrichmentOptions enrichment = currentEnrichmentOptions();
+            if (config.contains("enrichment")) {
+                const json& settings = config["enrichment"];
+                
+                if (settings.contains("lazy")) {
+                    enrichment.lazy = settings["lazy"].get<bool>();
+                }
+                if (settings.contains("cacheTtlSeconds")) {
+                    enrichment.cacheTtlSeconds = settings["cacheTtlSeconds"].get<int>();
+                }
+                
+                if (enrichment.cacheTtlSeconds < 0) {
+                    json error;
+                    error["success"] = false;
+                    error["error"] = "Invalid enrichment settings: cacheTtlSeconds must be >= 0";
+                    res.set_content(error.dump(2) + "\n", "application/json");
+                    res.status = 400;
+                    return;
+                }
+                
+                std::lock_guard<std::mutex> lock(enrichmentMutex);
+                enrichmentOptions = enrichment;
             }
             
+            APICredentials creds = currentCredentials();
             json response;
             response["success"] = true;
             response["message"] = "Configuration updated";
-            response["youtubeEnabled"] = apiCreds.hasYouTube();
-            response["spotifyEnabled"] = apiCreds.hasSpotify();
+            response["youtubeEnabled"] = creds.hasYouTube();
+            response["spotifyEnabled"] = creds.hasSpotify();
+            response["recognition"] = recognitionOptionsToJson(options);
+            response["enrichment"] = enrichmentOptionsToJson(enrichment);
             
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_content(response.dump(2) + "\n", "application/json");
@@ -822,19 +1395,26 @@ public:
                 return;
             }
             
-            std::string tempFilePath = saveUploadedFile(file.content, filename);
-            
-            auto startTime = std::chrono::high_resolution_clock::now();
-            AudioFingerprinting::SongInfo result = recognizer->recognizeSong(tempFilePath);
-            auto endTime = std::chrono::high_resolution_clock::now();
-            
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            // Decode straight from the request; the extension is the format hint
+            AudioFingerprinting::RecognitionResult result;
+            double queueWaitMs = 0.0;
+            int64_t recognitionMs = 0;
+            bool admitted = runRecognitionTask([&]() {
+                result = recognizer->recognizeBuffer(
+                    file.content.data(), file.content.size(),
+                    AudioFingerprinting::audioFormatFromFilename(filename), currentRecognitionOptions());
+            }, queueWaitMs, recognitionMs);
             
-            cleanupTempFile(tempFilePath);
+            if (!admitted) {
+                rejectOverloaded(res);
+                return;
+            }
             
-            // Build enhanced response with improved workflow
-            json response = songInfoToJsonEnhanced(result);
-            response["recognitionTimeMs"] = duration.count();
+            // Build enhanced response with improved workflow (enrichment runs here, off the workers)
+            json response = songInfoToJsonEnhanced(result.song);
+            addRecognitionDetails(response, result);
+            response["recognitionTimeMs"] = recognitionMs;
+            response["queueWaitMs"] = queueWaitMs;
             
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_content(response.dump(2) + "\n", "application/json");
@@ -861,20 +1441,25 @@ public:
                 return;
             }
             
-            std::string filename = "stream.wav";
+            // Content-Type is the format hint; otherwise the format is sniffed from the data
+            AudioFingerprinting::AudioFormat format = AudioFingerprinting::AudioFormat::UNKNOWN;
             auto contentType = req.get_header_value("Content-Type");
             if (!contentType.empty()) {
                 if (contentType.find("audio/mpeg") != std::string::npos || 
                     contentType.find("audio/mp3") != std::string::npos) {
-                    filename = "stream.mp3";
+                    format = AudioFingerprinting::AudioFormat::MP3;
                 } else if (contentType.find("audio/flac") != std::string::npos) {
-                    filename = "stream.flac";
+                    format = AudioFingerprinting::AudioFormat::FLAC;
                 } else if (contentType.find("audio/wav") != std::string::npos) {
-                    filename = "stream.wav";
+                    format = AudioFingerprinting::AudioFormat::WAV;
                 }
             }
             
-            if (!AudioFingerprinting::SongRecognizer::isSupportedExtension(filename)) {
+            if (format == AudioFingerprinting::AudioFormat::UNKNOWN) {
+                format = AudioFingerprinting::audioFormatFromContent(req.body.data(), req.body.size());
+            }
+            
+            if (format == AudioFingerprinting::AudioFormat::UNKNOWN) {
                 json error;
                 error["success"] = false;
                 error["error"] = "Unsupported audio format. Supported formats: mp3, wav, flac";
@@ -884,18 +1469,277 @@ public:
                 return;
             }
             
-            std::string tempFilePath = saveUploadedFile(req.body, filename);
+            AudioFingerprinting::RecognitionResult result;
+            double queueWaitMs = 0.0;
+            int64_t recognitionMs = 0;
+            bool admitted = runRecognitionTask([&]() {
+                result = recognizer->recognizeBuffer(
+                    req.body.data(), req.body.size(), format, currentRecognitionOptions());
+            }, queueWaitMs, recognitionMs);
+            
+            if (!admitted) {
+                rejectOverloaded(res);
+                return;
+            }
+            
+            json response = songInfoToJsonEnhanced(result.song);
+            addRecognitionDetails(response, result);
+            response["recognitionTimeMs"] = recognitionMs;
+            response["queueWaitMs"] = queueWaitMs;
+            
+            res.set_header("Access-Control-Allow-Origin", "*");
+            res.set_content(response.dump(2) + "\n", "application/json");
+            
+        } catch (const std::exception& e) {
+            json error;
+            error["success"] = false;
+            error["error"] = std::string("Recognition failed: ") + e.what();
+            
+            res.set_content(error.dump(2) + "\n", "application/json");
+            res.status = 500;
+        }
+    }
+    
+    // Many clips in one multipart request: every file part is one clip, and
+    // the clips share a single database lookup. Results keep upload order.
+    void handleBatchRecognition(const httplib::Request& req, httplib::Response& res) {
+        try {
+            std::vector<const httplib::MultipartFormData*> uploads;
+            for (const auto& part : req.files) {
+                if (!part.second.filename.empty()) {
+                    uploads.push_back(&part.second);
+                }
+            }
+            
+            if (uploads.empty()) {
+                json error;
+                error["success"] = false;
+                error["error"] = "No audio files found in request. Send each clip as a multipart file part.";
+                
+                res.set_content(error.dump(2) + "\n", "application/json");
+                res.status = 400;
+                return;
+            }
+            
+            // Unsupported files are reported in place and left out of the batch
+            std::vector<AudioFingerprinting::AudioClip> clips;
+            std::vector<size_t> clipUploads;
+            for (size_t i = 0; i < uploads.size(); ++i) {
+                if (!AudioFingerprinting::SongRecognizer::isSupportedExtension(uploads[i]->filename)) {
+                    continue;
+                }
+                AudioFingerprinting::AudioClip clip;
+                clip.data = uploads[i]->content.data();
+                clip.size = uploads[i]->content.size();
+                clip.format = AudioFingerprinting::audioFormatFromFilename(uploads[i]->filename);
+                clips.push_back(clip);
+                clipUploads.push_back(i);
+            }
+            
+            // One task per batch. Its clips are fingerprinted by this worker's
+            // share of the cores, so a batch doesn't crowd out the other workers.
+            int clipWorkers = static_cast<int>(std::max<size_t>(1, std::thread::hardware_concurrency() / recognitionWorkers));
+            std::vector<AudioFingerprinting::RecognitionResult> results;
+            double queueWaitMs = 0.0;
+            int64_t recognitionMs = 0;
+            bool admitted = runRecognitionTask([&]() {
+                results = recognizer->recognizeBuffers(clips, currentRecognitionOptions(), clipWorkers);
+            }, queueWaitMs, recognitionMs);
+            
+            if (!admitted) {
+                rejectOverloaded(res);
+                return;
+            }
+            
+            std::vector<json> entries(uploads.size());
+            for (size_t i = 0; i < uploads.size(); ++i) {
+                entries[i]["success"] = false;
+                entries[i]["error"] = "Unsupported file format. Supported formats: mp3, wav, flac";
+            }
+            
+            int matched = 0;
+            for (size_t c = 0; c < clips.size(); ++c) {
+                json entry = songInfoToJsonEnhanced(results[c].song);
+                addRecognitionDetails(entry, results[c]);
+                if (!results[c].song.songId.empty()) {
+                    matched++;
+                }
+                entries[clipUploads[c]] = entry;
+            }
+            
+            json response;
+            response["success"] = true;
+            response["results"] = json::array();
+            for (size_t i = 0; i < uploads.size(); ++i) {
+                entries[i]["filename"] = uploads[i]->filename;
+                response["results"].push_back(entries[i]);
+            }
+            response["clips"] = uploads.size();
+            response["matched"] = matched;
+            response["recognitionTimeMs"] = recognitionMs;
+            response["queueWaitMs"] = queueWaitMs;
+            
+            res.set_header("Access-Control-Allow-Origin", "*");
+            res.set_content(response.dump(2) + "\n", "application/json");
+            
+        } catch (const std::exception& e) {
+            json error;
+            error["success"] = false;
+            error["error"] = std::string("Batch recognition failed: ") + e.what();
+            
+            res.set_content(error.dump(2) + "\n", "application/json");
+            res.status = 500;
+        }
+    }
+    
+    // A non-negative integer query parameter; value is left alone when the
+    // parameter is absent, false when it is not a plain number
+    static bool parseUnsigned(const httplib::Request& req, const char* name, unsigned int& value) {
+        if (!req.has_param(name)) {
+            return true;
+        }
+        
+        std::string text = req.get_param_value(name);
+        if (text.empty() || text.size() > 9 ||
+            !std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            return false;
+        }
+        value = static_cast<unsigned int>(std::stoul(text));
+        return true;
+    }
+    
+    // Live recognition over a chunked request body. Each chunk is decoded and
+    // fingerprinted as it arrives, and the response goes out as soon as one
+    // song clearly leads; the rest of the body is not read.
+    void handleLiveRecognition(const httplib::Request& req, httplib::Response& res,
+                               const httplib::ContentReader& content_reader) {
+        try {
+            if (req.is_multipart_form_data()) {
+                json error;
+                error["success"] = false;
+                error["error"] = "Live recognition takes raw audio, not multipart uploads";
+                
+                res.set_content(error.dump(2) + "\n", "application/json");
+                res.status = 400;
+                return;
+            }
+            
+            // ?format= (s16le, f32le, wav, mp3) or Content-Type; raw PCM also takes ?rate= and ?channels=
+            AudioFingerprinting::AudioFormat format = AudioFingerprinting::AudioFormat::UNKNOWN;
+            AudioFingerprinting::PcmFormat pcm;
+            std::string formatName = req.get_param_value("format");
+            auto contentType = req.get_header_value("Content-Type");
+            bool knownFormat = true;
+            if (formatName == "f32le") {
+                pcm.encoding = AudioFingerprinting::PcmEncoding::F32LE;
+            } else if (formatName == "wav") {
+                format = AudioFingerprinting::AudioFormat::WAV;
+            } else if (formatName == "mp3") {
+                format = AudioFingerprinting::AudioFormat::MP3;
+            } else if (formatName.empty()) {
+                if (contentType.find("audio/mpeg") != std::string::npos || 
+                    contentType.find("audio/mp3") != std::string::npos) {
+                    format = AudioFingerprinting::AudioFormat::MP3;
+                } else if (contentType.find("audio/wav") != std::string::npos) {
+                    format = AudioFingerprinting::AudioFormat::WAV;
+                } else if (contentType.find("audio/flac") != std::string::npos) {
+                    knownFormat = false;
+                }
+            } else if (formatName != "s16le") {
+                knownFormat = false;
+            }
+            
+            if (!knownFormat) {
+                json error;
+                error["success"] = false;
+                error["error"] = "Unsupported live audio format. Supported formats: s16le, f32le, wav, mp3";
+                
+                res.set_content(error.dump(2) + "\n", "application/json");
+                res.status = 400;
+                return;
+            }
+            
+            // Raw PCM takes its geometry from the query, which is untrusted:
+            // it sizes the resampler's filter bank
+            bool validGeometry = parseUnsigned(req, "rate", pcm.sampleRate) &&
+                                 parseUnsigned(req, "channels", pcm.channels);
+            if (!validGeometry || (format == AudioFingerprinting::AudioFormat::UNKNOWN &&
+                                   !AudioFingerprinting::Resampler::supportsSource(pcm.sampleRate, pcm.channels))) {
+                json error;
+                error["success"] = false;
+                error["error"] = "Unsupported rate or channels (" +
+                                 std::to_string(AudioFingerprinting::MIN_SOURCE_SAMPLE_RATE) + "-" +
+                                 std::to_string(AudioFingerprinting::MAX_SOURCE_SAMPLE_RATE) + " Hz, 1-" +
+                                 std::to_string(AudioFingerprinting::MAX_SOURCE_CHANNELS) + " channels)";
+                
+                res.set_content(error.dump(2) + "\n", "application/json");
+                res.status = 400;
+                return;
+            }
+            
+            if (!admitLiveStream()) {
+                rejectOverloaded(res);
+                return;
+            }
+            LiveStreamSlot slot{liveStreams};
             
             auto startTime = std::chrono::high_resolution_clock::now();
-            AudioFingerprinting::SongInfo result = recognizer->recognizeSong(tempFilePath);
+            AudioFingerprinting::PushDecoder decoder(format, pcm);
+            AudioFingerprinting::StreamingRecognizer live(*recognizer, currentRecognitionOptions());
+            std::vector<double> samples;
+            bool decodeFailed = false;
+            bool decided = false;
+            bool admitted = true;
+            double queueWaitMs = 0.0;
+            int64_t chunkMs = 0;
+            
+            // A chunk that finds the recognition queue full ends the stream with a 429
+            content_reader([&](const char* data, size_t length) {
+                admitted = runRecognitionTask([&]() {
+                    samples.clear();
+                    if (!decoder.push(data, length, samples)) {
+                        decodeFailed = true;
+                        return;
+                    }
+                    decided = live.push(samples.data(), samples.size());
+                }, queueWaitMs, chunkMs);
+                return admitted && !decodeFailed && !decided;
+            });
+            
+            if (decodeFailed) {
+                json error;
+                error["success"] = false;
+                error["error"] = "Could not decode audio: " + decoder.error();
+                
+                res.set_content(error.dump(2) + "\n", "application/json");
+                res.status = 400;
+                return;
+            }
+            
+            AudioFingerprinting::RecognitionResult result;
+            if (admitted) {
+                admitted = runRecognitionTask([&]() {
+                    if (!decided) {
+                        samples.clear();
+                        decoder.finish(samples);
+                        live.push(samples.data(), samples.size());
+                    }
+                    result = live.finish();
+                }, queueWaitMs, chunkMs);
+            }
+            
+            if (!admitted) {
+                rejectOverloaded(res);
+                return;
+            }
             auto endTime = std::chrono::high_resolution_clock::now();
             
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
             
-            cleanupTempFile(tempFilePath);
-            
-            json response = songInfoToJsonEnhanced(result);
-            response["recognitionTimeMs"] = duration.count();
+            json response = songInfoToJsonEnhanced(result.song);
+            addRecognitionDetails(response, result);
+            response["timeToMatchMs"] = duration.count();
+            response["audioSecondsReceived"] = live.secondsReceived();
             
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_content(response.dump(2) + "\n", "application/json");
@@ -910,16 +1754,61 @@ public:
         }
     }
     
+    // Links for a song recognized in lazy enrichment mode
+    void handleEnrichment(const httplib::Request& req, httplib::Response& res) {
+        std::string songId = req.matches[1];
+        
+        std::shared_future<json> enrichment;
+        {
+            std::lock_guard<std::mutex> lock(enrichmentMutex);
+            auto it = enrichmentCache.find(songId);
+            if (it != enrichmentCache.end()) {
+                enrichment = it->second.enrichment;
+            }
+        }
+        
+        json response;
+        response["songId"] = songId;
+        
+        if (!enrichment.valid()) {
+            response["success"] = false;
+            response["error"] = "No enrichment pending or cached for this song";
+            res.status = 404;
+        } else if (enrichment.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            response["success"] = true;
+            response["status"] = "pending";
+            res.status = 202;
+        } else {
+            response["success"] = true;
+            response["status"] = "ready";
+            addEnrichment(response, enrichment.get());
+        }
+        
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_content(response.dump(2) + "\n", "application/json");
+    }
+    
     void handleStats(const httplib::Request&, httplib::Response& res) {
         try {
+            APICredentials creds = currentCredentials();
+            AudioFingerprinting::CatalogStats catalog = recognizer->getCatalogStats();
             json stats;
-            stats["totalSongs"] = 0; // recognizer->getTotalSongs();
-            stats["totalHashes"] = 0; // recognizer->getTotalHashes();
+            stats["totalSongs"] = catalog.totalSongs;
+            // A coordinator's database only holds song info; the hashes live on the shards
+            if (shardNodes.empty()) {
+                stats["totalHashes"] = catalog.totalHashes;
+            } else {
+                stats["shardNodes"] = shardNodes.size();
+            }
             stats["database"] = dbPath;
             stats["apiStatus"] = {
-                {"youtube", apiCreds.hasYouTube()},
-                {"spotify", apiCreds.hasSpotify()}
+                {"youtube", creds.hasYouTube()},
+                {"spotify", creds.hasSpotify()}
             };
+            {
+                std::lock_guard<std::mutex> lock(enrichmentMutex);
+                stats["enrichmentCacheSongs"] = enrichmentCache.size();
+            }
             
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_content(stats.dump(2) + "\n", "application/json");
@@ -933,12 +1822,81 @@ public:
             res.status = 500;
         }
     }
+    
+    // Shard node side of a coordinator lookup: the offset histogram of this
+    // database's rows for the posted [hash, offsetFrame] pairs
+    void handleShardMatch(const httplib::Request& req, httplib::Response& res) {
+        try {
+            json request = json::parse(req.body);
+            std::vector<AudioFingerprinting::HashResult> hashes;
+            hashes.reserve(request["hashes"].size());
+            for (const auto& hash : request["hashes"]) {
+                hashes.emplace_back(hash[0].get<long>(), hash[1].get<uint32_t>());
+            }
+            
+            // Lookups are recognition work on a shard node and share its queue;
+            // the coordinator counts a 429 as a failed shard
+            std::vector<AudioFingerprinting::ScoreBin> bins;
+            double queueWaitMs = 0.0;
+            int64_t lookupMs = 0;
+            bool admitted = runRecognitionTask([&]() {
+                bins = recognizer->scoreBins(hashes);
+            }, queueWaitMs, lookupMs);
+            
+            if (!admitted) {
+                rejectOverloaded(res);
+                return;
+            }
+            
+            json response;
+            response["fingerprintProfile"] = fingerprintProfileTag();
+            response["bins"] = json::array();
+            for (const auto& bin : bins) {
+                response["bins"].push_back({bin.songIdx, bin.bin, bin.count});
+            }
+            res.set_content(response.dump(), "application/json");
+            
+        } catch (const std::exception& e) {
+            json error;
+            error["success"] = false;
+            error["error"] = std::string("Shard lookup failed: ") + e.what();
+            
+            res.set_content(error.dump(2) + "\n", "application/json");
+            res.status = 400;
+        }
+    }
+    
+    // Tag of the catalog profile the database's hashes were made with
+    std::string fingerprintProfileTag() const {
+        return AudioFingerprinting::profileTag(recognizer->getCatalogProfile());
+    }
+    
+    void handleMetrics(const httplib::Request&, httplib::Response& res) {
+        AudioFingerprinting::CatalogStats catalog = recognizer->getCatalogStats();
+        
+        std::string body = AudioFingerprinting::Metrics::prometheusText();
+        body += "# TYPE audentify_catalog_songs gauge\n";
+        body += "audentify_catalog_songs " + std::to_string(catalog.totalSongs) + "\n";
+        if (shardNodes.empty()) {
+            body += "# TYPE audentify_catalog_hashes gauge\n";
+            body += "audentify_catalog_hashes " + std::to_string(catalog.totalHashes) + "\n";
+        }
+        
+        res.set_content(body, "text/plain; version=0.0.4");
+    }
 };
 
 int main(int argc, char* argv[]) {
     std::string dbPath = "fingerprints.db";
     int port = 8080;
     std::string envPath = "";
+    std::string indexPath = "";
+    std::vector<std::string> shardNodes;
+    uint64_t stopHashPostings = AudioFingerprinting::INDEX_STOP_HASH_POSTINGS;
+    bool denseQueries = false;
+    size_t recognitionWorkers = std::max(1u, std::thread::hardware_concurrency());
+    size_t recognitionQueueDepth = RECOGNITION_QUEUE_DEPTH;
+    size_t liveStreamLimit = LIVE_STREAM_LIMIT;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -949,12 +1907,52 @@ int main(int argc, char* argv[]) {
             port = std::stoi(argv[++i]);
         } else if (arg == "--env" && i + 1 < argc) {
             envPath = argv[++i];
+        } else if (arg == "--index" && i + 1 < argc) {
+            indexPath = argv[++i];
+        } else if (arg == "--stop-hash-postings" && i + 1 < argc) {
+            stopHashPostings = std::stoull(argv[++i]);
+        } else if (arg == "--dense-queries") {
+            denseQueries = true;
+        } else if (arg == "--recognition-workers" && i + 1 < argc) {
+            recognitionWorkers = std::stoul(argv[++i]);
+        } else if (arg == "--recognition-queue" && i + 1 < argc) {
+            recognitionQueueDepth = std::stoul(argv[++i]);
+        } else if (arg == "--live-streams" && i + 1 < argc) {
+            liveStreamLimit = std::stoul(argv[++i]);
+        } else if (arg == "--shard-nodes" && i + 1 < argc) {
+            std::stringstream nodes(argv[++i]);
+            std::string node;
+            while (std::getline(nodes, node, ',')) {
+                if (!node.empty()) {
+                    shardNodes.push_back(node);
+                }
+            }
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            AudioFingerprinting::LogLevel level;
+            if (!AudioFingerprinting::parseLogLevel(argv[++i], level)) {
+                std::cerr << "Unknown log level: " << argv[i] << std::endl;
+                return 1;
+            }
+            AudioFingerprinting::setLogLevel(level);
         } else if (arg == "--help") {
             std::cout << "Usage: " << argv[0] << " [options]\n";
             std::cout << "Options:\n";
             std::cout << "  --db <path>     Database path (default: fingerprints.db)\n";
             std::cout << "  --port <port>   Server port (default: 8080)\n";
             std::cout << "  --env <path>    .env file path (default: auto-detect)\n";
+            std::cout << "  --index <path>  Hash index path (default: <db>.idx, used when present)\n";
+            std::cout << "  --log-level <l> error, warn, info or debug (default: AF_LOG_LEVEL or info)\n";
+            std::cout << "  --stop-hash-postings <n> Skip query hashes with more postings than n;\n";
+            std::cout << "                  0 keeps them all (default: " << AudioFingerprinting::INDEX_STOP_HASH_POSTINGS << ")\n";
+            std::cout << "  --dense-queries Fingerprint query clips with the denser query profile\n";
+            std::cout << "  --recognition-workers <n> Threads running recognitions (default: one per core)\n";
+            std::cout << "  --recognition-queue <n> Recognitions waiting for a worker before requests\n";
+            std::cout << "                  get 429 Too Many Requests; 0 only admits them while a\n";
+            std::cout << "                  worker is free (default: " << RECOGNITION_QUEUE_DEPTH << ")\n";
+            std::cout << "  --live-streams <n> Live recognition streams open at once before more\n";
+            std::cout << "                  get 429 Too Many Requests (default: " << LIVE_STREAM_LIMIT << ")\n";
+            std::cout << "  --shard-nodes <url,...> Coordinate these shard servers, in shard order;\n";
+            std::cout << "                  --db is then the catalog (song info only)\n";
             std::cout << "  --help          Show this help\n";
             std::cout << "\nEnvironment Variables (from .env file):\n";
             std::cout << "  YOUTUBE_API_KEY      YouTube Data API v3 key\n";
@@ -966,6 +1964,15 @@ int main(int argc, char* argv[]) {
     
     // Initialize server
     AudioFingerprintingServer server(dbPath, "./temp", envPath);
+    if (!indexPath.empty()) {
+        server.setIndexPath(indexPath);
+    }
+    server.setStopHashLimit(stopHashPostings);
+    server.setDenseQueries(denseQueries);
+    server.setRecognitionExecutor(recognitionWorkers, recognitionQueueDepth, liveStreamLimit);
+    if (!shardNodes.empty()) {
+        server.setShardNodes(shardNodes);
+    }
     if (!server.initialize()) {
         return 1;
     }
@@ -974,6 +1981,10 @@ int main(int argc, char* argv[]) {
     httplib::Server svr;
     svr.set_payload_max_length(50 * 1024 * 1024);
     
+    // Connection threads only read requests and wait; the CPU work is bounded by the recognition workers
+    size_t connectionThreads = server.connectionThreads();
+    svr.new_task_queue = [connectionThreads]() { return new httplib::ThreadPool(connectionThreads); };
+    
     // Enable CORS
     svr.set_pre_routing_handler([](const httplib::Request&, httplib::Response& res) {
         res.set_header("Access-Control-Allow-Origin", "*");
@@ -1000,21 +2011,48 @@ int main(int argc, char* argv[]) {
         server.handleStreamRecognition(req, res);
     });
     
+    // Batch recognition endpoint (multipart, one file part per clip)
+    svr.Post("/recognize/batch", [&server](const httplib::Request& req, httplib::Response& res) {
+        server.handleBatchRecognition(req, res);
+    });
+    
+    // Live recognition endpoint (chunked raw audio, answers once confident)
+    svr.Post("/recognize/live", [&server](const httplib::Request& req, httplib::Response& res,
+                                          const httplib::ContentReader& content_reader) {
+        server.handleLiveRecognition(req, res, content_reader);
+    });
+    
+    // Enrichment endpoint (links for lazily enriched matches)
+    svr.Get(R"(/enrichment/([^/]+))", [&server](const httplib::Request& req, httplib::Response& res) {
+        server.handleEnrichment(req, res);
+    });
+    
     // Stats endpoint
     svr.Get("/stats", [&server](const httplib::Request& req, httplib::Response& res) {
         server.handleStats(req, res);
     });
     
+    // Shard lookup endpoint (called by a coordinator)
+    svr.Post("/shard/match", [&server](const httplib::Request& req, httplib::Response& res) {
+        server.handleShardMatch(req, res);
+    });
+    
+    // Prometheus metrics endpoint
+    svr.Get("/metrics", [&server](const httplib::Request& req, httplib::Response& res) {
+        server.handleMetrics(req, res);
+    });
+    
     // Configuration endpoint
     svr.Put("/config", [&server](const httplib::Request& req, httplib::Response& res) {
         server.handleConfig(req, res);
     });
     
     // Health check endpoint
-    svr.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+    svr.Get("/health", [&server](const httplib::Request&, httplib::Response& res) {
         json health;
         health["status"] = "ok";
         health["service"] = "audio-fingerprinting-enhanced";
+        health["fingerprintProfile"] = server.fingerprintProfileTag();
         
         res.set_header("Access-Control-Allow-Origin", "*");
         res.set_content(health.dump(2) + "\n", "application/json");
@@ -1025,12 +2063,21 @@ int main(int argc, char* argv[]) {
     std::cout << "Endpoints:" << std::endl;
     std::cout << "  POST /recognize        - Upload audio file for recognition (multipart)" << std::endl;
     std::cout << "  POST /recognize/stream - Stream audio data for recognition (raw)" << std::endl;
+    std::cout << "  POST /recognize/batch  - Upload many clips for recognition in one lookup (multipart)" << std::endl;
+    std::cout << "  POST /recognize/live   - Stream live audio (chunked), answered once a match is confident" << std::endl;
+    std::cout << "  GET  /enrichment/<id> - Spotify/YouTube links for a lazily enriched match" << std::endl;
     std::cout << "  GET  /stats           - Database statistics" << std::endl;
-    std::cout << "  PUT  /config          - Configure API keys" << std::endl;
+    std::cout << "  POST /shard/match     - Offset histogram for a coordinator's hashes (shard nodes)" << std::endl;
+    std::cout << "  GET  /metrics         - Per-stage latency histograms and counters (Prometheus)" << std::endl;
+    std::cout << "  PUT  /config          - Configure API keys, recognition and enrichment settings" << std::endl;
     std::cout << "  GET  /health          - Health check" << std::endl;
     
+    if (!shardNodes.empty()) {
+        std::cout << "Coordinating " << shardNodes.size() << " shard nodes" << std::endl;
+    }
+    
     if (!svr.listen("0.0.0.0", port)) {
-        std::cerr << "Failed to start server on port " << port << std::endl;
+        AF_LOG(Error) << "Failed to start server on port " << port;
         return 1;
     }
     
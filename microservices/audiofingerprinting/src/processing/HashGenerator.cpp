@@ -2,12 +2,17 @@
 #include "PeakDetection.h"
 #include "../audio/AudioLoader.h"
 #include "../audio/AudioProcessor.h"
+#include "../utils/Log.h"
+#include "../utils/Metrics.h"
+#include <array>
 #include <functional>
 #include <sstream>
-#include <thread>
-#include <future>
 #include <iostream>
 #include <unordered_set>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <stdexcept>
 
 namespace AudioFingerprinting {
 
@@ -26,10 +31,10 @@ std::vector<Peak> getTargetZone(const Peak& anchor, const std::vector<Peak>& all
     std::vector<Peak> targetPeaks;
     targetPeaks.reserve(100); // Pre-allocate reasonable size
     
-    double xMin = anchor.time + TARGET_START;
-    double xMax = xMin + TARGET_T;
-    double yMin = anchor.frequency - (TARGET_F * 0.5);
-    double yMax = yMin + TARGET_F;
+    double xMin = anchor.time + CatalogProfile::TARGET_START;
+    double xMax = xMin + CatalogProfile::TARGET_T;
+    double yMin = anchor.frequency - (CatalogProfile::TARGET_F * 0.5);
+    double yMax = yMin + CatalogProfile::TARGET_F;
     
     for (const Peak& peak : allPeaks) {
         if (peak.frequency >= yMin && peak.frequency <= yMax &&
@@ -50,95 +55,27 @@ std::string generateSongId(const std::string& filename) {
     return oss.str();
 }
 
-std::vector<HashResult> hashPoints(const std::vector<Peak>& peaks, const std::string& filename) {
+std::vector<HashResult> hashPoints(const std::vector<Peak>& peaks) {
     std::vector<HashResult> hashes;
     hashes.reserve(peaks.size() * 10); // Pre-allocate
     
-    std::string songId = generateSongId(filename);
-    
     for (const Peak& anchor : peaks) {
         std::vector<Peak> targetPeaks = getTargetZone(anchor, peaks);
+        uint32_t anchorFrame = secondsToFrame(anchor.time);
         
         for (const Peak& target : targetPeaks) {
             long hash = hashPointPair(anchor, target);
-            hashes.emplace_back(hash, anchor.time, songId);
+            hashes.emplace_back(hash, anchorFrame);
         }
     }
     
     return hashes;
 }
 
-std::vector<HashResult> fingerprintFileParallel(const std::string& filename) {
-    try {
-        std::cout << "Processing (parallel): " << filename << std::endl;
-        
-        if (!isSupportedFormat(filename)) {
-            std::cout << "  Skipping unsupported format" << std::endl;
-            return std::vector<HashResult>();
-        }
-        
-        // Load audio
-        std::vector<double> audio = loadAudioFile(filename);
-        std::cout << "  Loaded audio: " << audio.size() << " samples" << std::endl;
-        
-        // Use multithreading for large files (>30 seconds)
-        if (audio.size() > static_cast<size_t>(SAMPLE_RATE * 30)) {
-            const size_t numThreads = std::thread::hardware_concurrency();
-            const size_t chunkSize = audio.size() / numThreads;
-            
-            std::vector<std::future<std::vector<Peak>>> futures;
-            std::vector<AudioProcessor> processors(numThreads);
-            
-            for (size_t i = 0; i < numThreads; i++) {
-                size_t start = i * chunkSize;
-                size_t end = (i == numThreads - 1) ? audio.size() : start + chunkSize;
-                
-                std::vector<double> chunk(audio.begin() + start, audio.begin() + end);
-                
-                futures.push_back(std::async(std::launch::async, [&processors, i, chunk]() {
-                    SpectrogramResult spec = processors[i].computeSpectrogramOptimized(chunk);
-                    return findPeaksOptimized(spec);
-                }));
-            }
-            
-            // Combine results
-            std::vector<Peak> allPeaks;
-            for (auto& future : futures) {
-                auto peaks = future.get();
-                allPeaks.insert(allPeaks.end(), peaks.begin(), peaks.end());
-            }
-            
-            std::cout << "  Found peaks (parallel): " << allPeaks.size() << std::endl;
-            
-            std::vector<HashResult> hashes = hashPoints(allPeaks, filename);
-            std::cout << "  Generated hashes: " << hashes.size() << std::endl;
-            
-            return hashes;
-        } else {
-            // Single-threaded for smaller files
-            AudioProcessor processor;
-            SpectrogramResult spec = processor.computeSpectrogramOptimized(audio);
-            std::cout << "  Spectrogram: " << spec.frequencies.size() << " x " << spec.times.size() << std::endl;
-            
-            std::vector<Peak> peaks = findPeaksOptimized(spec);
-            std::cout << "  Found peaks: " << peaks.size() << std::endl;
-            
-            std::vector<HashResult> hashes = hashPoints(peaks, filename);
-            std::cout << "  Generated hashes: " << hashes.size() << std::endl;
-            
-            return hashes;
-        }
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error processing " << filename << ": " << e.what() << std::endl;
-        return std::vector<HashResult>();
-    }
-}
-
 // NEW ENHANCED FUNCTIONS
 
 // Enhanced hash function with reduced collision probability
-inline uint64_t hashPointPairEnhanced(const Peak& p1, const Peak& p2) {
+uint64_t hashPointPairEnhanced(const Peak& p1, const Peak& p2) {
     // Use higher precision and more bits to reduce collisions
     uint64_t f1 = static_cast<uint64_t>(p1.frequency * 10) & 0x3FFF;  // 14 bits
     uint64_t f2 = static_cast<uint64_t>(p2.frequency * 10) & 0x3FFF;  // 14 bits
@@ -157,12 +94,12 @@ inline uint64_t hashPointPairEnhanced(const Peak& p1, const Peak& p2) {
 // Optimized target zone with limited points
 std::vector<Peak> getTargetZoneOptimized(const Peak& anchor, const std::vector<Peak>& allPeaks) {
     std::vector<Peak> targetPeaks;
-    targetPeaks.reserve(TARGET_ZONE_POINTS * 2); // Pre-allocate conservatively
+    targetPeaks.reserve(CatalogProfile::TARGET_ZONE_POINTS * 2); // Pre-allocate conservatively
     
-    double xMin = anchor.time + TARGET_START;
-    double xMax = xMin + TARGET_T;
-    double yMin = anchor.frequency - (TARGET_F * 0.5);
-    double yMax = yMin + TARGET_F;
+    double xMin = anchor.time + CatalogProfile::TARGET_START;
+    double xMax = xMin + CatalogProfile::TARGET_T;
+    double yMin = anchor.frequency - (CatalogProfile::TARGET_F * 0.5);
+    double yMax = yMin + CatalogProfile::TARGET_F;
     
     // Collect candidate peaks
     for (const Peak& peak : allPeaks) {
@@ -173,172 +110,473 @@ std::vector<Peak> getTargetZoneOptimized(const Peak& anchor, const std::vector<P
     }
     
     // Limit target zone size and select best peaks
-    if (targetPeaks.size() > TARGET_ZONE_POINTS) {
+    if (targetPeaks.size() > CatalogProfile::TARGET_ZONE_POINTS) {
         // Sort by amplitude (strongest peaks first)
         std::sort(targetPeaks.begin(), targetPeaks.end(),
                  [](const Peak& a, const Peak& b) {
                      return a.amplitude > b.amplitude;
                  });
-        targetPeaks.resize(TARGET_ZONE_POINTS);
+        targetPeaks.resize(CatalogProfile::TARGET_ZONE_POINTS);
     }
     
     return targetPeaks;
 }
 
+namespace {
+
+// The strongest peaks of one target zone, strongest first. The profile
+// fixes the capacity, so the selection lives on the stack.
+template <int CAPACITY>
+struct ZoneTargets {
+    std::array<uint32_t, CAPACITY> peaks;
+    size_t count = 0;
+    
+    const uint32_t* begin() const { return peaks.data(); }
+    const uint32_t* end() const { return peaks.data() + count; }
+};
+
+// Peaks ordered by time, so an anchor's target zone is one contiguous range
+// found by binary search instead of a scan over every peak
+template <typename Profile>
+class TargetZoneIndex {
+private:
+    const std::vector<Peak>& peaks;
+    std::vector<uint32_t> order; // Indices into peaks, by time
+    std::vector<double> times;   // peaks[order[k]].time
+    
+    // Amplitude first; ties go to the earlier peak so the selection is deterministic
+    bool stronger(uint32_t a, uint32_t b) const {
+        if (peaks[a].amplitude != peaks[b].amplitude) {
+            return peaks[a].amplitude > peaks[b].amplitude;
+        }
+        return a < b;
+    }
+    
+public:
+    explicit TargetZoneIndex(const std::vector<Peak>& peaks) : peaks(peaks), order(peaks.size()) {
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&peaks](uint32_t a, uint32_t b) {
+            return peaks[a].time < peaks[b].time;
+        });
+        
+        times.reserve(order.size());
+        for (uint32_t idx : order) {
+            times.push_back(peaks[idx].time);
+        }
+    }
+    
+    using Targets = ZoneTargets<Profile::TARGET_ZONE_POINTS>;
+    
+    // Same zone and limit as getTargetZoneOptimized, for the profile. The
+    // strongest TARGET_ZONE_POINTS peaks are kept in `best`, strongest
+    // first, by insertion.
+    void strongestInZone(const Peak& anchor, Targets& best) const {
+        double xMin = anchor.time + Profile::TARGET_START;
+        double xMax = xMin + Profile::TARGET_T;
+        double yMin = anchor.frequency - (Profile::TARGET_F * 0.5);
+        double yMax = yMin + Profile::TARGET_F;
+        
+        best.count = 0;
+        
+        size_t k = std::lower_bound(times.begin(), times.end(), xMin) - times.begin();
+        for (; k < times.size() && times[k] <= xMax; k++) {
+            uint32_t idx = order[k];
+            const Peak& peak = peaks[idx];
+            if (peak.frequency < yMin || peak.frequency > yMax) {
+                continue;
+            }
+            
+            if (best.count < best.peaks.size()) {
+                best.peaks[best.count++] = idx;
+            } else if (stronger(idx, best.peaks.back())) {
+                best.peaks.back() = idx;
+            } else {
+                continue;
+            }
+            
+            // Move the new entry up to its place
+            for (size_t pos = best.count - 1; pos > 0 && stronger(best.peaks[pos], best.peaks[pos - 1]); pos--) {
+                std::swap(best.peaks[pos], best.peaks[pos - 1]);
+            }
+        }
+    }
+};
+
 // Enhanced hash generation with deduplication
-std::vector<HashResult> hashPointsOptimized(const std::vector<Peak>& peaks, const std::string& filename) {
+template <typename Profile>
+std::vector<HashResult> hashPointsWith(const std::vector<Peak>& peaks) {
+    ScopedStageTimer timer(Stage::Hashing);
     std::vector<HashResult> hashes;
     std::unordered_set<uint64_t> seenHashes; // Prevent duplicate hashes
     
-    std::string songId = generateSongId(filename);
-    
     // Limit anchor points for efficiency
-    size_t maxAnchors = std::min(peaks.size(), static_cast<size_t>(peaks.size() * 0.8));
+    size_t maxAnchors = std::min(peaks.size(), static_cast<size_t>(peaks.size() * Profile::ANCHOR_FRACTION));
+    
+    TargetZoneIndex<Profile> zoneIndex(peaks);
+    typename TargetZoneIndex<Profile>::Targets targetPeaks;
     
     for (size_t i = 0; i < maxAnchors; i++) {
         const Peak& anchor = peaks[i];
-        std::vector<Peak> targetPeaks = getTargetZoneOptimized(anchor, peaks);
+        zoneIndex.strongestInZone(anchor, targetPeaks);
         
-        for (const Peak& target : targetPeaks) {
-            uint64_t hash = hashPointPairEnhanced(anchor, target);
+        for (uint32_t targetIdx : targetPeaks) {
+            uint64_t hash = hashPointPairEnhanced(anchor, peaks[targetIdx]);
             
             // Skip if we've seen this hash before (deduplication)
             if (seenHashes.find(hash) == seenHashes.end()) {
                 seenHashes.insert(hash);
-                hashes.emplace_back(static_cast<long>(hash), anchor.time, songId);
+                hashes.emplace_back(static_cast<long>(hash), secondsToFrame(anchor.time));
             }
         }
     }
     
-    std::cout << "  Generated " << hashes.size() 
-              << " unique hashes from " << peaks.size() 
-              << " peaks (deduped " << (seenHashes.size() - hashes.size()) << ")" << std::endl;
+    AF_LOG(Debug) << "  Generated " << hashes.size() 
+                  << " unique hashes from " << peaks.size() 
+                  << " peaks (deduped " << (seenHashes.size() - hashes.size()) << ")";
     
     return hashes;
 }
 
-// Enhanced fingerprinting with quality control and parallel processing
-std::vector<HashResult> fingerprintFileParallelOptimized(const std::string& filename) {
-    try {
-        std::cout << "Processing (optimized): " << filename << std::endl;
+// Frames either side of a segment or block that its peaks need to see
+size_t peakHaloFrames(FingerprintProfile profile) {
+    return visitProfile(profile, [](auto selected) {
+        return static_cast<size_t>(decltype(selected)::PEAK_BOX_SIZE / 2);
+    });
+}
+
+} // namespace
+
+std::vector<HashResult> hashPointsOptimized(const std::vector<Peak>& peaks, FingerprintProfile profile) {
+    return visitProfile(profile, [&peaks](auto selected) {
+        return hashPointsWith<decltype(selected)>(peaks);
+    });
+}
+
+StreamingFingerprinter::StreamingFingerprinter(FingerprintProfile profile)
+    : profile(profile), halo(peakHaloFrames(profile)),
+      ring(FFT_SIZE + static_cast<size_t>(STFT_FRAMES_PER_TASK) * HOP_SIZE),
+      frequencies(FFT_SIZE / 2 + 1) {
+    // Same bin frequencies as AudioProcessor::computeSpectrogramOptimized
+    const double freqStep = static_cast<double>(SAMPLE_RATE) / FFT_SIZE;
+    for (size_t i = 0; i < frequencies.size(); i++) {
+        frequencies[i] = i * freqStep;
+    }
+}
+
+void StreamingFingerprinter::computeFrames() {
+    // The ring starts at the first sample of frame computedFrames
+    size_t available = ring.available();
+    if (available < static_cast<size_t>(FFT_SIZE)) {
+        return;
+    }
+    
+    size_t frames = (available - FFT_SIZE) / HOP_SIZE + 1;
+    size_t count = FFT_SIZE + (frames - 1) * HOP_SIZE;
+    
+    // Frames are read in place unless the run wraps past the end of the ring
+    RingReadView view = ring.readView(count);
+    const double* samples = view.first.data;
+    if (view.second.size > 0) {
+        window.resize(count);
+        ring.peek(window.data(), count);
+        samples = window.data();
+    }
+    
+    SpectrogramResult spec = processor.computeSpectrogramOptimized(samples, count, computedFrames);
+    const PowerMatrix& power = spec.powerMatrix;
+    frameData.insert(frameData.end(), power.frame(0), power.frame(0) + power.rows() * power.cols());
+    computedFrames += power.cols();
+    
+    ring.discard(power.cols() * HOP_SIZE);
+}
+
+void StreamingFingerprinter::pickBlockPeaks(size_t coreBegin, size_t coreEnd) {
+    const size_t bins = frequencies.size();
+    size_t first = coreBegin > halo ? coreBegin - halo : 0;
+    size_t last = std::min(coreEnd + halo, computedFrames);
+    
+    PowerMatrix power(bins, last - first);
+    std::copy(frameData.begin() + (first - frameBase) * bins, frameData.begin() + (last - frameBase) * bins,
+              power.frame(0));
+    
+    const double timeStep = static_cast<double>(HOP_SIZE) / SAMPLE_RATE;
+    std::vector<double> times(last - first);
+    for (size_t j = 0; j < times.size(); j++) {
+        times[j] = (first + j) * timeStep;
+    }
+    
+    // Halo peaks belong to the neighbouring blocks
+    SpectrogramResult spec(frequencies, std::move(times), std::move(power));
+    std::vector<Peak> blockPeaks;
+    for (const Peak& peak : findPeaksOptimizedEnhanced(spec, profile)) {
+        size_t frame = first + peak.timeIdx;
+        if (frame >= coreBegin && frame < coreEnd) {
+            blockPeaks.push_back(peak);
+        }
+    }
+    
+    // Blocks own disjoint frames, so appending keeps the peaks in time order
+    std::sort(blockPeaks.begin(), blockPeaks.end(), [](const Peak& a, const Peak& b) {
+        return a.time < b.time;
+    });
+    peaks.insert(peaks.end(), blockPeaks.begin(), blockPeaks.end());
+    
+    // The next block starts one halo before this block's end
+    size_t keepFrom = std::max(frameBase, coreEnd > halo ? coreEnd - halo : 0);
+    frameData.erase(frameData.begin(), frameData.begin() + (keepFrom - frameBase) * bins);
+    frameBase = keepFrom;
+}
+
+void StreamingFingerprinter::pickPeaks(bool flush) {
+    const size_t blockFrames = std::max<size_t>(1, secondsToFrame(LIVE_PEAK_BLOCK_SECONDS));
+    
+    // A block is picked once its trailing halo has been computed
+    while ((nextBlock + 1) * blockFrames + halo <= computedFrames) {
+        pickBlockPeaks(nextBlock * blockFrames, (nextBlock + 1) * blockFrames);
+        nextBlock++;
+    }
+    
+    // The last block owns the rest of the stream
+    if (flush && computedFrames > nextBlock * blockFrames) {
+        pickBlockPeaks(nextBlock * blockFrames, computedFrames);
+        nextBlock = (computedFrames + blockFrames - 1) / blockFrames;
+    }
+}
+
+template <typename Profile>
+void StreamingFingerprinter::emitAnchorsWith(double knownUntil, std::vector<HashResult>& hashes) {
+    ScopedStageTimer timer(Stage::Hashing);
+    TargetZoneIndex<Profile> zoneIndex(peaks);
+    typename TargetZoneIndex<Profile>::Targets targetPeaks;
+    
+    // Peaks before knownUntil are final, so an anchor whose zone ends earlier is complete
+    size_t anchored = 0;
+    for (; anchored < peaks.size(); anchored++) {
+        const Peak& anchor = peaks[anchored];
+        if (anchor.time + Profile::TARGET_START + Profile::TARGET_T >= knownUntil) {
+            break;
+        }
         
-        if (!isSupportedFormat(filename)) {
-            std::cout << "  Skipping unsupported format" << std::endl;
-            return std::vector<HashResult>();
+        zoneIndex.strongestInZone(anchor, targetPeaks);
+        for (uint32_t targetIdx : targetPeaks) {
+            uint64_t hash = hashPointPairEnhanced(anchor, peaks[targetIdx]);
+            if (seenHashes.insert(hash).second) {
+                hashes.emplace_back(static_cast<long>(hash), secondsToFrame(anchor.time));
+            }
         }
+    }
+    
+    // Anchored peaks are all earlier than any remaining anchor's zone
+    peaks.erase(peaks.begin(), peaks.begin() + anchored);
+}
+
+void StreamingFingerprinter::emitAnchors(double knownUntil, std::vector<HashResult>& hashes) {
+    visitProfile(profile, [&](auto selected) {
+        emitAnchorsWith<decltype(selected)>(knownUntil, hashes);
+    });
+}
+
+std::vector<HashResult> StreamingFingerprinter::push(const double* samples, size_t count) {
+    std::vector<HashResult> hashes;
+    size_t blocksBefore = nextBlock;
+    
+    // The ring holds at most STFT_FRAMES_PER_TASK frames of audio; drain it as it fills
+    while (count > 0) {
+        size_t n = std::min(count, ring.space());
+        ring.write(samples, n);
+        samples += n;
+        count -= n;
+        samplesReceived += n;
+        
+        computeFrames();
+        pickPeaks(false);
+    }
+    
+    if (nextBlock != blocksBefore) {
+        const size_t blockFrames = std::max<size_t>(1, secondsToFrame(LIVE_PEAK_BLOCK_SECONDS));
+        emitAnchors(frameToSeconds(static_cast<uint32_t>(nextBlock * blockFrames)), hashes);
+    }
+    
+    return hashes;
+}
+
+std::vector<HashResult> StreamingFingerprinter::finish() {
+    std::vector<HashResult> hashes;
+    
+    // Frames never extend past the last sample, as in the file path; only peaks remain
+    pickPeaks(true);
+    emitAnchors(std::numeric_limits<double>::infinity(), hashes);
+    
+    return hashes;
+}
+
+// Fingerprints an opened stream; only the first minute is buffered before deciding how to process it
+static std::vector<HashResult> fingerprintStreamOptimized(AudioStream& stream, FingerprintProfile profile) {
+    printStreamInfo(stream);
+    
+    const size_t longThreshold = static_cast<size_t>(SAMPLE_RATE * 60);
+    std::vector<double> audio;
+    readStream(stream, audio, longThreshold + 1);
+    
+    // Skip very short files (less than 10 seconds)
+    if (audio.size() < static_cast<size_t>(SAMPLE_RATE * 10)) {
+        AF_LOG(Debug) << "  Loaded audio: " << audio.size() << " samples";
+        AF_LOG(Info) << "  Skipping short file (< 10 seconds)";
+        return std::vector<HashResult>();
+    }
+    
+    // Stream large files (>60 seconds) through fixed-length segments
+    if (audio.size() > longThreshold) {
+        // Fixed-length segments keep memory independent of track length. Each
+        // segment owns a core run of STFT frames and is analysed with a halo
+        // of half a peak box on either side, so a core peak sees the same
+        // neighbourhood as in a whole-track spectrogram. Segment boundaries
+        // fall on frame boundaries to keep frames aligned across segments.
+        // The spectrogram itself is computed frame-parallel on the shared pool.
+        const size_t segmentFrames = secondsToFrame(STREAM_SEGMENT_SECONDS);
+        const size_t segmentSize = segmentFrames * HOP_SIZE;
+        const size_t haloFrames = peakHaloFrames(profile);
+        const size_t haloBefore = haloFrames * HOP_SIZE;
+        const size_t haloAfter = (haloFrames - 1) * HOP_SIZE + FFT_SIZE; // Last halo frame ends here
         
-        // Load audio
-        std::vector<double> audio = loadAudioFile(filename);
-        std::cout << "  Loaded audio: " << audio.size() << " samples" << std::endl;
+        AudioProcessor processor;
+        std::vector<Peak> allPeaks;
         
-        // Skip very short files (less than 10 seconds)
-        if (audio.size() < static_cast<size_t>(SAMPLE_RATE * 10)) {
-            std::cout << "  Skipping short file (< 10 seconds)" << std::endl;
-            return std::vector<HashResult>();
-        }
+        // audio holds input samples [bufferStart, bufferStart + audio.size())
+        size_t bufferStart = 0;
+        bool streamDone = false;
         
-        // Use multithreading for large files (>60 seconds) with optimized algorithm
-        if (audio.size() > static_cast<size_t>(SAMPLE_RATE * 60)) {
-            const size_t numThreads = std::min(static_cast<size_t>(4), static_cast<size_t>(std::thread::hardware_concurrency()));
-            const size_t chunkSize = audio.size() / numThreads;
-            const size_t overlapSize = static_cast<size_t>(SAMPLE_RATE * 2); // 2 second overlap
+        for (size_t segment = 0; ; segment++) {
+            size_t start = (segment == 0) ? 0 : (segment * segmentSize - haloBefore);
+            size_t end = (segment + 1) * segmentSize + haloAfter;
             
-            std::vector<std::future<std::vector<Peak>>> futures;
-            std::vector<AudioProcessor> processors(numThreads);
-            
-            for (size_t i = 0; i < numThreads; i++) {
-                size_t start = (i == 0) ? 0 : (i * chunkSize - overlapSize);
-                size_t end = (i == numThreads - 1) ? audio.size() : ((i + 1) * chunkSize + overlapSize);
-                end = std::min(end, audio.size());
-                
-                std::vector<double> chunk(audio.begin() + start, audio.begin() + end);
-                double timeOffset = static_cast<double>(start) / SAMPLE_RATE;
-                
-                futures.push_back(std::async(std::launch::async, [&processors, i, chunk, timeOffset]() {
-                    SpectrogramResult spec = processors[i].computeSpectrogramOptimized(chunk);
-                    
-                    // Adjust time values for chunk offset
-                    SpectrogramResult adjustedSpec = spec;
-                    for (auto& time : adjustedSpec.times) {
-                        time += timeOffset;
-                    }
-                    
-                    return findPeaksOptimizedEnhanced(adjustedSpec);
-                }));
+            // Read half a segment ahead so a short tail joins this segment instead of standing alone
+            size_t wanted = end + segmentSize / 2;
+            while (!streamDone && bufferStart + audio.size() < wanted) {
+                if (readStream(stream, audio, wanted - bufferStart - audio.size()) == 0) {
+                    streamDone = true;
+                }
             }
             
-            // Combine results and remove overlapping peaks
-            std::vector<Peak> allPeaks;
-            for (auto& future : futures) {
-                auto peaks = future.get();
-                allPeaks.insert(allPeaks.end(), peaks.begin(), peaks.end());
+            size_t available = bufferStart + audio.size();
+            bool lastSegment = streamDone && available < wanted;
+            if (lastSegment) {
+                end = available;
             }
             
-            // Remove duplicate/overlapping peaks from chunk boundaries
-            std::sort(allPeaks.begin(), allPeaks.end(), 
-                     [](const Peak& a, const Peak& b) { 
-                         return a.time < b.time; 
-                     });
+            // Segment-local frame j is track frame firstFrame + j
+            size_t firstFrame = start / HOP_SIZE;
+            SpectrogramResult spec = processor.computeSpectrogramOptimized(
+                audio.data() + (start - bufferStart), end - start, firstFrame);
             
-            // Remove peaks that are too close in time and frequency
-            std::vector<Peak> dedupedPeaks;
-            const double timeThreshold = 0.1; // 100ms
-            const double freqThreshold = 50.0; // 50Hz
+            // Core frames in segment-local indices; the last segment owns the rest of the track
+            int coreBegin = static_cast<int>(segment * segmentFrames - firstFrame);
+            int coreEnd = lastSegment ? std::numeric_limits<int>::max()
+                                      : static_cast<int>((segment + 1) * segmentFrames - firstFrame);
             
-            for (const auto& peak : allPeaks) {
-                bool isDuplicate = false;
-                for (const auto& existing : dedupedPeaks) {
-                    if (std::abs(peak.time - existing.time) < timeThreshold &&
-                        std::abs(peak.frequency - existing.frequency) < freqThreshold) {
-                        isDuplicate = true;
-                        break;
-                    }
-                }
-                if (!isDuplicate) {
-                    dedupedPeaks.push_back(peak);
+            // Halo peaks belong to the neighbouring segment
+            for (const Peak& peak : findPeaksOptimizedEnhanced(spec, profile)) {
+                if (peak.timeIdx >= coreBegin && peak.timeIdx < coreEnd) {
+                    allPeaks.push_back(peak);
                 }
             }
             
-            std::cout << "  Found peaks (parallel): " << allPeaks.size() 
-                      << " -> " << dedupedPeaks.size() << " (after dedup)" << std::endl;
-            
-            // Quality check
-            if (dedupedPeaks.size() < 100) {
-                std::cout << "  Warning: Too few peaks detected (" << dedupedPeaks.size() 
-                          << "), file may be problematic" << std::endl;
+            if (lastSegment) {
+                break;
             }
             
-            // Generate optimized hashes
-            std::vector<HashResult> hashes = hashPointsOptimized(dedupedPeaks, filename);
-            std::cout << "  Generated hashes: " << hashes.size() << std::endl;
-            
-            return hashes;
-            
-        } else {
-            // Single-threaded processing for smaller files
-            AudioProcessor processor;
-            SpectrogramResult spec = processor.computeSpectrogramOptimized(audio);
-            std::cout << "  Spectrogram: " << spec.frequencies.size() << " x " << spec.times.size() << std::endl;
-            
-            // Use enhanced peak detection
-            std::vector<Peak> peaks = findPeaksOptimizedEnhanced(spec);
-            std::cout << "  Found peaks: " << peaks.size() << std::endl;
-            
-            // Quality check - ensure minimum number of peaks
-            if (peaks.size() < 50) {
-                std::cout << "  Warning: Too few peaks detected (" << peaks.size() 
-                          << "), file may be problematic" << std::endl;
-            }
-            
-            // Generate optimized hashes
-            std::vector<HashResult> hashes = hashPointsOptimized(peaks, filename);
-            std::cout << "  Generated hashes: " << hashes.size() << std::endl;
-            
-            return hashes;
+            // Drop samples no later segment needs
+            size_t nextStart = (segment + 1) * segmentSize - haloBefore;
+            audio.erase(audio.begin(), audio.begin() + (nextStart - bufferStart));
+            bufferStart = nextStart;
         }
         
+        AF_LOG(Debug) << "  Streamed audio: " << (bufferStart + audio.size()) << " samples";
+        
+        // Segments own disjoint frames, so no boundary duplicates to remove; only order by time
+        std::sort(allPeaks.begin(), allPeaks.end(), 
+                 [](const Peak& a, const Peak& b) { 
+                     return a.time < b.time; 
+                 });
+        
+        AF_LOG(Debug) << "  Found peaks (parallel): " << allPeaks.size();
+        
+        // Quality check
+        if (allPeaks.size() < 100) {
+            AF_LOG(Warn) << "  Warning: Too few peaks detected (" << allPeaks.size() 
+                         << "), file may be problematic";
+        }
+        
+        // Generate optimized hashes
+        std::vector<HashResult> hashes = hashPointsOptimized(allPeaks, profile);
+        AF_LOG(Debug) << "  Generated hashes: " << hashes.size();
+        
+        return hashes;
+        
+    } else {
+        // Whole-buffer processing for smaller files
+        AF_LOG(Debug) << "  Loaded audio: " << audio.size() << " samples";
+        
+        AudioProcessor processor;
+        SpectrogramResult spec = processor.computeSpectrogramOptimized(audio);
+        AF_LOG(Debug) << "  Spectrogram: " << spec.frequencies.size() << " x " << spec.times.size();
+        
+        // Use enhanced peak detection
+        std::vector<Peak> peaks = findPeaksOptimizedEnhanced(spec, profile);
+        AF_LOG(Debug) << "  Found peaks: " << peaks.size();
+        
+        // Quality check - ensure minimum number of peaks
+        if (peaks.size() < 50) {
+            AF_LOG(Warn) << "  Warning: Too few peaks detected (" << peaks.size() 
+                         << "), file may be problematic";
+        }
+        
+        // Generate optimized hashes
+        std::vector<HashResult> hashes = hashPointsOptimized(peaks, profile);
+        AF_LOG(Debug) << "  Generated hashes: " << hashes.size();
+        
+        return hashes;
+    }
+}
+
+// Enhanced fingerprinting with quality control and parallel processing
+std::vector<HashResult> fingerprintFileParallelOptimized(const std::string& filename, FingerprintProfile profile) {
+    try {
+        AF_LOG(Debug) << "Processing (optimized): " << filename;
+        
+        if (!isSupportedFormat(filename)) {
+            AF_LOG(Info) << "  Skipping unsupported format";
+            return std::vector<HashResult>();
+        }
+        
+        AudioStream stream;
+        if (!stream.open(filename)) {
+            throw std::runtime_error("Failed to open audio stream: " + filename);
+        }
+        
+        return fingerprintStreamOptimized(stream, profile);
+        
+    } catch (const std::exception& e) {
+        AF_LOG(Error) << "Error processing " << filename << ": " << e.what();
+        return std::vector<HashResult>();
+    }
+}
+
+// Same pipeline for an encoded file already in memory (e.g. an HTTP upload)
+std::vector<HashResult> fingerprintBufferOptimized(const void* data, size_t size, AudioFormat format,
+                                                   FingerprintProfile profile) {
+    try {
+        AF_LOG(Debug) << "Processing (optimized): " << size << " byte buffer";
+        
+        AudioStream stream;
+        if (!stream.openMemory(data, size, format)) {
+            throw std::runtime_error("Failed to decode audio buffer");
+        }
+        
+        return fingerprintStreamOptimized(stream, profile);
+        
     } catch (const std::exception& e) {
-        std::cerr << "Error processing " << filename << ": " << e.what() << std::endl;
+        AF_LOG(Error) << "Error processing audio buffer: " << e.what();
         return std::vector<HashResult>();
     }
 }
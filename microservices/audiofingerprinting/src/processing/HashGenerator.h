@@ -3,9 +3,11 @@
 
 #include "../utils/Types.h"
 #include "../core/Constants.h"
+#include "../core/FingerprintProfile.h"
 #include "PeakDetection.h"
 #include "../audio/AudioLoader.h"
 #include "../audio/AudioProcessor.h"
+#include "../utils/CircularBuffer.h"
 #include <string>
 #include <vector>
 #include <functional>
@@ -18,18 +20,71 @@
 
 namespace AudioFingerprinting {
 
-// Enhanced hash functions
+// Enhanced hash functions. The pipeline runs the peak detector and hasher
+// specialized for profile: the catalog profile registers songs, the query
+// profile fingerprints clips to recognize.
 uint64_t hashPointPairEnhanced(const Peak& p1, const Peak& p2);
 std::vector<Peak> getTargetZoneOptimized(const Peak& anchor, const std::vector<Peak>& allPeaks);
-std::vector<HashResult> hashPointsOptimized(const std::vector<Peak>& peaks, const std::string& filename);
-std::vector<HashResult> fingerprintFileParallelOptimized(const std::string& filename);
+std::vector<HashResult> hashPointsOptimized(const std::vector<Peak>& peaks,
+                                            FingerprintProfile profile = FingerprintProfile::Catalog);
+std::vector<HashResult> fingerprintFileParallelOptimized(const std::string& filename,
+                                                         FingerprintProfile profile = FingerprintProfile::Catalog);
+std::vector<HashResult> fingerprintBufferOptimized(const void* data, size_t size, AudioFormat format = AudioFormat::UNKNOWN,
+                                                   FingerprintProfile profile = FingerprintProfile::Catalog);
+
+// Incremental fingerprinting of live mono audio at SAMPLE_RATE.
+//
+// Samples are staged in a CircularBuffer and every STFT frame is computed
+// once, as soon as its window has arrived. Peaks are picked one block of
+// LIVE_PEAK_BLOCK_SECONDS at a time with the file detector and the same
+// half-box halo as long-track segments, and an anchor's hashes are emitted
+// as soon as every peak that can fall in its target zone is known. Live
+// audio is a query, so the query profile is the default.
+class StreamingFingerprinter {
+private:
+    FingerprintProfile profile;
+    size_t halo;                      // Half a peak box of the profile, in frames
+    AudioProcessor processor;
+    CircularBuffer ring;
+    std::vector<double> window;       // Samples behind the frames being computed
+    std::vector<double> frequencies;
+    uint64_t samplesReceived = 0;
+    
+    std::vector<float> frameData;     // Power frames [frameBase, computedFrames)
+    size_t frameBase = 0;
+    size_t computedFrames = 0;
+    size_t nextBlock = 0;
+    
+    std::vector<Peak> peaks;          // Picked but not yet anchored, by time
+    std::unordered_set<uint64_t> seenHashes;
+    
+    void computeFrames();
+    void pickBlockPeaks(size_t coreBegin, size_t coreEnd);
+    void pickPeaks(bool flush);
+    void emitAnchors(double knownUntil, std::vector<HashResult>& hashes);
+    template <typename Profile>
+    void emitAnchorsWith(double knownUntil, std::vector<HashResult>& hashes);
+    
+public:
+    explicit StreamingFingerprinter(FingerprintProfile profile = FingerprintProfile::Query);
+    
+    StreamingFingerprinter(const StreamingFingerprinter&) = delete;
+    StreamingFingerprinter& operator=(const StreamingFingerprinter&) = delete;
+    
+    // Appends samples; returns the hashes whose target zones they completed
+    std::vector<HashResult> push(const double* samples, size_t count);
+    
+    // End of the stream: picks the last block and anchors the remaining peaks
+    std::vector<HashResult> finish();
+    
+    double secondsReceived() const { return static_cast<double>(samplesReceived) / SAMPLE_RATE; }
+};
 
 // Keep original functions for compatibility
 long hashPointPair(const Peak& p1, const Peak& p2);
 std::vector<Peak> getTargetZone(const Peak& anchor, const std::vector<Peak>& allPeaks);
 std::string generateSongId(const std::string& filename);
-std::vector<HashResult> hashPoints(const std::vector<Peak>& peaks, const std::string& filename);
-std::vector<HashResult> fingerprintFileParallel(const std::string& filename);
+std::vector<HashResult> hashPoints(const std::vector<Peak>& peaks);
 
 } // namespace AudioFingerprinting
 
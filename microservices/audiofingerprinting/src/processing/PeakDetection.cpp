@@ -1,81 +1,140 @@
 #include "PeakDetection.h"
+#include "../utils/Log.h"
+#include "../utils/Metrics.h"
 #include <algorithm>
 #include <set>
 #include <iostream>
+#include <limits>
+#include <utility>
 
 namespace AudioFingerprinting {
 
-// Original functions for compatibility
-inline bool isLocalMaximum(const std::vector<std::vector<double>>& matrix, int i, int j) {
-    double centerValue = matrix[i][j];
-    int halfBox = PEAK_BOX_SIZE / 2;
+namespace {
+
+// Sliding maximum over a window of 2 * half + 1 elements along one axis
+// (van Herk / Gil-Werman): a constant number of comparisons per element,
+// whatever the window size. Element k is the `lanes` contiguous values at
+// in + k * lanes, so the same routine filters along time (one lane per
+// frequency bin, whole frames at a time) and along frequency (one lane).
+// Neighbours outside [0, n) are ignored. HALF is a template parameter so
+// the block loops run a constant trip count.
+template <int HALF>
+void slidingMax(const float* in, float* out, size_t n, size_t lanes,
+                std::vector<float>& prefix, std::vector<float>& suffix) {
+    constexpr size_t window = 2 * static_cast<size_t>(HALF) + 1;
+    const size_t padded = n + 2 * static_cast<size_t>(HALF);
+    const size_t total = ((padded + window - 1) / window) * window;
+    const float outside = -std::numeric_limits<float>::infinity();
     
-    for (int di = -halfBox; di <= halfBox; di++) {
-        for (int dj = -halfBox; dj <= halfBox; dj++) {
-            if (di == 0 && dj == 0) continue;
-            
-            int ni = i + di;
-            int nj = j + dj;
-            
-            if (ni >= 0 && ni < static_cast<int>(matrix.size()) && 
-                nj >= 0 && nj < static_cast<int>(matrix[0].size())) {
-                if (matrix[ni][nj] > centerValue) {
-                    return false;
-                }
+    prefix.resize(total * lanes);
+    suffix.resize(total * lanes);
+    
+    // Padded element k is input element k - half
+    auto load = [&](float* dst, size_t k) {
+        if (k >= static_cast<size_t>(HALF) && k - HALF < n) {
+            std::copy(in + (k - HALF) * lanes, in + (k - HALF + 1) * lanes, dst);
+        } else {
+            std::fill(dst, dst + lanes, outside);
+        }
+    };
+    
+    for (size_t blockStart = 0; blockStart < total; blockStart += window) {
+        // Running max from the start of the block...
+        load(&prefix[blockStart * lanes], blockStart);
+        for (size_t k = blockStart + 1; k < blockStart + window; k++) {
+            float* cur = &prefix[k * lanes];
+            const float* prev = cur - lanes;
+            load(cur, k);
+            for (size_t l = 0; l < lanes; l++) {
+                cur[l] = std::max(cur[l], prev[l]);
+            }
+        }
+        
+        // ...and from the end of the block
+        size_t blockEnd = blockStart + window - 1;
+        load(&suffix[blockEnd * lanes], blockEnd);
+        for (size_t k = blockEnd; k-- > blockStart; ) {
+            float* cur = &suffix[k * lanes];
+            const float* next = cur + lanes;
+            load(cur, k);
+            for (size_t l = 0; l < lanes; l++) {
+                cur[l] = std::max(cur[l], next[l]);
             }
         }
     }
-    return true;
+    
+    // Window [t, t + window) spans at most two blocks
+    for (size_t t = 0; t < n; t++) {
+        const float* left = &suffix[t * lanes];
+        const float* right = &prefix[(t + window - 1) * lanes];
+        float* dst = out + t * lanes;
+        for (size_t l = 0; l < lanes; l++) {
+            dst[l] = std::max(left[l], right[l]);
+        }
+    }
 }
 
-std::vector<Peak> findPeaksOptimized(const SpectrogramResult& spec) {
-    const auto& Sxx = spec.powerMatrix;
-    size_t rows = Sxx.size();
-    size_t cols = Sxx[0].size();
+// Maximum of the 2 * HALF + 1 neighbourhood (center included) of every cell
+template <int HALF>
+PowerMatrix boxMaximum(const PowerMatrix& Sxx) {
+    size_t rows = Sxx.rows();
+    size_t cols = Sxx.cols();
     
-    std::vector<Peak> peaks;
-    peaks.reserve(rows * cols / (PEAK_BOX_SIZE * PEAK_BOX_SIZE * 4)); // Pre-allocate
+    PowerMatrix timeMax(rows, cols);
+    PowerMatrix boxMax(rows, cols);
+    if (rows == 0 || cols == 0) {
+        return boxMax;
+    }
     
-    // Calculate adaptive threshold
-    double globalSum = 0.0;
-    for (const auto& row : Sxx) {
-        for (double val : row) {
-            globalSum += val;
-        }
+    std::vector<float> prefix;
+    std::vector<float> suffix;
+    
+    // Separable: along time over whole frames, then along frequency within each frame
+    slidingMax<HALF>(Sxx.frame(0), timeMax.frame(0), cols, rows, prefix, suffix);
+    for (size_t t = 0; t < cols; t++) {
+        slidingMax<HALF>(timeMax.frame(t), boxMax.frame(t), rows, 1, prefix, suffix);
     }
-    double globalMean = globalSum / (rows * cols);
-    double threshold = globalMean * 2.0; // Adaptive threshold
     
-    // Find peaks with early termination
-    int halfBox = PEAK_BOX_SIZE / 2;
-    for (int i = halfBox; i < static_cast<int>(rows) - halfBox; i++) {
-        for (int j = halfBox; j < static_cast<int>(cols) - halfBox; j++) {
-            if (Sxx[i][j] > threshold && isLocalMaximum(Sxx, i, j)) {
-                peaks.emplace_back(i, j, spec.frequencies[i], spec.times[j]);
-            }
-        }
+    return boxMax;
+}
+
+// Cells above threshold that no neighbour in the box exceeds, in the same
+// (frequency, time) order as the original per-cell scan. Equivalent to
+// isLocalMaximum: a cell survives exactly when it equals its box maximum.
+template <typename Profile>
+std::vector<std::pair<int, int>> findLocalMaxima(const PowerMatrix& Sxx, double threshold,
+                                                 const std::vector<char>& rowEnabled) {
+    std::vector<std::pair<int, int>> maxima;
+    constexpr int halfBox = Profile::PEAK_BOX_SIZE / 2;
+    int rows = static_cast<int>(Sxx.rows());
+    int cols = static_cast<int>(Sxx.cols());
+    
+    if (rows <= 2 * halfBox || cols <= 2 * halfBox) {
+        return maxima;
     }
     
-    // Sort by power and limit results
-    std::sort(peaks.begin(), peaks.end(), 
-              [&Sxx](const Peak& a, const Peak& b) {
-                  return Sxx[a.freqIdx][a.timeIdx] > Sxx[b.freqIdx][b.timeIdx];
-              });
+    PowerMatrix boxMax = boxMaximum<halfBox>(Sxx);
     
-    size_t peakTarget = static_cast<size_t>((rows * cols / (PEAK_BOX_SIZE * PEAK_BOX_SIZE)) * POINT_EFFICIENCY);
-    if (peaks.size() > peakTarget) {
-        peaks.resize(peakTarget);
+    // Scan frame by frame for contiguous access
+    for (int j = halfBox; j < cols - halfBox; j++) {
+        const float* power = Sxx.frame(j);
+        const float* localMax = boxMax.frame(j);
+        for (int i = halfBox; i < rows - halfBox; i++) {
+            if (rowEnabled[i] && power[i] > threshold && power[i] == localMax[i]) {
+                maxima.emplace_back(i, j);
+            }
+        }
     }
     
-    return peaks;
+    std::sort(maxima.begin(), maxima.end());
+    return maxima;
 }
 
-// NEW ENHANCED FUNCTIONS
-
 // Enhanced peak detection with amplitude-based filtering
-bool isLocalMaximumEnhanced(const std::vector<std::vector<double>>& matrix, int i, int j, double& peakStrength) {
-    double centerValue = matrix[i][j];
-    int halfBox = PEAK_BOX_SIZE / 2;
+template <typename Profile>
+bool localMaximumStrength(const PowerMatrix& matrix, int i, int j, double& peakStrength) {
+    double centerValue = matrix.at(i, j);
+    constexpr int halfBox = Profile::PEAK_BOX_SIZE / 2;
     
     double maxNeighbor = 0.0;
     double sumNeighbors = 0.0;
@@ -88,10 +147,10 @@ bool isLocalMaximumEnhanced(const std::vector<std::vector<double>>& matrix, int
             int ni = i + di;
             int nj = j + dj;
             
-            if (ni >= 0 && ni < static_cast<int>(matrix.size()) && 
-                nj >= 0 && nj < static_cast<int>(matrix[0].size())) {
+            if (ni >= 0 && ni < static_cast<int>(matrix.rows()) && 
+                nj >= 0 && nj < static_cast<int>(matrix.cols())) {
                 
-                double neighborValue = matrix[ni][nj];
+                double neighborValue = matrix.at(ni, nj);
                 
                 if (neighborValue > centerValue) {
                     return false; // Not a local maximum
@@ -112,12 +171,14 @@ bool isLocalMaximumEnhanced(const std::vector<std::vector<double>>& matrix, int
 }
 
 // Frequency filtering helper
-bool isValidFrequency(double frequency) {
-    return frequency >= MIN_FREQUENCY_HZ && frequency <= MAX_FREQUENCY_HZ;
+template <typename Profile>
+bool validFrequency(double frequency) {
+    return frequency >= Profile::MIN_FREQUENCY_HZ && frequency <= Profile::MAX_FREQUENCY_HZ;
 }
 
 // Temporal peak filtering to reduce redundancy
-std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks) {
+template <typename Profile>
+std::vector<Peak> filterTemporal(const std::vector<Peak>& rawPeaks) {
     std::vector<Peak> filteredPeaks;
     
     // Sort by time first
@@ -126,7 +187,7 @@ std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks) {
               [](const Peak& a, const Peak& b) { return a.time < b.time; });
     
     // Group by time windows and limit peaks per window
-    const double timeWindow = 1.0 / MAX_PEAKS_PER_SECOND; // Time window size
+    const double timeWindow = 1.0 / Profile::MAX_PEAKS_PER_SECOND; // Time window size
     double currentWindowStart = 0.0;
     std::vector<Peak> currentWindowPeaks;
     
@@ -141,7 +202,7 @@ std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks) {
                          });
                 
                 int maxPeaksInWindow = std::min(static_cast<int>(currentWindowPeaks.size()), 
-                                               MAX_PEAKS_PER_SECOND);
+                                               Profile::MAX_PEAKS_PER_SECOND);
                 for (int i = 0; i < maxPeaksInWindow; i++) {
                     filteredPeaks.push_back(currentWindowPeaks[i]);
                 }
@@ -162,7 +223,7 @@ std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks) {
                  });
         
         int maxPeaksInWindow = std::min(static_cast<int>(currentWindowPeaks.size()), 
-                                       MAX_PEAKS_PER_SECOND);
+                                       Profile::MAX_PEAKS_PER_SECOND);
         for (int i = 0; i < maxPeaksInWindow; i++) {
             filteredPeaks.push_back(currentWindowPeaks[i]);
         }
@@ -171,23 +232,25 @@ std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks) {
     return filteredPeaks;
 }
 
-std::vector<Peak> findPeaksOptimizedEnhanced(const SpectrogramResult& spec) {
+template <typename Profile>
+std::vector<Peak> findPeaks(const SpectrogramResult& spec) {
+    ScopedStageTimer timer(Stage::PeakPicking);
     const auto& Sxx = spec.powerMatrix;
-    size_t rows = Sxx.size();
-    size_t cols = Sxx[0].size();
+    size_t rows = Sxx.rows();
+    size_t cols = Sxx.cols();
     
     std::vector<Peak> peaks;
-    peaks.reserve(rows * cols / (PEAK_BOX_SIZE * PEAK_BOX_SIZE * 8)); // Smaller pre-allocation
+    peaks.reserve(rows * cols / (Profile::PEAK_BOX_SIZE * Profile::PEAK_BOX_SIZE * 8)); // Smaller pre-allocation
     
     // Calculate adaptive threshold with frequency weighting
     double globalSum = 0.0;
     int validSamples = 0;
     
     for (size_t i = 0; i < rows; i++) {
-        if (!isValidFrequency(spec.frequencies[i])) continue;
+        if (!validFrequency<Profile>(spec.frequencies[i])) continue;
         
         for (size_t j = 0; j < cols; j++) {
-            globalSum += Sxx[i][j];
+            globalSum += Sxx.at(i, j);
             validSamples++;
         }
     }
@@ -195,49 +258,138 @@ std::vector<Peak> findPeaksOptimizedEnhanced(const SpectrogramResult& spec) {
     double globalMean = (validSamples > 0) ? globalSum / validSamples : 0.0;
     double adaptiveThreshold = globalMean * 3.0; // Increased threshold
     
-    // Find peaks with enhanced filtering
-    int halfBox = PEAK_BOX_SIZE / 2;
-    for (int i = halfBox; i < static_cast<int>(rows) - halfBox; i++) {
-        // Skip frequencies outside our range
-        if (!isValidFrequency(spec.frequencies[i])) continue;
+    // Skip frequencies outside our range
+    std::vector<char> validRows(rows);
+    for (size_t i = 0; i < rows; i++) {
+        validRows[i] = validFrequency<Profile>(spec.frequencies[i]) ? 1 : 0;
+    }
+    
+    // Find peaks with enhanced filtering. The box maximum rejects non-maxima in
+    // O(rows * cols); the neighbour mean is only summed for the few survivors,
+    // in the original order, so peak strengths stay bit-identical.
+    for (const auto& cell : findLocalMaxima<Profile>(Sxx, adaptiveThreshold, validRows)) {
+        int i = cell.first;
+        int j = cell.second;
+        double peakStrength = 0.0;
         
-        for (int j = halfBox; j < static_cast<int>(cols) - halfBox; j++) {
-            if (Sxx[i][j] > adaptiveThreshold) {
-                double peakStrength = 0.0;
-                
-                if (isLocalMaximumEnhanced(Sxx, i, j, peakStrength) && 
-                    peakStrength >= MIN_PEAK_AMPLITUDE_RATIO) {
-                    
-                    Peak peak(i, j, spec.frequencies[i], spec.times[j]);
-                    peak.amplitude = Sxx[i][j]; // Store amplitude for filtering
-                    peaks.push_back(peak);
-                }
-            }
+        if (localMaximumStrength<Profile>(Sxx, i, j, peakStrength) && 
+            peakStrength >= Profile::MIN_PEAK_AMPLITUDE_RATIO) {
+            
+            Peak peak(i, j, spec.frequencies[i], spec.times[j]);
+            peak.amplitude = Sxx.at(i, j); // Store amplitude for filtering
+            peaks.push_back(peak);
         }
     }
     
     // Apply temporal filtering
-    std::vector<Peak> temporalFiltered = filterTemporalPeaks(peaks);
+    std::vector<Peak> temporalFiltered = filterTemporal<Profile>(peaks);
     
     // Final selection by power
     std::sort(temporalFiltered.begin(), temporalFiltered.end(), 
               [&Sxx](const Peak& a, const Peak& b) {
-                  return Sxx[a.freqIdx][a.timeIdx] > Sxx[b.freqIdx][b.timeIdx];
+                  return Sxx.at(a.freqIdx, a.timeIdx) > Sxx.at(b.freqIdx, b.timeIdx);
               });
     
     // Limit final peak count more aggressively
     size_t maxPeaks = std::min(temporalFiltered.size(), 
-                              static_cast<size_t>((rows * cols / (PEAK_BOX_SIZE * PEAK_BOX_SIZE)) * POINT_EFFICIENCY));
+                              static_cast<size_t>((rows * cols / (Profile::PEAK_BOX_SIZE * Profile::PEAK_BOX_SIZE)) * Profile::POINT_EFFICIENCY));
     
     if (temporalFiltered.size() > maxPeaks) {
         temporalFiltered.resize(maxPeaks);
     }
     
-    std::cout << "  Enhanced peak detection: " << peaks.size() 
-              << " -> " << temporalFiltered.size() 
-              << " (filtered " << (peaks.size() - temporalFiltered.size()) << ")" << std::endl;
+    AF_LOG(Debug) << "  Enhanced peak detection (" << Profile::TAG << "): " << peaks.size() 
+                  << " -> " << temporalFiltered.size() 
+                  << " (filtered " << (peaks.size() - temporalFiltered.size()) << ")";
     
     return temporalFiltered;
 }
 
+} // namespace
+
+// Original functions for compatibility
+inline bool isLocalMaximum(const PowerMatrix& matrix, int i, int j) {
+    double centerValue = matrix.at(i, j);
+    int halfBox = CatalogProfile::PEAK_BOX_SIZE / 2;
+    
+    for (int di = -halfBox; di <= halfBox; di++) {
+        for (int dj = -halfBox; dj <= halfBox; dj++) {
+            if (di == 0 && dj == 0) continue;
+            
+            int ni = i + di;
+            int nj = j + dj;
+            
+            if (ni >= 0 && ni < static_cast<int>(matrix.rows()) && 
+                nj >= 0 && nj < static_cast<int>(matrix.cols())) {
+                if (matrix.at(ni, nj) > centerValue) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<Peak> findPeaksOptimized(const SpectrogramResult& spec) {
+    const auto& Sxx = spec.powerMatrix;
+    size_t rows = Sxx.rows();
+    size_t cols = Sxx.cols();
+    
+    std::vector<Peak> peaks;
+    peaks.reserve(rows * cols / (CatalogProfile::PEAK_BOX_SIZE * CatalogProfile::PEAK_BOX_SIZE * 4)); // Pre-allocate
+    
+    // Calculate adaptive threshold
+    double globalSum = 0.0;
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            globalSum += Sxx.at(i, j);
+        }
+    }
+    double globalMean = globalSum / (rows * cols);
+    double threshold = globalMean * 2.0; // Adaptive threshold
+    
+    // Find peaks with a running box maximum instead of per-cell neighbourhood scans
+    std::vector<char> allRows(rows, 1);
+    for (const auto& cell : findLocalMaxima<CatalogProfile>(Sxx, threshold, allRows)) {
+        peaks.emplace_back(cell.first, cell.second, spec.frequencies[cell.first], spec.times[cell.second]);
+    }
+    
+    // Sort by power and limit results
+    std::sort(peaks.begin(), peaks.end(), 
+              [&Sxx](const Peak& a, const Peak& b) {
+                  return Sxx.at(a.freqIdx, a.timeIdx) > Sxx.at(b.freqIdx, b.timeIdx);
+              });
+    
+    size_t peakTarget = static_cast<size_t>((rows * cols / (CatalogProfile::PEAK_BOX_SIZE * CatalogProfile::PEAK_BOX_SIZE)) * CatalogProfile::POINT_EFFICIENCY);
+    if (peaks.size() > peakTarget) {
+        peaks.resize(peakTarget);
+    }
+    
+    return peaks;
+}
+
+// NEW ENHANCED FUNCTIONS
+
+// Enhanced peak detection with amplitude-based filtering
+bool isLocalMaximumEnhanced(const PowerMatrix& matrix, int i, int j, double& peakStrength) {
+    return localMaximumStrength<CatalogProfile>(matrix, i, j, peakStrength);
+}
+
+// Frequency filtering helper
+bool isValidFrequency(double frequency) {
+    return validFrequency<CatalogProfile>(frequency);
+}
+
+// Temporal peak filtering to reduce redundancy
+std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks) {
+    return filterTemporal<CatalogProfile>(rawPeaks);
+}
+
+// One branch on the profile, then loops specialized for it
+std::vector<Peak> findPeaksOptimizedEnhanced(const SpectrogramResult& spec, FingerprintProfile profile) {
+    return visitProfile(profile, [&spec](auto selected) {
+        return findPeaks<decltype(selected)>(spec);
+    });
+}
+
 } // namespace AudioFingerprinting
\ No newline at end of file
@@ -3,17 +3,20 @@
 
 #include "../utils/Types.h"
 #include "../core/Constants.h"
+#include "../core/FingerprintProfile.h"
 
 namespace AudioFingerprinting {
 
-// Enhanced peak detection functions
-bool isLocalMaximumEnhanced(const std::vector<std::vector<double>>& matrix, int i, int j, double& peakStrength);
+// Enhanced peak detection functions. The helpers use the catalog
+// profile; the detector runs the loops specialized for profile.
+bool isLocalMaximumEnhanced(const PowerMatrix& matrix, int i, int j, double& peakStrength);
 bool isValidFrequency(double frequency);
 std::vector<Peak> filterTemporalPeaks(const std::vector<Peak>& rawPeaks);
-std::vector<Peak> findPeaksOptimizedEnhanced(const SpectrogramResult& spec);
+std::vector<Peak> findPeaksOptimizedEnhanced(const SpectrogramResult& spec,
+                                             FingerprintProfile profile = FingerprintProfile::Catalog);
 
 // Keep original function for compatibility
-bool isLocalMaximum(const std::vector<std::vector<double>>& matrix, int i, int j);
+bool isLocalMaximum(const PowerMatrix& matrix, int i, int j);
 std::vector<Peak> findPeaksOptimized(const SpectrogramResult& spec);
 
 } // namespace AudioFingerprinting
@@ -0,0 +1,177 @@
+#include "MatchScorer.h"
+#include "../core/Constants.h"
+#include <algorithm>
+
+namespace AudioFingerprinting {
+
+namespace {
+
+const size_t MIN_TABLE_SIZE = 64;
+
+inline size_t slotFor(uint64_t key, size_t mask) {
+    // Fibonacci hashing spreads the consecutive bins of one song
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+size_t tableSizeFor(size_t entries) {
+    // Keep the load factor at or below one half
+    size_t size = MIN_TABLE_SIZE;
+    while (size < entries * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Ranking order: score, then match count, then the lower song_idx
+bool better(const ScoredMatch& a, const ScoredMatch& b) {
+    if (a.score != b.score) return a.score > b.score;
+    if (a.matchCount != b.matchCount) return a.matchCount > b.matchCount;
+    return a.songIdx < b.songIdx;
+}
+
+} // namespace
+
+MatchScorer::MatchScorer(size_t expectedRows)
+    : bins(tableSizeFor(expectedRows)), songs(MIN_TABLE_SIZE),
+      binWidth(std::max<int64_t>(1, secondsToFrame(0.5))) {} // 0.5 second bins
+
+MatchScorer::SongCell& MatchScorer::songCell(uint32_t songIdx) {
+    size_t mask = songs.size() - 1;
+    for (size_t slot = slotFor(songIdx, mask); ; slot = (slot + 1) & mask) {
+        SongCell& cell = songs[slot];
+        if (cell.songIdx == songIdx) {
+            return cell;
+        }
+        if (cell.songIdx == 0) {
+            if ((usedSongs + 1) * 2 > songs.size()) {
+                growSongs();
+                return songCell(songIdx);
+            }
+            cell.songIdx = songIdx;
+            usedSongs++;
+            return cell;
+        }
+    }
+}
+
+MatchScorer::BinCell& MatchScorer::binCell(uint64_t key) {
+    size_t mask = bins.size() - 1;
+    for (size_t slot = slotFor(key, mask); ; slot = (slot + 1) & mask) {
+        BinCell& cell = bins[slot];
+        if (cell.key == key) {
+            return cell;
+        }
+        if (cell.key == 0) {
+            if ((usedBins + 1) * 2 > bins.size()) {
+                growBins();
+                return binCell(key);
+            }
+            cell.key = key;
+            usedBins++;
+            return cell;
+        }
+    }
+}
+
+void MatchScorer::growBins() {
+    std::vector<BinCell> old(bins.size() * 2);
+    old.swap(bins);
+    size_t mask = bins.size() - 1;
+
+    for (const BinCell& cell : old) {
+        if (cell.key == 0) continue;
+        size_t slot = slotFor(cell.key, mask);
+        while (bins[slot].key != 0) {
+            slot = (slot + 1) & mask;
+        }
+        bins[slot] = cell;
+    }
+}
+
+void MatchScorer::growSongs() {
+    std::vector<SongCell> old(songs.size() * 2);
+    old.swap(songs);
+    size_t mask = songs.size() - 1;
+
+    for (const SongCell& cell : old) {
+        if (cell.songIdx == 0) continue;
+        size_t slot = slotFor(cell.songIdx, mask);
+        while (songs[slot].songIdx != 0) {
+            slot = (slot + 1) & mask;
+        }
+        songs[slot] = cell;
+    }
+}
+
+void MatchScorer::add(uint32_t songIdx, uint32_t dbOffset, uint32_t sampleOffset) {
+    if (songIdx == 0) {
+        return;
+    }
+
+    // Same quantization as the former per-song histogram (truncating division)
+    int64_t delta = static_cast<int64_t>(dbOffset) - static_cast<int64_t>(sampleOffset);
+    addBin(songIdx, static_cast<int32_t>(delta / binWidth), 1);
+}
+
+void MatchScorer::addBin(uint32_t songIdx, int32_t bin, uint32_t count) {
+    if (songIdx == 0 || count == 0) {
+        return;
+    }
+
+    uint64_t key = (static_cast<uint64_t>(songIdx) << 32) | static_cast<uint32_t>(bin);
+    uint32_t total = binCell(key).count += count;
+
+    SongCell& song = songCell(songIdx);
+    song.matches += count;
+    song.best = std::max(song.best, total);
+}
+
+void MatchScorer::forEachBin(const std::function<void(const ScoreBin&)>& callback) const {
+    for (const BinCell& cell : bins) {
+        if (cell.key == 0) continue;
+        callback(ScoreBin{static_cast<uint32_t>(cell.key >> 32), static_cast<int32_t>(static_cast<uint32_t>(cell.key)),
+                          cell.count});
+    }
+}
+
+size_t MatchScorer::candidateCount(int minMatches) const {
+    size_t count = 0;
+    for (const SongCell& cell : songs) {
+        if (cell.songIdx != 0 && static_cast<int>(cell.matches) >= minMatches) {
+            count++;
+        }
+    }
+    return count;
+}
+
+std::vector<ScoredMatch> MatchScorer::top(size_t k, int minMatches) const {
+    std::vector<ScoredMatch> heap;
+    if (k == 0) {
+        return heap;
+    }
+    heap.reserve(k + 1);
+
+    // Min-heap on ranking: the weakest kept entry sits at the front
+    for (const SongCell& cell : songs) {
+        if (cell.songIdx == 0 || static_cast<int>(cell.matches) < minMatches) {
+            continue;
+        }
+
+        ScoredMatch match{cell.songIdx, static_cast<int>(cell.best), static_cast<int>(cell.matches)};
+        if (heap.size() == k && !better(match, heap.front())) {
+            continue;
+        }
+
+        heap.push_back(match);
+        std::push_heap(heap.begin(), heap.end(), better);
+        if (heap.size() > k) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.pop_back();
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+} // namespace AudioFingerprinting
@@ -0,0 +1,77 @@
+#ifndef MATCH_SCORER_H
+#define MATCH_SCORER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+namespace AudioFingerprinting {
+
+struct ScoredMatch {
+    uint32_t songIdx;
+    int score;       // Largest number of matches agreeing on one time offset
+    int matchCount;  // All matching rows for the song
+};
+
+// One offset-histogram cell: count rows of songIdx agreed on offset bin
+struct ScoreBin {
+    uint32_t songIdx;
+    int32_t bin;
+    uint32_t count;
+};
+
+// Offset-histogram scoring fed one match row at a time.
+//
+// Counts per (song, quantized offset delta) live in a flat open-addressing
+// table and each song's best bin is kept up to date as rows arrive, so no
+// per-song offset lists, sorts or maps are built. Both tables grow by
+// doubling and are otherwise allocation-free.
+class MatchScorer {
+private:
+    struct BinCell {
+        uint64_t key = 0;   // songIdx << 32 | bin; 0 = empty (song_idx starts at 1)
+        uint32_t count = 0;
+    };
+
+    struct SongCell {
+        uint32_t songIdx = 0; // 0 = empty
+        uint32_t matches = 0;
+        uint32_t best = 0;
+    };
+
+    std::vector<BinCell> bins;
+    std::vector<SongCell> songs;
+    size_t usedBins = 0;
+    size_t usedSongs = 0;
+    int64_t binWidth;
+
+    SongCell& songCell(uint32_t songIdx);
+    BinCell& binCell(uint64_t key);
+    void growBins();
+    void growSongs();
+
+public:
+    // expectedRows sizes the tables up front
+    explicit MatchScorer(size_t expectedRows = 0);
+
+    // The query hash at sampleOffset matched dbOffset in songIdx (frames)
+    void add(uint32_t songIdx, uint32_t dbOffset, uint32_t sampleOffset);
+
+    // Adds count rows already binned elsewhere (another shard's scorer);
+    // scorers fed disjoint rows merge into the scorer of all of them
+    void addBin(uint32_t songIdx, int32_t bin, uint32_t count);
+    
+    // Every non-empty cell, in no particular order
+    void forEachBin(const std::function<void(const ScoreBin&)>& callback) const;
+    
+    // Songs with at least minMatches rows
+    size_t candidateCount(int minMatches) const;
+
+    // The k best of those by score, then match count, then lowest songIdx
+    std::vector<ScoredMatch> top(size_t k, int minMatches) const;
+};
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -1,6 +1,12 @@
 #include "Recognition.h"
 #include "../audio/AudioLoader.h"
+#include "../audio/FFTPlanCache.h"
 #include "../processing/HashGenerator.h"
+#include "../storage/LibraryScan.h"
+#include "../storage/FingerprintPack.h"
+#include "../utils/Log.h"
+#include "../utils/Metrics.h"
+#include "../utils/ThreadPool.h"
 #include <iostream>
 #include <filesystem>
 #include <algorithm>
@@ -8,7 +14,11 @@
 #include <future>
 #include <vector>
 #include <map>
+#include <unordered_set>
 #include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
 #include <taglib/tstring.h>
@@ -20,12 +30,189 @@ std::mutex SongRecognizer::dbMutex;
 
 SongRecognizer::SongRecognizer(const std::string& dbPath) {
     db = std::make_unique<Database>(dbPath);
+    indexPath = HashIndex::defaultPathFor(dbPath);
+    wisdomPath = FFTPlanCache::defaultWisdomPathFor(dbPath);
 }
 
-SongRecognizer::~SongRecognizer() = default;
+SongRecognizer::~SongRecognizer() {
+    // A running compaction publishes into this recognizer when it finishes
+    std::future<void> running;
+    {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        running = std::move(compaction);
+    }
+    if (running.valid()) {
+        running.wait();
+    }
+}
 
 bool SongRecognizer::initializeDatabase() {
-    return db->open();
+    if (!db->open()) {
+        return false;
+    }
+    
+    std::string profileTag = db->getFingerprintProfile();
+    if (!profilesForTag(profileTag, catalogProfile, queryCompanion)) {
+        AF_LOG(Error) << "Database uses fingerprint profile '" << profileTag
+                      << "', which this build does not support; register its songs again into a new database"
+                      << " (" << CatalogProfile::TAG << ")";
+        db->close();
+        return false;
+    }
+    AF_LOG(Debug) << "Fingerprint profile: " << profileTag;
+    
+    // Measure the STFT plan once per process, reusing wisdom from earlier runs
+    FFTPlanCache& fftPlans = FFTPlanCache::instance();
+    fftPlans.importWisdom(wisdomPath);
+    fftPlans.realForward(FFT_SIZE);
+    fftPlans.exportWisdom(wisdomPath);
+    
+    // The hash index is optional; fall back to SQLite lookups without it.
+    // An empty catalog starts one, so it grows with the registrations.
+    if (SegmentedIndex::existsFor(indexPath) || db->getTotalSongs() == 0) {
+        loadHashIndex();
+    }
+    
+    return true;
+}
+
+std::shared_ptr<const IndexSnapshot> SongRecognizer::currentHashIndex() const {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    return hashIndex;
+}
+
+void SongRecognizer::setHashIndex(std::shared_ptr<const IndexSnapshot> index) {
+    // In-flight recognitions keep the previous mapping alive until they finish
+    std::lock_guard<std::mutex> lock(indexMutex);
+    hashIndex = std::move(index);
+}
+
+bool SongRecognizer::loadHashIndex() {
+    std::lock_guard<std::mutex> lock(dbMutex);
+    std::lock_guard<std::mutex> segmentsLock(segmentsMutex);
+    
+    // Kept even when stale, so refreshHashIndex can switch to it once it catches up
+    segmentedIndex = std::make_shared<SegmentedIndex>(indexPath, catalogProfile);
+    if (!segmentedIndex->open()) {
+        setHashIndex(nullptr);
+        return false;
+    }
+    std::shared_ptr<const IndexSnapshot> index = segmentedIndex->snapshot();
+    
+    // An index built before the latest registrations would silently miss songs
+    int totalSongs = db->getTotalSongs();
+    if (static_cast<int>(index->songCount()) != totalSongs) {
+        if (!index->parts.empty()) {
+            AF_LOG(Warn) << "Hash index is stale (" << index->songCount() << " songs indexed, "
+                         << totalSongs << " in database); using SQLite lookups. "
+                         << "Run 'build-index' to refresh it.";
+        }
+        setHashIndex(nullptr);
+        return false;
+    }
+    
+    setHashIndex(std::move(index));
+    return true;
+}
+
+bool SongRecognizer::buildHashIndex() {
+    {
+        std::lock_guard<std::mutex> lock(dbMutex);
+        setHashIndex(nullptr);
+        
+        // Segments and unflushed runs are covered by the rebuild and dropped with it
+        SegmentedIndex index(indexPath, catalogProfile);
+        if (!index.replaceBase([this](const std::string& path, uint64_t lastMergedSegment,
+                                      const std::vector<uint32_t>& droppedSongs) {
+                return HashIndex::build(*db, path, catalogProfile, lastMergedSegment, droppedSongs);
+            })) {
+            return false;
+        }
+    }
+    
+    return loadHashIndex();
+}
+
+void SongRecognizer::indexSongs(const std::vector<PendingSong>& batch) {
+    catalogStatsStale.store(true);
+    
+    // Without a current index, lookups go to SQLite, which already has the rows
+    std::lock_guard<std::mutex> lock(segmentsMutex);
+    if (!segmentedIndex || !currentHashIndex()) {
+        return;
+    }
+    
+    // Visible to the next lookup, without touching the files readers map
+    segmentedIndex->add(batch);
+    setHashIndex(segmentedIndex->snapshot());
+    
+    if (segmentedIndex->needsCompaction()) {
+        startCompaction();
+    }
+}
+
+void SongRecognizer::startCompaction() {
+    if (compaction.valid() && compaction.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    
+    std::shared_ptr<SegmentedIndex> index = segmentedIndex;
+    compaction = std::async(std::launch::async, [this, index]() {
+        bool compacted = index->compact();
+        
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        if (compacted && index == segmentedIndex && currentHashIndex()) {
+            setHashIndex(index->snapshot());
+        }
+    });
+}
+
+void SongRecognizer::flushHashIndex() {
+    // Shard node indexes are compacted here too: their servers only read them
+    for (const auto& shardIndex : shardIndexes) {
+        if (shardIndex && shardIndex->flush() && shardIndex->needsCompaction()) {
+            shardIndex->compact();
+        }
+    }
+    
+    std::future<void> running;
+    {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        if (segmentedIndex && currentHashIndex()) {
+            segmentedIndex->flush();
+            setHashIndex(segmentedIndex->snapshot());
+            
+            if (segmentedIndex->needsCompaction()) {
+                startCompaction();
+            }
+        }
+        running = std::move(compaction);
+    }
+    
+    // The compaction takes segmentsMutex to publish, so wait outside it
+    if (running.valid()) {
+        running.wait();
+    }
+}
+
+bool SongRecognizer::refreshHashIndex() {
+    std::lock_guard<std::mutex> lock(segmentsMutex);
+    if (!segmentedIndex || !segmentedIndex->refresh()) {
+        return false;
+    }
+    catalogStatsStale.store(true);
+    
+    std::shared_ptr<const IndexSnapshot> index = segmentedIndex->snapshot();
+    if (!currentHashIndex()) {
+        // On SQLite lookups: switch only once the index covers the catalog again
+        if (static_cast<int>(index->songCount()) != db->getTotalSongs()) {
+            return false;
+        }
+        AF_LOG(Info) << "Hash index covers the catalog again; using it for lookups";
+    }
+    
+    setHashIndex(std::move(index));
+    return true;
 }
 
 SongInfo SongRecognizer::extractMetadata(const std::string& filename) {
@@ -73,13 +260,13 @@ SongInfo SongRecognizer::extractMetadata(const std::string& filename) {
             info.album = "Unknown Album";
         }
         
-        std::cout << "Extracted metadata:" << std::endl;
-        std::cout << "  Title: " << info.title << std::endl;
-        std::cout << "  Artist: " << info.artist << std::endl;
-        std::cout << "  Album: " << info.album << std::endl;
+        AF_LOG(Debug) << "Extracted metadata:";
+        AF_LOG(Debug) << "  Title: " << info.title;
+        AF_LOG(Debug) << "  Artist: " << info.artist;
+        AF_LOG(Debug) << "  Album: " << info.album;
         
     } else {
-        std::cerr << "Warning: Could not read metadata from " << filename << std::endl;
+        AF_LOG(Warn) << "Could not read metadata from " << filename;
         
         // Fallback to filename
         size_t lastSlash = filename.find_last_of("/\\");
@@ -98,204 +285,498 @@ SongInfo SongRecognizer::extractMetadata(const std::string& filename) {
     return info;
 }
 
-int SongRecognizer::scoreMatch(const std::vector<MatchOffset>& offsets) {
-    if (offsets.empty()) {
-        return 0;
+void SongRecognizer::displayTopMatches(const std::vector<ScoredMatch>& ranked) {
+    // Metadata is only fetched for the songs actually shown, and only when they are shown
+    if (!logEnabled(LogLevel::Debug)) {
+        return;
     }
     
-    // Calculate time deltas
-    std::vector<double> deltas;
-    deltas.reserve(offsets.size());
+    AF_LOG(Debug) << "Top potential matches:";
     
-    for (const auto& offset : offsets) {
-        deltas.push_back(offset.dbOffset - offset.sampleOffset);
+    for (size_t i = 0; i < ranked.size(); ++i) {
+        const ScoredMatch& match = ranked[i];
+        SongInfo info = db->getInfoForSongIdx(match.songIdx);
+        AF_LOG(Debug) << "  " << (i + 1) << ". " 
+                      << info.artist << " - " << info.title
+                      << " (Score: " << match.score 
+                      << ", Matches: " << match.matchCount << ")";
     }
-    
-    // Sort deltas to make histogram calculation easier
-    std::sort(deltas.begin(), deltas.end());
-    
-    // Create histogram with 0.5 second bins
-    const double binWidth = 0.5;
-    std::map<int, int> histogram;
-    
-    for (double delta : deltas) {
-        int bin = static_cast<int>(delta / binWidth);
-        histogram[bin]++;
+}
+
+bool SongRecognizer::fingerprintSong(const std::string& filename, PendingSong& song) {
+    try {
+        AF_LOG(Info) << "Registering: " << filename;
+        
+        song.hashes = fingerprintFileParallelOptimized(filename, catalogProfile);
+        
+        if (song.hashes.empty()) {
+            AF_LOG(Error) << "Failed to generate fingerprints for: " << filename;
+            return false;
+        }
+        
+        // Extract metadata using TagLib
+        song.info = extractMetadata(filename);
+        return true;
+        
+    } catch (const std::exception& e) {
+        AF_LOG(Error) << "Error registering " << filename << ": " << e.what();
+        return false;
     }
+}
+
+void SongRecognizer::invalidateHashIndex() {
+    // Only called after registrations, so the cached catalog size is stale too
+    catalogStatsStale.store(true);
     
-    // Find maximum count in histogram
-    int maxCount = 0;
-    for (const auto& pair : histogram) {
-        maxCount = std::max(maxCount, pair.second);
+    if (currentHashIndex()) {
+        AF_LOG(Info) << "Hash index no longer covers the catalog; using SQLite lookups until 'build-index' is run";
+        setHashIndex(nullptr);
     }
-    
-    return maxCount;
 }
 
-// Helper struct for ranking matches
-struct MatchRanking {
-    std::string songId;
-    SongInfo songInfo;
-    int score;
-    int matchCount;
+bool SongRecognizer::registerSong(const std::string& filename) {
+    if (db->songInDb(filename)) {
+        AF_LOG(Info) << "Song already registered: " << filename;
+        return true;
+    }
     
-    MatchRanking(const std::string& id, const SongInfo& info, int s, int count)
-        : songId(id), songInfo(info), score(s), matchCount(count) {}
-};
+    // The manifest row lets a rescan skip the file while it is unchanged
+    SourceFile source;
+    if (!describeSourceFile(filename, source)) {
+        source = SourceFile();
+    }
+    return registerFile(filename, source);
+}
 
-std::string SongRecognizer::bestMatch(const std::map<std::string, std::vector<MatchOffset>>& matches) {
-    std::string bestSongId;
-    int bestScore = 0;
+bool SongRecognizer::registerFile(const std::string& filename, const SourceFile& source) {
+    std::vector<PendingSong> batch(1);
+    if (!fingerprintSong(filename, batch.front())) {
+        return false;
+    }
+    PendingSong& song = batch.front();
+    song.source = source;
+    
+    // Store in database (the writer connection serializes concurrent callers)
+    bool success = storeSongBatch(batch);
     
-    for (const auto& match : matches) {
-        const std::string& songId = match.first;
-        const std::vector<MatchOffset>& offsets = match.second;
+    if (success) {
+        Metrics::add(Counter::SongsRegistered);
+        AF_LOG(Info) << "Successfully registered: " << filename 
+                     << " (" << song.hashes.size() << " hashes)";
+        AF_LOG(Debug) << "  Title: " << song.info.title;
+        AF_LOG(Debug) << "  Artist: " << song.info.artist;
+        AF_LOG(Debug) << "  Album: " << song.info.album;
+    } else {
+        AF_LOG(Error) << "Failed to store song in database: " << filename;
+    }
+    
+    return success;
+}
+
+bool SongRecognizer::attachShardDatabases(const std::vector<std::string>& paths) {
+    shardDbs.clear();
+    shardIndexPaths.clear();
+    shardIndexes.clear();
+    for (const auto& path : paths) {
+        auto shard = std::make_unique<Database>(path);
+        if (!shard->open()) {
+            AF_LOG(Error) << "Failed to open shard database: " << path;
+            shardDbs.clear();
+            return false;
+        }
         
-        // Skip if we can't possibly beat the best score
-        if (static_cast<int>(offsets.size()) < bestScore) {
-            continue;
+        FingerprintProfile shardCatalog;
+        FingerprintProfile shardQuery;
+        if (!profilesForTag(shard->getFingerprintProfile(), shardCatalog, shardQuery) ||
+            shardCatalog != catalogProfile) {
+            AF_LOG(Error) << "Shard database " << path << " uses another fingerprint profile ('"
+                          << shard->getFingerprintProfile() << "')";
+            shardDbs.clear();
+            return false;
         }
+        shardDbs.push_back(std::move(shard));
+        shardIndexPaths.push_back(HashIndex::defaultPathFor(path));
         
-        int score = scoreMatch(offsets);
-        if (score > bestScore) {
-            bestScore = score;
-            bestSongId = songId;
+        // Registrations add to a shard node's index like to the catalog's own
+        std::unique_ptr<SegmentedIndex> shardIndex;
+        if (SegmentedIndex::existsFor(shardIndexPaths.back())) {
+            shardIndex = std::make_unique<SegmentedIndex>(shardIndexPaths.back(), catalogProfile);
         }
+        shardIndexes.push_back(std::move(shardIndex));
     }
-    
-    return bestSongId;
+    return true;
 }
 
-void SongRecognizer::displayTopMatches(const std::map<std::string, std::vector<MatchOffset>>& matches) {
-    std::vector<MatchRanking> rankings;
+bool SongRecognizer::storeSongBatch(std::vector<PendingSong>& batch) {
+    if (shardDbs.empty()) {
+        if (!db->storeSongs(batch)) {
+            return false;
+        }
+        indexSongs(batch);
+        return true;
+    }
     
-    // Calculate scores for all matches
-    for (const auto& match : matches) {
-        const std::string& songId = match.first;
-        const std::vector<MatchOffset>& offsets = match.second;
-        
-        int score = scoreMatch(offsets);
-        int matchCount = static_cast<int>(offsets.size());
-        
-        // Get song info for display
-        SongInfo info = db->getInfoForSongId(songId);
-        
-        rankings.emplace_back(songId, info, score, matchCount);
+    // The catalog assigns the keys; each shard stores its rows under them
+    std::vector<SongInfo> infos;
+    infos.reserve(batch.size());
+    for (const auto& song : batch) {
+        infos.push_back(song.info);
+    }
+    if (!db->storeSongInfos(infos)) {
+        return false;
     }
+    invalidateHashIndex(); // The catalog holds no hash rows; the shard nodes index them
     
-    // Sort by score (descending), then by match count (descending)
-    std::sort(rankings.begin(), rankings.end(), 
-              [](const MatchRanking& a, const MatchRanking& b) {
-                  if (a.score != b.score) {
-                      return a.score > b.score;
-                  }
-                  return a.matchCount > b.matchCount;
-              });
+    const uint32_t count = static_cast<uint32_t>(shardDbs.size());
+    std::vector<std::vector<PendingSong>> shardBatches(count);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::vector<std::vector<HashResult>> parts = partitionByShard(batch[i].hashes, count);
+        for (uint32_t shard = 0; shard < count; ++shard) {
+            if (parts[shard].empty()) {
+                continue;
+            }
+            PendingSong part;
+            part.info = infos[i];
+            part.hashes = std::move(parts[shard]);
+            shardBatches[shard].push_back(std::move(part));
+        }
+    }
     
-    // Display top 10 (or fewer if less than 10)
-    std::cout << "Top potential matches:" << std::endl;
-    int displayCount = std::min(static_cast<int>(rankings.size()), 10);
+    // Shards are separate files with their own writers, so they are written in parallel
+    std::vector<std::future<bool>> writes;
+    for (uint32_t shard = 0; shard < count; ++shard) {
+        writes.push_back(std::async(std::launch::async, [this, &shardBatches, shard]() {
+            return shardBatches[shard].empty() || shardDbs[shard]->storeSongs(shardBatches[shard]);
+        }));
+    }
+    std::vector<uint32_t> storedOn;
+    for (uint32_t shard = 0; shard < count; ++shard) {
+        if (writes[shard].get()) {
+            storedOn.push_back(shard);
+        } else {
+            AF_LOG(Error) << "Failed to store " << shardBatches[shard].size() << " songs on shard " << shard;
+        }
+    }
     
-    for (int i = 0; i < displayCount; ++i) {
-        const auto& ranking = rankings[i];
-        std::cout << "  " << (i + 1) << ". " 
-                  << ranking.songInfo.artist << " - " << ranking.songInfo.title
-                  << " (Score: " << ranking.score 
-                  << ", Matches: " << ranking.matchCount << ")" << std::endl;
+    // A song is stored whole or not at all: without its catalog and manifest
+    // rows, a rescan registers the file again instead of adopting it
+    if (storedOn.size() != count) {
+        std::vector<uint32_t> songIdxs;
+        for (const auto& info : infos) {
+            songIdxs.push_back(info.songIdx);
+        }
+        bool rolledBack = db->deleteSongs(songIdxs);
+        for (uint32_t shard : storedOn) {
+            rolledBack = (shardBatches[shard].empty() || shardDbs[shard]->deleteSongs(songIdxs)) && rolledBack;
+        }
+        if (!rolledBack) {
+            AF_LOG(Error) << "Failed to roll back " << songIdxs.size() << " partly stored songs";
+        }
+        return false;
     }
-    std::cout << std::endl;
-}
-
-bool SongRecognizer::registerSong(const std::string& filename) {
-    std::lock_guard<std::mutex> lock(dbMutex);
     
-    if (db->songInDb(filename)) {
-        std::cout << "Song already registered: " << filename << std::endl;
-        return true;
+    // Shard nodes pick the new segments up on their next refresh
+    for (uint32_t shard = 0; shard < count; ++shard) {
+        if (shardIndexes[shard] && !shardBatches[shard].empty()) {
+            shardIndexes[shard]->add(shardBatches[shard]);
+        }
     }
     
-    try {
-        std::cout << "Registering: " << filename << std::endl;
-        
-        // Use OPTIMIZED fingerprinting
-        std::vector<HashResult> hashes = fingerprintFileParallelOptimized(filename);
-        
-        if (hashes.empty()) {
-            std::cerr << "Failed to generate fingerprints for: " << filename << std::endl;
-            return false;
+    // The manifest lives with the catalog, and only records songs every shard has
+    std::vector<SourceFile> sources;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (!batch[i].source.path.empty()) {
+            sources.push_back(batch[i].source);
+            sources.back().songIdx = infos[i].songIdx;
+        }
+    }
+    if (!sources.empty() && !db->storeSourceFiles(sources)) {
+        AF_LOG(Warn) << "Failed to record " << sources.size() << " source files; they are rescanned next time";
+    }
+    return true;
+}
+
+bool SongRecognizer::writeQueuedSongs(BoundedQueue<PendingSong>& queue, size_t& storedSongs) {
+    bool allSuccess = true;
+    std::vector<PendingSong> batch;
+    batch.reserve(INGEST_BATCH_SONGS);
+    
+    PendingSong song;
+    while (queue.pop(song)) {
+        // Take whatever else is already waiting, up to a full batch
+        batch.push_back(std::move(song));
+        while (static_cast<int>(batch.size()) < INGEST_BATCH_SONGS && queue.tryPop(song)) {
+            batch.push_back(std::move(song));
         }
         
-        // Extract metadata using TagLib
-        SongInfo songInfo = extractMetadata(filename);
-        
-        // Store in database
-        bool success = db->storeSong(hashes, songInfo);
+        size_t batchHashes = 0;
+        for (const auto& pending : batch) {
+            batchHashes += pending.hashes.size();
+        }
         
-        if (success) {
-            std::cout << "Successfully registered: " << filename 
-                      << " (" << hashes.size() << " hashes)" << std::endl;
-            std::cout << "  Title: " << songInfo.title << std::endl;
-            std::cout << "  Artist: " << songInfo.artist << std::endl;
-            std::cout << "  Album: " << songInfo.album << std::endl;
+        if (storeSongBatch(batch)) {
+            storedSongs += batch.size();
+            Metrics::add(Counter::SongsRegistered, batch.size());
+            AF_LOG(Info) << "Stored " << batch.size() << " songs (" << batchHashes << " hashes), "
+                         << storedSongs << " registered so far";
         } else {
-            std::cerr << "Failed to store song in database: " << filename << std::endl;
+            // Keep the good songs of a failed batch by retrying them one at a time
+            AF_LOG(Warn) << "Batch write failed, storing " << batch.size() << " songs individually";
+            for (auto& pending : batch) {
+                std::vector<PendingSong> single(1, std::move(pending));
+                if (storeSongBatch(single)) {
+                    storedSongs++;
+                    Metrics::add(Counter::SongsRegistered);
+                } else {
+                    AF_LOG(Error) << "Failed to store song in database: " << single.front().info.title;
+                    allSuccess = false;
+                }
+            }
         }
         
-        return success;
+        batch.clear();
+    }
+    
+    return allSuccess;
+}
+
+// Per-worker counters for a bulk registration run
+struct WorkerStats {
+    size_t files = 0;
+    size_t failed = 0;
+    size_t hashes = 0;
+    uintmax_t bytes = 0;
+    double busySeconds = 0.0;
+};
+
+// The manifest row of a walked file: size and mtime as the walk saw them,
+// and the digest diffLibrary already read for a modified file
+static SourceFile scannedSourceFile(const ScannedFile& file) {
+    SourceFile source;
+    source.path = file.path;
+    source.size = file.size;
+    source.mtime = file.mtime;
+    source.digest = file.digest.empty() ? fileDigest(file.path) : file.digest;
+    return source.digest.empty() ? SourceFile() : source;
+}
+
+static void printWorkerStats(const std::vector<WorkerStats>& workerStats, double wallSeconds) {
+    AF_LOG(Info) << "=== Worker Statistics ===";
+    
+    WorkerStats total;
+    for (size_t i = 0; i < workerStats.size(); ++i) {
+        const WorkerStats& stats = workerStats[i];
+        double mbPerSecond = stats.busySeconds > 0.0 ? (stats.bytes / 1048576.0) / stats.busySeconds : 0.0;
+        
+        AF_LOG(Info) << "Worker " << i << ": " << stats.files << " files, " 
+                     << stats.hashes << " hashes, " 
+                     << stats.failed << " failed, busy " << std::fixed << std::setprecision(1) 
+                     << stats.busySeconds << " s (" << std::setprecision(2) << mbPerSecond << " MB/s)";
         
-    } catch (const std::exception& e) {
-        std::cerr << "Error registering " << filename << ": " << e.what() << std::endl;
+        total.files += stats.files;
+        total.hashes += stats.hashes;
+        total.bytes += stats.bytes;
+    }
+    
+    if (wallSeconds > 0.0) {
+        AF_LOG(Info) << "Total: " << total.files << " files in " << std::fixed << std::setprecision(1) 
+                     << wallSeconds << " s (" << std::setprecision(2) << (total.files / wallSeconds) 
+                     << " files/s, " << ((total.bytes / 1048576.0) / wallSeconds) << " MB/s)";
+    }
+    AF_LOG(Info) << "=========================";
+}
+
+bool SongRecognizer::removeSongs(const std::vector<uint32_t>& songIdxs) {
+    if (!db->deleteSongs(songIdxs)) {
         return false;
     }
+    
+    // Shards hold the removed songs' rows under the same keys, and their
+    // nodes' indexes get the tombstones with their next refresh
+    std::vector<std::future<bool>> deletes;
+    for (size_t shard = 0; shard < shardDbs.size(); ++shard) {
+        Database* shardDb = shardDbs[shard].get();
+        SegmentedIndex* shardIndex = shardIndexes[shard].get();
+        const std::string& shardIndexPath = shardIndexPaths[shard];
+        deletes.push_back(std::async(std::launch::async, [shardDb, shardIndex, &shardIndexPath, &songIdxs]() {
+            if (!shardDb->deleteSongs(songIdxs)) {
+                return false;
+            }
+            if (shardIndex && !shardIndex->remove(songIdxs)) {
+                AF_LOG(Warn) << "Failed to update " << shardIndexPath << "; run 'build-index' on its shard";
+            }
+            return true;
+        }));
+    }
+    bool removed = true;
+    for (size_t shard = 0; shard < deletes.size(); ++shard) {
+        if (!deletes[shard].get()) {
+            AF_LOG(Error) << "Failed to remove " << songIdxs.size() << " songs from shard " << shard;
+            removed = false;
+        }
+    }
+    
+    // The index skips the removed songs' postings until compaction drops them
+    catalogStatsStale.store(true);
+    std::lock_guard<std::mutex> lock(segmentsMutex);
+    if (segmentedIndex && currentHashIndex()) {
+        if (segmentedIndex->remove(songIdxs)) {
+            setHashIndex(segmentedIndex->snapshot());
+        } else {
+            AF_LOG(Warn) << "Hash index could not record the removal; using SQLite lookups until 'build-index' is run";
+            setHashIndex(nullptr);
+        }
+    }
+    return removed;
 }
 
 bool SongRecognizer::registerDirectory(const std::string& path, int numWorkers) {
-    std::vector<std::string> supportedFiles = getSupportedFiles(path);
+    // Parallel walk, then one read of the manifest to diff it against
+    std::vector<ScannedFile> scanned;
+    bool walked = scanLibrary(path, isSupportedExtension, scanned);
+    if (!walked && scanned.empty()) {
+        AF_LOG(Error) << "Cannot read directory: " << path;
+        return false;
+    }
+    LibraryDiff diff = diffLibrary(path, scanned, db->loadSourceFiles());
+    
+    // A file an incomplete walk did not reach may still be there: only a
+    // clean walk removes songs
+    if (!walked && !diff.removed.empty()) {
+        AF_LOG(Warn) << "Directory walk of " << path << " was incomplete; keeping the "
+                     << diff.removed.size() << " songs of files it did not find";
+        diff.removed.clear();
+    }
     
-    if (supportedFiles.empty()) {
-        std::cout << "No supported audio files found in: " << path << std::endl;
+    if (scanned.empty() && diff.removed.empty()) {
+        AF_LOG(Info) << "No supported audio files found in: " << path;
         return false;
     }
     
-    std::cout << "Found " << supportedFiles.size() << " supported files" << std::endl;
+    // Songs registered before the manifest existed are adopted, not fingerprinted again
+    std::vector<SourceFile> adopted(diff.added.size());
+    ThreadPool::shared().parallelFor(diff.added.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t songIdx = db->getInfoForSongId(db->generateSongIdFromPath(diff.added[i].path)).songIdx;
+            if (songIdx != 0) {
+                adopted[i] = scannedSourceFile(diff.added[i]);
+                adopted[i].songIdx = adopted[i].path.empty() ? 0 : songIdx;
+            }
+        }
+    });
+    
+    std::vector<ScannedFile> toRegister;
+    for (size_t i = 0; i < diff.added.size(); ++i) {
+        if (adopted[i].songIdx != 0) {
+            diff.touched.push_back(std::move(adopted[i]));
+        } else {
+            toRegister.push_back(diff.added[i]);
+        }
+    }
+    size_t added = toRegister.size();
+    toRegister.insert(toRegister.end(), diff.modified.begin(), diff.modified.end());
+    
+    AF_LOG(Info) << "Found " << scanned.size() << " supported files: " << added << " new, "
+                 << diff.modified.size() << " modified, " << diff.removed.size() << " removed, "
+                 << (scanned.size() - toRegister.size()) << " unchanged";
+    
+    bool allSuccess = true;
+    if (!diff.touched.empty() && !db->storeSourceFiles(diff.touched)) {
+        allSuccess = false;
+    }
+    
+    // Modified files are registered again as new songs once their old rows are gone
+    std::vector<uint32_t> stale;
+    for (const auto& files : {&diff.replaced, &diff.removed}) {
+        for (const SourceFile& file : *files) {
+            if (file.songIdx != 0) {
+                stale.push_back(file.songIdx);
+            }
+        }
+    }
+    if (!stale.empty()) {
+        if (!removeSongs(stale)) {
+            AF_LOG(Error) << "Failed to remove " << stale.size() << " stale songs";
+            return false;
+        }
+        AF_LOG(Info) << "Removed " << stale.size() << " songs of deleted or modified files";
+    }
+    
+    if (!toRegister.empty() && !registerFiles(toRegister, numWorkers)) {
+        allSuccess = false;
+    }
     
+    // Hand the new songs to servers, then checkpoint without stalling their reads
+    flushHashIndex();
+    if (!toRegister.empty() || !stale.empty()) {
+        db->checkpointDb();
+    }
+    return allSuccess;
+}
+
+// The files come from a manifest diff: none of them has a song in the
+// catalog, and the walk already gave their size and mtime
+bool SongRecognizer::registerFiles(const std::vector<ScannedFile>& supportedFiles, int numWorkers) {
     if (numWorkers <= 1 || static_cast<int>(supportedFiles.size()) < numWorkers) {
         // Single-threaded processing
         bool allSuccess = true;
-        for (const std::string& file : supportedFiles) {
-            if (!registerSong(file)) {
+        for (const ScannedFile& file : supportedFiles) {
+            if (!registerFile(file.path, scannedSourceFile(file))) {
                 allSuccess = false;
             }
         }
         return allSuccess;
     } else {
-        // Multi-threaded processing
-        std::vector<std::future<bool>> futures;
+        // Pipeline: fingerprint workers feed a bounded queue drained by one writer
+        BoundedQueue<PendingSong> queue(static_cast<size_t>(numWorkers) * INGEST_QUEUE_DEPTH);
+        size_t storedSongs = 0;
+        
+        auto writer = std::async(std::launch::async, [this, &queue, &storedSongs]() {
+            return writeQueuedSongs(queue, storedSongs);
+        });
         
-        // Divide files among workers
-        size_t filesPerWorker = supportedFiles.size() / static_cast<size_t>(numWorkers);
-        size_t remainder = supportedFiles.size() % static_cast<size_t>(numWorkers);
+        // Shared work queue, largest files first, so a long file never starts last
+        std::vector<ScannedFile> workItems = supportedFiles;
+        std::stable_sort(workItems.begin(), workItems.end(),
+                         [](const ScannedFile& a, const ScannedFile& b) { return a.size > b.size; });
+        std::atomic<size_t> nextItem{0};
+        
+        auto runStart = std::chrono::steady_clock::now();
+        std::vector<WorkerStats> workerStats(static_cast<size_t>(numWorkers));
+        std::vector<std::future<bool>> futures;
         
-        size_t startIdx = 0;
         for (int i = 0; i < numWorkers; ++i) {
-            size_t endIdx = startIdx + filesPerWorker + (static_cast<size_t>(i) < remainder ? 1 : 0);
-            
-            std::vector<std::string> workerFiles(
-                supportedFiles.begin() + startIdx,
-                supportedFiles.begin() + endIdx
-            );
+            WorkerStats& stats = workerStats[static_cast<size_t>(i)];
             
-            futures.push_back(std::async(std::launch::async, [this, workerFiles]() {
+            futures.push_back(std::async(std::launch::async, [this, &queue, &workItems, &nextItem, &stats]() {
                 bool success = true;
-                for (const std::string& file : workerFiles) {
-                    if (!registerSong(file)) {
+                size_t item;
+                while ((item = nextItem.fetch_add(1)) < workItems.size()) {
+                    const ScannedFile& file = workItems[item];
+                    
+                    auto start = std::chrono::steady_clock::now();
+                    PendingSong song;
+                    bool fingerprinted = fingerprintSong(file.path, song);
+                    if (fingerprinted) {
+                        song.source = scannedSourceFile(file);
+                    }
+                    stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    
+                    if (!fingerprinted) {
+                        stats.failed++;
                         success = false;
+                        continue;
                     }
+                    
+                    stats.files++;
+                    stats.bytes += file.size;
+                    stats.hashes += song.hashes.size();
+                    
+                    // Blocks while the writer is behind
+                    queue.push(std::move(song));
                 }
                 return success;
             }));
-            
-            startIdx = endIdx;
         }
         
         // Wait for all workers to complete
@@ -306,69 +787,520 @@ bool SongRecognizer::registerDirectory(const std::string& path, int numWorkers)
             }
         }
         
-        // Checkpoint database for faster future reads
-        db->checkpointDb();
+        // Let the writer flush what is left
+        queue.close();
+        if (!writer.get()) {
+            allSuccess = false;
+        }
+        
+        double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+        printWorkerStats(workerStats, wallSeconds);
         
         return allSuccess;
     }
 }
 
+bool SongRecognizer::exportPack(const std::string& path) {
+    FingerprintPackWriter writer(path, catalogProfile);
+    bool complete = db->forEachSongRows([&writer](const SongInfo& info, std::vector<HashResult>& hashes) {
+        return writer.add(info, std::move(hashes));
+    });
+    if (!complete || !writer.finish()) {
+        AF_LOG(Error) << "Failed to export fingerprint pack: " << path;
+        return false;
+    }
+    
+    if (writer.songCount() == 0) {
+        AF_LOG(Warn) << "No hash rows to export; a sharded catalog's rows are on its shards";
+    }
+    AF_LOG(Info) << "Exported " << writer.songCount() << " songs (" << writer.hashCount() << " hashes) to " << path;
+    return true;
+}
+
+bool SongRecognizer::importPack(const std::string& path, bool keepSongKeys, uint32_t shard, uint32_t shardCount) {
+    FingerprintPack pack;
+    if (!pack.open(path, catalogProfile)) {
+        return false;
+    }
+    AF_LOG(Info) << "Importing " << pack.songCount() << " songs (" << pack.hashCount() << " hashes) from " << path;
+    if (shardCount > 0) {
+        AF_LOG(Info) << "Keeping the rows of shard " << shard << " of " << shardCount;
+    }
+    
+    size_t imported = 0;
+    size_t skipped = 0;
+    std::vector<PendingSong> batch;
+    batch.reserve(INGEST_BATCH_SONGS);
+    
+    auto storeBatch = [&]() {
+        if (batch.empty()) {
+            return true;
+        }
+        if (!storeSongBatch(batch)) {
+            AF_LOG(Error) << "Failed to store " << batch.size() << " imported songs";
+            return false;
+        }
+        imported += batch.size();
+        Metrics::add(Counter::SongsRegistered, batch.size());
+        batch.clear();
+        return true;
+    };
+    
+    bool complete = pack.forEachSong([&](PendingSong& song) {
+        if (db->getInfoForSongId(song.info.songId).songIdx != 0) {
+            skipped++;
+            return true;
+        }
+        if (shardCount > 0) {
+            // As with routed registrations, a shard stores no song it has no rows of
+            song.hashes.erase(std::remove_if(song.hashes.begin(), song.hashes.end(),
+                                             [shard, shardCount](const HashResult& hash) {
+                                                 return shardForHash(hash.hash, shardCount) != shard;
+                                             }),
+                              song.hashes.end());
+            if (song.hashes.empty()) {
+                return true;
+            }
+        } else if (!keepSongKeys) {
+            song.info.songIdx = 0;
+        }
+        batch.push_back(std::move(song));
+        return static_cast<int>(batch.size()) < INGEST_BATCH_SONGS || storeBatch();
+    });
+    complete = complete && storeBatch();
+    
+    flushHashIndex();
+    db->checkpointDb();
+    
+    AF_LOG(Info) << "Imported " << imported << " songs, " << skipped << " already present";
+    return complete;
+}
+
 SongInfo SongRecognizer::recognizeSong(const std::string& filename) {
+    return recognize(filename, RecognitionOptions()).song;
+}
+
+SongInfo SongRecognizer::recognizeFromHashes(const std::vector<HashResult>& hashes) {
+    return recognizeHashes(hashes, RecognitionOptions()).song;
+}
+
+RecognitionResult SongRecognizer::recognize(const std::string& filename, const RecognitionOptions& options) {
+    ScopedStageTimer timer(Stage::Recognition);
     try {
-        std::cout << "Recognizing: " << filename << std::endl;
+        AF_LOG(Info) << "Recognizing: " << filename;
         
-        // Use OPTIMIZED fingerprinting for recognition too
-        std::vector<HashResult> hashes = fingerprintFileParallelOptimized(filename);
+        std::vector<HashResult> hashes = fingerprintFileParallelOptimized(filename, getQueryProfile());
         
         if (hashes.empty()) {
-            std::cerr << "Failed to generate fingerprints for sample" << std::endl;
-            return SongInfo();
+            AF_LOG(Error) << "Failed to generate fingerprints for sample";
+            return RecognitionResult();
         }
         
-        return recognizeFromHashes(hashes);
+        return recognizeHashes(hashes, options);
         
     } catch (const std::exception& e) {
-        std::cerr << "Error recognizing " << filename << ": " << e.what() << std::endl;
-        return SongInfo();
+        AF_LOG(Error) << "Error recognizing " << filename << ": " << e.what();
+        return RecognitionResult();
     }
 }
 
-SongInfo SongRecognizer::recognizeFromHashes(const std::vector<HashResult>& hashes) {
-    std::lock_guard<std::mutex> lock(dbMutex);
+RecognitionResult SongRecognizer::recognizeBuffer(const void* data, size_t size, AudioFormat format,
+                                                  const RecognitionOptions& options) {
+    ScopedStageTimer timer(Stage::Recognition);
     
-    // Get matches from database
-    auto matches = db->getMatches(hashes);
+    // Decoded straight from memory: no temporary file
+    std::vector<HashResult> hashes = fingerprintBufferOptimized(data, size, format, getQueryProfile());
     
-    if (matches.empty()) {
-        std::cout << "No matches found in database" << std::endl;
-        return SongInfo();
+    if (hashes.empty()) {
+        AF_LOG(Error) << "Failed to generate fingerprints for sample";
+        return RecognitionResult();
     }
     
-    std::cout << "Found potential matches in " << matches.size() << " songs" << std::endl;
+    return recognizeHashes(hashes, options);
+}
+
+namespace {
+
+int runnerUpScore(const std::vector<ScoredMatch>& ranked) {
+    return ranked.size() > 1 ? ranked[1].score : 0;
+}
+
+// Relative lead over the runner-up, scaled down while the score itself is weak
+double matchConfidence(const std::vector<ScoredMatch>& ranked, int minScore) {
+    if (ranked.empty() || ranked.front().score <= 0) {
+        return 0.0;
+    }
+    double best = ranked.front().score;
+    double separation = (best - runnerUpScore(ranked)) / best;
+    double strength = std::min(1.0, best / std::max(1, minScore));
+    return separation * strength;
+}
+
+} // namespace
+
+bool isConfidentMatch(const MatchScorer& scorer, const RecognitionOptions& options) {
+    std::vector<ScoredMatch> leaders = scorer.top(2, MIN_SONG_MATCHES);
+    return !leaders.empty() && leaders.front().score >= options.minScore &&
+           leaders.front().score - runnerUpScore(leaders) >= options.scoreMargin;
+}
+
+void SongRecognizer::setShardLookup(uint32_t count, ShardLookup lookup) {
+    shardCount = count;
+    shardLookup = std::move(lookup);
+}
+
+void SongRecognizer::matchShards(const std::vector<HashResult>& hashes, MatchScorer& scorer) {
+    std::vector<std::vector<HashResult>> parts = partitionByShard(hashes, shardCount);
+    
+    // Every shard is queried at once; a query costs the slowest shard, not their sum
+    std::vector<std::vector<ScoreBin>> shardBins(shardCount);
+    std::vector<std::future<bool>> lookups(shardCount);
+    for (uint32_t shard = 0; shard < shardCount; ++shard) {
+        if (!parts[shard].empty()) {
+            lookups[shard] = std::async(std::launch::async, [this, &parts, &shardBins, shard]() {
+                return shardLookup(shard, parts[shard], shardBins[shard]);
+            });
+        }
+    }
+    
+    // Rows of one hash live on one shard, so summing the histograms gives the unsharded one
+    uint64_t rows = 0;
+    for (uint32_t shard = 0; shard < shardCount; ++shard) {
+        if (!lookups[shard].valid()) {
+            continue;
+        }
+        if (!lookups[shard].get()) {
+            AF_LOG(Warn) << "Shard " << shard << " did not answer; matching without its "
+                         << parts[shard].size() << " hashes";
+            continue;
+        }
+        for (const ScoreBin& bin : shardBins[shard]) {
+            scorer.addBin(bin.songIdx, bin.bin, bin.count);
+            rows += bin.count;
+        }
+    }
+    
+    Metrics::add(Counter::QueryHashes, hashes.size());
+    Metrics::add(Counter::MatchedRows, rows);
+}
+
+std::vector<ScoreBin> SongRecognizer::scoreBins(const std::vector<HashResult>& hashes) {
+    MatchScorer scorer(hashes.size());
+    matchHashes(hashes, scorer);
+    
+    std::vector<ScoreBin> bins;
+    scorer.forEachBin([&bins](const ScoreBin& bin) { bins.push_back(bin); });
+    return bins;
+}
+
+void SongRecognizer::matchHashes(const std::vector<HashResult>& hashes, MatchScorer& scorer) {
+    ScopedStageTimer timer(Stage::Lookup);
     
-    // Display top matches with rankings
-    displayTopMatches(matches);
+    if (shardLookup) {
+        matchShards(hashes, scorer);
+        return;
+    }
     
-    // Find best match
-    std::string bestSongId = bestMatch(matches);
+    // No global lock: the index is immutable and SQLite lookups use pooled read connections
+    std::shared_ptr<const IndexSnapshot> index = currentHashIndex();
     
-    if (bestSongId.empty()) {
-        std::cout << "No confident match found" << std::endl;
-        return SongInfo();
+    // Score rows as they come out of the hash index when available, otherwise SQLite
+    uint64_t rows = 0;
+    auto addRow = [&scorer, &rows](uint32_t songIdx, uint32_t dbOffset, uint32_t sampleOffset) {
+        scorer.add(songIdx, dbOffset, sampleOffset);
+        rows++;
+    };
+    if (index) {
+        // Hashes no song holds are dropped before they reach the index
+        std::vector<HashResult> present;
+        present.reserve(hashes.size());
+        for (const auto& hash : hashes) {
+            if (index->mayContain(hash.hash)) {
+                present.push_back(hash);
+            }
+        }
+        Metrics::add(Counter::FilteredHashes, hashes.size() - present.size());
+        
+        uint64_t stopped = 0;
+        index->forEachMatch(present, addRow, stopHashPostings, &stopped);
+        Metrics::add(Counter::StopHashes, stopped);
+    } else {
+        db->forEachMatch(hashes, addRow);
     }
     
-    // Get song information
-    SongInfo info = db->getInfoForSongId(bestSongId);
+    Metrics::add(Counter::QueryHashes, hashes.size());
+    Metrics::add(Counter::MatchedRows, rows);
+}
+
+RecognitionResult SongRecognizer::recognizeHashes(const std::vector<HashResult>& hashes, const RecognitionOptions& options) {
+    RecognitionResult result;
+    MatchScorer scorer(hashes.size());
     
-    if (!info.songId.empty()) {
-        int matchCount = matches[bestSongId].size();
-        int score = scoreMatch(matches[bestSongId]);
+    uint32_t lastFrame = 0;
+    for (const auto& hash : hashes) {
+        lastFrame = std::max(lastFrame, hash.offsetFrame);
+    }
+    
+    if (!options.progressive) {
+        matchHashes(hashes, scorer);
+        result.secondsUsed = frameToSeconds(lastFrame);
+    } else {
+        // Earliest audio first; scores only grow, so the leader can be checked after every batch
+        std::vector<HashResult> ordered(hashes);
+        std::stable_sort(ordered.begin(), ordered.end(), [](const HashResult& a, const HashResult& b) {
+            return a.offsetFrame < b.offsetFrame;
+        });
         
-        std::cout << "Match found: " << info.artist << " - " << info.title 
-                  << " (Score: " << score << ", Matches: " << matchCount << ")" << std::endl;
+        const uint32_t batchFrames = std::max<uint32_t>(1, secondsToFrame(options.batchSeconds));
+        std::vector<HashResult> batch;
+        std::unordered_set<long> matched; // A hash scores at its earliest offset only, as in one lookup
+        
+        for (size_t begin = 0; begin < ordered.size(); ) {
+            uint32_t batchEnd = ordered[begin].offsetFrame + batchFrames;
+            size_t end = begin;
+            while (end < ordered.size() && ordered[end].offsetFrame < batchEnd) {
+                end++;
+            }
+            
+            batch.clear();
+            for (size_t i = begin; i < end; ++i) {
+                if (matched.insert(ordered[i].hash).second) {
+                    batch.push_back(ordered[i]);
+                }
+            }
+            matchHashes(batch, scorer);
+            result.secondsUsed = frameToSeconds(std::min(batchEnd, lastFrame));
+            begin = end;
+            
+            if (isConfidentMatch(scorer, options)) {
+                result.earlyExit = begin < ordered.size();
+                break;
+            }
+        }
     }
     
-    return info;
+    resolveMatch(scorer, options, result);
+    return result;
+}
+
+namespace {
+
+// One distinct (hash, clip) pair of a batch, with the clip's sample offset
+struct BatchEntry {
+    long hash;
+    uint32_t clip;
+    uint32_t sampleOffset;
+};
+
+} // namespace
+
+std::vector<std::vector<HashResult>> SongRecognizer::fingerprintClips(
+    size_t count, const std::function<std::vector<HashResult>(size_t)>& fingerprint, int numWorkers) {
+    std::vector<std::vector<HashResult>> clipHashes(count);
+    std::atomic<size_t> nextClip{0};
+    
+    auto worker = [&clipHashes, &nextClip, &fingerprint, count]() {
+        size_t clip;
+        while ((clip = nextClip.fetch_add(1)) < count) {
+            try {
+                clipHashes[clip] = fingerprint(clip);
+            } catch (const std::exception& e) {
+                AF_LOG(Error) << "Error fingerprinting clip " << clip + 1 << ": " << e.what();
+            }
+        }
+    };
+    
+    size_t workers = std::min(count, static_cast<size_t>(std::max(1, numWorkers)));
+    std::vector<std::future<void>> futures;
+    for (size_t i = 1; i < workers; ++i) {
+        futures.push_back(std::async(std::launch::async, worker));
+    }
+    worker();
+    for (auto& future : futures) {
+        future.get();
+    }
+    
+    return clipHashes;
+}
+
+std::vector<RecognitionResult> SongRecognizer::recognizeFiles(const std::vector<std::string>& filenames,
+                                                              const RecognitionOptions& options, int numWorkers) {
+    AF_LOG(Info) << "Recognizing " << filenames.size() << " files";
+    
+    std::vector<std::vector<HashResult>> clipHashes = fingerprintClips(filenames.size(), [this, &filenames](size_t clip) {
+        return fingerprintFileParallelOptimized(filenames[clip], getQueryProfile());
+    }, numWorkers);
+    
+    return recognizeHashBatch(clipHashes, options);
+}
+
+std::vector<RecognitionResult> SongRecognizer::recognizeBuffers(const std::vector<AudioClip>& clips,
+                                                                const RecognitionOptions& options, int numWorkers) {
+    std::vector<std::vector<HashResult>> clipHashes = fingerprintClips(clips.size(), [this, &clips](size_t clip) {
+        return fingerprintBufferOptimized(clips[clip].data, clips[clip].size, clips[clip].format, getQueryProfile());
+    }, numWorkers);
+    
+    return recognizeHashBatch(clipHashes, options);
+}
+
+void SongRecognizer::matchHashBatch(const std::vector<std::vector<HashResult>>& clipHashes,
+                                    std::vector<MatchScorer>& scorers) {
+    // Same offsets as a single query: one per distinct hash of a clip, the earliest
+    std::vector<BatchEntry> entries;
+    size_t queryHashes = 0;
+    for (size_t clip = 0; clip < clipHashes.size(); ++clip) {
+        queryHashes += clipHashes[clip].size();
+        for (const auto& hash : clipHashes[clip]) {
+            entries.push_back({hash.hash, static_cast<uint32_t>(clip), hash.offsetFrame});
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const BatchEntry& a, const BatchEntry& b) {
+        if (a.hash != b.hash) {
+            return a.hash < b.hash;
+        }
+        return a.clip != b.clip ? a.clip < b.clip : a.sampleOffset < b.sampleOffset;
+    });
+    
+    std::vector<BatchEntry> distinctEntries;
+    std::vector<long> distinctHashes;
+    distinctEntries.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        bool firstOfPair = i == 0 || entries[i - 1].hash != entries[i].hash || entries[i - 1].clip != entries[i].clip;
+        if (!firstOfPair) {
+            continue;
+        }
+        if (distinctHashes.empty() || distinctHashes.back() != entries[i].hash) {
+            distinctHashes.push_back(entries[i].hash);
+        }
+        distinctEntries.push_back(entries[i]);
+    }
+    entries.clear();
+    entries.shrink_to_fit();
+    
+    AF_LOG(Debug) << "Batch lookup: " << distinctHashes.size() << " distinct hashes for " << queryHashes
+                  << " query hashes across " << clipHashes.size() << " clips";
+    
+    // One lookup for the whole batch; each row goes to every clip holding its hash
+    uint64_t rows = 0;
+    auto addRow = [&distinctEntries, &scorers, &rows](long hash, uint32_t songIdx, uint32_t dbOffset) {
+        rows++;
+        auto range = std::equal_range(distinctEntries.begin(), distinctEntries.end(), BatchEntry{hash, 0, 0},
+                                      [](const BatchEntry& a, const BatchEntry& b) { return a.hash < b.hash; });
+        for (auto it = range.first; it != range.second; ++it) {
+            scorers[it->clip].add(songIdx, dbOffset, it->sampleOffset);
+        }
+    };
+    size_t distinct = distinctHashes.size();
+    {
+        ScopedStageTimer timer(Stage::Lookup);
+        std::shared_ptr<const IndexSnapshot> index = currentHashIndex();
+        if (index) {
+            distinctHashes.erase(std::remove_if(distinctHashes.begin(), distinctHashes.end(),
+                                                [&index](long hash) { return !index->mayContain(hash); }),
+                                 distinctHashes.end());
+            Metrics::add(Counter::FilteredHashes, distinct - distinctHashes.size());
+            
+            uint64_t stopped = 0;
+            index->forEachHashMatch(distinctHashes, addRow, stopHashPostings, &stopped);
+            Metrics::add(Counter::StopHashes, stopped);
+        } else {
+            db->forEachHashMatch(distinctHashes, addRow);
+        }
+    }
+    Metrics::add(Counter::QueryHashes, distinct);
+    Metrics::add(Counter::MatchedRows, rows);
+}
+
+std::vector<RecognitionResult> SongRecognizer::recognizeHashBatch(const std::vector<std::vector<HashResult>>& clipHashes,
+                                                                  const RecognitionOptions& options) {
+    std::vector<RecognitionResult> results(clipHashes.size());
+    
+    std::vector<MatchScorer> scorers;
+    scorers.reserve(clipHashes.size());
+    for (const auto& hashes : clipHashes) {
+        scorers.emplace_back(hashes.size());
+    }
+    
+    if (shardLookup) {
+        // Shard nodes score one query at a time, so each clip is its own fan-out
+        for (size_t clip = 0; clip < clipHashes.size(); ++clip) {
+            if (!clipHashes[clip].empty()) {
+                matchHashes(clipHashes[clip], scorers[clip]);
+            }
+        }
+    } else {
+        matchHashBatch(clipHashes, scorers);
+    }
+    
+    for (size_t clip = 0; clip < clipHashes.size(); ++clip) {
+        if (clipHashes[clip].empty()) {
+            AF_LOG(Info) << "Clip " << clip + 1 << "/" << clipHashes.size() << ": Failed to generate fingerprints for sample";
+            continue;
+        }
+        AF_LOG(Debug) << "Clip " << clip + 1 << "/" << clipHashes.size() << ": " << clipHashes[clip].size() << " hashes";
+        
+        uint32_t lastFrame = 0;
+        for (const auto& hash : clipHashes[clip]) {
+            lastFrame = std::max(lastFrame, hash.offsetFrame);
+        }
+        results[clip].secondsUsed = frameToSeconds(lastFrame);
+        resolveMatch(scorers[clip], options, results[clip]);
+    }
+    
+    return results;
+}
+
+bool SongRecognizer::resolveMatch(const MatchScorer& scorer, const RecognitionOptions& options,
+                                  RecognitionResult& result) {
+    ScopedStageTimer timer(Stage::Scoring);
+    Metrics::add(Counter::Recognitions);
+    
+    size_t candidates = scorer.candidateCount(MIN_SONG_MATCHES);
+    if (candidates == 0) {
+        AF_LOG(Info) << "No matches found in database";
+        return false;
+    }
+    
+    AF_LOG(Debug) << "Found potential matches in " << candidates << " songs";
+    
+    // Display top matches with rankings; the first one is the best match
+    std::vector<ScoredMatch> ranked = scorer.top(TOP_MATCHES_SHOWN, MIN_SONG_MATCHES);
+    displayTopMatches(ranked);
+    
+    const ScoredMatch& best = ranked.front();
+    if (best.score <= 0) {
+        AF_LOG(Info) << "No confident match found";
+        return false;
+    }
+    
+    // Get song information
+    result.song = db->getInfoForSongIdx(best.songIdx);
+    if (result.song.songId.empty()) {
+        return false;
+    }
+    
+    result.score = best.score;
+    result.matchCount = best.matchCount;
+    result.confidence = matchConfidence(ranked, options.minScore);
+    Metrics::add(Counter::Matches);
+    
+    AF_LOG(Info) << "Match found: " << result.song.artist << " - " << result.song.title 
+                 << " (Score: " << best.score << ", Matches: " << best.matchCount << ")";
+    AF_LOG(Info) << "Confidence: " << std::fixed << std::setprecision(2) << result.confidence
+                 << " after " << std::setprecision(1) << result.secondsUsed << " s of audio"
+                 << (result.earlyExit ? " (stopped early)" : "") << std::defaultfloat;
+    
+    return true;
+}
+
+CatalogStats SongRecognizer::getCatalogStats() {
+    // COUNT(*) over the hash table is a full scan, so it is only redone after registrations
+    std::lock_guard<std::mutex> lock(catalogStatsMutex);
+    if (catalogStatsStale.exchange(false)) {
+        catalogStats.totalSongs = db->getTotalSongs();
+        catalogStats.totalHashes = db->getTotalHashes();
+    }
+    return catalogStats;
 }
 
 void SongRecognizer::printDatabaseStats() {
@@ -381,10 +1313,38 @@ void SongRecognizer::printDatabaseStats() {
     std::cout << "Total songs: " << totalSongs << std::endl;
     std::cout << "Total hashes: " << totalHashes << std::endl;
     
+    std::shared_ptr<const IndexSnapshot> index = currentHashIndex();
+    if (index) {
+        std::cout << "Hash index: " << indexPath << " (" << index->postingCount() << " postings in "
+                  << index->flushedParts << " files and " << index->parts.size() - index->flushedParts
+                  << " in-memory runs)" << std::endl;
+        if (index->filter) {
+            std::cout << "Hash filter: " << index->filter->size() << " hashes, "
+                      << index->filter->memoryBytes() / (1024 * 1024) << " MB" << std::endl;
+        }
+        
+        HashFrequencyStats frequency = index->frequencyStats(stopHashPostings);
+        std::cout << "Postings per hash: median " << frequency.median << ", p99 " << frequency.p99
+                  << ", max " << frequency.max << " over " << frequency.hashes << " distinct hashes" << std::endl;
+        if (stopHashPostings > 0) {
+            double share = frequency.postings > 0 ? 100.0 * frequency.stopPostings / frequency.postings : 0.0;
+            std::cout << "Stop hashes: " << frequency.stopHashes << " over " << stopHashPostings
+                      << " postings, holding " << std::fixed << std::setprecision(1) << share
+                      << "% of postings, skipped at query time" << std::endl;
+        }
+    } else {
+        std::cout << "Hash index: not loaded" << std::endl;
+    }
+    
     if (totalSongs > 0) {
         std::cout << "Average hashes per song: " << (totalHashes / totalSongs) << std::endl;
     }
     
+    for (size_t shard = 0; shard < shardDbs.size(); ++shard) {
+        std::cout << "Shard " << shard << ": " << shardDbs[shard]->getTotalSongs() << " songs, "
+                  << shardDbs[shard]->getTotalHashes() << " hashes" << std::endl;
+    }
+    
     std::cout << "==========================" << std::endl;
 }
 
@@ -398,7 +1358,7 @@ std::vector<std::string> SongRecognizer::getSupportedFiles(const std::string& di
             }
         }
     } catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << "Error accessing directory " << directory << ": " << e.what() << std::endl;
+        AF_LOG(Error) << "Error accessing directory " << directory << ": " << e.what();
     }
     
     return supportedFiles;
@@ -415,44 +1375,4 @@ bool SongRecognizer::isSupportedExtension(const std::string& filename) {
            != supportedExtensions.end();
 }
 
-void registerSongThreadSafe(const std::string& filename, Database* database, std::mutex* mutex) {
-    std::lock_guard<std::mutex> lock(*mutex);
-    
-    try {
-        if (database->songInDb(filename)) {
-            return;
-        }
-        
-        // Use OPTIMIZED fingerprinting
-        std::vector<HashResult> hashes = fingerprintFileParallelOptimized(filename);
-        
-        // Extract metadata using TagLib directly
-        SongInfo songInfo;
-        TagLib::FileRef file(filename.c_str());
-        
-        if (!file.isNull() && file.tag()) {
-            TagLib::Tag* tag = file.tag();
-            songInfo.title = tag->title().to8Bit(true);
-            songInfo.artist = tag->artist().to8Bit(true);
-            songInfo.album = tag->album().to8Bit(true);
-            
-            // Fallbacks for empty fields
-            if (songInfo.title.empty()) songInfo.title = "Unknown Title";
-            if (songInfo.artist.empty()) songInfo.artist = "Unknown Artist";
-            if (songInfo.album.empty()) songInfo.album = "Unknown Album";
-        } else {
-            songInfo.title = "Unknown Title";
-            songInfo.artist = "Unknown Artist";
-            songInfo.album = "Unknown Album";
-        }
-        
-        songInfo.songId = database->generateSongIdFromPath(filename);
-        
-        database->storeSong(hashes, songInfo);
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error in thread-safe registration: " << e.what() << std::endl;
-    }
-}
-
 } // namespace AudioFingerprinting
\ No newline at end of file
@@ -3,41 +3,226 @@
 
 #include "../utils/Types.h"
 #include "../storage/Storage.h"
+#include "../storage/HashIndex.h"
+#include "../storage/SegmentedIndex.h"
+#include "../storage/LibraryScan.h"
+#include "../storage/Sharding.h"
+#include "../utils/BoundedQueue.h"
+#include "MatchScorer.h"
+#include "../audio/AudioStream.h"
+#include "../core/Constants.h"
+#include "../core/FingerprintProfile.h"
 #include <string>
 #include <vector>
 #include <map>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <future>
 
 namespace AudioFingerprinting {
 
+// Per-request recognition settings. In progressive mode the query's hashes
+// are matched in time order, batchSeconds of audio at a time, and matching
+// stops as soon as the leading song reaches minScore and is ahead of the
+// runner-up by scoreMargin.
+struct RecognitionOptions {
+    bool progressive = false;
+    double batchSeconds = PROGRESSIVE_BATCH_SECONDS;
+    int minScore = EARLY_EXIT_MIN_SCORE;
+    int scoreMargin = EARLY_EXIT_SCORE_MARGIN;
+};
+
+struct RecognitionResult {
+    SongInfo song;              // songId is empty when nothing matched
+    int score = 0;              // Aligned-offset score of the match
+    int matchCount = 0;
+    double confidence = 0.0;    // 0..1: lead over the runner-up, scaled down below minScore
+    double secondsUsed = 0.0;   // Query audio matched before deciding
+    bool earlyExit = false;     // Progressive mode stopped before the end of the query
+};
+
+// Catalog size as of the last registration
+struct CatalogStats {
+    int totalSongs = 0;
+    int totalHashes = 0;
+};
+
+// One in-memory clip of a batch (an uploaded file)
+struct AudioClip {
+    const void* data = nullptr;
+    size_t size = 0;
+    AudioFormat format = AudioFormat::UNKNOWN;
+};
+
+// Coordinator transport: fills bins with shard's offset histogram for
+// hashes, which all belong to that shard. False when the shard failed.
+using ShardLookup = std::function<bool(uint32_t shard, const std::vector<HashResult>& hashes,
+                                       std::vector<ScoreBin>& bins)>;
+
+// The progressive stopping rule: the leader has reached minScore and is
+// scoreMargin ahead of the runner-up
+bool isConfidentMatch(const MatchScorer& scorer, const RecognitionOptions& options);
+
 class SongRecognizer {
 private:
     std::unique_ptr<Database> db;
-    static std::mutex dbMutex; // For thread-safe database operations
+    std::shared_ptr<const IndexSnapshot> hashIndex; // Optional read-optimized lookup path
+    std::string indexPath;
+    std::string wisdomPath;   // FFTW wisdom kept beside the database
+    mutable std::mutex indexMutex; // Guards swapping hashIndex, not lookups through it
+    
+    // Files and unflushed runs behind hashIndex; registrations add to it
+    // instead of invalidating it, and compaction runs in the background
+    std::shared_ptr<SegmentedIndex> segmentedIndex;
+    std::future<void> compaction;
+    std::mutex segmentsMutex; // Guards segmentedIndex and compaction
+    static std::mutex dbMutex; // Serializes index rebuilds and stats; lookups do not take it
+    
+    std::mutex catalogStatsMutex;
+    CatalogStats catalogStats;
+    std::atomic<bool> catalogStatsStale{true}; // Set by registrations, cleared by getCatalogStats
+    
+    std::vector<std::unique_ptr<Database>> shardDbs; // Hash rows of a sharded catalog, by shard
+    std::vector<std::string> shardIndexPaths;        // Their shard nodes' default index files
+    std::vector<std::unique_ptr<SegmentedIndex>> shardIndexes; // On the ones that exist, else null
+    ShardLookup shardLookup;  // Set on a coordinator: lookups go to the shard nodes
+    uint32_t shardCount = 0;
+    
+    uint64_t stopHashPostings = INDEX_STOP_HASH_POSTINGS;
+    
+    // Chosen by the database's profile tag: registration fingerprints with
+    // the catalog profile, and so does recognition unless dense queries are
+    // enabled, which use its query companion
+    FingerprintProfile catalogProfile = FingerprintProfile::Catalog;
+    FingerprintProfile queryCompanion = FingerprintProfile::Query;
+    bool denseQueries = false;
+    
+    std::shared_ptr<const IndexSnapshot> currentHashIndex() const;
+    void setHashIndex(std::shared_ptr<const IndexSnapshot> index);
     
     // Helper methods
-    int scoreMatch(const std::vector<MatchOffset>& offsets);
-    std::string bestMatch(const std::map<std::string, std::vector<MatchOffset>>& matches);
     SongInfo extractMetadata(const std::string& filename);
-    void displayTopMatches(const std::map<std::string, std::vector<MatchOffset>>& matches);
+    void displayTopMatches(const std::vector<ScoredMatch>& ranked);
+    
+    // Registration pipeline stages
+    bool fingerprintSong(const std::string& filename, PendingSong& song);
+    bool registerFile(const std::string& filename, const SourceFile& source);
+    bool writeQueuedSongs(BoundedQueue<PendingSong>& queue, size_t& storedSongs);
+    bool storeSongBatch(std::vector<PendingSong>& batch);
+    bool registerFiles(const std::vector<ScannedFile>& files, int numWorkers);
+    bool removeSongs(const std::vector<uint32_t>& songIdxs); // Catalog and shards
+    void indexSongs(const std::vector<PendingSong>& batch);
+    void startCompaction();
+    void invalidateHashIndex();
+    
+    // Batch stage: fingerprint(i) for every clip, numWorkers at a time
+    std::vector<std::vector<HashResult>> fingerprintClips(
+        size_t count, const std::function<std::vector<HashResult>(size_t)>& fingerprint, int numWorkers);
+    void matchHashBatch(const std::vector<std::vector<HashResult>>& clipHashes, std::vector<MatchScorer>& scorers);
+    void matchShards(const std::vector<HashResult>& hashes, MatchScorer& scorer);
     
 public:
     SongRecognizer(const std::string& dbPath = "fingerprints.db");
     ~SongRecognizer();
     
-    // Database management
+    // Database management. Fails on a database whose fingerprint profile
+    // this build does not have, since its hashes would never match.
     bool initializeDatabase();
+    FingerprintProfile getCatalogProfile() const { return catalogProfile; }
+    FingerprintProfile getQueryProfile() const { return denseQueries ? queryCompanion : catalogProfile; }
+    
+    // Fingerprint queries with the denser query profile instead of the
+    // catalog's. Off by default: it makes two to three times as many hashes
+    // per clip, and neither its recall nor its false-match rate has been
+    // measured yet (audioFingerprintingBench --dense-queries), nor have the
+    // progressive minScore and scoreMargin been retuned for it.
+    void setDenseQueries(bool enabled) { denseQueries = enabled; }
+    
+    // Hash index management (defaults to <dbPath>.idx)
+    void setIndexPath(const std::string& path) { indexPath = path; }
+    const std::string& getIndexPath() const { return indexPath; }
+    bool loadHashIndex();
+    bool buildHashIndex();
+    
+    // Query hashes with more postings than this (silence, common drum hits,
+    // pure tones) are skipped: they cost thousands of rows and tell songs
+    // apart poorly. 0 looks up every hash. Applies to hash index lookups.
+    void setStopHashLimit(uint64_t postings) { stopHashPostings = postings; }
+    
+    // Writes songs registered since the last flush to a segment file, so
+    // servers pick them up, and waits for a running compaction
+    void flushHashIndex();
+    
+    // Picks up segments other processes flushed; true when the view changed
+    bool refreshHashIndex();
+    
+    // Sharded catalog. With shard databases attached, this database keeps
+    // song_info only and each hash row is written to the shard owning its
+    // hash (shardForHash), under the song_idx the catalog assigned. Every
+    // shard must use the catalog's fingerprint profile. A shard that has a
+    // hash index gets each batch as index segments too, so its node picks
+    // the songs up on refresh; a batch that fails on any shard is rolled back.
+    bool attachShardDatabases(const std::vector<std::string>& paths);
+    
+    // Coordinator side: lookups are split by shard, sent to all shards in
+    // parallel and their offset histograms merged before scoring. Song info
+    // still comes from this database, the catalog.
+    void setShardLookup(uint32_t shardCount, ShardLookup lookup);
+    
+    // Shard side: the offset histogram of this database's rows for hashes
+    std::vector<ScoreBin> scoreBins(const std::vector<HashResult>& hashes);
     
     // Song registration
+    // registerDirectory diffs the directory against the library manifest:
+    // only new and modified files are fingerprinted, and the songs of files
+    // deleted from it (or modified) are removed, the former only after a walk
+    // that read the whole directory. Removed songs are tombstoned in the hash
+    // index, which skips their postings until compaction drops them.
     bool registerSong(const std::string& filename);
     bool registerDirectory(const std::string& path, int numWorkers = 4);
     
+    // Fingerprint packs (FingerprintPack.h). exportPack writes every song
+    // with hash rows in this database. importPack stores a pack's songs
+    // through the registration write path, so they reach the shards and the
+    // index segments like registered songs, and skips songs already present.
+    // keepSongKeys stores them under their exported song_idx, as seeding a
+    // shard or replica of the same catalog needs. A shardCount other than 0
+    // keeps only the rows shardForHash assigns to shard, under their
+    // exported keys, to load one shard node from a whole catalog's pack.
+    bool exportPack(const std::string& path);
+    bool importPack(const std::string& path, bool keepSongKeys = false, uint32_t shard = 0, uint32_t shardCount = 0);
+    
     // Song recognition
     SongInfo recognizeSong(const std::string& filename);
     SongInfo recognizeFromHashes(const std::vector<HashResult>& hashes);
+    RecognitionResult recognize(const std::string& filename, const RecognitionOptions& options);
+    RecognitionResult recognizeBuffer(const void* data, size_t size, AudioFormat format,
+                                      const RecognitionOptions& options);
+    RecognitionResult recognizeHashes(const std::vector<HashResult>& hashes, const RecognitionOptions& options);
+    
+    // Batch recognition: clips are fingerprinted in parallel, the distinct
+    // hashes of all of them are looked up once, and the rows are scored per
+    // clip. Results are in input order; a clip that could not be
+    // fingerprinted gets an empty result. Every clip is matched in full
+    // (options.progressive does not apply).
+    std::vector<RecognitionResult> recognizeFiles(const std::vector<std::string>& filenames,
+                                                  const RecognitionOptions& options, int numWorkers = 4);
+    std::vector<RecognitionResult> recognizeBuffers(const std::vector<AudioClip>& clips,
+                                                    const RecognitionOptions& options, int numWorkers = 4);
+    std::vector<RecognitionResult> recognizeHashBatch(const std::vector<std::vector<HashResult>>& clipHashes,
+                                                      const RecognitionOptions& options);
+    
+    // Building blocks for callers that collect hashes themselves (live streams):
+    // adds the database rows matching hashes to scorer, and fills result's song,
+    // score and confidence from the scorer's leader. secondsUsed and earlyExit
+    // are left to the caller. Returns false when there is no match.
+    void matchHashes(const std::vector<HashResult>& hashes, MatchScorer& scorer);
+    bool resolveMatch(const MatchScorer& scorer, const RecognitionOptions& options, RecognitionResult& result);
     
     // Database statistics
+    CatalogStats getCatalogStats(); // Cached; recounted only after the catalog changed
     void printDatabaseStats();
     
     // Utility functions
@@ -45,9 +230,6 @@ public:
     static bool isSupportedExtension(const std::string& filename);
 };
 
-// Thread-safe registration function for multiprocessing
-void registerSongThreadSafe(const std::string& filename, Database* database, std::mutex* mutex);
-
 } // namespace AudioFingerprinting
 
 #endif
\ No newline at end of file
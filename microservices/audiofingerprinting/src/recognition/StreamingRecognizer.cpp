@@ -0,0 +1,45 @@
+#include "StreamingRecognizer.h"
+
+namespace AudioFingerprinting {
+
+StreamingRecognizer::StreamingRecognizer(SongRecognizer& recognizer, const RecognitionOptions& options)
+    : recognizer(recognizer), options(options), fingerprinter(recognizer.getQueryProfile()) {}
+
+void StreamingRecognizer::match(const std::vector<HashResult>& hashes) {
+    if (!hashes.empty()) {
+        recognizer.matchHashes(hashes, scorer);
+    }
+}
+
+bool StreamingRecognizer::push(const double* samples, size_t count) {
+    if (decided) {
+        return hasMatch();
+    }
+    
+    std::vector<HashResult> hashes = fingerprinter.push(samples, count);
+    if (hashes.empty()) {
+        return false;
+    }
+    match(hashes);
+    
+    if (isConfidentMatch(scorer, options)) {
+        matchResult.secondsUsed = fingerprinter.secondsReceived();
+        matchResult.earlyExit = true;
+        decided = recognizer.resolveMatch(scorer, options, matchResult);
+    }
+    return decided;
+}
+
+const RecognitionResult& StreamingRecognizer::finish() {
+    if (!decided) {
+        match(fingerprinter.finish());
+        
+        matchResult.secondsUsed = fingerprinter.secondsReceived();
+        matchResult.earlyExit = false;
+        recognizer.resolveMatch(scorer, options, matchResult);
+        decided = true;
+    }
+    return matchResult;
+}
+
+} // namespace AudioFingerprinting
@@ -0,0 +1,50 @@
+#ifndef STREAMING_RECOGNIZER_H
+#define STREAMING_RECOGNIZER_H
+
+#include "Recognition.h"
+#include "MatchScorer.h"
+#include "../processing/HashGenerator.h"
+#include <vector>
+
+namespace AudioFingerprinting {
+
+// One live recognition session (radio, microphone, a chunked upload).
+//
+// Audio is pushed as it arrives and fingerprinted incrementally; the hashes
+// of every completed target zone are matched straight away, and the session
+// decides as soon as the leader passes the progressive stopping rule of
+// options (minScore, scoreMargin). Audio pushed after that is ignored.
+//
+// The fingerprinter emits each distinct hash once, at its earliest anchor,
+// across all chunks. That is the offset a one-shot lookup scores it at, so
+// a whole clip scores the same streamed or matched at once.
+class StreamingRecognizer {
+private:
+    SongRecognizer& recognizer;
+    RecognitionOptions options;
+    StreamingFingerprinter fingerprinter;
+    MatchScorer scorer;
+    RecognitionResult matchResult;
+    bool decided = false;
+    
+    void match(const std::vector<HashResult>& hashes);
+    
+public:
+    explicit StreamingRecognizer(SongRecognizer& recognizer,
+                                 const RecognitionOptions& options = RecognitionOptions());
+    
+    // Feeds mono samples at SAMPLE_RATE; returns true once a confident match is found
+    bool push(const double* samples, size_t count);
+    
+    // End of the stream: matches what is left and settles on the best
+    // candidate, confident or not
+    const RecognitionResult& finish();
+    
+    bool hasMatch() const { return decided && !matchResult.song.songId.empty(); }
+    const RecognitionResult& result() const { return matchResult; }
+    double secondsReceived() const { return fingerprinter.secondsReceived(); }
+};
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -0,0 +1,314 @@
+#include "FingerprintPack.h"
+#include "../utils/Log.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace AudioFingerprinting {
+
+namespace {
+
+const char PACK_MAGIC[8] = {'A', 'F', 'P', 'A', 'C', 'K', '0', '1'};
+const char FOOTER_MAGIC[8] = {'A', 'F', 'P', 'E', 'N', 'D', '0', '1'};
+const uint32_t PACK_VERSION = 1;
+
+// magic | version (LE32) | catalog profile FILE_ID (LE32)
+const size_t HEADER_BYTES = 16;
+// magic | songs (LE64) | hashes (LE64) | checksum (LE64)
+const size_t FOOTER_BYTES = 32;
+
+void putFixed(std::string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint64_t getFixed(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void putString(std::string& out, const std::string& text) {
+    putVarint(out, text.size());
+    out += text;
+}
+
+// Bounds-checked reading of a record; any overrun clears ok
+struct Cursor {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool ok = true;
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos == end) {
+                break;
+            }
+            uint8_t byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    std::string string() {
+        uint64_t length = varint();
+        if (!ok || length > static_cast<uint64_t>(end - pos)) {
+            ok = false;
+            return "";
+        }
+        std::string text(reinterpret_cast<const char*>(pos), static_cast<size_t>(length));
+        pos += length;
+        return text;
+    }
+};
+
+// Chained over the records; eight bytes per step, a record's tail zero-padded
+uint64_t checksumBytes(uint64_t state, const uint8_t* data, size_t size) {
+    auto mix = [&state](uint64_t word) {
+        state ^= word * 0x87c37b91114253d5ULL;
+        state = (state << 31) | (state >> 33);
+        state *= 0x4cf5ad432745937fULL;
+    };
+
+    // Words are read little-endian, so the checksum is the same on every host
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        mix(getFixed(data + i, 8));
+    }
+    if (i < size) {
+        mix(getFixed(data + i, static_cast<int>(size - i)));
+    }
+    mix(size);
+    return state;
+}
+
+const uint64_t CHECKSUM_SEED = 0x9e3779b97f4a7c15ULL;
+
+} // namespace
+
+FingerprintPackWriter::FingerprintPackWriter(const std::string& path, FingerprintProfile catalog)
+    : path(path), tempPath(path + ".tmp"), out(tempPath, std::ios::binary | std::ios::trunc),
+      songs(0), hashes(0), checksum(CHECKSUM_SEED) {
+    std::string header(PACK_MAGIC, sizeof(PACK_MAGIC));
+    putFixed(header, PACK_VERSION, 4);
+    putFixed(header, profileFileId(catalog), 4);
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+}
+
+FingerprintPackWriter::~FingerprintPackWriter() {
+    if (out.is_open()) {
+        out.close();
+        std::remove(tempPath.c_str());
+    }
+}
+
+bool FingerprintPackWriter::add(const SongInfo& info, std::vector<HashResult> songHashes) {
+    // Sorted like the index keys, so the deltas stay small and non-negative
+    std::sort(songHashes.begin(), songHashes.end(), [](const HashResult& a, const HashResult& b) {
+        uint64_t ha = static_cast<uint64_t>(a.hash);
+        uint64_t hb = static_cast<uint64_t>(b.hash);
+        return ha != hb ? ha < hb : a.offsetFrame < b.offsetFrame;
+    });
+
+    record.clear();
+    putVarint(record, info.songIdx);
+    putString(record, info.songId);
+    putString(record, info.title);
+    putString(record, info.artist);
+    putString(record, info.album);
+    putVarint(record, songHashes.size());
+
+    uint64_t previous = 0;
+    for (const HashResult& hash : songHashes) {
+        uint64_t value = static_cast<uint64_t>(hash.hash);
+        putVarint(record, value - previous);
+        previous = value;
+    }
+    for (size_t i = 0; i < songHashes.size(); ++i) {
+        bool repeated = i > 0 && songHashes[i].hash == songHashes[i - 1].hash;
+        putVarint(record, repeated ? songHashes[i].offsetFrame - songHashes[i - 1].offsetFrame
+                                   : songHashes[i].offsetFrame);
+    }
+
+    std::string length;
+    putVarint(length, record.size());
+    out.write(length.data(), static_cast<std::streamsize>(length.size()));
+    out.write(record.data(), static_cast<std::streamsize>(record.size()));
+
+    checksum = checksumBytes(checksum, reinterpret_cast<const uint8_t*>(record.data()), record.size());
+    songs++;
+    hashes += songHashes.size();
+    return static_cast<bool>(out);
+}
+
+bool FingerprintPackWriter::finish() {
+    std::string footer(FOOTER_MAGIC, sizeof(FOOTER_MAGIC));
+    putFixed(footer, songs, 8);
+    putFixed(footer, hashes, 8);
+    putFixed(footer, checksum, 8);
+    out.write(footer.data(), static_cast<std::streamsize>(footer.size()));
+    out.close();
+
+    if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        AF_LOG(Error) << "Failed to write fingerprint pack: " << path;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+FingerprintPack::FingerprintPack()
+    : mapping(nullptr), mappingSize(0), recordsBegin(nullptr), recordsEnd(nullptr), songs(0), hashes(0) {}
+
+FingerprintPack::~FingerprintPack() {
+    close();
+}
+
+bool FingerprintPack::open(const std::string& path, FingerprintProfile catalog) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        AF_LOG(Error) << "Cannot open fingerprint pack: " << path;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_BYTES + FOOTER_BYTES) {
+        AF_LOG(Error) << "Fingerprint pack is truncated: " << path;
+        ::close(fd);
+        return false;
+    }
+
+    size_t fileSize = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        AF_LOG(Error) << "Failed to map fingerprint pack: " << path;
+        return false;
+    }
+
+    // Read once front to back: the framing and checksum are verified before any song is used
+    madvise(addr, fileSize, MADV_SEQUENTIAL);
+
+    const uint8_t* base = static_cast<const uint8_t*>(addr);
+    const uint8_t* footer = base + fileSize - FOOTER_BYTES;
+    bool valid = std::memcmp(base, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0 &&
+                 getFixed(base + 8, 4) == PACK_VERSION &&
+                 std::memcmp(footer, FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) == 0;
+
+    // Hashes of another profile would never match the database's queries
+    if (valid && !fileIdMatches(static_cast<uint32_t>(getFixed(base + 12, 4)), catalog)) {
+        AF_LOG(Error) << "Fingerprint pack " << path << " was made with another fingerprint profile than "
+                      << profileTag(catalog);
+        munmap(addr, fileSize);
+        return false;
+    }
+
+    uint64_t counted = 0;
+    uint64_t checksum = CHECKSUM_SEED;
+    Cursor cursor{base + HEADER_BYTES, footer};
+    while (valid && cursor.pos < cursor.end) {
+        uint64_t length = cursor.varint();
+        if (!cursor.ok || length > static_cast<uint64_t>(cursor.end - cursor.pos)) {
+            valid = false;
+            break;
+        }
+        checksum = checksumBytes(checksum, cursor.pos, static_cast<size_t>(length));
+        cursor.pos += length;
+        counted++;
+    }
+
+    if (!valid || counted != getFixed(footer + 8, 8) || checksum != getFixed(footer + 24, 8)) {
+        AF_LOG(Error) << "Invalid or corrupt fingerprint pack: " << path;
+        munmap(addr, fileSize);
+        return false;
+    }
+
+    mapping = addr;
+    mappingSize = fileSize;
+    recordsBegin = base + HEADER_BYTES;
+    recordsEnd = footer;
+    songs = counted;
+    hashes = getFixed(footer + 16, 8);
+    return true;
+}
+
+void FingerprintPack::close() {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    recordsBegin = nullptr;
+    recordsEnd = nullptr;
+    songs = 0;
+    hashes = 0;
+}
+
+bool FingerprintPack::forEachSong(const std::function<bool(PendingSong& song)>& callback) const {
+    Cursor records{recordsBegin, recordsEnd};
+    while (records.pos < records.end) {
+        uint64_t length = records.varint();
+        Cursor cursor{records.pos, records.pos + length};
+        records.pos += length;
+
+        PendingSong song;
+        song.info.songIdx = static_cast<uint32_t>(cursor.varint());
+        song.info.songId = cursor.string();
+        song.info.title = cursor.string();
+        song.info.artist = cursor.string();
+        song.info.album = cursor.string();
+
+        uint64_t count = cursor.varint();
+        if (!cursor.ok || count > static_cast<uint64_t>(cursor.end - cursor.pos)) {
+            AF_LOG(Error) << "Malformed song record in fingerprint pack";
+            return false;
+        }
+
+        // Every varint takes at least one byte, which bounds count above
+        song.hashes.reserve(static_cast<size_t>(count));
+        uint64_t hash = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            hash += cursor.varint();
+            song.hashes.emplace_back(static_cast<long>(hash), 0);
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            uint32_t offset = static_cast<uint32_t>(cursor.varint());
+            bool repeated = i > 0 && song.hashes[i].hash == song.hashes[i - 1].hash;
+            song.hashes[i].offsetFrame = repeated ? song.hashes[i - 1].offsetFrame + offset : offset;
+        }
+
+        if (!cursor.ok || cursor.pos != cursor.end || song.info.songId.empty()) {
+            AF_LOG(Error) << "Malformed song record in fingerprint pack";
+            return false;
+        }
+        if (!callback(song)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace AudioFingerprinting
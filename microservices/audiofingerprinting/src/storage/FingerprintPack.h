@@ -0,0 +1,88 @@
+#ifndef FINGERPRINT_PACK_H
+#define FINGERPRINT_PACK_H
+
+#include "Storage.h"
+#include "../core/FingerprintProfile.h"
+#include "../utils/Types.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+// Portable file of fingerprinted songs, for moving a catalog between nodes
+// without copying the SQLite file or decoding the audio again.
+//
+// Layout: header | song records | footer. Each record is length-prefixed
+// and holds the song's key and metadata followed by its hashes sorted by
+// (hash, offset), stored as two columns: hash deltas, then offsets, each
+// offset a delta from the previous one when the hash repeats. Every
+// integer is a LEB128 varint except the fixed little-endian header and
+// footer fields, so the file reads the same on any architecture. The footer
+// carries the song and hash counts and a checksum of the records. The
+// header records the catalog profile (FingerprintProfile.h) the hashes were
+// made with; a pack is only opened for a database of the same profile.
+class FingerprintPackWriter {
+public:
+    // Writes to path.tmp; finish() renames it into place, otherwise it is
+    // removed. catalog is the profile of the database being exported.
+    FingerprintPackWriter(const std::string& path, FingerprintProfile catalog);
+    ~FingerprintPackWriter();
+
+    FingerprintPackWriter(const FingerprintPackWriter&) = delete;
+    FingerprintPackWriter& operator=(const FingerprintPackWriter&) = delete;
+
+    bool add(const SongInfo& info, std::vector<HashResult> hashes);
+    bool finish();
+
+    uint64_t songCount() const { return songs; }
+    uint64_t hashCount() const { return hashes; }
+
+private:
+    std::string path;
+    std::string tempPath;
+    std::ofstream out;
+    std::string record; // Reused encoding buffer
+    uint64_t songs;
+    uint64_t hashes;
+    uint64_t checksum;
+};
+
+// Read side: the pack is memory-mapped and checked once on open, then
+// decoded one song at a time, so importing streams at disk bandwidth.
+class FingerprintPack {
+public:
+    FingerprintPack();
+    ~FingerprintPack();
+
+    FingerprintPack(const FingerprintPack&) = delete;
+    FingerprintPack& operator=(const FingerprintPack&) = delete;
+
+    // False when the file is missing, truncated, fails its checksum or was
+    // made with another catalog profile than the importing database's
+    bool open(const std::string& path, FingerprintProfile catalog);
+    void close();
+
+    uint64_t songCount() const { return songs; }
+    uint64_t hashCount() const { return hashes; }
+
+    // Decodes the songs in file order; song.info carries the key the song
+    // had where it was exported. Returns false on a malformed record or
+    // when callback does.
+    bool forEachSong(const std::function<bool(PendingSong& song)>& callback) const;
+
+private:
+    void* mapping;
+    size_t mappingSize;
+    const uint8_t* recordsBegin;
+    const uint8_t* recordsEnd;
+    uint64_t songs;
+    uint64_t hashes;
+};
+
+} // namespace AudioFingerprinting
+
+#endif
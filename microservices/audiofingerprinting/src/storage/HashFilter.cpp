@@ -0,0 +1,147 @@
+#include "HashFilter.h"
+#include "../core/Constants.h"
+#include "../utils/Log.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace AudioFingerprinting {
+
+namespace {
+
+const char FILTER_MAGIC[8] = {'A', 'F', 'B', 'L', 'O', 'O', 'M', '1'};
+
+// Odd multipliers spreading the low hash bits over the eight words of a block
+const uint32_t SALTS[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                           0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+// On-disk layout: header | blocks[blockCount]
+struct FilterHeader {
+    char magic[8];
+    uint64_t blockCount;
+    uint64_t capacity;
+    uint64_t inserted;
+    uint64_t sourceKeys;
+};
+
+// The low bits of a fingerprint hash are the anchor-target time delta, so
+// the hash is mixed before its bits pick the block and the bit positions
+uint64_t mix(long hash) {
+    uint64_t x = static_cast<uint64_t>(hash);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint32_t bitFor(uint64_t mixed, int word) {
+    return 1U << ((static_cast<uint32_t>(mixed) * SALTS[word]) >> 27);
+}
+
+} // namespace
+
+HashFilter::HashFilter(uint64_t capacity) : blockCount(blocksFor(capacity)), capacityKeys(capacity), inserted(0) {
+    blocks.reset(new Block[blockCount]());
+}
+
+uint64_t HashFilter::blocksFor(uint64_t capacity) {
+    // Blocks are picked from 32 hash bits, so their count stays below 2^32
+    const uint64_t bitsPerKey = static_cast<uint64_t>(INDEX_FILTER_BITS_PER_KEY);
+    uint64_t keys = std::min<uint64_t>(std::max<uint64_t>(capacity, 1), 0xFFFFFFFFULL * 256 / bitsPerKey);
+    return std::min<uint64_t>((keys * bitsPerKey + 255) / 256, 0xFFFFFFFFULL);
+}
+
+std::string HashFilter::pathFor(const std::string& indexPath) {
+    return indexPath + ".filter";
+}
+
+void HashFilter::insert(long hash) {
+    uint64_t mixed = mix(hash);
+    Block& block = blocks[blockIndex(mixed)];
+    for (int word = 0; word < 8; ++word) {
+        block.words[word].fetch_or(bitFor(mixed, word), std::memory_order_relaxed);
+    }
+    inserted.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool HashFilter::mayContain(long hash) const {
+    uint64_t mixed = mix(hash);
+    const Block& block = blocks[blockIndex(mixed)];
+    for (int word = 0; word < 8; ++word) {
+        uint32_t bit = bitFor(mixed, word);
+        if ((block.words[word].load(std::memory_order_relaxed) & bit) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HashFilter::save(const std::string& path, uint64_t sourceKeys) const {
+    static_assert(sizeof(Block) == 32, "filter blocks are written as raw words");
+
+    // Renamed into place like the index it belongs to
+    std::string tempPath = path + ".tmp";
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+
+    FilterHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, FILTER_MAGIC, sizeof(FILTER_MAGIC));
+    header.blockCount = blockCount;
+    header.capacity = capacityKeys;
+    header.inserted = size();
+    header.sourceKeys = sourceKeys;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(blocks.get()), static_cast<std::streamsize>(memoryBytes()));
+    out.close();
+
+    if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        AF_LOG(Error) << "Failed to write hash filter: " << path;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<HashFilter> HashFilter::load(const std::string& path, uint64_t sourceKeys) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return nullptr;
+    }
+
+    FilterHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, FILTER_MAGIC, sizeof(FILTER_MAGIC)) != 0 ||
+        header.sourceKeys != sourceKeys) {
+        AF_LOG(Warn) << "Hash filter " << path << " does not match its index; rebuilding it";
+        return nullptr;
+    }
+
+    if (blocksFor(header.capacity) != header.blockCount) {
+        AF_LOG(Warn) << "Hash filter " << path << " was built with other settings; rebuilding it";
+        return nullptr;
+    }
+
+    // Checked before allocating, so a corrupt header cannot ask for more memory than the file holds
+    in.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    if (!in || fileSize != sizeof(header) + header.blockCount * sizeof(Block)) {
+        AF_LOG(Warn) << "Truncated hash filter: " << path;
+        return nullptr;
+    }
+    in.seekg(sizeof(header));
+
+    auto filter = std::make_shared<HashFilter>(header.capacity);
+    in.read(reinterpret_cast<char*>(filter->blocks.get()), static_cast<std::streamsize>(filter->memoryBytes()));
+    if (!in) {
+        AF_LOG(Warn) << "Truncated hash filter: " << path;
+        return nullptr;
+    }
+    filter->inserted.store(header.inserted, std::memory_order_relaxed);
+    return filter;
+}
+
+} // namespace AudioFingerprinting
@@ -0,0 +1,59 @@
+#ifndef HASH_FILTER_H
+#define HASH_FILTER_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+namespace AudioFingerprinting {
+
+// Catalog-wide membership filter over the indexed hashes.
+//
+// A split-block Bloom filter: every hash sets one bit in each of the eight
+// 32-bit words of a single 32-byte block, so a probe touches one cache line.
+// At INDEX_FILTER_BITS_PER_KEY bits per hash about 1% of the hashes missing
+// from the catalog pass. Bits are only ever set, atomically, so lookups run
+// while registrations insert; a hash is inserted before the index part
+// holding it is published, hence the filter never rejects a published hash.
+class HashFilter {
+public:
+    // Sized for capacity hashes; more can be inserted at a higher false positive rate
+    explicit HashFilter(uint64_t capacity);
+
+    HashFilter(const HashFilter&) = delete;
+    HashFilter& operator=(const HashFilter&) = delete;
+
+    static std::string pathFor(const std::string& indexPath);
+
+    void insert(long hash);
+    bool mayContain(long hash) const;
+
+    uint64_t capacity() const { return capacityKeys; }
+    uint64_t size() const { return inserted.load(std::memory_order_relaxed); }
+    size_t memoryBytes() const { return static_cast<size_t>(blockCount) * sizeof(Block); }
+
+    // File I/O. sourceKeys ties the file to the index it was built from:
+    // load() returns nullptr when it doesn't match, and the caller rebuilds.
+    bool save(const std::string& path, uint64_t sourceKeys) const;
+    static std::shared_ptr<HashFilter> load(const std::string& path, uint64_t sourceKeys);
+
+private:
+    struct Block {
+        std::atomic<uint32_t> words[8];
+    };
+
+    std::unique_ptr<Block[]> blocks;
+    uint64_t blockCount;
+    uint64_t capacityKeys;
+    std::atomic<uint64_t> inserted;
+
+    // The top 32 bits of the mixed hash pick the block, the low 32 the bits in it
+    uint64_t blockIndex(uint64_t mixed) const { return (mixed >> 32) * blockCount >> 32; }
+
+    static uint64_t blocksFor(uint64_t capacity);
+};
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -0,0 +1,507 @@
+#include "HashIndex.h"
+#include "../utils/Log.h"
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace AudioFingerprinting {
+
+namespace {
+
+const char INDEX_MAGIC[8] = {'A', 'F', 'H', 'I', 'D', 'X', '0', '2'};
+const uint32_t INDEX_VERSION = 4;
+const uint32_t INDEX_VERSION_V3 = 3; // Header without the dropped songs
+const uint32_t INDEX_VERSION_V2 = 2; // Header without lastMergedSegment either
+const uint32_t DIRECTORY_BITS = 16;
+
+// On-disk layout, all sections 8-byte aligned:
+//   header | postings[numPostings] | keys[numKeys] | starts[numKeys + 1]
+//   | directory[2^directoryBits + 1] | droppedSongs[numDropped]
+// Postings carry song_info.song_idx directly; numSongs is kept for staleness checks.
+// profile is the FILE_ID of the catalog profile the hashes were made with.
+// A base index written by a compaction records the highest segment id it
+// merged in lastMergedSegment; readers skip any such segment still listed.
+// It also lists the removed songs whose postings it dropped, sorted, so
+// their tombstones are not applied twice while the manifest still has them.
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t directoryBits;
+    uint32_t directoryShift;
+    uint32_t profile;
+    uint64_t numKeys;
+    uint64_t numPostings;
+    uint64_t numSongs;
+    uint64_t postingsOffset;
+    uint64_t keysOffset;
+    uint64_t startsOffset;
+    uint64_t directoryOffset;
+    uint64_t lastMergedSegment;
+    uint64_t droppedOffset;
+    uint64_t numDropped;
+};
+
+static_assert(sizeof(IndexHeader) % 8 == 0, "index header must keep sections aligned");
+static_assert(sizeof(HashIndex::Posting) == 8, "postings must be packed");
+
+uint64_t alignTo8(uint64_t value) {
+    return (value + 7) & ~static_cast<uint64_t>(7);
+}
+
+void writePadding(std::ofstream& out, uint64_t& position) {
+    static const char zeros[8] = {};
+    uint64_t aligned = alignTo8(position);
+    out.write(zeros, static_cast<std::streamsize>(aligned - position));
+    position = aligned;
+}
+
+template <typename T>
+void writeArray(std::ofstream& out, uint64_t& position, const T* data, size_t count) {
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+    position += count * sizeof(T);
+}
+
+uint32_t bitWidth(uint64_t value) {
+    uint32_t width = 0;
+    while (value) {
+        value >>= 1;
+        width++;
+    }
+    return width;
+}
+
+// Distinct keys with the position of their first posting; starts gets the
+// closing entry once the rows are exhausted
+struct KeyTable {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> starts;
+    uint64_t postings = 0;
+};
+
+// Streams rows into table, handing every posting to sink. Only the distinct
+// keys stay in memory. Fails if the source does or its rows are out of order.
+bool collectRows(const HashIndex::RowSource& rows, KeyTable& table,
+                 const std::function<void(const HashIndex::Posting&)>& sink) {
+    bool sorted = true;
+    bool scanned = rows([&](long hash, uint32_t offset, uint32_t songIdx) {
+        uint64_t key = static_cast<uint64_t>(hash);
+        if (table.keys.empty() || table.keys.back() != key) {
+            if (!table.keys.empty() && key < table.keys.back()) {
+                sorted = false;
+                return false;
+            }
+            table.keys.push_back(key);
+            table.starts.push_back(table.postings);
+        }
+
+        sink({songIdx, offset});
+        table.postings++;
+        return true;
+    });
+
+    if (!scanned || !sorted) {
+        AF_LOG(Error) << "Failed to read index rows" << (sorted ? "" : " (rows not in hash order)");
+        return false;
+    }
+
+    table.starts.push_back(table.postings);
+    return true;
+}
+
+// Whether count items of itemSize bytes at offset, 8-byte aligned, lie
+// inside a file of fileSize bytes; no sum is formed, so nothing wraps
+bool sectionFits(uint64_t offset, uint64_t count, uint64_t itemSize, uint64_t fileSize) {
+    return offset % 8 == 0 && offset <= fileSize && count <= (fileSize - offset) / itemSize;
+}
+
+// Whether count positions start at 0, never decrease and end at end, so
+// every range between neighbours lies inside a section of end items
+bool positionsValid(const uint64_t* positions, uint64_t count, uint64_t end) {
+    if (positions[0] != 0 || positions[count - 1] != end) {
+        return false;
+    }
+    for (uint64_t i = 1; i < count; i++) {
+        if (positions[i] < positions[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t directoryShiftFor(const std::vector<uint64_t>& keys, uint32_t bits) {
+    uint32_t width = keys.empty() ? 0 : bitWidth(keys.back());
+    return width > bits ? width - bits : 0;
+}
+
+// First key index of every bucket of the top bits bits
+std::vector<uint64_t> buildDirectory(const std::vector<uint64_t>& keys, uint32_t bits, uint32_t shift) {
+    size_t bucketCount = static_cast<size_t>(1) << bits;
+    std::vector<uint64_t> directory(bucketCount + 1);
+    size_t keyIdx = 0;
+    for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+        while (keyIdx < keys.size() && (keys[keyIdx] >> shift) < bucket) {
+            keyIdx++;
+        }
+        directory[bucket] = keyIdx;
+    }
+    directory[bucketCount] = keys.size();
+    return directory;
+}
+
+} // namespace
+
+HashIndex::HashIndex()
+    : mapping(nullptr), mappingSize(0), postings(nullptr), keys(nullptr), starts(nullptr),
+      directory(nullptr), droppedSongs(nullptr), numKeys(0), numPostings(0), numSongs(0), mergedThrough(0),
+      numDropped(0), directoryBits(0), directoryShift(0) {}
+
+HashIndex::~HashIndex() {
+    close();
+}
+
+std::string HashIndex::defaultPathFor(const std::string& dbPath) {
+    return dbPath + ".idx";
+}
+
+bool HashIndex::open(const std::string& path, FingerprintProfile catalog) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(IndexHeader)) {
+        AF_LOG(Error) << "Hash index is truncated: " << path;
+        ::close(fd);
+        return false;
+    }
+
+    size_t fileSize = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        AF_LOG(Error) << "Failed to map hash index: " << path;
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(addr);
+    IndexHeader header;
+    std::memcpy(&header, base, sizeof(header));
+
+    // Fields older headers lack are the first bytes of the postings there
+    if (header.version == INDEX_VERSION_V2) {
+        header.lastMergedSegment = 0;
+    }
+    if (header.version == INDEX_VERSION_V2 || header.version == INDEX_VERSION_V3) {
+        header.droppedOffset = 0;
+        header.numDropped = 0;
+    }
+
+    bool valid = std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                 (header.version == INDEX_VERSION || header.version == INDEX_VERSION_V3 ||
+                  header.version == INDEX_VERSION_V2) &&
+                 header.directoryBits > 0 && header.directoryBits <= 24 && header.directoryShift < 64;
+
+    // Sizes come from the header, so a corrupt one must not wrap the bounds
+    // checks, and lookups trust starts and the directory to stay in bounds
+    uint64_t directorySize = (static_cast<uint64_t>(1) << std::min<uint32_t>(header.directoryBits, 24)) + 1;
+    if (valid) {
+        valid = sectionFits(header.postingsOffset, header.numPostings, sizeof(Posting), fileSize) &&
+                sectionFits(header.keysOffset, header.numKeys, sizeof(uint64_t), fileSize) &&
+                header.numKeys < fileSize / sizeof(uint64_t) &&
+                sectionFits(header.startsOffset, header.numKeys + 1, sizeof(uint64_t), fileSize) &&
+                sectionFits(header.directoryOffset, directorySize, sizeof(uint64_t), fileSize) &&
+                sectionFits(header.droppedOffset, header.numDropped, sizeof(uint32_t), fileSize);
+    }
+    if (valid) {
+        valid = positionsValid(reinterpret_cast<const uint64_t*>(base + header.startsOffset),
+                               header.numKeys + 1, header.numPostings) &&
+                positionsValid(reinterpret_cast<const uint64_t*>(base + header.directoryOffset),
+                               directorySize, header.numKeys);
+    }
+
+    if (!valid) {
+        AF_LOG(Error) << "Invalid or incompatible hash index: " << path;
+        munmap(addr, fileSize);
+        return false;
+    }
+
+    // Postings of another profile would never meet this database's queries
+    if (!fileIdMatches(header.profile, catalog)) {
+        AF_LOG(Error) << "Hash index " << path << " was made with another fingerprint profile than "
+                      << profileTag(catalog);
+        munmap(addr, fileSize);
+        return false;
+    }
+
+    mapping = addr;
+    mappingSize = fileSize;
+    postings = reinterpret_cast<const Posting*>(base + header.postingsOffset);
+    keys = reinterpret_cast<const uint64_t*>(base + header.keysOffset);
+    starts = reinterpret_cast<const uint64_t*>(base + header.startsOffset);
+    directory = reinterpret_cast<const uint64_t*>(base + header.directoryOffset);
+    droppedSongs = reinterpret_cast<const uint32_t*>(base + header.droppedOffset);
+    numKeys = header.numKeys;
+    numPostings = header.numPostings;
+    directoryBits = header.directoryBits;
+    directoryShift = header.directoryShift;
+    numSongs = header.numSongs;
+    mergedThrough = header.lastMergedSegment;
+    numDropped = header.numDropped;
+
+    // Keys and directory are probed on every lookup, postings only on hits
+    madvise(const_cast<char*>(base + header.keysOffset),
+            header.directoryOffset - header.keysOffset, MADV_WILLNEED);
+    madvise(const_cast<char*>(base + header.postingsOffset),
+            header.numPostings * sizeof(Posting), MADV_RANDOM);
+
+    AF_LOG(Info) << "Loaded hash index: " << path << " (" << numKeys << " hashes, "
+                 << numPostings << " postings, " << numSongs << " songs)";
+
+    return true;
+}
+
+void HashIndex::close() {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    ownedPostings.clear();
+    ownedKeys.clear();
+    ownedStarts.clear();
+    ownedDirectory.clear();
+    postings = nullptr;
+    keys = nullptr;
+    starts = nullptr;
+    directory = nullptr;
+    droppedSongs = nullptr;
+    numKeys = 0;
+    numPostings = 0;
+    numSongs = 0;
+    mergedThrough = 0;
+    numDropped = 0;
+}
+
+bool HashIndex::hasDropped(uint32_t songIdx) const {
+    return numDropped > 0 && std::binary_search(droppedSongs, droppedSongs + numDropped, songIdx);
+}
+
+std::pair<const HashIndex::Posting*, const HashIndex::Posting*> HashIndex::lookup(uint64_t hash) const {
+    if (!directory || numKeys == 0) {
+        return {nullptr, nullptr};
+    }
+
+    uint64_t bucket = hash >> directoryShift;
+    if (bucket >= (static_cast<uint64_t>(1) << directoryBits)) {
+        return {nullptr, nullptr};
+    }
+
+    const uint64_t* first = keys + directory[bucket];
+    const uint64_t* last = keys + directory[bucket + 1];
+    const uint64_t* it = std::lower_bound(first, last, hash);
+
+    if (it == last || *it != hash) {
+        return {nullptr, nullptr};
+    }
+
+    size_t keyIdx = static_cast<size_t>(it - keys);
+    return {postings + starts[keyIdx], postings + starts[keyIdx + 1]};
+}
+
+bool HashIndex::forEachMatch(const std::vector<HashResult>& hashes, const MatchCallback& callback) const {
+    if (!isOpen()) {
+        return false;
+    }
+
+    // Same lookup map as the SQL path: the earliest sample offset of each distinct hash
+    std::map<long, uint32_t> hashDict;
+    for (const auto& hash : hashes) {
+        auto entry = hashDict.emplace(hash.hash, hash.offsetFrame);
+        entry.first->second = std::min(entry.first->second, hash.offsetFrame);
+    }
+
+    for (const auto& entry : hashDict) {
+        auto range = lookup(static_cast<uint64_t>(entry.first));
+        for (const Posting* p = range.first; p != range.second; ++p) {
+            callback(p->songIdx, p->offsetFrame, entry.second);
+        }
+    }
+
+    return true;
+}
+
+bool HashIndex::forEachHashMatch(const std::vector<long>& hashes, const HashRowCallback& callback) const {
+    if (!isOpen()) {
+        return false;
+    }
+
+    for (long hash : hashes) {
+        auto range = lookup(static_cast<uint64_t>(hash));
+        for (const Posting* p = range.first; p != range.second; ++p) {
+            callback(hash, p->songIdx, p->offsetFrame);
+        }
+    }
+
+    return true;
+}
+
+MatchMap HashIndex::getMatches(const std::vector<HashResult>& hashes, int threshold) const {
+    MatchMap resultDict;
+
+    if (!isOpen() || hashes.empty()) {
+        return resultDict;
+    }
+
+    // Collect into a hash map first to avoid an ordered map probe per posting
+    std::unordered_map<uint32_t, std::vector<MatchOffset>> bySong;
+    forEachMatch(hashes, [&bySong](uint32_t songIdx, uint32_t dbOffset, uint32_t sampleOffset) {
+        bySong[songIdx].emplace_back(dbOffset, sampleOffset);
+    });
+
+    // Filter results by threshold
+    for (auto& song : bySong) {
+        if (static_cast<int>(song.second.size()) >= threshold) {
+            resultDict[song.first] = std::move(song.second);
+        }
+    }
+
+    return resultDict;
+}
+
+bool HashIndex::build(Database& database, const std::string& path, FingerprintProfile catalog,
+                      uint64_t lastMergedSegment, const std::vector<uint32_t>& droppedSongs) {
+    RowSource rows = [&database](const RowCallback& callback) {
+        return database.forEachHashRow(callback);
+    };
+    return write(rows, static_cast<uint64_t>(database.getTotalSongs()), path, catalog, lastMergedSegment,
+                 droppedSongs);
+}
+
+bool HashIndex::write(const RowSource& rows, uint64_t songs, const std::string& path, FingerprintProfile catalog,
+                      uint64_t lastMergedSegment, const std::vector<uint32_t>& droppedSongs) {
+    // Write to a temporary file and rename, so running servers keep their mapping
+    std::string tempPath = path + ".tmp";
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        AF_LOG(Error) << "Failed to create hash index file: " << tempPath;
+        return false;
+    }
+
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.profile = profileFileId(catalog);
+    header.directoryBits = DIRECTORY_BITS;
+    header.numSongs = songs;
+    header.lastMergedSegment = lastMergedSegment;
+
+    uint64_t position = 0;
+    writeArray(out, position, reinterpret_cast<const char*>(&header), sizeof(header));
+    header.postingsOffset = position;
+
+    // Postings are streamed straight to disk
+    KeyTable table;
+    std::vector<Posting> buffer;
+    buffer.reserve(1 << 16);
+
+    bool collected = collectRows(rows, table, [&](const Posting& posting) {
+        buffer.push_back(posting);
+        if (buffer.size() == buffer.capacity()) {
+            writeArray(out, position, buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    });
+
+    if (!collected) {
+        out.close();
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    writeArray(out, position, buffer.data(), buffer.size());
+
+    header.numKeys = table.keys.size();
+    header.numPostings = table.postings;
+
+    writePadding(out, position);
+    header.keysOffset = position;
+    writeArray(out, position, table.keys.data(), table.keys.size());
+
+    header.startsOffset = position;
+    writeArray(out, position, table.starts.data(), table.starts.size());
+
+    header.directoryShift = directoryShiftFor(table.keys, DIRECTORY_BITS);
+    std::vector<uint64_t> directoryList = buildDirectory(table.keys, DIRECTORY_BITS, header.directoryShift);
+
+    header.directoryOffset = position;
+    writeArray(out, position, directoryList.data(), directoryList.size());
+
+    std::vector<uint32_t> dropped = droppedSongs;
+    std::sort(dropped.begin(), dropped.end());
+    header.droppedOffset = position;
+    header.numDropped = dropped.size();
+    writeArray(out, position, dropped.data(), dropped.size());
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+
+    if (!out) {
+        AF_LOG(Error) << "Failed to write hash index file: " << tempPath;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        AF_LOG(Error) << "Failed to move hash index into place: " << path;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    AF_LOG(Info) << "Built hash index: " << path << " (" << header.numKeys << " hashes, "
+                 << header.numPostings << " postings, " << header.numSongs << " songs)";
+
+    return true;
+}
+
+std::shared_ptr<HashIndex> HashIndex::inMemory(const RowSource& rows, uint64_t songs) {
+    auto index = std::make_shared<HashIndex>();
+
+    KeyTable table;
+    bool collected = collectRows(rows, table, [&index](const Posting& posting) {
+        index->ownedPostings.push_back(posting);
+    });
+    if (!collected) {
+        return nullptr;
+    }
+
+    // Small runs get a directory sized to their key count, about one key per bucket
+    index->directoryBits = std::max<uint32_t>(1, std::min(DIRECTORY_BITS, bitWidth(table.keys.size())));
+    index->directoryShift = directoryShiftFor(table.keys, index->directoryBits);
+    index->ownedDirectory = buildDirectory(table.keys, index->directoryBits, index->directoryShift);
+    index->ownedKeys = std::move(table.keys);
+    index->ownedStarts = std::move(table.starts);
+
+    index->postings = index->ownedPostings.data();
+    index->keys = index->ownedKeys.data();
+    index->starts = index->ownedStarts.data();
+    index->directory = index->ownedDirectory.data();
+    index->numKeys = index->ownedKeys.size();
+    index->numPostings = index->ownedPostings.size();
+    index->numSongs = songs;
+
+    return index;
+}
+
+} // namespace AudioFingerprinting
\ No newline at end of file
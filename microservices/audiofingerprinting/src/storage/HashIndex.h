@@ -0,0 +1,104 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "Storage.h"
+#include "../core/FingerprintProfile.h"
+#include "../utils/Types.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+// Read-optimized inverted index over the fingerprint hashes.
+//
+// The file holds every distinct hash in sorted order, each pointing at a
+// postings list of packed (song_idx, offset frame) pairs. It is memory-mapped
+// read-only and searched through a directory on the hash's top bits followed
+// by a binary search inside the bucket. SQLite remains the source of truth;
+// the index is rebuilt from it with HashIndex::build(). The same layout is
+// used for the segments of a SegmentedIndex, on disk or held in memory.
+class HashIndex {
+public:
+    struct Posting {
+        uint32_t songIdx;
+        uint32_t offsetFrame;
+    };
+
+    // Rows in ascending (unsigned) hash order, as Database::forEachHashRow yields them
+    using RowCallback = std::function<bool(long hash, uint32_t offset, uint32_t songIdx)>;
+    using RowSource = std::function<bool(const RowCallback& callback)>;
+
+    HashIndex();
+    ~HashIndex();
+
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+
+    // Index file management; a file made with another catalog profile is refused
+    bool open(const std::string& path, FingerprintProfile catalog);
+    void close();
+    bool isOpen() const { return directory != nullptr; }
+
+    static std::string defaultPathFor(const std::string& dbPath);
+    // lastMergedSegment marks a SegmentedIndex base that covers the segments
+    // up to that id, and droppedSongs the removed songs whose postings it
+    // left out; 0 and none for everything else
+    static bool build(Database& database, const std::string& path, FingerprintProfile catalog,
+                      uint64_t lastMergedSegment = 0, const std::vector<uint32_t>& droppedSongs = {});
+    static bool write(const RowSource& rows, uint64_t songs, const std::string& path, FingerprintProfile catalog,
+                      uint64_t lastMergedSegment = 0, const std::vector<uint32_t>& droppedSongs = {});
+    static std::shared_ptr<HashIndex> inMemory(const RowSource& rows, uint64_t songs);
+
+    // Lookup: returns the postings for a hash as a [begin, end) range
+    std::pair<const Posting*, const Posting*> lookup(uint64_t hash) const;
+
+    // Same contracts as Database::forEachMatch, forEachHashMatch and getMatches
+    bool forEachMatch(const std::vector<HashResult>& hashes, const MatchCallback& callback) const;
+    bool forEachHashMatch(const std::vector<long>& hashes, const HashRowCallback& callback) const;
+    MatchMap getMatches(const std::vector<HashResult>& hashes, int threshold = 5) const;
+
+    // Sequential access by key position, for merging indexes
+    uint64_t keyAt(uint64_t keyIdx) const { return keys[keyIdx]; }
+    std::pair<const Posting*, const Posting*> postingsAt(uint64_t keyIdx) const {
+        return {postings + starts[keyIdx], postings + starts[keyIdx + 1]};
+    }
+
+    // Statistics
+    uint64_t songCount() const { return numSongs; }
+    uint64_t hashCount() const { return numKeys; }
+    uint64_t postingCount() const { return numPostings; }
+    uint64_t lastMergedSegment() const { return mergedThrough; }
+    bool hasDropped(uint32_t songIdx) const; // Listed in droppedSongs when written
+
+private:
+    void* mapping;
+    size_t mappingSize;
+
+    // Storage of an in-memory index; the pointers below refer to it instead of the mapping
+    std::vector<Posting> ownedPostings;
+    std::vector<uint64_t> ownedKeys;
+    std::vector<uint64_t> ownedStarts;
+    std::vector<uint64_t> ownedDirectory;
+
+    const Posting* postings;
+    const uint64_t* keys;
+    const uint64_t* starts;
+    const uint64_t* directory;
+    const uint32_t* droppedSongs;
+    uint64_t numKeys;
+    uint64_t numPostings;
+    uint64_t numSongs;
+    uint64_t mergedThrough;
+    uint64_t numDropped;
+    uint32_t directoryBits;
+    uint32_t directoryShift;
+};
+
+} // namespace AudioFingerprinting
+
+#endif
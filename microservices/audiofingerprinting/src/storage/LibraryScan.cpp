@@ -0,0 +1,222 @@
+#include "LibraryScan.h"
+#include "../utils/ThreadPool.h"
+#include "../utils/Log.h"
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace AudioFingerprinting {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+const size_t DIGEST_CHUNK_BYTES = 1 << 20;
+
+int64_t ticksOf(fs::file_time_type time) {
+    return static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+// False when the entry is an accepted file whose size or mtime can't be read
+bool addFile(const fs::directory_entry& entry, const std::function<bool(const std::string&)>& accept,
+             std::vector<ScannedFile>& files) {
+    std::error_code ec;
+    if (!entry.is_regular_file(ec) || !accept(entry.path().string())) {
+        return true;
+    }
+
+    ScannedFile file;
+    file.path = entry.path().string();
+    file.size = entry.file_size(ec);
+    if (!ec) {
+        file.mtime = ticksOf(entry.last_write_time(ec));
+    }
+    if (ec) {
+        AF_LOG(Warn) << "Skipping " << file.path << ": " << ec.message();
+        return false;
+    }
+    files.push_back(std::move(file));
+    return true;
+}
+
+// Unreadable directories are errors, not skipped: their files would look deleted
+bool walkTree(const fs::path& directory, const std::function<bool(const std::string&)>& accept,
+              std::vector<ScannedFile>& files) {
+    bool complete = true;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(directory, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        complete = addFile(*it, accept, files) && complete;
+    }
+    if (ec) {
+        AF_LOG(Error) << "Error accessing directory " << directory.string() << ": " << ec.message();
+        return false;
+    }
+    return complete;
+}
+
+uint64_t mixWord(uint64_t state, uint64_t word) {
+    state ^= word * 0x87c37b91114253d5ULL;
+    state = (state << 31) | (state >> 33);
+    return state * 0x4cf5ad432745937fULL;
+}
+
+} // namespace
+
+bool scanLibrary(const std::string& root, const std::function<bool(const std::string&)>& accept,
+                 std::vector<ScannedFile>& files) {
+    // Files directly under root are taken here; every subdirectory is its own task
+    files.clear();
+    std::vector<fs::path> subdirectories;
+    bool complete = true;
+
+    std::error_code ec;
+    fs::directory_iterator it(root, ec);
+    for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        std::error_code typeError;
+        if (it->is_directory(typeError) && !it->is_symlink(typeError)) {
+            subdirectories.push_back(it->path());
+        } else {
+            complete = addFile(*it, accept, files) && complete;
+        }
+    }
+    if (ec) {
+        AF_LOG(Error) << "Error accessing directory " << root << ": " << ec.message();
+        complete = false;
+    }
+
+    std::vector<std::vector<ScannedFile>> found(subdirectories.size());
+    std::vector<char> walked(subdirectories.size(), 0);
+    ThreadPool::shared().parallelFor(subdirectories.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            walked[i] = walkTree(subdirectories[i], accept, found[i]);
+        }
+    });
+
+    for (size_t i = 0; i < found.size(); ++i) {
+        complete = complete && walked[i];
+        files.insert(files.end(), std::make_move_iterator(found[i].begin()), std::make_move_iterator(found[i].end()));
+    }
+    std::sort(files.begin(), files.end(),
+              [](const ScannedFile& a, const ScannedFile& b) { return a.path < b.path; });
+    return complete;
+}
+
+std::string fileDigest(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return "";
+    }
+
+    // Eight bytes per step; only the final chunk can end in a partial word
+    std::vector<char> buffer(DIGEST_CHUNK_BYTES);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    uint64_t length = 0;
+    while (in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        size_t got = static_cast<size_t>(in.gcount());
+        if (got == 0) {
+            break;
+        }
+
+        size_t i = 0;
+        for (; i + 8 <= got; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, buffer.data() + i, 8);
+            state = mixWord(state, word);
+        }
+        if (i < got) {
+            uint64_t word = 0;
+            std::memcpy(&word, buffer.data() + i, got - i);
+            state = mixWord(state, word);
+        }
+        length += got;
+    }
+    if (in.bad()) {
+        return "";
+    }
+
+    state = mixWord(state, length);
+    state ^= state >> 33;
+    state *= 0xff51afd7ed558ccdULL;
+    state ^= state >> 33;
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(state));
+    return hex;
+}
+
+bool describeSourceFile(const std::string& path, SourceFile& file) {
+    std::error_code ec;
+    file.path = path;
+    file.size = fs::file_size(path, ec);
+    if (!ec) {
+        file.mtime = ticksOf(fs::last_write_time(path, ec));
+    }
+    file.digest = ec ? "" : fileDigest(path);
+    return !file.digest.empty();
+}
+
+LibraryDiff diffLibrary(const std::string& root, const std::vector<ScannedFile>& files,
+                        const std::unordered_map<std::string, SourceFile>& manifest) {
+    LibraryDiff diff;
+    std::unordered_set<std::string> seen;
+    std::vector<const ScannedFile*> changed;
+
+    for (const ScannedFile& file : files) {
+        seen.insert(file.path);
+        auto known = manifest.find(file.path);
+        if (known == manifest.end()) {
+            diff.added.push_back(file);
+        } else if (known->second.size == file.size && known->second.mtime == file.mtime) {
+            diff.unchanged++;
+        } else {
+            changed.push_back(&file);
+        }
+    }
+
+    // A new mtime alone (copied, touched, retagged then reverted) is not a new song
+    std::vector<std::string> digests(changed.size());
+    ThreadPool::shared().parallelFor(changed.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            digests[i] = fileDigest(changed[i]->path);
+        }
+    });
+
+    for (size_t i = 0; i < changed.size(); ++i) {
+        const ScannedFile& file = *changed[i];
+        const SourceFile& previous = manifest.at(file.path);
+        if (digests[i].empty()) {
+            AF_LOG(Warn) << "Cannot read " << file.path << "; keeping its registered song";
+            diff.unchanged++;
+        } else if (digests[i] == previous.digest) {
+            SourceFile current = previous;
+            current.size = file.size;
+            current.mtime = file.mtime;
+            diff.touched.push_back(std::move(current));
+        } else {
+            diff.modified.push_back(file);
+            diff.modified.back().digest = std::move(digests[i]);
+            diff.replaced.push_back(previous);
+        }
+    }
+
+    // Only rows under root can be judged; other directories were not walked
+    std::string prefix = root;
+    if (!prefix.empty() && prefix.back() != fs::path::preferred_separator) {
+        prefix += fs::path::preferred_separator;
+    }
+    for (const auto& entry : manifest) {
+        if (entry.first.compare(0, prefix.size(), prefix) == 0 && seen.count(entry.first) == 0) {
+            diff.removed.push_back(entry.second);
+        }
+    }
+    std::sort(diff.removed.begin(), diff.removed.end(),
+              [](const SourceFile& a, const SourceFile& b) { return a.path < b.path; });
+    return diff;
+}
+
+} // namespace AudioFingerprinting
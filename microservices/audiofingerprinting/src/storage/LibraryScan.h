@@ -0,0 +1,56 @@
+#ifndef LIBRARY_SCAN_H
+#define LIBRARY_SCAN_H
+
+#include "Storage.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+namespace AudioFingerprinting {
+
+// An audio file found by the directory walk
+struct ScannedFile {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::string digest; // Only read for files diffLibrary found modified
+};
+
+// How a directory differs from the library manifest
+struct LibraryDiff {
+    std::vector<ScannedFile> added;    // No manifest row
+    std::vector<ScannedFile> modified; // Content changed; the song registered from it is replaced
+    std::vector<SourceFile> replaced;  // The manifest rows of the modified files
+    std::vector<SourceFile> touched;   // Same content under a new size or mtime: manifest row only
+    std::vector<SourceFile> removed;   // Under the directory but gone from disk
+    size_t unchanged = 0;
+};
+
+// Walks root for files accept() takes, one top-level subdirectory per task
+// on ThreadPool::shared(), and fills files with them sorted by path. Size
+// and mtime come from the walk itself. False when root or any directory or
+// file under it could not be read: files then holds what was reached, and
+// a file missing from it may still be on disk.
+bool scanLibrary(const std::string& root, const std::function<bool(const std::string&)>& accept,
+                 std::vector<ScannedFile>& files);
+
+// 64-bit digest of the file's bytes, as 16 hex digits; empty when it can't be read.
+// Detects changed content, it is not a cryptographic hash.
+std::string fileDigest(const std::string& path);
+
+// The manifest row for path as it is on disk now; false when it can't be read
+bool describeSourceFile(const std::string& path, SourceFile& file);
+
+// Diffs a walk of root against the manifest; removed is only meaningful when
+// the walk was complete. Files whose size or mtime changed are read for their
+// digest, in parallel, and only count as modified when it differs; modified
+// files keep the digest. Paths are compared as walked, so a directory is
+// rescanned under the same spelling it was registered with.
+LibraryDiff diffLibrary(const std::string& root, const std::vector<ScannedFile>& files,
+                        const std::unordered_map<std::string, SourceFile>& manifest);
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -0,0 +1,892 @@
+#include "SegmentedIndex.h"
+#include "../core/Constants.h"
+#include "../utils/Log.h"
+#include <fstream>
+#include <algorithm>
+#include <queue>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace AudioFingerprinting {
+
+namespace {
+
+const char MANIFEST_MAGIC[] = "AFSEG 2";
+const char MANIFEST_MAGIC_V1[] = "AFSEG 1"; // No tombstones
+
+// Segment ids in flush order, the id the next flush takes, and the
+// tombstoned songs in ascending order
+struct Manifest {
+    uint64_t nextId = 1;
+    std::vector<uint64_t> segments;
+    std::vector<uint32_t> removed;
+};
+
+// A missing manifest is an empty one
+bool readManifest(const std::string& path, Manifest& manifest) {
+    manifest = Manifest();
+    std::ifstream in(path);
+    if (!in) {
+        return true;
+    }
+
+    std::string magic;
+    std::string key;
+    std::getline(in, magic);
+    if ((magic != MANIFEST_MAGIC && magic != MANIFEST_MAGIC_V1) ||
+        !(in >> key >> manifest.nextId) || key != "next") {
+        AF_LOG(Error) << "Invalid index segment manifest: " << path;
+        return false;
+    }
+
+    // A segment id per line, then "removed <song_idx>" lines
+    std::string token;
+    while (in >> token) {
+        uint32_t songIdx = 0;
+        char* end = nullptr;
+        bool valid;
+        if (token == "removed") {
+            valid = static_cast<bool>(in >> songIdx);
+            manifest.removed.push_back(songIdx);
+        } else {
+            manifest.segments.push_back(std::strtoull(token.c_str(), &end, 10));
+            valid = *end == '\0';
+        }
+        if (!valid) {
+            AF_LOG(Error) << "Invalid index segment manifest: " << path;
+            return false;
+        }
+    }
+    std::sort(manifest.removed.begin(), manifest.removed.end());
+    return true;
+}
+
+bool writeManifest(const std::string& path, const Manifest& manifest) {
+    // Renamed into place, so readers never see a partial list
+    std::string tempPath = path + ".tmp";
+    std::ofstream out(tempPath, std::ios::trunc);
+    out << MANIFEST_MAGIC << "\nnext " << manifest.nextId << "\n";
+    for (uint64_t id : manifest.segments) {
+        out << id << "\n";
+    }
+    for (uint32_t songIdx : manifest.removed) {
+        out << "removed " << songIdx << "\n";
+    }
+    out.close();
+
+    if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        AF_LOG(Error) << "Failed to write index segment manifest: " << path;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// flock held for the lifetime of the object
+class FileLock {
+public:
+    FileLock(const std::string& path, int operation) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0 && flock(fd, operation) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    ~FileLock() {
+        if (fd >= 0) {
+            flock(fd, LOCK_UN);
+            ::close(fd);
+        }
+    }
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    bool locked() const { return fd >= 0; }
+
+private:
+    int fd;
+};
+
+// Rows of parts merged into hash order; the postings of one hash keep the
+// order of the parts, oldest first
+HashIndex::RowSource mergedRows(const std::vector<std::shared_ptr<const HashIndex>>& parts) {
+    return [&parts](const HashIndex::RowCallback& callback) {
+        using Cursor = std::pair<uint64_t, size_t>; // (key, part)
+        std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> heap;
+        std::vector<uint64_t> nextKey(parts.size(), 0);
+
+        for (size_t part = 0; part < parts.size(); ++part) {
+            if (parts[part]->hashCount() > 0) {
+                heap.push({parts[part]->keyAt(0), part});
+            }
+        }
+
+        while (!heap.empty()) {
+            Cursor cursor = heap.top();
+            heap.pop();
+
+            const HashIndex& index = *parts[cursor.second];
+            uint64_t& keyIdx = nextKey[cursor.second];
+            auto range = index.postingsAt(keyIdx);
+            for (const HashIndex::Posting* p = range.first; p != range.second; ++p) {
+                if (!callback(static_cast<long>(cursor.first), p->offsetFrame, p->songIdx)) {
+                    return false;
+                }
+            }
+
+            if (++keyIdx < index.hashCount()) {
+                heap.push({index.keyAt(keyIdx), cursor.second});
+            }
+        }
+        return true;
+    };
+}
+
+// rows less the postings of the removed songs
+HashIndex::RowSource withoutRemoved(const HashIndex::RowSource& rows, const RemovedSongs& removed) {
+    if (removed.empty()) {
+        return rows;
+    }
+    return [&rows, &removed](const HashIndex::RowCallback& callback) {
+        return rows([&](long hash, uint32_t offset, uint32_t songIdx) {
+            return removed.count(songIdx) > 0 || callback(hash, offset, songIdx);
+        });
+    };
+}
+
+uint64_t songsIn(const std::vector<std::shared_ptr<const HashIndex>>& parts) {
+    uint64_t songs = 0;
+    for (const auto& part : parts) {
+        songs += part->songCount();
+    }
+    return songs;
+}
+
+void insertKeys(HashFilter& filter, const HashIndex& part) {
+    for (uint64_t keyIdx = 0; keyIdx < part.hashCount(); ++keyIdx) {
+        filter.insert(static_cast<long>(part.keyAt(keyIdx)));
+    }
+}
+
+// A filter over parts with room for half as many hashes again, so
+// registrations don't force a rebuild soon after
+std::shared_ptr<HashFilter> filterOver(const std::vector<std::shared_ptr<const HashIndex>>& parts) {
+    uint64_t keys = 0;
+    for (const auto& part : parts) {
+        keys += part->hashCount();
+    }
+
+    auto filter = std::make_shared<HashFilter>(std::max<uint64_t>(keys + keys / 2, 1 << 16));
+    for (const auto& part : parts) {
+        insertKeys(*filter, *part);
+    }
+    return filter;
+}
+
+// Saves the filter of the index file at indexPath under filterPath
+bool writeFilterFor(const std::string& indexPath, const std::string& filterPath, FingerprintProfile catalog) {
+    auto index = std::make_shared<HashIndex>();
+    if (!index->open(indexPath, catalog)) {
+        return false;
+    }
+    return filterOver({index})->save(filterPath, index->hashCount());
+}
+
+using PostingRange = std::pair<const HashIndex::Posting*, const HashIndex::Posting*>;
+
+// The postings of hash in every part, into ranges; false for a stop hash
+bool lookupParts(const std::vector<std::shared_ptr<const HashIndex>>& parts, long hash, uint64_t maxPostings,
+                 std::vector<PostingRange>& ranges) {
+    ranges.clear();
+    uint64_t total = 0;
+    for (const auto& part : parts) {
+        PostingRange range = part->lookup(static_cast<uint64_t>(hash));
+        if (range.first != range.second) {
+            ranges.push_back(range);
+            total += static_cast<uint64_t>(range.second - range.first);
+        }
+    }
+    return maxPostings == 0 || total <= maxPostings;
+}
+
+} // namespace
+
+bool IndexSnapshot::forEachMatch(const std::vector<HashResult>& hashes, const MatchCallback& callback,
+                                 uint64_t maxPostings, uint64_t* stopped) const {
+    // Same lookup map as the SQL path: the earliest sample offset of each distinct hash
+    std::map<long, uint32_t> hashDict;
+    for (const auto& hash : hashes) {
+        auto entry = hashDict.emplace(hash.hash, hash.offsetFrame);
+        entry.first->second = std::min(entry.first->second, hash.offsetFrame);
+    }
+
+    const RemovedSongs* dead = removed && !removed->empty() ? removed.get() : nullptr;
+    std::vector<PostingRange> ranges;
+    uint64_t skipped = 0;
+    for (const auto& entry : hashDict) {
+        if (!lookupParts(parts, entry.first, maxPostings, ranges)) {
+            skipped++;
+            continue;
+        }
+        for (const PostingRange& range : ranges) {
+            for (const HashIndex::Posting* p = range.first; p != range.second; ++p) {
+                if (!dead || dead->count(p->songIdx) == 0) {
+                    callback(p->songIdx, p->offsetFrame, entry.second);
+                }
+            }
+        }
+    }
+
+    if (stopped) {
+        *stopped = skipped;
+    }
+    return true;
+}
+
+bool IndexSnapshot::forEachHashMatch(const std::vector<long>& hashes, const HashRowCallback& callback,
+                                     uint64_t maxPostings, uint64_t* stopped) const {
+    const RemovedSongs* dead = removed && !removed->empty() ? removed.get() : nullptr;
+    std::vector<PostingRange> ranges;
+    uint64_t skipped = 0;
+    for (long hash : hashes) {
+        if (!lookupParts(parts, hash, maxPostings, ranges)) {
+            skipped++;
+            continue;
+        }
+        for (const PostingRange& range : ranges) {
+            for (const HashIndex::Posting* p = range.first; p != range.second; ++p) {
+                if (!dead || dead->count(p->songIdx) == 0) {
+                    callback(hash, p->songIdx, p->offsetFrame);
+                }
+            }
+        }
+    }
+
+    if (stopped) {
+        *stopped = skipped;
+    }
+    return true;
+}
+
+uint64_t IndexSnapshot::songCount() const {
+    // Each tombstone names a song the parts count
+    uint64_t songs = songsIn(parts);
+    uint64_t dead = removed ? removed->size() : 0;
+    return songs > dead ? songs - dead : 0;
+}
+
+uint64_t IndexSnapshot::postingCount() const {
+    uint64_t postings = 0;
+    for (const auto& part : parts) {
+        postings += part->postingCount();
+    }
+    return postings;
+}
+
+HashFrequencyStats IndexSnapshot::frequencyStats(uint64_t maxPostings) const {
+    // Postings per hash, merged over the parts in key order, into a
+    // histogram of (postings, hashes)
+    using Cursor = std::pair<uint64_t, size_t>; // (key, part)
+    std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> heap;
+    std::vector<uint64_t> nextKey(parts.size(), 0);
+    for (size_t part = 0; part < parts.size(); ++part) {
+        if (parts[part]->hashCount() > 0) {
+            heap.push({parts[part]->keyAt(0), part});
+        }
+    }
+
+    std::map<uint64_t, uint64_t> histogram;
+    while (!heap.empty()) {
+        uint64_t key = heap.top().first;
+        uint64_t postings = 0;
+        while (!heap.empty() && heap.top().first == key) {
+            size_t part = heap.top().second;
+            heap.pop();
+
+            auto range = parts[part]->postingsAt(nextKey[part]);
+            postings += static_cast<uint64_t>(range.second - range.first);
+            if (++nextKey[part] < parts[part]->hashCount()) {
+                heap.push({parts[part]->keyAt(nextKey[part]), part});
+            }
+        }
+        histogram[postings]++;
+    }
+
+    HashFrequencyStats stats;
+    for (const auto& bucket : histogram) {
+        stats.hashes += bucket.second;
+        stats.postings += bucket.first * bucket.second;
+        stats.max = bucket.first;
+        if (maxPostings > 0 && bucket.first > maxPostings) {
+            stats.stopHashes += bucket.second;
+            stats.stopPostings += bucket.first * bucket.second;
+        }
+    }
+
+    uint64_t seen = 0;
+    for (const auto& bucket : histogram) {
+        seen += bucket.second;
+        if (stats.median == 0 && seen * 2 >= stats.hashes) {
+            stats.median = bucket.first;
+        }
+        if (stats.p99 == 0 && seen * 100 >= stats.hashes * 99) {
+            stats.p99 = bucket.first;
+        }
+    }
+    return stats;
+}
+
+SegmentedIndex::SegmentedIndex(const std::string& basePath, FingerprintProfile catalog)
+    : basePath(basePath), catalogProfile(catalog) {
+    publish();
+}
+
+std::string SegmentedIndex::manifestPathFor(const std::string& basePath) {
+    return basePath + ".segments";
+}
+
+bool SegmentedIndex::existsFor(const std::string& basePath) {
+    return identityOf(basePath).present || identityOf(manifestPathFor(basePath)).present;
+}
+
+SegmentedIndex::FileIdentity SegmentedIndex::identityOf(const std::string& path) {
+    FileIdentity identity;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        identity.device = st.st_dev;
+        identity.inode = st.st_ino;
+        identity.present = true;
+    }
+    return identity;
+}
+
+std::string SegmentedIndex::lockPath() const {
+    return basePath + ".lock";
+}
+
+std::string SegmentedIndex::segmentPath(uint64_t id) const {
+    return basePath + "." + std::to_string(id) + ".seg";
+}
+
+bool SegmentedIndex::loadFiles(const std::vector<uint64_t>& segmentIds, const std::vector<uint32_t>& removedSongs) {
+    // Files are replaced by rename, so a new inode means a new base
+    FileIdentity identity = identityOf(basePath);
+    bool baseChanged = !(identity == baseIdentity);
+    if (baseChanged) {
+        base.reset();
+        baseIdentity = FileIdentity();
+        if (identity.present) {
+            auto index = std::make_shared<HashIndex>();
+            if (!index->open(basePath, catalogProfile)) {
+                return false;
+            }
+            base = std::move(index);
+        }
+        baseIdentity = identity;
+    }
+    setRemoved(removedSongs);
+
+    // Segments are immutable: ones already mapped are kept as they are
+    std::vector<Segment> loaded;
+    std::vector<std::shared_ptr<const HashIndex>> opened;
+    for (uint64_t id : segmentIds) {
+        if (isCovered(id)) {
+            continue;
+        }
+        auto existing = std::find_if(segments.begin(), segments.end(),
+                                     [id](const Segment& segment) { return segment.id == id; });
+        if (existing != segments.end()) {
+            loaded.push_back(*existing);
+            continue;
+        }
+
+        auto index = std::make_shared<HashIndex>();
+        if (!index->open(segmentPath(id), catalogProfile)) {
+            AF_LOG(Error) << "Missing index segment: " << segmentPath(id);
+            return false;
+        }
+        loaded.push_back({id, index});
+        opened.push_back(std::move(index));
+    }
+    segments = std::move(loaded);
+    syncFilter(baseChanged, opened);
+    return true;
+}
+
+RemovedSongs SegmentedIndex::liveTombstones(const std::vector<uint32_t>& removedSongs) const {
+    // A fold that stopped short of rewriting the manifest left the
+    // tombstones it applied listed; the base records which those were
+    RemovedSongs live;
+    for (uint32_t songIdx : removedSongs) {
+        if (!base || !base->hasDropped(songIdx)) {
+            live.insert(songIdx);
+        }
+    }
+    return live;
+}
+
+void SegmentedIndex::setRemoved(const std::vector<uint32_t>& removedSongs) {
+    RemovedSongs live = liveTombstones(removedSongs);
+    if (live != *removed) {
+        removed = std::make_shared<const RemovedSongs>(std::move(live));
+    }
+}
+
+bool SegmentedIndex::isCovered(uint64_t segmentId) const {
+    // Listed by a manifest that a fold into the base stopped short of rewriting
+    return base && segmentId <= base->lastMergedSegment();
+}
+
+std::vector<std::shared_ptr<const HashIndex>> SegmentedIndex::allParts() const {
+    std::vector<std::shared_ptr<const HashIndex>> parts;
+    if (base) {
+        parts.push_back(base);
+    }
+    for (const auto& segment : segments) {
+        parts.push_back(segment.index);
+    }
+    parts.insert(parts.end(), runs.begin(), runs.end());
+    return parts;
+}
+
+void SegmentedIndex::syncFilter(bool baseChanged, const std::vector<std::shared_ptr<const HashIndex>>& opened) {
+    if (!baseChanged && filter) {
+        for (const auto& part : opened) {
+            addToFilter(*part);
+        }
+        return;
+    }
+
+    // A new base brings its own filter file; the smaller parts go on top of it
+    std::shared_ptr<HashFilter> loaded;
+    if (base) {
+        loaded = HashFilter::load(HashFilter::pathFor(basePath), base->hashCount());
+    }
+    if (!loaded) {
+        filter = filterOver(allParts());
+        return;
+    }
+
+    filter = std::move(loaded);
+    for (const auto& segment : segments) {
+        addToFilter(*segment.index);
+    }
+    for (const auto& run : runs) {
+        addToFilter(*run);
+    }
+}
+
+void SegmentedIndex::addToFilter(const HashIndex& part) {
+    insertKeys(*filter, part);
+
+    // Past its capacity the false positive rate climbs; rebuild with headroom.
+    // Snapshots already published keep the old filter, which holds their parts.
+    if (filter->size() > filter->capacity()) {
+        filter = filterOver(allParts());
+    }
+}
+
+void SegmentedIndex::publish() {
+    auto view = std::make_shared<IndexSnapshot>();
+    if (base) {
+        view->parts.push_back(base);
+    }
+    for (const auto& segment : segments) {
+        view->parts.push_back(segment.index);
+    }
+    view->flushedParts = view->parts.size();
+    view->parts.insert(view->parts.end(), runs.begin(), runs.end());
+    view->filter = filter;
+    view->removed = removed;
+    current = std::move(view);
+}
+
+bool SegmentedIndex::open() {
+    // Read-only deployments cannot create the lock file; they only read
+    FileLock lock(lockPath(), LOCK_SH);
+    std::lock_guard<std::mutex> state(stateMutex);
+
+    Manifest manifest;
+    bool loaded = readManifest(manifestPathFor(basePath), manifest) && loadFiles(manifest.segments, manifest.removed);
+    publish();
+    return loaded;
+}
+
+bool SegmentedIndex::refresh() {
+    FileLock lock(lockPath(), LOCK_SH);
+    std::lock_guard<std::mutex> state(stateMutex);
+
+    Manifest manifest;
+    if (!readManifest(manifestPathFor(basePath), manifest)) {
+        return false;
+    }
+
+    std::vector<uint64_t> listed;
+    for (uint64_t id : manifest.segments) {
+        if (!isCovered(id)) {
+            listed.push_back(id);
+        }
+    }
+    bool sameSegments = listed.size() == segments.size() &&
+                        std::equal(segments.begin(), segments.end(), listed.begin(),
+                                   [](const Segment& segment, uint64_t id) { return segment.id == id; });
+    bool sameRemoved = liveTombstones(manifest.removed) == *removed;
+    if (sameSegments && sameRemoved && identityOf(basePath) == baseIdentity) {
+        return false;
+    }
+
+    loadFiles(manifest.segments, manifest.removed);
+    publish();
+    return true;
+}
+
+std::shared_ptr<const IndexSnapshot> SegmentedIndex::snapshot() const {
+    std::lock_guard<std::mutex> state(stateMutex);
+    return current;
+}
+
+void SegmentedIndex::add(const std::vector<PendingSong>& songs) {
+    // The new run is sorted before taking the lock
+    std::vector<std::pair<uint64_t, HashIndex::Posting>> rows;
+    for (const auto& song : songs) {
+        for (const auto& hash : song.hashes) {
+            rows.push_back({static_cast<uint64_t>(hash.hash), {song.info.songIdx, hash.offsetFrame}});
+        }
+    }
+    std::stable_sort(rows.begin(), rows.end(),
+                     [](const std::pair<uint64_t, HashIndex::Posting>& a, const std::pair<uint64_t, HashIndex::Posting>& b) {
+                         return a.first < b.first;
+                     });
+
+    std::shared_ptr<const HashIndex> run = HashIndex::inMemory([&rows](const HashIndex::RowCallback& callback) {
+        for (const auto& row : rows) {
+            if (!callback(static_cast<long>(row.first), row.second.offsetFrame, row.second.songIdx)) {
+                return false;
+            }
+        }
+        return true;
+    }, songs.size());
+    if (!run) {
+        return;
+    }
+
+    bool flushDue;
+    {
+        std::lock_guard<std::mutex> state(stateMutex);
+        runs.push_back(run);
+        runPostings += run->postingCount();
+        addToFilter(*run); // Before publishing, so no snapshot holds a hash its filter lacks
+
+        // Runs of similar size are merged, so a lookup probes O(log n) of them
+        while (runs.size() >= 2 && runs[runs.size() - 2]->postingCount() <= 2 * runs.back()->postingCount()) {
+            std::vector<std::shared_ptr<const HashIndex>> pair(runs.end() - 2, runs.end());
+            std::shared_ptr<const HashIndex> merged = HashIndex::inMemory(mergedRows(pair), songsIn(pair));
+            if (!merged) {
+                break;
+            }
+            runs.pop_back();
+            runs.back() = std::move(merged);
+        }
+
+        publish();
+        flushDue = runPostings >= static_cast<uint64_t>(INDEX_FLUSH_POSTINGS);
+    }
+
+    if (flushDue) {
+        flush();
+    }
+}
+
+bool SegmentedIndex::flush() {
+    // The file lock is always taken before stateMutex
+    FileLock lock(lockPath(), LOCK_EX);
+    if (!lock.locked()) {
+        AF_LOG(Error) << "Cannot lock the index segment manifest: " << lockPath();
+        return false;
+    }
+    std::lock_guard<std::mutex> state(stateMutex);
+    bool flushed = flushRuns();
+    publish();
+    return flushed;
+}
+
+bool SegmentedIndex::flushRuns() {
+    if (runs.empty()) {
+        return true;
+    }
+
+    // Re-read under the lock: other processes may have flushed or compacted
+    Manifest manifest;
+    if (!readManifest(manifestPathFor(basePath), manifest)) {
+        return false;
+    }
+
+    uint64_t id = manifest.nextId++;
+    if (!HashIndex::write(mergedRows(runs), songsIn(runs), segmentPath(id), catalogProfile)) {
+        return false;
+    }
+    manifest.segments.push_back(id);
+    if (!writeManifest(manifestPathFor(basePath), manifest)) {
+        std::remove(segmentPath(id).c_str());
+        return false;
+    }
+
+    // The flushed hashes are in the filter already, from their runs
+    auto flushed = std::make_shared<HashIndex>();
+    if (flushed->open(segmentPath(id), catalogProfile)) {
+        segments.push_back({id, std::move(flushed)});
+    }
+
+    runs.clear();
+    runPostings = 0;
+    return loadFiles(manifest.segments, manifest.removed);
+}
+
+bool SegmentedIndex::needsCompaction() const {
+    std::lock_guard<std::mutex> state(stateMutex);
+    return segments.size() > static_cast<size_t>(INDEX_MAX_SEGMENTS);
+}
+
+bool SegmentedIndex::compact() {
+    std::unique_lock<std::mutex> compacting(compactionMutex, std::try_to_lock);
+    if (!compacting.owns_lock()) {
+        return true;
+    }
+
+    // Another process may be compacting the same files
+    FileLock compactionLock(basePath + ".compact.lock", LOCK_EX | LOCK_NB);
+    if (!compactionLock.locked()) {
+        return true;
+    }
+
+    std::vector<std::shared_ptr<const HashIndex>> inputs;
+    std::vector<uint64_t> mergedIds;
+    std::shared_ptr<const RemovedSongs> dropped;
+    std::shared_ptr<const HashIndex> foldedBase;
+    FileIdentity mergedBase;
+    bool intoBase;
+    {
+        FileLock lock(lockPath(), LOCK_SH);
+        std::lock_guard<std::mutex> state(stateMutex);
+
+        Manifest manifest;
+        bool loaded = readManifest(manifestPathFor(basePath), manifest) && loadFiles(manifest.segments, manifest.removed);
+        publish();
+        if (!loaded || segments.empty()) {
+            return loaded;
+        }
+
+        // Segments fold into the base only once they hold a fair share of
+        // its postings; until then the newest ones of similar size merge
+        // into one segment, so no posting is rewritten more than a few times
+        uint64_t segmentPostings = 0;
+        for (const auto& segment : segments) {
+            segmentPostings += segment.index->postingCount();
+        }
+        intoBase = !base || segmentPostings >= INDEX_BASE_MERGE_FRACTION * base->postingCount();
+
+        size_t first = 0;
+        if (intoBase) {
+            if (base) {
+                inputs.push_back(base);
+            }
+        } else {
+            if (segments.size() < 2) {
+                return true;
+            }
+            // An older segment joins while it is no larger than the newer ones taken
+            first = segments.size() - 1;
+            uint64_t taken = segments[first].index->postingCount();
+            while (first > 0 && segments[first - 1].index->postingCount() <= taken) {
+                taken += segments[--first].index->postingCount();
+            }
+            first = std::min(first, segments.size() - 2);
+        }
+        for (size_t i = first; i < segments.size(); ++i) {
+            inputs.push_back(segments[i].index);
+            mergedIds.push_back(segments[i].id);
+        }
+        mergedBase = baseIdentity;
+        foldedBase = base;
+        dropped = removed;
+    }
+
+    // The merge itself holds no lock: flushes and lookups carry on meanwhile.
+    // Removed songs' postings are dropped; a base made of every part takes
+    // their tombstones with it, while merged segments keep counting them.
+    auto start = std::chrono::steady_clock::now();
+    std::string compactedPath = basePath + ".compact";
+    std::string compactedFilterPath = HashFilter::pathFor(compactedPath);
+    uint64_t lastMerged = *std::max_element(mergedIds.begin(), mergedIds.end());
+    uint64_t songs = songsIn(inputs);
+    if (intoBase) {
+        songs = songs > dropped->size() ? songs - dropped->size() : 0;
+    }
+    std::vector<uint32_t> droppedSongs;
+    if (intoBase) {
+        droppedSongs.assign(dropped->begin(), dropped->end());
+    }
+    if (!HashIndex::write(withoutRemoved(mergedRows(inputs), *dropped), songs, compactedPath, catalogProfile,
+                          intoBase ? lastMerged : 0, droppedSongs)) {
+        return false;
+    }
+    if (intoBase && !writeFilterFor(compactedPath, compactedFilterPath, catalogProfile)) {
+        std::remove(compactedPath.c_str());
+        return false;
+    }
+
+    FileLock lock(lockPath(), LOCK_EX);
+    std::lock_guard<std::mutex> state(stateMutex);
+
+    Manifest manifest;
+    bool intact = lock.locked() && readManifest(manifestPathFor(basePath), manifest) &&
+                  identityOf(basePath) == mergedBase;
+    for (uint64_t id : mergedIds) {
+        intact = intact && std::find(manifest.segments.begin(), manifest.segments.end(), id) != manifest.segments.end();
+    }
+    if (!intact) {
+        // The base was rebuilt while merging; the result is out of date
+        AF_LOG(Warn) << "Index changed during compaction; discarding " << compactedPath;
+        std::remove(compactedPath.c_str());
+        std::remove(compactedFilterPath.c_str());
+        return false;
+    }
+
+    auto isMerged = [&mergedIds](uint64_t id) {
+        return std::find(mergedIds.begin(), mergedIds.end(), id) != mergedIds.end();
+    };
+    std::vector<uint64_t> retired;
+    if (intoBase) {
+        // Renaming the base commits the fold: it records the segments it
+        // covers, so a crash before the manifest is rewritten cannot count
+        // them twice. The filter goes first: a base with a stale filter file
+        // only costs a rebuild.
+        if (std::rename(compactedFilterPath.c_str(), HashFilter::pathFor(basePath).c_str()) != 0 ||
+            std::rename(compactedPath.c_str(), basePath.c_str()) != 0) {
+            AF_LOG(Error) << "Failed to move compacted hash index into place: " << basePath;
+            std::remove(compactedPath.c_str());
+            std::remove(compactedFilterPath.c_str());
+            return false;
+        }
+        for (uint64_t id : manifest.segments) {
+            if (id <= lastMerged) {
+                retired.push_back(id);
+            }
+        }
+        manifest.segments.erase(std::remove_if(manifest.segments.begin(), manifest.segments.end(),
+                                               [lastMerged](uint64_t id) { return id <= lastMerged; }),
+                                manifest.segments.end());
+        // Including the ones an earlier fold applied without clearing them
+        manifest.removed.erase(std::remove_if(manifest.removed.begin(), manifest.removed.end(),
+                                              [&dropped, &foldedBase](uint32_t songIdx) {
+                                                  return dropped->count(songIdx) > 0 ||
+                                                         (foldedBase && foldedBase->hasDropped(songIdx));
+                                              }),
+                               manifest.removed.end());
+    } else {
+        // Until the manifest lists it, the merged segment is a stray file
+        // the next flush overwrites
+        uint64_t id = manifest.nextId++;
+        if (std::rename(compactedPath.c_str(), segmentPath(id).c_str()) != 0) {
+            AF_LOG(Error) << "Failed to move merged index segment into place: " << segmentPath(id);
+            std::remove(compactedPath.c_str());
+            return false;
+        }
+        // It takes the place of the oldest segment merged, keeping postings in age order
+        auto position = manifest.segments.insert(
+            std::find_if(manifest.segments.begin(), manifest.segments.end(), isMerged), id);
+        manifest.segments.erase(std::remove_if(position + 1, manifest.segments.end(), isMerged),
+                                manifest.segments.end());
+        retired = mergedIds;
+
+        // Its hashes are in the filter already, from the segments it replaces
+        auto merged = std::make_shared<HashIndex>();
+        if (merged->open(segmentPath(id), catalogProfile)) {
+            segments.push_back({id, std::move(merged)});
+        }
+    }
+    bool written = writeManifest(manifestPathFor(basePath), manifest);
+    bool loaded = loadFiles(manifest.segments, manifest.removed);
+    publish();
+
+    // Mappings of the merged segments stay valid until their last reader drops them
+    if (written) {
+        for (uint64_t id : retired) {
+            std::remove(segmentPath(id).c_str());
+        }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    AF_LOG(Info) << "Compacted " << mergedIds.size() << " index segments into "
+                 << (intoBase ? basePath : segmentPath(manifest.nextId - 1))
+                 << " in " << static_cast<long>(ms) << " ms";
+    return written && loaded;
+}
+
+bool SegmentedIndex::remove(const std::vector<uint32_t>& songIdxs) {
+    FileLock lock(lockPath(), LOCK_EX);
+    if (!lock.locked()) {
+        AF_LOG(Error) << "Cannot lock the index segment manifest: " << lockPath();
+        return false;
+    }
+    std::lock_guard<std::mutex> state(stateMutex);
+
+    Manifest manifest;
+    bool removedAll = flushRuns() && readManifest(manifestPathFor(basePath), manifest);
+    if (removedAll) {
+        manifest.removed.insert(manifest.removed.end(), songIdxs.begin(), songIdxs.end());
+        std::sort(manifest.removed.begin(), manifest.removed.end());
+        manifest.removed.erase(std::unique(manifest.removed.begin(), manifest.removed.end()), manifest.removed.end());
+        removedAll = writeManifest(manifestPathFor(basePath), manifest);
+    }
+    if (removedAll) {
+        // Segments other processes flushed are picked up by the next refresh
+        setRemoved(manifest.removed);
+    }
+    publish();
+    return removedAll;
+}
+
+bool SegmentedIndex::replaceBase(const BaseWriter& writeBase) {
+    FileLock lock(lockPath(), LOCK_EX);
+    if (!lock.locked()) {
+        AF_LOG(Error) << "Cannot lock the index segment manifest: " << lockPath();
+        return false;
+    }
+    std::lock_guard<std::mutex> state(stateMutex);
+
+    Manifest manifest;
+    readManifest(manifestPathFor(basePath), manifest);
+
+    // The new base covers every segment flushed so far and every tombstone,
+    // even before the manifest stops listing them
+    if (!writeBase(basePath, manifest.nextId - 1, manifest.removed)) {
+        return false;
+    }
+    writeFilterFor(basePath, HashFilter::pathFor(basePath), catalogProfile);
+
+    // The new base covers everything the segments and runs held
+    for (uint64_t id : manifest.segments) {
+        std::remove(segmentPath(id).c_str());
+    }
+    manifest.segments.clear();
+    manifest.removed.clear();
+    bool written = writeManifest(manifestPathFor(basePath), manifest);
+
+    runs.clear();
+    runPostings = 0;
+    segments.clear();
+    bool loaded = loadFiles(manifest.segments, manifest.removed);
+    publish();
+    return written && loaded;
+}
+
+} // namespace AudioFingerprinting
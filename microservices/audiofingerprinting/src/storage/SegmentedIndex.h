@@ -0,0 +1,176 @@
+#ifndef SEGMENTED_INDEX_H
+#define SEGMENTED_INDEX_H
+
+#include "HashIndex.h"
+#include "HashFilter.h"
+#include "Storage.h"
+#include "../utils/Types.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace AudioFingerprinting {
+
+// Postings per distinct hash, combined over the parts of a snapshot
+struct HashFrequencyStats {
+    uint64_t hashes = 0;
+    uint64_t postings = 0;
+    uint64_t median = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+    uint64_t stopHashes = 0;   // Hashes over the stop limit
+    uint64_t stopPostings = 0; // Postings they hold
+};
+
+// Songs removed from the catalog whose postings are still in index files
+using RemovedSongs = std::unordered_set<uint32_t>;
+
+// One consistent view of a SegmentedIndex: the base index, the flushed
+// segment files and the in-memory runs not flushed yet, oldest first.
+// Immutable once published, so lookups search every part without locks.
+class IndexSnapshot {
+public:
+    std::vector<std::shared_ptr<const HashIndex>> parts;
+    size_t flushedParts = 0; // Leading parts that are files; the rest are in memory
+    std::shared_ptr<const HashFilter> filter; // Holds every hash of the parts, when built
+    std::shared_ptr<const RemovedSongs> removed; // Postings of these songs are skipped
+
+    // False when no part holds hash, so the lookup can be skipped
+    bool mayContain(long hash) const { return !filter || filter->mayContain(hash); }
+
+    // Same contracts as HashIndex::forEachMatch and forEachHashMatch, less
+    // the removed songs. Stop hashes, those with more than maxPostings
+    // postings over all parts, are skipped and counted in *stopped;
+    // maxPostings 0 looks up every hash.
+    bool forEachMatch(const std::vector<HashResult>& hashes, const MatchCallback& callback,
+                      uint64_t maxPostings = 0, uint64_t* stopped = nullptr) const;
+    bool forEachHashMatch(const std::vector<long>& hashes, const HashRowCallback& callback,
+                          uint64_t maxPostings = 0, uint64_t* stopped = nullptr) const;
+
+    // Statistics, summed over the parts. songCount leaves out the removed
+    // songs; postingCount still holds their postings until compaction.
+    uint64_t songCount() const;
+    uint64_t postingCount() const;
+
+    // Walks every distinct hash once: a full scan, for reporting
+    HashFrequencyStats frequencyStats(uint64_t maxPostings) const;
+};
+
+// Log-structured hash index.
+//
+// Registrations never touch the files readers have mapped. New songs go
+// into small sorted in-memory runs, which are flushed into an immutable
+// segment file (the HashIndex format) once they hold INDEX_FLUSH_POSTINGS
+// postings or flush() is called. A manifest beside the base index lists the
+// segment files, so servers in other processes pick them up with refresh().
+// compact() merges without holding any lock during the merge, so ingest and
+// lookups carry on. It is tiered: the newest segments of similar size are
+// merged into one segment, and the segments are folded into a new base
+// only once they hold INDEX_BASE_MERGE_FRACTION of its postings, so the
+// base is not rewritten for every handful of flushes. A folded base records
+// the last segment id it covers; a crash before the manifest drops those
+// segments leaves them listed but skipped.
+//
+// The manifest is guarded by an flock on <base>.lock: exclusive for the
+// processes that change it, shared for the ones reloading it.
+//
+// Removing songs records them in the manifest as tombstones: lookups skip
+// their postings and compactions drop them, so the files need no rebuild.
+// A fold into the base clears the tombstones it has applied; the base
+// lists them too, so a crash before the manifest drops them does not
+// count those songs out twice.
+//
+// A HashFilter over every part rides along in the snapshots. Whoever writes
+// a base also writes its filter file, which the others load rather than
+// scanning the base's keys; segments and runs are inserted on top.
+class SegmentedIndex {
+public:
+    // catalog is the database's catalog profile, checked against every file
+    // opened and recorded in every file written
+    SegmentedIndex(const std::string& basePath, FingerprintProfile catalog);
+
+    SegmentedIndex(const SegmentedIndex&) = delete;
+    SegmentedIndex& operator=(const SegmentedIndex&) = delete;
+
+    static std::string manifestPathFor(const std::string& basePath);
+    static bool existsFor(const std::string& basePath);
+
+    // Loads the base index (when present) and the manifest's segments
+    bool open();
+
+    // Reloads the files if another process changed them; true when it did
+    bool refresh();
+
+    std::shared_ptr<const IndexSnapshot> snapshot() const;
+
+    // Writers. Songs must carry the songIdx the database assigned them.
+    void add(const std::vector<PendingSong>& songs);
+    bool flush();
+    bool needsCompaction() const;
+    bool compact();
+
+    // Tombstones songs removed from the database; unflushed runs are
+    // flushed first, so every tombstone names a song in the files. Needs
+    // no open(): on an index that was never opened it edits the manifest.
+    bool remove(const std::vector<uint32_t>& songIdxs);
+
+    // Replaces the base with writeBase(path, lastMergedSegment, droppedSongs)'s
+    // output and drops every segment, run and tombstone, for a full rebuild
+    // from the database
+    using BaseWriter = std::function<bool(const std::string& path, uint64_t lastMergedSegment,
+                                          const std::vector<uint32_t>& droppedSongs)>;
+    bool replaceBase(const BaseWriter& writeBase);
+
+private:
+    struct Segment {
+        uint64_t id;
+        std::shared_ptr<const HashIndex> index;
+    };
+
+    struct FileIdentity {
+        dev_t device = 0;
+        ino_t inode = 0;
+        bool present = false;
+
+        bool operator==(const FileIdentity& other) const {
+            return present == other.present && device == other.device && inode == other.inode;
+        }
+    };
+
+    std::string basePath;
+    FingerprintProfile catalogProfile;
+
+    mutable std::mutex stateMutex; // Guards the fields below; lookups go through snapshots
+    std::shared_ptr<const HashIndex> base;
+    FileIdentity baseIdentity;
+    std::vector<Segment> segments;
+    std::vector<std::shared_ptr<const HashIndex>> runs;
+    uint64_t runPostings = 0;
+    std::shared_ptr<HashFilter> filter;
+    std::shared_ptr<const RemovedSongs> removed = std::make_shared<const RemovedSongs>();
+    std::shared_ptr<const IndexSnapshot> current;
+
+    std::mutex compactionMutex; // One compaction at a time per process
+
+    static FileIdentity identityOf(const std::string& path);
+    std::string lockPath() const;
+    std::string segmentPath(uint64_t id) const;
+    bool loadFiles(const std::vector<uint64_t>& segmentIds, const std::vector<uint32_t>& removedSongs);
+    RemovedSongs liveTombstones(const std::vector<uint32_t>& removedSongs) const;
+    void setRemoved(const std::vector<uint32_t>& removedSongs);
+    bool isCovered(uint64_t segmentId) const;
+    std::vector<std::shared_ptr<const HashIndex>> allParts() const;
+    void syncFilter(bool baseChanged, const std::vector<std::shared_ptr<const HashIndex>>& opened);
+    void addToFilter(const HashIndex& part);
+    bool flushRuns();
+    void publish();
+};
+
+} // namespace AudioFingerprinting
+
+#endif
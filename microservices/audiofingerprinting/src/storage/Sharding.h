@@ -0,0 +1,37 @@
+#ifndef SHARDING_H
+#define SHARDING_H
+
+#include "../utils/Types.h"
+#include <vector>
+#include <cstdint>
+
+namespace AudioFingerprinting {
+
+// Hash-space partitioning across shard databases or server nodes.
+//
+// A hash row lives on exactly one shard, chosen from the hash value alone,
+// so the rows for a query hash are always found on one node and per-shard
+// offset histograms add up to the unsharded one. The hash is mixed before
+// the modulo: its low bits are the anchor-target time delta, which would
+// otherwise send whole delta ranges to the same shard.
+inline uint32_t shardForHash(long hash, uint32_t shardCount) {
+    uint64_t mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<uint32_t>((mixed >> 32) % shardCount);
+}
+
+// hashes split by owning shard, keeping their order within each shard
+inline std::vector<std::vector<HashResult>> partitionByShard(const std::vector<HashResult>& hashes,
+                                                             uint32_t shardCount) {
+    std::vector<std::vector<HashResult>> shards(shardCount);
+    for (auto& shard : shards) {
+        shard.reserve(hashes.size() / shardCount + 1);
+    }
+    for (const auto& hash : hashes) {
+        shards[shardForHash(hash.hash, shardCount)].push_back(hash);
+    }
+    return shards;
+}
+
+} // namespace AudioFingerprinting
+
+#endif
@@ -1,4 +1,6 @@
 #include "Storage.h"
+#include "../core/FingerprintProfile.h"
+#include "../utils/Log.h"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
@@ -9,13 +11,100 @@
 
 namespace AudioFingerprinting {
 
+namespace {
+
+std::string buildMatchBatchSql() {
+    std::ostringstream sql;
+    sql << "SELECT hash, offset, song_idx FROM hash WHERE hash IN (";
+    for (int i = 0; i < Database::MATCH_BATCH_SIZE; ++i) {
+        if (i > 0) sql << ",";
+        sql << "?";
+    }
+    sql << ")";
+    return sql.str();
+}
+
+// Never produced by the hash generator, used to pad partial batches
+const sqlite3_int64 UNUSED_HASH = -1;
+
+// Songs per DELETE statement; hash rows are found through idx_hash_song
+const size_t DELETE_BATCH_SONGS = 500;
+
+std::string columnText(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? reinterpret_cast<const char*>(text) : "";
+}
+
+} // namespace
+
+sqlite3_stmt* ReaderConnection::statement(Statement which) {
+    if (statements[which]) {
+        sqlite3_reset(statements[which]);
+        sqlite3_clear_bindings(statements[which]);
+        return statements[which];
+    }
+    
+    static const std::string matchBatchSql = buildMatchBatchSql();
+    const char* sql = nullptr;
+    
+    switch (which) {
+        case MATCH_BATCH:
+            sql = matchBatchSql.c_str();
+            break;
+        case INFO_BY_SONG_IDX:
+            sql = "SELECT artist, album, title, song_id, song_idx FROM song_info WHERE song_idx = ?";
+            break;
+        case INFO_BY_SONG_ID:
+            sql = "SELECT artist, album, title, song_id, song_idx FROM song_info WHERE song_id = ?";
+            break;
+        default:
+            return nullptr;
+    }
+    
+    if (sqlite3_prepare_v3(conn, sql, -1, SQLITE_PREPARE_PERSISTENT, &statements[which], nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to prepare reader statement: " << sqlite3_errmsg(conn) << std::endl;
+        statements[which] = nullptr;
+    }
+    
+    return statements[which];
+}
+
+ReaderConnection::~ReaderConnection() {
+    for (sqlite3_stmt*& stmt : statements) {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+    sqlite3_close(conn);
+}
+
+// Returns its connection to the pool when it goes out of scope
+class Database::ReaderLease {
+public:
+    explicit ReaderLease(Database& database) : database(database), reader(database.acquireReader()) {}
+    ~ReaderLease() {
+        if (reader) {
+            database.releaseReader(std::move(reader));
+        }
+    }
+    
+    ReaderLease(const ReaderLease&) = delete;
+    ReaderLease& operator=(const ReaderLease&) = delete;
+    
+    ReaderConnection* operator->() const { return reader.get(); }
+    explicit operator bool() const { return reader != nullptr; }
+    
+private:
+    Database& database;
+    std::unique_ptr<ReaderConnection> reader;
+};
+
 Database::Database(const std::string& dbPath) : dbPath(dbPath), db(nullptr), isOpen(false) {}
 
 Database::~Database() {
     close();
 }
 
-bool Database::open() {
+bool Database::connect() {
     if (isOpen) {
         return true;
     }
@@ -28,18 +117,50 @@ bool Database::open() {
     
     // Set timeout for better concurrency (30 seconds)
     sqlite3_busy_timeout(db, 30000);
+    isOpen = true;
     
-    // Enable better concurrency settings
+    // Enable better concurrency settings; WAL lets the reader pool run
+    // alongside the writer
     executeSQL("PRAGMA journal_mode=WAL");
     executeSQL("PRAGMA synchronous=NORMAL");
     executeSQL("PRAGMA cache_size=10000");
     executeSQL("PRAGMA temp_store=MEMORY");
     
-    isOpen = true;
+    return true;
+}
+
+bool Database::open() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    
+    if (isOpen) {
+        return true;
+    }
+    
+    if (!connect()) {
+        return false;
+    }
+    
+    if (isLegacySchema()) {
+        std::cerr << "Database " << dbPath << " uses the legacy schema (TEXT song ids per hash row). "
+                  << "Run 'audioFingerprintingCLI migrate --db " << dbPath << "' to upgrade it." << std::endl;
+        sqlite3_close(db);
+        db = nullptr;
+        isOpen = false;
+        return false;
+    }
+    
     return setupTables();
 }
 
 void Database::close() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    
+    {
+        // Leased readers must be returned before closing
+        std::lock_guard<std::mutex> readerLock(readerMutex);
+        idleReaders.clear();
+    }
+    
     if (isOpen && db) {
         // Checkpoint WAL before closing
         sqlite3_exec(db, "PRAGMA wal_checkpoint(TRUNCATE)", nullptr, nullptr, nullptr);
@@ -72,84 +193,253 @@ bool Database::setupTables() {
         return false;
     }
     
-    // Create hash table
+    // Create hash table (song_idx references song_info, offset is an STFT frame index)
     std::string createHashTable = 
         "CREATE TABLE IF NOT EXISTS hash ("
         "hash INTEGER, "
-        "offset REAL, "
-        "song_id TEXT"
+        "offset INTEGER, "
+        "song_idx INTEGER"
         ")";
     
     // Create song_info table
     std::string createSongTable = 
         "CREATE TABLE IF NOT EXISTS song_info ("
+        "song_idx INTEGER PRIMARY KEY, "
         "artist TEXT, "
         "album TEXT, "
         "title TEXT, "
-        "song_id TEXT PRIMARY KEY"
+        "song_id TEXT NOT NULL UNIQUE"
         ")";
     
     // Create index for faster lookups
     std::string createIndex = 
         "CREATE INDEX IF NOT EXISTS idx_hash ON hash (hash)";
     
+    // Removals find a song's hash rows without scanning the table
+    std::string createSongIndex = 
+        "CREATE INDEX IF NOT EXISTS idx_hash_song ON hash (song_idx)";
+    
+    // Library manifest: the file each song was registered from. Added
+    // alongside the v2 tables, so older v2 databases gain it on open.
+    std::string createSourceTable = 
+        "CREATE TABLE IF NOT EXISTS source_file ("
+        "path TEXT PRIMARY KEY, "
+        "size INTEGER, "
+        "mtime INTEGER, "
+        "digest TEXT, "
+        "song_idx INTEGER"
+        ")";
+    
+    // Catalog settings. The fingerprint profile is recorded once, by the
+    // first open: a new database gets the catalog profile, one that already
+    // has songs or hash rows predates the table and was made with catalog-v1.
+    // Removals record song_idx_high_water, the highest song_idx ever removed.
+    std::string createMetaTable = 
+        "CREATE TABLE IF NOT EXISTS catalog_meta ("
+        "key TEXT PRIMARY KEY, "
+        "value TEXT"
+        ")";
+    std::string recordProfile = 
+        std::string("INSERT OR IGNORE INTO catalog_meta (key, value) SELECT 'fingerprint_profile', "
+                    "CASE WHEN EXISTS (SELECT 1 FROM hash) OR EXISTS (SELECT 1 FROM song_info) THEN '") +
+        LEGACY_CATALOG_TAG + "' ELSE '" + CatalogProfile::TAG + "' END";
+    
     return executeSQL(createHashTable) && 
            executeSQL(createSongTable) && 
-           executeSQL(createIndex);
-}
-
-bool Database::checkpointDb() {
-    return executeSQL("PRAGMA wal_checkpoint(FULL)");
+           executeSQL(createIndex) &&
+           executeSQL(createSongIndex) &&
+           executeSQL(createSourceTable) &&
+           executeSQL(createMetaTable) &&
+           executeSQL(recordProfile) &&
+           executeSQL("PRAGMA user_version = " + std::to_string(SCHEMA_VERSION));
 }
 
-std::string Database::generateSongIdFromPath(const std::string& filename) {
-    std::hash<std::string> hasher;
-    size_t hashValue = hasher(filename);
+int Database::getSchemaVersion() {
+    sqlite3_stmt* stmt;
+    int version = 0;
     
-    std::ostringstream oss;
-    oss << std::hex << hashValue;
-    return oss.str();
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    return version;
 }
 
-bool Database::songInDb(const std::string& filename) {
-    if (!isOpen) {
+bool Database::isLegacySchema() {
+    if (getSchemaVersion() >= SCHEMA_VERSION) {
         return false;
     }
     
-    std::string songId = generateSongIdFromPath(filename);
-    
+    // Pre-v2 databases carry the string song id on every hash row
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT COUNT(*) FROM song_info WHERE song_id = ?";
+    const char* sql = "SELECT COUNT(*) FROM pragma_table_info('hash') WHERE name = 'song_id'";
+    int count = 0;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            count = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    return count > 0;
+}
+
+std::unique_ptr<ReaderConnection> Database::acquireReader() {
+    {
+        std::lock_guard<std::mutex> lock(readerMutex);
+        if (!idleReaders.empty()) {
+            std::unique_ptr<ReaderConnection> reader = std::move(idleReaders.back());
+            idleReaders.pop_back();
+            return reader;
+        }
+    }
+    
+    // Pool grows to the peak number of concurrent readers
+    auto reader = std::make_unique<ReaderConnection>();
+    int rc = sqlite3_open_v2(dbPath.c_str(), &reader->conn,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr);
     if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        return false;
+        std::cerr << "Cannot open read connection: " << sqlite3_errmsg(reader->conn) << std::endl;
+        return nullptr;
     }
     
-    sqlite3_bind_text(stmt, 1, songId.c_str(), -1, SQLITE_STATIC);
+    sqlite3_busy_timeout(reader->conn, 30000);
+    sqlite3_exec(reader->conn, "PRAGMA cache_size=10000", nullptr, nullptr, nullptr);
+    sqlite3_exec(reader->conn, "PRAGMA temp_store=MEMORY", nullptr, nullptr, nullptr);
+    
+    return reader;
+}
+
+void Database::releaseReader(std::unique_ptr<ReaderConnection> reader) {
+    std::lock_guard<std::mutex> lock(readerMutex);
+    idleReaders.push_back(std::move(reader));
+}
+
+int Database::queryCount(const char* sql) {
+    if (!isOpen) return 0;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) return 0;
     
-    rc = sqlite3_step(stmt);
     int count = 0;
-    if (rc == SQLITE_ROW) {
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
         count = sqlite3_column_int(stmt, 0);
     }
     
     sqlite3_finalize(stmt);
-    return count > 0;
+    return count;
 }
 
-bool Database::storeSong(const std::vector<HashResult>& hashes, const SongInfo& songInfo) {
-    if (!isOpen || hashes.empty()) {
-        std::cerr << "Database not open or no hashes provided" << std::endl;
+bool Database::migrateLegacySchema() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    
+    if (!connect()) {
         return false;
     }
     
+    if (!isLegacySchema()) {
+        std::cout << "Database already uses schema version " << SCHEMA_VERSION << std::endl;
+        return setupTables();
+    }
+    
+    int legacySongs = queryCount("SELECT COUNT(*) FROM song_info");
+    int legacyHashes = queryCount("SELECT COUNT(*) FROM hash");
+    std::cout << "Migrating " << legacySongs << " songs and " << legacyHashes 
+              << " hashes to schema version " << SCHEMA_VERSION << std::endl;
+    
+    // Offsets were stored in seconds; convert them to the nearest STFT frame
+    std::ostringstream frameExpr;
+    frameExpr << "CAST(ROUND(MAX(h.offset, 0) * " << SAMPLE_RATE << ".0 / " << HOP_SIZE << ") AS INTEGER)";
+    
+    const std::vector<std::string> steps = {
+        "DROP INDEX IF EXISTS idx_hash",
+        "ALTER TABLE hash RENAME TO hash_legacy",
+        "ALTER TABLE song_info RENAME TO song_info_legacy",
+        "CREATE TABLE song_info ("
+            "song_idx INTEGER PRIMARY KEY, artist TEXT, album TEXT, title TEXT, "
+            "song_id TEXT NOT NULL UNIQUE)",
+        "INSERT INTO song_info (artist, album, title, song_id) "
+            "SELECT artist, album, title, song_id FROM song_info_legacy ORDER BY rowid",
+        "CREATE TABLE hash (hash INTEGER, offset INTEGER, song_idx INTEGER)",
+        "INSERT INTO hash (hash, offset, song_idx) "
+            "SELECT h.hash, " + frameExpr.str() + ", s.song_idx "
+            "FROM hash_legacy h JOIN song_info s ON s.song_id = h.song_id",
+        "DROP TABLE hash_legacy",
+        "DROP TABLE song_info_legacy",
+        "CREATE INDEX idx_hash ON hash (hash)",
+        "CREATE INDEX idx_hash_song ON hash (song_idx)",
+        "PRAGMA user_version = " + std::to_string(SCHEMA_VERSION)
+    };
+    
+    if (!executeSQL("BEGIN IMMEDIATE TRANSACTION")) {
+        return false;
+    }
+    
+    for (const auto& step : steps) {
+        if (!executeSQL(step)) {
+            std::cerr << "Migration failed, rolling back" << std::endl;
+            executeSQL("ROLLBACK");
+            return false;
+        }
+    }
+    
+    if (!executeSQL("COMMIT")) {
+        executeSQL("ROLLBACK");
+        return false;
+    }
+    
+    int migratedHashes = queryCount("SELECT COUNT(*) FROM hash");
+    if (migratedHashes < legacyHashes) {
+        std::cout << "  Dropped " << (legacyHashes - migratedHashes) 
+                  << " hash rows without song info" << std::endl;
+    }
+    
+    // Reclaim the space of the dropped TEXT columns
+    std::cout << "  Compacting database..." << std::endl;
+    executeSQL("VACUUM");
+    
+    std::cout << "Migration complete: " << queryCount("SELECT COUNT(*) FROM song_info") << " songs, " 
+              << migratedHashes << " hashes" << std::endl;
+    if (migratedHashes > 0) {
+        std::cout << "  Hashes were made with fingerprint profile " << LEGACY_CATALOG_TAG
+                  << "; register the songs again into a new database to use them with "
+                  << CatalogProfile::TAG << std::endl;
+    }
+    return true;
+}
+
+bool Database::checkpointDb() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    // PASSIVE copies what it can without waiting on readers, so lookups
+    // still in flight never stall on it
+    return executeSQL("PRAGMA wal_checkpoint(PASSIVE)");
+}
+
+std::string Database::generateSongIdFromPath(const std::string& filename) {
+    std::hash<std::string> hasher;
+    size_t hashValue = hasher(filename);
+    
+    std::ostringstream oss;
+    oss << std::hex << hashValue;
+    return oss.str();
+}
+
+bool Database::songInDb(const std::string& filename) {
+    // Lookups by song_id go through the read pool so ingest workers don't wait on the writer
+    return getInfoForSongId(generateSongIdFromPath(filename)).songIdx != 0;
+}
+
+bool Database::writeTransaction(const std::function<bool()>& body) {
     // Retry mechanism for database locks
     const int maxRetries = 3;
     for (int attempt = 0; attempt < maxRetries; attempt++) {
         if (attempt > 0) {
-            std::cout << "  Retrying database operation (attempt " << (attempt + 1) << ")" << std::endl;
+            AF_LOG(Warn) << "  Retrying database operation (attempt " << (attempt + 1) << ")";
             std::this_thread::sleep_for(std::chrono::milliseconds(100 * attempt));
         }
         
@@ -160,87 +450,9 @@ bool Database::storeSong(const std::vector<HashResult>& hashes, const SongInfo&
             return false;
         }
         
-        bool success = true;
-        
-        // Insert song info first
-        sqlite3_stmt* infoStmt;
-        const char* infoSql = "INSERT OR REPLACE INTO song_info (artist, album, title, song_id) VALUES (?, ?, ?, ?)";
-        
-        int rc = sqlite3_prepare_v2(db, infoSql, -1, &infoStmt, nullptr);
-        if (rc != SQLITE_OK) {
-            std::cerr << "Failed to prepare song info statement: " << sqlite3_errmsg(db) << std::endl;
-            executeSQL("ROLLBACK");
-            if (attempt < maxRetries - 1) continue;
-            return false;
-        }
-        
-        std::string artist = songInfo.artist.empty() ? "Unknown" : songInfo.artist;
-        std::string album = songInfo.album.empty() ? "Unknown" : songInfo.album;
-        std::string title = songInfo.title.empty() ? "Unknown" : songInfo.title;
-        
-        sqlite3_bind_text(infoStmt, 1, artist.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(infoStmt, 2, album.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(infoStmt, 3, title.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(infoStmt, 4, songInfo.songId.c_str(), -1, SQLITE_TRANSIENT);
-        
-        rc = sqlite3_step(infoStmt);
-        sqlite3_finalize(infoStmt);
-        
-        if (rc != SQLITE_DONE) {
-            std::cerr << "Failed to insert song info: " << sqlite3_errmsg(db) << std::endl;
-            executeSQL("ROLLBACK");
-            if (attempt < maxRetries - 1) continue;
-            return false;
-        }
-        
-        // Insert hashes in batches
-        sqlite3_stmt* hashStmt;
-        const char* hashSql = "INSERT INTO hash (hash, offset, song_id) VALUES (?, ?, ?)";
-        
-        rc = sqlite3_prepare_v2(db, hashSql, -1, &hashStmt, nullptr);
-        if (rc != SQLITE_OK) {
-            std::cerr << "Failed to prepare hash statement: " << sqlite3_errmsg(db) << std::endl;
-            executeSQL("ROLLBACK");
-            if (attempt < maxRetries - 1) continue;
-            return false;
-        }
-        
-        // Process hashes in smaller batches to avoid locks
-        const size_t batchSize = 1000;
-        for (size_t i = 0; i < hashes.size(); i += batchSize) {
-            size_t endIdx = std::min(i + batchSize, hashes.size());
-            
-            for (size_t j = i; j < endIdx; j++) {
-                const auto& hash = hashes[j];
-                
-                sqlite3_bind_int64(hashStmt, 1, hash.hash);
-                sqlite3_bind_double(hashStmt, 2, hash.timeOffset);
-                sqlite3_bind_text(hashStmt, 3, hash.songId.c_str(), -1, SQLITE_TRANSIENT);
-                
-                rc = sqlite3_step(hashStmt);
-                if (rc != SQLITE_DONE) {
-                    std::cerr << "Failed to insert hash: " << sqlite3_errmsg(db) << " (Code: " << rc << ")" << std::endl;
-                    success = false;
-                    break;
-                }
-                
-                sqlite3_reset(hashStmt);
-            }
-            
-            if (!success) break;
-            
-            // Periodic progress update for large batches
-            if (endIdx % 5000 == 0) {
-                std::cout << "  Inserted " << endIdx << "/" << hashes.size() << " hashes..." << std::endl;
-            }
-        }
-        
-        sqlite3_finalize(hashStmt);
-        
-        if (success) {
+        if (body()) {
             // Commit transaction
             if (executeSQL("COMMIT")) {
-                std::cout << "  Successfully stored " << hashes.size() << " hashes" << std::endl;
                 return true;
             } else {
                 std::cerr << "Failed to commit transaction: " << sqlite3_errmsg(db) << std::endl;
@@ -251,8 +463,7 @@ bool Database::storeSong(const std::vector<HashResult>& hashes, const SongInfo&
         executeSQL("ROLLBACK");
         
         if (attempt < maxRetries - 1) {
-            std::cout << "  Database operation failed, retrying..." << std::endl;
-            continue;
+            AF_LOG(Warn) << "  Database operation failed, retrying...";
         }
     }
     
@@ -260,52 +471,424 @@ bool Database::storeSong(const std::vector<HashResult>& hashes, const SongInfo&
     return false;
 }
 
-std::map<std::string, std::vector<MatchOffset>> Database::getMatches(
-    const std::vector<HashResult>& hashes, int threshold) {
+uint32_t Database::insertSongInfo(const SongInfo& songInfo) {
+    // An existing song keeps its song_idx. A new one without a key takes one
+    // above every key assigned so far, removed songs' included: an index
+    // loaded elsewhere may still hold a removed song's postings, which must
+    // not be credited to a song registered after it.
+    sqlite3_stmt* infoStmt;
+    const char* infoSql = 
+        "INSERT INTO song_info (song_idx, artist, album, title, song_id) VALUES ("
+        "COALESCE(?, MAX(IFNULL((SELECT MAX(song_idx) FROM song_info), 0), "
+        "IFNULL((SELECT CAST(value AS INTEGER) FROM catalog_meta WHERE key = 'song_idx_high_water'), 0)) + 1), "
+        "?, ?, ?, ?) "
+        "ON CONFLICT(song_id) DO UPDATE SET artist = excluded.artist, "
+        "album = excluded.album, title = excluded.title";
+    
+    int rc = sqlite3_prepare_v2(db, infoSql, -1, &infoStmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Failed to prepare song info statement: " << sqlite3_errmsg(db) << std::endl;
+        return 0;
+    }
+    
+    std::string artist = songInfo.artist.empty() ? "Unknown" : songInfo.artist;
+    std::string album = songInfo.album.empty() ? "Unknown" : songInfo.album;
+    std::string title = songInfo.title.empty() ? "Unknown" : songInfo.title;
     
-    std::map<std::string, std::vector<MatchOffset>> resultDict;
+    if (songInfo.songIdx != 0) {
+        sqlite3_bind_int64(infoStmt, 1, songInfo.songIdx);
+    } else {
+        sqlite3_bind_null(infoStmt, 1);
+    }
+    sqlite3_bind_text(infoStmt, 2, artist.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(infoStmt, 3, album.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(infoStmt, 4, title.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(infoStmt, 5, songInfo.songId.c_str(), -1, SQLITE_TRANSIENT);
+    
+    rc = sqlite3_step(infoStmt);
+    sqlite3_finalize(infoStmt);
+    
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to insert song info: " << sqlite3_errmsg(db) << std::endl;
+        return 0;
+    }
+    
+    // Resolve the integer key the hash rows will reference
+    sqlite3_stmt* idxStmt;
+    uint32_t songIdx = 0;
+    rc = sqlite3_prepare_v2(db, "SELECT song_idx FROM song_info WHERE song_id = ?", -1, &idxStmt, nullptr);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(idxStmt, 1, songInfo.songId.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(idxStmt) == SQLITE_ROW) {
+            songIdx = static_cast<uint32_t>(sqlite3_column_int64(idxStmt, 0));
+        }
+        sqlite3_finalize(idxStmt);
+    }
+    
+    if (songIdx == 0) {
+        std::cerr << "Failed to resolve song index: " << sqlite3_errmsg(db) << std::endl;
+    } else if (songInfo.songIdx != 0 && songIdx != songInfo.songIdx) {
+        // A shard must use the catalog's key, or its rows would score the wrong song
+        std::cerr << "Song " << songInfo.songId << " is stored as song_idx " << songIdx
+                  << ", expected " << songInfo.songIdx << std::endl;
+        return 0;
+    }
+    return songIdx;
+}
+
+uint32_t Database::insertSongRows(const std::vector<HashResult>& hashes, const SongInfo& songInfo) {
+    uint32_t songIdx = insertSongInfo(songInfo);
+    if (songIdx == 0) {
+        return 0;
+    }
+    
+    // Insert hashes in batches
+    sqlite3_stmt* hashStmt;
+    const char* hashSql = "INSERT INTO hash (hash, offset, song_idx) VALUES (?, ?, ?)";
+    
+    int rc = sqlite3_prepare_v2(db, hashSql, -1, &hashStmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Failed to prepare hash statement: " << sqlite3_errmsg(db) << std::endl;
+        return 0;
+    }
+    
+    bool success = true;
+    
+    // Process hashes in smaller batches to avoid locks
+    const size_t batchSize = 1000;
+    for (size_t i = 0; i < hashes.size(); i += batchSize) {
+        size_t endIdx = std::min(i + batchSize, hashes.size());
+        
+        for (size_t j = i; j < endIdx; j++) {
+            const auto& hash = hashes[j];
+            
+            sqlite3_bind_int64(hashStmt, 1, hash.hash);
+            sqlite3_bind_int64(hashStmt, 2, hash.offsetFrame);
+            sqlite3_bind_int64(hashStmt, 3, songIdx);
+            
+            rc = sqlite3_step(hashStmt);
+            if (rc != SQLITE_DONE) {
+                std::cerr << "Failed to insert hash: " << sqlite3_errmsg(db) << " (Code: " << rc << ")" << std::endl;
+                success = false;
+                break;
+            }
+            
+            sqlite3_reset(hashStmt);
+        }
+        
+        if (!success) break;
+        
+        // Periodic progress update for large batches
+        if (endIdx % 5000 == 0) {
+            AF_LOG(Debug) << "  Inserted " << endIdx << "/" << hashes.size() << " hashes...";
+        }
+    }
+    
+    sqlite3_finalize(hashStmt);
+    return success ? songIdx : 0;
+}
+
+bool Database::insertSourceFile(const SourceFile& file) {
+    sqlite3_stmt* stmt;
+    const char* sql = 
+        "INSERT INTO source_file (path, size, mtime, digest, song_idx) VALUES (?, ?, ?, ?, ?) "
+        "ON CONFLICT(path) DO UPDATE SET size = excluded.size, mtime = excluded.mtime, "
+        "digest = excluded.digest, song_idx = excluded.song_idx";
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to prepare source file statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    
+    sqlite3_bind_text(stmt, 1, file.path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(file.size));
+    sqlite3_bind_int64(stmt, 3, file.mtime);
+    sqlite3_bind_text(stmt, 4, file.digest.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 5, file.songIdx);
+    
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to record source file: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Database::storeSong(const std::vector<HashResult>& hashes, const SongInfo& songInfo) {
+    std::lock_guard<std::mutex> lock(writeMutex);
     
     if (!isOpen || hashes.empty()) {
-        return resultDict;
+        std::cerr << "Database not open or no hashes provided" << std::endl;
+        return false;
     }
     
-    // Create hash lookup map
-    std::map<long, double> hashDict;
-    for (const auto& hash : hashes) {
-        hashDict[hash.hash] = hash.timeOffset;
+    bool stored = writeTransaction([&]() {
+        return insertSongRows(hashes, songInfo) != 0;
+    });
+    
+    if (stored) {
+        AF_LOG(Debug) << "  Successfully stored " << hashes.size() << " hashes";
     }
+    return stored;
+}
+
+bool Database::storeSongs(std::vector<PendingSong>& songs) {
+    std::lock_guard<std::mutex> lock(writeMutex);
     
-    // Build IN clause for SQL query
-    std::ostringstream inClause;
-    inClause << "(";
-    for (size_t i = 0; i < hashes.size(); ++i) {
-        if (i > 0) inClause << ",";
-        inClause << hashes[i].hash;
+    if (!isOpen || songs.empty()) {
+        std::cerr << "Database not open or no songs provided" << std::endl;
+        return false;
+    }
+    
+    // Keys handed out inside a transaction that rolls back must not stick
+    std::vector<uint32_t> requestedKeys;
+    requestedKeys.reserve(songs.size());
+    for (const auto& song : songs) {
+        requestedKeys.push_back(song.info.songIdx);
+    }
+    
+    // One transaction for the whole batch amortizes the commit and WAL sync
+    bool stored = writeTransaction([&]() {
+        for (auto& song : songs) {
+            uint32_t songIdx = song.hashes.empty() ? 0 : insertSongRows(song.hashes, song.info);
+            if (songIdx == 0) {
+                return false;
+            }
+            song.info.songIdx = songIdx;
+            
+            if (!song.source.path.empty()) {
+                song.source.songIdx = songIdx;
+                if (!insertSourceFile(song.source)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    });
+    
+    if (!stored) {
+        for (size_t i = 0; i < songs.size(); ++i) {
+            songs[i].info.songIdx = requestedKeys[i];
+        }
     }
-    inClause << ")";
+    return stored;
+}
+
+bool Database::storeSourceFiles(const std::vector<SourceFile>& files) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    
+    if (!isOpen) {
+        std::cerr << "Database not open" << std::endl;
+        return false;
+    }
+    
+    return writeTransaction([&]() {
+        for (const auto& file : files) {
+            if (!insertSourceFile(file)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+std::unordered_map<std::string, SourceFile> Database::loadSourceFiles() {
+    std::unordered_map<std::string, SourceFile> files;
+    if (!isOpen) return files;
     
-    std::string sql = "SELECT hash, offset, song_id FROM hash WHERE hash IN " + inClause.str();
+    // One scan of the manifest instead of a lookup per file
+    ReaderLease reader(*this);
+    if (!reader) return files;
     
     sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+    const char* sql = "SELECT path, size, mtime, digest, song_idx FROM source_file";
+    if (sqlite3_prepare_v2(reader->conn, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to prepare manifest scan: " << sqlite3_errmsg(reader->conn) << std::endl;
+        return files;
+    }
     
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare match query: " << sqlite3_errmsg(db) << std::endl;
-        return resultDict;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        SourceFile file;
+        file.path = columnText(stmt, 0);
+        file.size = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1));
+        file.mtime = sqlite3_column_int64(stmt, 2);
+        file.digest = columnText(stmt, 3);
+        file.songIdx = static_cast<uint32_t>(sqlite3_column_int64(stmt, 4));
+        files.emplace(file.path, std::move(file));
     }
     
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        long hash = sqlite3_column_int64(stmt, 0);
-        double dbOffset = sqlite3_column_double(stmt, 1);
-        const char* songId = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+bool Database::deleteSongs(const std::vector<uint32_t>& songIdxs) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    
+    if (!isOpen) {
+        std::cerr << "Database not open" << std::endl;
+        return false;
+    }
+    if (songIdxs.empty()) {
+        return true;
+    }
+    
+    static const char* const tables[] = {"hash", "song_info", "source_file"};
+    static const char* const recordHighWater = 
+        "INSERT INTO catalog_meta (key, value) VALUES ('song_idx_high_water', ?) "
+        "ON CONFLICT(key) DO UPDATE SET value = MAX(CAST(value AS INTEGER), CAST(excluded.value AS INTEGER))";
+    
+    return writeTransaction([&]() {
+        // The keys stay taken after their songs are gone (see insertSongInfo)
+        sqlite3_stmt* highWaterStmt;
+        if (sqlite3_prepare_v2(db, recordHighWater, -1, &highWaterStmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Failed to prepare song key statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        sqlite3_bind_int64(highWaterStmt, 1, *std::max_element(songIdxs.begin(), songIdxs.end()));
+        int highWaterRc = sqlite3_step(highWaterStmt);
+        sqlite3_finalize(highWaterStmt);
+        if (highWaterRc != SQLITE_DONE) {
+            std::cerr << "Failed to record removed song keys: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
         
+        for (size_t begin = 0; begin < songIdxs.size(); begin += DELETE_BATCH_SONGS) {
+            size_t end = std::min(begin + DELETE_BATCH_SONGS, songIdxs.size());
+            
+            std::ostringstream keys;
+            for (size_t i = begin; i < end; ++i) {
+                keys << (i > begin ? "," : "") << "?";
+            }
+            
+            for (const char* table : tables) {
+                std::string sql = std::string("DELETE FROM ") + table + " WHERE song_idx IN (" + keys.str() + ")";
+                sqlite3_stmt* stmt;
+                if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                    std::cerr << "Failed to prepare delete statement: " << sqlite3_errmsg(db) << std::endl;
+                    return false;
+                }
+                
+                for (size_t i = begin; i < end; ++i) {
+                    sqlite3_bind_int64(stmt, static_cast<int>(i - begin + 1), songIdxs[i]);
+                }
+                
+                int rc = sqlite3_step(stmt);
+                sqlite3_finalize(stmt);
+                if (rc != SQLITE_DONE) {
+                    std::cerr << "Failed to delete songs from " << table << ": " << sqlite3_errmsg(db) << std::endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    });
+}
+
+bool Database::storeSongInfos(std::vector<SongInfo>& songs) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    
+    if (!isOpen || songs.empty()) {
+        std::cerr << "Database not open or no songs provided" << std::endl;
+        return false;
+    }
+    
+    return writeTransaction([&]() {
+        for (auto& song : songs) {
+            song.songIdx = insertSongInfo(song);
+            if (song.songIdx == 0) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+bool Database::forEachMatch(const std::vector<HashResult>& hashes, const MatchCallback& callback) {
+    // One sample offset per distinct hash, its earliest, so a query matched
+    // in time-ordered pieces (progressive batches, live chunks) scores the
+    // same as the whole query
+    std::map<long, uint32_t> hashDict;
+    for (const auto& hash : hashes) {
+        auto entry = hashDict.emplace(hash.hash, hash.offsetFrame);
+        entry.first->second = std::min(entry.first->second, hash.offsetFrame);
+    }
+    
+    std::vector<long> distinct;
+    distinct.reserve(hashDict.size());
+    for (const auto& entry : hashDict) {
+        distinct.push_back(entry.first);
+    }
+    
+    return forEachHashMatch(distinct, [&hashDict, &callback](long hash, uint32_t songIdx, uint32_t dbOffset) {
         auto it = hashDict.find(hash);
         if (it != hashDict.end()) {
-            resultDict[songId].emplace_back(dbOffset, it->second);
+            callback(songIdx, dbOffset, it->second);
+        }
+    });
+}
+
+bool Database::forEachHashMatch(const std::vector<long>& hashes, const HashRowCallback& callback) {
+    if (!isOpen) {
+        return false;
+    }
+    
+    ReaderLease reader(*this);
+    if (!reader) {
+        return false;
+    }
+    
+    // Query in fixed-size batches so one cached statement serves every call
+    auto next = hashes.begin();
+    while (next != hashes.end()) {
+        sqlite3_stmt* stmt = reader->statement(ReaderConnection::MATCH_BATCH);
+        if (!stmt) {
+            return false;
+        }
+        
+        for (int param = 1; param <= MATCH_BATCH_SIZE; ++param) {
+            if (next != hashes.end()) {
+                sqlite3_bind_int64(stmt, param, *next);
+                ++next;
+            } else {
+                sqlite3_bind_int64(stmt, param, UNUSED_HASH);
+            }
+        }
+        
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            long hash = sqlite3_column_int64(stmt, 0);
+            uint32_t dbOffset = static_cast<uint32_t>(sqlite3_column_int64(stmt, 1));
+            uint32_t songIdx = static_cast<uint32_t>(sqlite3_column_int64(stmt, 2));
+            callback(hash, songIdx, dbOffset);
+        }
+        
+        if (rc != SQLITE_DONE) {
+            std::cerr << "Match query failed: " << sqlite3_errmsg(reader->conn) << std::endl;
+            sqlite3_reset(stmt);
+            return false;
         }
+        
+        sqlite3_reset(stmt);
     }
     
-    sqlite3_finalize(stmt);
+    return true;
+}
+
+MatchMap Database::getMatches(const std::vector<HashResult>& hashes, int threshold) {
+    MatchMap resultDict;
+    
+    if (!isOpen || hashes.empty()) {
+        return resultDict;
+    }
+    
+    bool ok = forEachMatch(hashes, [&resultDict](uint32_t songIdx, uint32_t dbOffset, uint32_t sampleOffset) {
+        resultDict[songIdx].emplace_back(dbOffset, sampleOffset);
+    });
+    if (!ok) {
+        return MatchMap();
+    }
     
     // Filter results by threshold
     auto it = resultDict.begin();
@@ -320,69 +903,168 @@ std::map<std::string, std::vector<MatchOffset>> Database::getMatches(
     return resultDict;
 }
 
-SongInfo Database::getInfoForSongId(const std::string& songId) {
+SongInfo Database::readSongInfo(sqlite3_stmt* stmt) {
     SongInfo info;
     
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        info.artist = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        info.album = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        info.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        info.songId = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+        info.songIdx = static_cast<uint32_t>(sqlite3_column_int64(stmt, 4));
+    }
+    
+    sqlite3_reset(stmt);
+    return info;
+}
+
+SongInfo Database::getInfoForSongId(const std::string& songId) {
     if (!isOpen || songId.empty()) {
-        return info;
+        return SongInfo();
+    }
+    
+    ReaderLease reader(*this);
+    sqlite3_stmt* stmt = reader ? reader->statement(ReaderConnection::INFO_BY_SONG_ID) : nullptr;
+    if (!stmt) {
+        return SongInfo();
+    }
+    
+    sqlite3_bind_text(stmt, 1, songId.c_str(), -1, SQLITE_TRANSIENT);
+    return readSongInfo(stmt);
+}
+
+SongInfo Database::getInfoForSongIdx(uint32_t songIdx) {
+    if (!isOpen || songIdx == 0) {
+        return SongInfo();
     }
     
+    ReaderLease reader(*this);
+    sqlite3_stmt* stmt = reader ? reader->statement(ReaderConnection::INFO_BY_SONG_IDX) : nullptr;
+    if (!stmt) {
+        return SongInfo();
+    }
+    
+    sqlite3_bind_int64(stmt, 1, songIdx);
+    return readSongInfo(stmt);
+}
+
+bool Database::forEachHashRow(const std::function<bool(long hash, uint32_t offset, uint32_t songIdx)>& callback) {
+    if (!isOpen) return false;
+    
+    // Scan on a read connection so registrations are not blocked meanwhile
+    ReaderLease reader(*this);
+    if (!reader) return false;
+    
+    // Rows are streamed in hash order so callers can build sorted postings
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT artist, album, title FROM song_info WHERE song_id = ?";
+    const char* sql = "SELECT hash, offset, song_idx FROM hash ORDER BY hash";
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+    int rc = sqlite3_prepare_v2(reader->conn, sql, -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
-        return info;
+        std::cerr << "Failed to prepare hash scan: " << sqlite3_errmsg(reader->conn) << std::endl;
+        return false;
     }
     
-    sqlite3_bind_text(stmt, 1, songId.c_str(), -1, SQLITE_STATIC);
+    bool completed = true;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        long hash = sqlite3_column_int64(stmt, 0);
+        uint32_t offset = static_cast<uint32_t>(sqlite3_column_int64(stmt, 1));
+        uint32_t songIdx = static_cast<uint32_t>(sqlite3_column_int64(stmt, 2));
+        
+        if (!callback(hash, offset, songIdx)) {
+            completed = false;
+            break;
+        }
+    }
     
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) {
-        info.artist = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        info.album = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        info.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        info.songId = songId;
+    if (completed && rc != SQLITE_DONE) {
+        std::cerr << "Hash scan failed: " << sqlite3_errmsg(reader->conn) << std::endl;
+        completed = false;
     }
     
     sqlite3_finalize(stmt);
-    return info;
+    return completed;
 }
 
-int Database::getTotalSongs() {
-    if (!isOpen) return 0;
+bool Database::forEachSongRows(const std::function<bool(const SongInfo& info, std::vector<HashResult>& hashes)>& callback) {
+    if (!isOpen) return false;
+    
+    ReaderLease reader(*this);
+    if (!reader) return false;
     
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT COUNT(*) FROM song_info";
+    const char* sql = "SELECT song_idx, hash, offset FROM hash ORDER BY song_idx";
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) return 0;
+    int rc = sqlite3_prepare_v2(reader->conn, sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Failed to prepare song scan: " << sqlite3_errmsg(reader->conn) << std::endl;
+        return false;
+    }
     
-    int count = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        count = sqlite3_column_int(stmt, 0);
+    // Info is looked up on another pooled connection while this one streams rows
+    std::vector<HashResult> hashes;
+    uint32_t current = 0;
+    auto emit = [&]() {
+        SongInfo info = getInfoForSongIdx(current);
+        if (info.songIdx == 0) {
+            AF_LOG(Warn) << "Skipping " << hashes.size() << " hash rows of unknown song_idx " << current;
+            return true;
+        }
+        return callback(info, hashes);
+    };
+    
+    bool completed = true;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        uint32_t songIdx = static_cast<uint32_t>(sqlite3_column_int64(stmt, 0));
+        if (songIdx != current && !hashes.empty()) {
+            if (!emit()) {
+                completed = false;
+                break;
+            }
+            hashes.clear();
+        }
+        current = songIdx;
+        hashes.emplace_back(sqlite3_column_int64(stmt, 1), static_cast<uint32_t>(sqlite3_column_int64(stmt, 2)));
+    }
+    
+    if (completed && rc != SQLITE_DONE) {
+        std::cerr << "Song scan failed: " << sqlite3_errmsg(reader->conn) << std::endl;
+        completed = false;
+    }
+    if (completed && !hashes.empty()) {
+        completed = emit();
     }
     
     sqlite3_finalize(stmt);
-    return count;
+    return completed;
 }
 
-int Database::getTotalHashes() {
-    if (!isOpen) return 0;
+std::string Database::getFingerprintProfile() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!isOpen) return "";
     
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT COUNT(*) FROM hash";
-    
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) return 0;
+    const char* sql = "SELECT value FROM catalog_meta WHERE key = 'fingerprint_profile'";
+    std::string tag;
     
-    int count = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        count = sqlite3_column_int(stmt, 0);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            tag = columnText(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
     }
     
-    sqlite3_finalize(stmt);
-    return count;
+    return tag;
+}
+
+int Database::getTotalSongs() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return queryCount("SELECT COUNT(*) FROM song_info");
+}
+
+int Database::getTotalHashes() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return queryCount("SELECT COUNT(*) FROM hash");
 }
 
 } // namespace AudioFingerprinting
\ No newline at end of file
@@ -5,8 +5,11 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <sqlite3.h>
 #include <memory>
+#include <functional>
+#include <mutex>
 
 namespace AudioFingerprinting {
 
@@ -14,7 +17,8 @@ struct SongInfo {
     std::string artist;
     std::string album;
     std::string title;
-    std::string songId;
+    std::string songId;   // Stable string id derived from the file path
+    uint32_t songIdx = 0; // Compact integer key used by the hash rows (0 = none)
     
     SongInfo() = default;
     SongInfo(const std::string& artist, const std::string& album, 
@@ -22,22 +26,79 @@ struct SongInfo {
         : artist(artist), album(album), title(title), songId(songId) {}
 };
 
+// Offsets are STFT frame indices (see secondsToFrame)
 struct MatchOffset {
-    double dbOffset;
-    double sampleOffset;
+    uint32_t dbOffset;
+    uint32_t sampleOffset;
     
-    MatchOffset(double dbOffset, double sampleOffset)
+    MatchOffset(uint32_t dbOffset, uint32_t sampleOffset)
         : dbOffset(dbOffset), sampleOffset(sampleOffset) {}
 };
 
+// A registered audio file as the library manifest last saw it. A rescan
+// compares size and mtime first and reads the file for its digest only
+// when they changed.
+struct SourceFile {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;    // Filesystem clock ticks; only compared for equality
+    std::string digest;   // Content digest (fileDigest)
+    uint32_t songIdx = 0; // The song registered from it
+};
+
+// A fingerprinted song waiting to be written
+struct PendingSong {
+    SongInfo info;
+    std::vector<HashResult> hashes;
+    SourceFile source; // Recorded in the manifest with the song unless path is empty
+};
+
+// Matches grouped by song_info.song_idx
+using MatchMap = std::map<uint32_t, std::vector<MatchOffset>>;
+
+// One matching row: a query hash found at dbOffset in song songIdx (frames)
+using MatchCallback = std::function<void(uint32_t songIdx, uint32_t dbOffset, uint32_t sampleOffset)>;
+
+// One row for a looked-up hash: it occurs at dbOffset in song songIdx
+using HashRowCallback = std::function<void(long hash, uint32_t songIdx, uint32_t dbOffset)>;
+
+// Read-only connection used by the match path. Statements are prepared on
+// first use and reused for the lifetime of the connection.
+struct ReaderConnection {
+    enum Statement { MATCH_BATCH, INFO_BY_SONG_IDX, INFO_BY_SONG_ID, STATEMENT_COUNT };
+    
+    sqlite3* conn = nullptr;
+    sqlite3_stmt* statements[STATEMENT_COUNT] = {};
+    
+    sqlite3_stmt* statement(Statement which);
+    ~ReaderConnection();
+};
+
 class Database {
 private:
     std::string dbPath;
-    sqlite3* db;
+    sqlite3* db;          // Single writer connection, guarded by writeMutex
     bool isOpen;
     
+    std::mutex writeMutex;
+    std::mutex readerMutex; // Guards idleReaders
+    std::vector<std::unique_ptr<ReaderConnection>> idleReaders;
+    
+    class ReaderLease;
+    std::unique_ptr<ReaderConnection> acquireReader();
+    void releaseReader(std::unique_ptr<ReaderConnection> reader);
+    SongInfo readSongInfo(sqlite3_stmt* stmt);
+    int queryCount(const char* sql);
+    
     // Helper methods
     bool executeSQL(const std::string& sql);
+    bool writeTransaction(const std::function<bool()>& body);
+    uint32_t insertSongInfo(const SongInfo& songInfo); // The row's song_idx, 0 on failure
+    uint32_t insertSongRows(const std::vector<HashResult>& hashes, const SongInfo& songInfo); // song_idx, 0 on failure
+    bool insertSourceFile(const SourceFile& file);
+    bool connect();
+    int getSchemaVersion();
+    bool isLegacySchema();
 
 public:
     // Make this public so Recognition can use it
@@ -47,21 +108,65 @@ public:
     Database(const std::string& dbPath = "fingerprints.db");
     ~Database();
     
+    // Current schema: integer song keys, integer frame offsets
+    static const int SCHEMA_VERSION = 2;
+    
+    // Hashes bound per match query; the statement is padded to this size
+    static const int MATCH_BATCH_SIZE = 256;
+    
     // Database management
     bool open();
     void close();
     bool setupTables();
     bool checkpointDb();
     
-    // Song operations
+    // Converts a pre-v2 database (TEXT song_id on every hash row, REAL offsets)
+    bool migrateLegacySchema();
+    
+    // Song operations (writes are serialized on the writer connection;
+    // lookups run on pooled read-only connections and may be concurrent)
     bool songInDb(const std::string& filename);
     bool storeSong(const std::vector<HashResult>& hashes, const SongInfo& songInfo);
+    bool storeSongs(std::vector<PendingSong>& songs); // All or nothing, one transaction; fills in songIdx
+    
+    // A song whose info carries a songIdx is stored under that key (shards
+    // reuse the catalog's keys). storeSongInfos writes song_info rows only,
+    // as the catalog of a sharded deployment does, and fills in their keys.
+    bool storeSongInfos(std::vector<SongInfo>& songs);
     SongInfo getInfoForSongId(const std::string& songId);
+    SongInfo getInfoForSongIdx(uint32_t songIdx);
     
-    // Matching operations
-    std::map<std::string, std::vector<MatchOffset>> getMatches(
-        const std::vector<HashResult>& hashes, int threshold = 5);
+    // Removes the songs' hash rows, song_info rows and manifest rows in one
+    // transaction, a few hundred songs per statement. Their keys are not
+    // given to new songs.
+    bool deleteSongs(const std::vector<uint32_t>& songIdxs);
+    
+    // Library manifest (source_file table), keyed by path. storeSongs
+    // records a song's source with its rows; storeSourceFiles updates
+    // manifest rows alone (files whose content did not change).
+    std::unordered_map<std::string, SourceFile> loadSourceFiles();
+    bool storeSourceFiles(const std::vector<SourceFile>& files);
+    
+    // Matching operations. forEachMatch streams every row for the distinct
+    // query hashes without grouping them; getMatches collects them per song.
+    // forEachHashMatch streams the rows of already distinct hashes, tagged
+    // with the hash, for callers that keep their own offsets (batches).
+    bool forEachMatch(const std::vector<HashResult>& hashes, const MatchCallback& callback);
+    bool forEachHashMatch(const std::vector<long>& hashes, const HashRowCallback& callback);
+    MatchMap getMatches(const std::vector<HashResult>& hashes, int threshold = 5);
         
+    // Bulk export (used by the hash index builder)
+    bool forEachHashRow(const std::function<bool(long hash, uint32_t offset, uint32_t songIdx)>& callback);
+    
+    // Every song with hash rows, one at a time with all of its rows (used
+    // by pack export). SQLite sorts the rows by song, spilling to disk when
+    // they don't fit in memory, so only one song is held at once.
+    bool forEachSongRows(const std::function<bool(const SongInfo& info, std::vector<HashResult>& hashes)>& callback);
+        
+    // Tag of the fingerprint profile the hash rows were made with
+    // (FingerprintProfile.h), recorded when the database was created
+    std::string getFingerprintProfile();
+    
     // Statistics
     int getTotalSongs();
     int getTotalHashes();
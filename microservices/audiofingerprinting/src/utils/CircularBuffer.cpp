@@ -1,23 +1,92 @@
 #include "CircularBuffer.h"
+#include <algorithm>
+#include <cstring>
 
 namespace AudioFingerprinting {
 
-CircularBuffer::CircularBuffer(size_t bufferSize) : buffer(bufferSize), size(bufferSize) {}
+static size_t nextPowerOfTwo(size_t n) {
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
 
-void CircularBuffer::write(const std::vector<double>& data) {
-    for (double sample : data) {
-        buffer[writePos] = sample;
-        writePos = (writePos + 1) % size;
+CircularBuffer::CircularBuffer(size_t minCapacity)
+    : buffer(nextPowerOfTwo(std::max<size_t>(minCapacity, 1))), mask(buffer.size() - 1) {}
+
+bool CircularBuffer::write(const std::vector<double>& data) {
+    return write(data.data(), data.size());
+}
+
+bool CircularBuffer::write(const double* data, size_t numSamples) {
+    // Only this thread moves head; tail is read to see how much the consumer freed
+    size_t writeCount = head.load(std::memory_order_relaxed);
+    size_t readCount = tail.load(std::memory_order_acquire);
+    if (numSamples > capacity() - (writeCount - readCount)) {
+        return false;
     }
+    
+    size_t pos = writeCount & mask;
+    size_t firstPart = std::min(numSamples, capacity() - pos);
+    std::memcpy(buffer.data() + pos, data, firstPart * sizeof(double));
+    std::memcpy(buffer.data(), data + firstPart, (numSamples - firstPart) * sizeof(double));
+    
+    head.store(writeCount + numSamples, std::memory_order_release);
+    return true;
+}
+
+RingReadView CircularBuffer::readView(size_t numSamples) const {
+    size_t readCount = tail.load(std::memory_order_relaxed);
+    size_t writeCount = head.load(std::memory_order_acquire);
+    numSamples = std::min(numSamples, writeCount - readCount);
+    
+    size_t pos = readCount & mask;
+    size_t firstPart = std::min(numSamples, capacity() - pos);
+    
+    RingReadView view;
+    view.first.data = buffer.data() + pos;
+    view.first.size = firstPart;
+    view.second.data = buffer.data();
+    view.second.size = numSamples - firstPart;
+    return view;
+}
+
+size_t CircularBuffer::read(double* dest, size_t numSamples) {
+    RingReadView view = readView(numSamples);
+    std::memcpy(dest, view.first.data, view.first.size * sizeof(double));
+    std::memcpy(dest + view.first.size, view.second.data, view.second.size * sizeof(double));
+    discard(view.size());
+    return view.size();
 }
 
 std::vector<double> CircularBuffer::read(size_t numSamples) {
-    std::vector<double> result(numSamples);
-    for (size_t i = 0; i < numSamples; i++) {
-        result[i] = buffer[readPos];
-        readPos = (readPos + 1) % size;
-    }
+    std::vector<double> result(std::min(numSamples, available()));
+    result.resize(read(result.data(), result.size()));
     return result;
 }
 
+void CircularBuffer::peek(double* dest, size_t numSamples) const {
+    RingReadView view = readView(numSamples);
+    std::memcpy(dest, view.first.data, view.first.size * sizeof(double));
+    std::memcpy(dest + view.first.size, view.second.data, view.second.size * sizeof(double));
+}
+
+void CircularBuffer::discard(size_t numSamples) {
+    // Only this thread moves tail; head bounds how far it may go
+    size_t readCount = tail.load(std::memory_order_relaxed);
+    size_t writeCount = head.load(std::memory_order_acquire);
+    numSamples = std::min(numSamples, writeCount - readCount);
+    tail.store(readCount + numSamples, std::memory_order_release);
+}
+
+bool CircularBuffer::readWindow(double* dest, size_t windowSize, size_t hopSize) {
+    if (available() < windowSize) {
+        return false;
+    }
+    peek(dest, windowSize);
+    discard(hopSize);
+    return true;
+}
+
 } // namespace AudioFingerprinting
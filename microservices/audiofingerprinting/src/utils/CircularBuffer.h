@@ -2,21 +2,69 @@
 #define CIRCULAR_BUFFER_H
 
 #include <vector>
+#include <atomic>
 #include <cstddef>
 
 namespace AudioFingerprinting {
 
+// Contiguous run of samples inside the ring
+struct SampleSpan {
+    const double* data = nullptr;
+    size_t size = 0;
+};
+
+// Zero-copy view of the oldest samples: first, then second when the run
+// wraps past the end of the storage
+struct RingReadView {
+    SampleSpan first;
+    SampleSpan second;
+    
+    size_t size() const { return first.size + second.size; }
+};
+
+// Single-producer/single-consumer lock-free ring of samples. The capacity is
+// rounded up to a power of two so positions wrap with a mask; head and tail
+// are free-running counters, written only by the producer and the consumer
+// respectively. One thread may write while another reads, with no locks.
 class CircularBuffer {
 private:
     std::vector<double> buffer;
-    size_t writePos = 0;
-    size_t readPos = 0;
-    size_t size;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0}; // Total samples written (producer)
+    alignas(64) std::atomic<size_t> tail{0}; // Total samples consumed (consumer)
     
 public:
-    CircularBuffer(size_t bufferSize);
-    void write(const std::vector<double>& data);
+    explicit CircularBuffer(size_t minCapacity);
+    
+    CircularBuffer(const CircularBuffer&) = delete;
+    CircularBuffer& operator=(const CircularBuffer&) = delete;
+    
+    // Producer: appends all of data, or nothing when it doesn't fit in the free space
+    bool write(const std::vector<double>& data);
+    bool write(const double* data, size_t numSamples);
+    
+    // Consumer: views of the oldest numSamples (clamped to what is available),
+    // valid until they are discarded
+    RingReadView readView(size_t numSamples) const;
+    
+    // Consumer: copies out and consumes up to numSamples; returns the count
+    size_t read(double* dest, size_t numSamples);
     std::vector<double> read(size_t numSamples);
+    
+    // Consumer: copies the oldest numSamples without consuming them
+    void peek(double* dest, size_t numSamples) const;
+    void discard(size_t numSamples);
+    
+    // Consumer: overlapping window read, as the STFT takes its frames. Copies
+    // windowSize samples and consumes hopSize of them; false (and nothing
+    // consumed) until a whole window is available.
+    bool readWindow(double* dest, size_t windowSize, size_t hopSize);
+    
+    size_t available() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    size_t space() const { return capacity() - available(); }
+    size_t capacity() const { return buffer.size(); }
 };
 
 } // namespace AudioFingerprinting
@@ -0,0 +1,55 @@
+#include "Log.h"
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace AudioFingerprinting {
+
+static int initialLogLevel() {
+    LogLevel level = LogLevel::Info;
+    const char* env = std::getenv("AF_LOG_LEVEL");
+    if (env && !parseLogLevel(env, level)) {
+        std::cerr << "Unknown AF_LOG_LEVEL '" << env << "', using info" << std::endl;
+    }
+    return static_cast<int>(level);
+}
+
+namespace detail {
+std::atomic<int> currentLogLevel{initialLogLevel()};
+}
+
+LogLevel logLevel() {
+    return static_cast<LogLevel>(detail::currentLogLevel.load(std::memory_order_relaxed));
+}
+
+void setLogLevel(LogLevel level) {
+    detail::currentLogLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+bool parseLogLevel(const std::string& name, LogLevel& level) {
+    std::string lower(name);
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    
+    if (lower == "error") {
+        level = LogLevel::Error;
+    } else if (lower == "warn" || lower == "warning") {
+        level = LogLevel::Warn;
+    } else if (lower == "info") {
+        level = LogLevel::Info;
+    } else if (lower == "debug") {
+        level = LogLevel::Debug;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+LogLine::~LogLine() {
+    line << '\n';
+    std::ostream& out = level <= LogLevel::Warn ? std::cerr : std::cout;
+    out << line.str();
+}
+
+} // namespace AudioFingerprinting
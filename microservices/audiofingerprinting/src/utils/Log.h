@@ -0,0 +1,57 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <sstream>
+#include <atomic>
+#include <string>
+
+namespace AudioFingerprinting {
+
+enum class LogLevel {
+    Error = 0,
+    Warn,
+    Info,
+    Debug
+};
+
+// Process-wide threshold; starts from AF_LOG_LEVEL (error, warn, info,
+// debug) and defaults to info
+LogLevel logLevel();
+void setLogLevel(LogLevel level);
+bool parseLogLevel(const std::string& name, LogLevel& level);
+
+namespace detail {
+extern std::atomic<int> currentLogLevel;
+}
+
+inline bool logEnabled(LogLevel level) {
+    return static_cast<int>(level) <= detail::currentLogLevel.load(std::memory_order_relaxed);
+}
+
+// One log line, built in memory and written in a single call when it goes
+// out of scope: lines from concurrent threads don't interleave, and nothing
+// is flushed per line. Error and Warn go to stderr, the rest to stdout.
+class LogLine {
+private:
+    LogLevel level;
+    std::ostringstream line;
+    
+public:
+    explicit LogLine(LogLevel level) : level(level) {}
+    ~LogLine();
+    
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+    
+    std::ostream& stream() { return line; }
+};
+
+} // namespace AudioFingerprinting
+
+// AF_LOG(Info) << "Loaded " << n << " songs";
+// Below the threshold the message is not formatted at all.
+#define AF_LOG(level) \
+    if (!::AudioFingerprinting::logEnabled(::AudioFingerprinting::LogLevel::level)) {} \
+    else ::AudioFingerprinting::LogLine(::AudioFingerprinting::LogLevel::level).stream()
+
+#endif
@@ -0,0 +1,215 @@
+#include "Metrics.h"
+#include <atomic>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+
+namespace AudioFingerprinting {
+namespace Metrics {
+
+namespace {
+
+constexpr size_t STAGES = static_cast<size_t>(Stage::COUNT);
+constexpr size_t COUNTERS = static_cast<size_t>(Counter::COUNT);
+
+// Upper bounds in seconds; one more bucket holds everything slower
+constexpr std::array<double, 14> BUCKET_BOUNDS = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+constexpr size_t BUCKETS = BUCKET_BOUNDS.size() + 1;
+
+struct StageHistogram {
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sumNanos{0};
+};
+
+// Written only by the owning thread; read by exporters
+struct alignas(64) Shard {
+    std::array<StageHistogram, STAGES> stages;
+    std::array<std::atomic<uint64_t>, COUNTERS> counters{};
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<Shard*> idle;   // Shards of exited threads, totals kept
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry(); // Never destroyed: threads may record during exit
+    return *instance;
+}
+
+// Claims a shard for the calling thread and returns it when the thread exits
+struct ShardLease {
+    Shard* shard;
+    
+    ShardLease() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (!reg.idle.empty()) {
+            shard = reg.idle.back();
+            reg.idle.pop_back();
+        } else {
+            reg.shards.push_back(std::make_unique<Shard>());
+            shard = reg.shards.back().get();
+        }
+    }
+    
+    ~ShardLease() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.idle.push_back(shard);
+    }
+};
+
+Shard& localShard() {
+    thread_local ShardLease lease;
+    return *lease.shard;
+}
+
+// Only the owning thread writes a shard, so a plain load and store replaces
+// a locked read-modify-write
+void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+size_t bucketFor(double seconds) {
+    size_t bucket = 0;
+    while (bucket < BUCKET_BOUNDS.size() && seconds > BUCKET_BOUNDS[bucket]) {
+        bucket++;
+    }
+    return bucket;
+}
+
+template <typename Fn>
+void forEachShard(Fn fn) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& shard : reg.shards) {
+        fn(*shard);
+    }
+}
+
+const char* counterName(Counter counter) {
+    switch (counter) {
+        case Counter::Recognitions: return "recognitions_total";
+        case Counter::Matches: return "recognition_matches_total";
+        case Counter::QueryHashes: return "query_hashes_total";
+        case Counter::MatchedRows: return "matched_rows_total";
+        case Counter::FilteredHashes: return "filtered_hashes_total";
+        case Counter::StopHashes: return "stop_hashes_total";
+        case Counter::SongsRegistered: return "songs_registered_total";
+        case Counter::RejectedRequests: return "rejected_requests_total";
+        default: return "unknown_total";
+    }
+}
+
+} // namespace
+
+void observe(Stage stage, double seconds) {
+    StageHistogram& histogram = localShard().stages[static_cast<size_t>(stage)];
+    bump(histogram.buckets[bucketFor(seconds)], 1);
+    bump(histogram.count, 1);
+    bump(histogram.sumNanos, static_cast<uint64_t>(seconds * 1e9));
+}
+
+void add(Counter counter, uint64_t amount) {
+    bump(localShard().counters[static_cast<size_t>(counter)], amount);
+}
+
+uint64_t counterValue(Counter counter) {
+    uint64_t total = 0;
+    forEachShard([&](const Shard& shard) {
+        total += shard.counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    });
+    return total;
+}
+
+uint64_t stageCount(Stage stage) {
+    uint64_t total = 0;
+    forEachShard([&](const Shard& shard) {
+        total += shard.stages[static_cast<size_t>(stage)].count.load(std::memory_order_relaxed);
+    });
+    return total;
+}
+
+double stageSeconds(Stage stage) {
+    uint64_t nanos = 0;
+    forEachShard([&](const Shard& shard) {
+        nanos += shard.stages[static_cast<size_t>(stage)].sumNanos.load(std::memory_order_relaxed);
+    });
+    return nanos / 1e9;
+}
+
+const char* stageName(Stage stage) {
+    switch (stage) {
+        case Stage::Decode: return "decode";
+        case Stage::Spectrogram: return "spectrogram";
+        case Stage::PeakPicking: return "peaks";
+        case Stage::Hashing: return "hashing";
+        case Stage::Lookup: return "lookup";
+        case Stage::Scoring: return "scoring";
+        case Stage::Recognition: return "recognition";
+        case Stage::QueueWait: return "queue_wait";
+        default: return "unknown";
+    }
+}
+
+std::string prometheusText() {
+    // Sum the shards first so the exposition is one consistent-enough snapshot
+    std::array<std::array<uint64_t, BUCKETS>, STAGES> buckets{};
+    std::array<uint64_t, STAGES> counts{};
+    std::array<uint64_t, STAGES> sumNanos{};
+    std::array<uint64_t, COUNTERS> counters{};
+    
+    forEachShard([&](const Shard& shard) {
+        for (size_t s = 0; s < STAGES; s++) {
+            for (size_t b = 0; b < BUCKETS; b++) {
+                buckets[s][b] += shard.stages[s].buckets[b].load(std::memory_order_relaxed);
+            }
+            counts[s] += shard.stages[s].count.load(std::memory_order_relaxed);
+            sumNanos[s] += shard.stages[s].sumNanos.load(std::memory_order_relaxed);
+        }
+        for (size_t c = 0; c < COUNTERS; c++) {
+            counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+        }
+    });
+    
+    std::ostringstream out;
+    out << "# HELP audentify_stage_duration_seconds Time spent per pipeline stage call\n";
+    out << "# TYPE audentify_stage_duration_seconds histogram\n";
+    for (size_t s = 0; s < STAGES; s++) {
+        const char* name = stageName(static_cast<Stage>(s));
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            cumulative += buckets[s][b];
+            out << "audentify_stage_duration_seconds_bucket{stage=\"" << name << "\",le=\"";
+            if (b < BUCKET_BOUNDS.size()) {
+                out << BUCKET_BOUNDS[b];
+            } else {
+                out << "+Inf";
+            }
+            out << "\"} " << cumulative << "\n";
+        }
+        out << "audentify_stage_duration_seconds_sum{stage=\"" << name << "\"} "
+            << std::fixed << std::setprecision(6) << sumNanos[s] / 1e9 << std::defaultfloat << "\n";
+        out << "audentify_stage_duration_seconds_count{stage=\"" << name << "\"} " << counts[s] << "\n";
+    }
+    
+    for (size_t c = 0; c < COUNTERS; c++) {
+        const char* name = counterName(static_cast<Counter>(c));
+        out << "# TYPE audentify_" << name << " counter\n";
+        out << "audentify_" << name << " " << counters[c] << "\n";
+    }
+    
+    return out.str();
+}
+
+} // namespace Metrics
+} // namespace AudioFingerprinting
@@ -0,0 +1,78 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+// Pipeline stages timed by ScopedStageTimer
+enum class Stage {
+    Decode,       // Compressed audio to mono samples at SAMPLE_RATE
+    Spectrogram,  // STFT power frames
+    PeakPicking,  // Constellation peaks from the spectrogram
+    Hashing,      // Peak pairs to hashes
+    Lookup,       // Database or hash index rows for the query hashes, scored as they stream in
+    Scoring,      // Ranking the scored candidates and resolving the match
+    Recognition,  // A whole query, decode to result
+    QueueWait,    // A server request waiting for a recognition worker
+    COUNT
+};
+
+enum class Counter {
+    Recognitions,      // Queries resolved
+    Matches,           // Queries that found a song
+    QueryHashes,       // Hashes looked up
+    MatchedRows,       // Database rows returned for them
+    FilteredHashes,    // Query hashes the membership filter dropped before the lookup
+    StopHashes,        // Query hashes skipped for having too many postings
+    SongsRegistered,
+    RejectedRequests,  // Server requests turned away with 429 because the recognition queue was full
+    COUNT
+};
+
+// Latency histograms and counters kept per thread and summed on export.
+//
+// Every thread records into its own shard, so the hot path takes no lock,
+// no atomic read-modify-write and no cache line shared with other threads.
+// The registry is only locked when a thread first records; a shard is
+// handed to the next new thread when its owner exits, so short-lived
+// workers don't grow it. Export reads all shards without stopping writers.
+namespace Metrics {
+
+void observe(Stage stage, double seconds);
+void add(Counter counter, uint64_t amount = 1);
+
+// Snapshot of one metric across every thread
+uint64_t counterValue(Counter counter);
+uint64_t stageCount(Stage stage);
+double stageSeconds(Stage stage);
+
+const char* stageName(Stage stage);
+
+// Prometheus text exposition of every histogram and counter
+std::string prometheusText();
+
+} // namespace Metrics
+
+// Records the time from construction to destruction against stage
+class ScopedStageTimer {
+private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+    
+public:
+    explicit ScopedStageTimer(Stage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~ScopedStageTimer() {
+        Metrics::observe(stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+};
+
+} // namespace AudioFingerprinting
+
+#endif
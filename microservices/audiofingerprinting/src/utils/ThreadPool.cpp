@@ -0,0 +1,121 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace AudioFingerprinting {
+
+ThreadPool::ThreadPool(size_t numWorkers) {
+    workers.reserve(numWorkers);
+    for (size_t i = 0; i < numWorkers; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idleWorkers++;
+            available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            idleWorkers--;
+            if (tasks.empty()) {
+                return; // Stopping and drained
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::trySubmit(std::function<void()> task, size_t maxQueued) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.size() >= idleWorkers + maxQueued) {
+            return false;
+        }
+        tasks.push_back(std::move(task));
+    }
+    available.notify_one();
+    return true;
+}
+
+size_t ThreadPool::queued() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tasks.size();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    grain = std::max(grain, static_cast<size_t>(1));
+    size_t numChunks = (count + grain - 1) / grain;
+    size_t helpers = std::min(workers.size(), numChunks - 1);
+
+    if (helpers == 0) {
+        body(0, count);
+        return;
+    }
+
+    // Shared with helper tasks, which may only get to run after the job is done
+    struct Job {
+        std::atomic<size_t> nextChunk{0};
+        size_t chunksDone = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto job = std::make_shared<Job>();
+
+    auto work = [job, count, grain, numChunks, &body]() {
+        size_t done = 0;
+        for (size_t chunk = job->nextChunk++; chunk < numChunks; chunk = job->nextChunk++) {
+            size_t begin = chunk * grain;
+            body(begin, std::min(begin + grain, count));
+            done++;
+        }
+        if (done > 0) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->chunksDone += done;
+            if (job->chunksDone == numChunks) {
+                job->finished.notify_all();
+            }
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < helpers; i++) {
+            tasks.emplace_back(work);
+        }
+    }
+    available.notify_all();
+
+    work();
+
+    // Helpers that start late find no chunk left and never touch body
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job, numChunks]() { return job->chunksDone == numChunks; });
+}
+
+} // namespace AudioFingerprinting
@@ -0,0 +1,63 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+namespace AudioFingerprinting {
+
+// Fixed set of worker threads started once and reused for every job, so
+// short jobs don't pay for thread creation. parallelFor() splits a range
+// into chunks that the workers and the calling thread claim from a shared
+// counter. The caller always takes part, so a job finishes even when every
+// worker is busy with other callers' chunks. Jobs must not call
+// parallelFor() on the same pool from inside their body.
+//
+// A pool of its own also serves as a bounded executor: trySubmit() hands a
+// task to the workers only, and refuses it when the backlog is full.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    size_t idleWorkers = 0; // Workers waiting for a task
+    bool stopping = false;
+
+    void workerLoop();
+
+public:
+    explicit ThreadPool(size_t numWorkers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Process-wide pool: one worker per core besides the caller
+    static ThreadPool& shared();
+
+    // Threads that may work on one job, the caller included
+    size_t concurrency() const { return workers.size() + 1; }
+
+    // Runs body(begin, end) over [0, count) in chunks of at least `grain`
+    // items and returns once all of them are done
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    // Queues task unless maxQueued tasks are already waiting beyond the ones
+    // idle workers are about to take, so with maxQueued 0 a task is only
+    // accepted when a worker is free; false when it was refused. Queued
+    // tasks still run on destruction.
+    bool trySubmit(std::function<void()> task, size_t maxQueued);
+
+    // Tasks waiting for a worker, not counting running ones
+    size_t queued() const;
+};
+
+} // namespace AudioFingerprinting
+
+#endif
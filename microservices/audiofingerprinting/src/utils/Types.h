@@ -6,18 +6,47 @@
 #include <complex>
 #include <sstream>
 #include <iomanip>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "../core/Constants.h"
 
 namespace AudioFingerprinting {
 
+// Spectrogram power values in one contiguous block. Each STFT frame is a
+// contiguous row of freqBins values, so a frame is written with one
+// sequential pass; at(freq, time) keeps the [freq][time] indexing.
+class PowerMatrix {
+private:
+    std::vector<float> data;
+    size_t numFreqs = 0;
+    size_t numTimes = 0;
+    
+public:
+    PowerMatrix() = default;
+    PowerMatrix(size_t freqBins, size_t frames)
+        : data(freqBins * frames, 0.0f), numFreqs(freqBins), numTimes(frames) {}
+    
+    size_t rows() const { return numFreqs; }   // Frequency bins
+    size_t cols() const { return numTimes; }   // Time frames
+    bool empty() const { return data.empty(); }
+    
+    float at(size_t freq, size_t time) const { return data[time * numFreqs + freq]; }
+    float& at(size_t freq, size_t time) { return data[time * numFreqs + freq]; }
+    
+    const float* frame(size_t time) const { return data.data() + time * numFreqs; }
+    float* frame(size_t time) { return data.data() + time * numFreqs; }
+};
+
 struct SpectrogramResult {
     std::vector<double> frequencies;
     std::vector<double> times;
-    std::vector<std::vector<double>> powerMatrix;
+    PowerMatrix powerMatrix;
     
-    SpectrogramResult(const std::vector<double>& f, 
-                     const std::vector<double>& t, 
-                     const std::vector<std::vector<double>>& Sxx)
-        : frequencies(f), times(t), powerMatrix(Sxx) {}
+    SpectrogramResult(std::vector<double> f, 
+                     std::vector<double> t, 
+                     PowerMatrix Sxx)
+        : frequencies(std::move(f)), times(std::move(t)), powerMatrix(std::move(Sxx)) {}
 };
 
 struct Peak {
@@ -34,16 +63,16 @@ struct Peak {
 
 struct HashResult {
     long hash;
-    double timeOffset;
-    std::string songId;
+    uint32_t offsetFrame; // STFT frame index of the anchor peak
+    uint32_t songIdx;     // song_info key, 0 until assigned by the database
     
-    HashResult(long hash, double timeOffset, const std::string& songId)
-        : hash(hash), timeOffset(timeOffset), songId(songId) {}
+    HashResult(long hash, uint32_t offsetFrame, uint32_t songIdx = 0)
+        : hash(hash), offsetFrame(offsetFrame), songIdx(songIdx) {}
     
     std::string toString() const {
         std::ostringstream oss;
-        oss << "Hash: " << hash << ", Time: " << std::fixed << std::setprecision(3) 
-            << timeOffset << ", Song: " << songId;
+        oss << "Hash: " << hash << ", Frame: " << offsetFrame << " (" << std::fixed << std::setprecision(3) 
+            << frameToSeconds(offsetFrame) << " s), Song: " << songIdx;
         return oss.str();
     }
 };
@@ -0,0 +1,138 @@
+#include "TestHarness.h"
+#include "storage/FingerprintPack.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace AudioFingerprinting;
+
+namespace {
+
+PendingSong makeSong(uint32_t songIdx, size_t hashCount, std::mt19937_64& rng) {
+    PendingSong song;
+    song.info = SongInfo("Artist " + std::to_string(songIdx), "Album", "Title " + std::to_string(songIdx),
+                         "song-" + std::to_string(songIdx));
+    song.info.songIdx = songIdx;
+    for (size_t i = 0; i < hashCount; ++i) {
+        long hash = static_cast<long>(rng() & ((static_cast<uint64_t>(1) << 40) - 1));
+        song.hashes.emplace_back(hash, static_cast<uint32_t>(rng() % 20000));
+        if (i % 5 == 0) {
+            // Repeated hashes store their offsets as deltas
+            song.hashes.emplace_back(hash, static_cast<uint32_t>(rng() % 20000));
+        }
+    }
+    return song;
+}
+
+bool sameHashes(std::vector<HashResult> a, std::vector<HashResult> b) {
+    auto order = [](const HashResult& x, const HashResult& y) {
+        return x.hash != y.hash ? x.hash < y.hash : x.offsetFrame < y.offsetFrame;
+    };
+    std::sort(a.begin(), a.end(), order);
+    std::sort(b.begin(), b.end(), order);
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const HashResult& x, const HashResult& y) {
+        return x.hash == y.hash && x.offsetFrame == y.offsetFrame;
+    });
+}
+
+std::string writePack(const std::vector<PendingSong>& songs) {
+    std::string path = Test::scratchDir() + "/catalog.afpack";
+    FingerprintPackWriter writer(path, FingerprintProfile::Catalog);
+    for (const PendingSong& song : songs) {
+        AF_CHECK(writer.add(song.info, song.hashes));
+    }
+    AF_CHECK(writer.finish());
+    return path;
+}
+
+bool opens(const std::string& path) {
+    FingerprintPack pack;
+    return pack.open(path, FingerprintProfile::Catalog);
+}
+
+} // namespace
+
+AF_TEST(fingerprint_pack, RoundTrip) {
+    std::mt19937_64 rng(7);
+    std::vector<PendingSong> songs;
+    songs.push_back(makeSong(1, 500, rng));
+    songs.push_back(makeSong(42, 0, rng)); // A song without hashes
+    songs.push_back(makeSong(7, 2000, rng));
+    songs[2].info.album = "";
+    songs[2].info.title = "Caf\xc3\xa9 \"live\"\n";
+    size_t totalHashes = songs[0].hashes.size() + songs[2].hashes.size();
+
+    std::string path = writePack(songs);
+
+    FingerprintPack pack;
+    AF_CHECK(pack.open(path, FingerprintProfile::Catalog));
+    AF_CHECK(pack.songCount() == songs.size());
+    AF_CHECK(pack.hashCount() == totalHashes);
+
+    size_t read = 0;
+    AF_CHECK(pack.forEachSong([&](PendingSong& song) {
+        const PendingSong& expected = songs[read++];
+        AF_CHECK(song.info.songIdx == expected.info.songIdx);
+        AF_CHECK(song.info.songId == expected.info.songId);
+        AF_CHECK(song.info.title == expected.info.title);
+        AF_CHECK(song.info.artist == expected.info.artist);
+        AF_CHECK(song.info.album == expected.info.album);
+        AF_CHECK(sameHashes(song.hashes, expected.hashes));
+        return true;
+    }));
+    AF_CHECK(read == songs.size());
+}
+
+AF_TEST(fingerprint_pack, UnfinishedWriterLeavesNoFile) {
+    std::string path = Test::scratchDir() + "/partial.afpack";
+    {
+        std::mt19937_64 rng(8);
+        FingerprintPackWriter writer(path, FingerprintProfile::Catalog);
+        PendingSong song = makeSong(1, 10, rng);
+        AF_CHECK(writer.add(song.info, song.hashes));
+    }
+    AF_CHECK(Test::readFile(path).empty());
+    AF_CHECK(Test::readFile(path + ".tmp").empty());
+    AF_CHECK(!opens(path));
+}
+
+AF_TEST(fingerprint_pack, RejectsCorruptFiles) {
+    std::mt19937_64 rng(9);
+    std::string path = writePack({makeSong(1, 300, rng), makeSong(2, 300, rng)});
+    std::string good = Test::readFile(path);
+    AF_CHECK(opens(path));
+
+    auto rejects = [&path](const std::string& data) {
+        Test::writeFile(path, data);
+        return !opens(path);
+    };
+
+    // Header: magic[8] | version | profile id; footer: magic[8] | songs | hashes | checksum
+    std::string corrupt = good;
+    corrupt[0] ^= 0x01;
+    AF_CHECK(rejects(corrupt));
+
+    corrupt = good;
+    corrupt[8] = 9;
+    AF_CHECK(rejects(corrupt));
+
+    corrupt = good;
+    corrupt[12] = 1; // A catalog-v1 pack
+    AF_CHECK(rejects(corrupt));
+
+    corrupt = good;
+    corrupt[good.size() / 2] ^= 0x40; // Inside a record: fails the checksum
+    AF_CHECK(rejects(corrupt));
+
+    corrupt = good;
+    corrupt[good.size() - 32 + 8] ^= 0x01; // Song count
+    AF_CHECK(rejects(corrupt));
+
+    AF_CHECK(rejects(good.substr(0, good.size() - 1)));
+    AF_CHECK(rejects(good.substr(0, 40)));
+    AF_CHECK(rejects(""));
+
+    Test::writeFile(path, good);
+    AF_CHECK(opens(path));
+}
@@ -0,0 +1,130 @@
+#include "TestHarness.h"
+#include "storage/HashFilter.h"
+#include <cstring>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+using namespace AudioFingerprinting;
+
+namespace {
+
+// Distinct 40-bit hashes, the width fingerprint hashes have
+std::vector<long> randomHashes(size_t count, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::unordered_set<long> seen;
+    std::vector<long> hashes;
+    while (hashes.size() < count) {
+        long hash = static_cast<long>(rng() & ((static_cast<uint64_t>(1) << 40) - 1));
+        if (seen.insert(hash).second) {
+            hashes.push_back(hash);
+        }
+    }
+    return hashes;
+}
+
+} // namespace
+
+AF_TEST(hash_filter, NoFalseNegatives) {
+    std::vector<long> hashes = randomHashes(50000, 1);
+    HashFilter filter(hashes.size() / 2); // Overfilled: still no false negatives
+    for (long hash : hashes) {
+        filter.insert(hash);
+    }
+
+    size_t missed = 0;
+    for (long hash : hashes) {
+        if (!filter.mayContain(hash)) {
+            missed++;
+        }
+    }
+    AF_CHECK(missed == 0);
+    AF_CHECK(filter.size() == hashes.size());
+}
+
+AF_TEST(hash_filter, FalsePositiveRate) {
+    std::vector<long> hashes = randomHashes(100000, 2);
+    HashFilter filter(50000);
+    for (size_t i = 0; i < 50000; ++i) {
+        filter.insert(hashes[i]);
+    }
+
+    // Sized for its capacity the filter passes about 1% of absent hashes
+    size_t passed = 0;
+    for (size_t i = 50000; i < hashes.size(); ++i) {
+        if (filter.mayContain(hashes[i])) {
+            passed++;
+        }
+    }
+    AF_CHECK(passed < 50000 / 20);
+}
+
+AF_TEST(hash_filter, SaveLoadRoundTrip) {
+    std::vector<long> hashes = randomHashes(20000, 3);
+    HashFilter filter(hashes.size());
+    for (long hash : hashes) {
+        filter.insert(hash);
+    }
+
+    std::string path = Test::scratchDir() + "/index.filter";
+    AF_CHECK(filter.save(path, 1234));
+
+    auto loaded = HashFilter::load(path, 1234);
+    AF_CHECK(loaded != nullptr);
+    if (!loaded) {
+        return;
+    }
+    AF_CHECK(loaded->size() == filter.size());
+    AF_CHECK(loaded->capacity() == filter.capacity());
+    AF_CHECK(loaded->memoryBytes() == filter.memoryBytes());
+
+    std::vector<long> absent = randomHashes(20000, 4);
+    size_t differing = 0;
+    for (long hash : hashes) {
+        differing += loaded->mayContain(hash) ? 0 : 1;
+    }
+    for (long hash : absent) {
+        differing += loaded->mayContain(hash) != filter.mayContain(hash) ? 1 : 0;
+    }
+    AF_CHECK(differing == 0);
+}
+
+AF_TEST(hash_filter, LoadRejectsStaleOrCorruptFiles) {
+    HashFilter filter(1000);
+    for (long hash : randomHashes(1000, 5)) {
+        filter.insert(hash);
+    }
+    std::string path = Test::scratchDir() + "/index.filter";
+    AF_CHECK(filter.save(path, 1000));
+    std::string good = Test::readFile(path);
+
+    AF_CHECK(HashFilter::load(Test::scratchDir() + "/missing.filter", 1000) == nullptr);
+    AF_CHECK(HashFilter::load(path, 999) == nullptr); // Built from another index
+
+    std::string corrupt = good;
+    corrupt[0] = 'X';
+    Test::writeFile(path, corrupt);
+    AF_CHECK(HashFilter::load(path, 1000) == nullptr);
+
+    Test::writeFile(path, good.substr(0, good.size() - 1));
+    AF_CHECK(HashFilter::load(path, 1000) == nullptr);
+
+    Test::writeFile(path, good + "x");
+    AF_CHECK(HashFilter::load(path, 1000) == nullptr);
+
+    // Header: magic[8] | blockCount | capacity | inserted | sourceKeys
+    corrupt = good;
+    uint64_t hugeCapacity = ~static_cast<uint64_t>(0);
+    std::memcpy(&corrupt[16], &hugeCapacity, sizeof(hugeCapacity));
+    Test::writeFile(path, corrupt);
+    AF_CHECK(HashFilter::load(path, 1000) == nullptr);
+
+    corrupt = good;
+    uint64_t otherBlocks = 1;
+    std::memcpy(&corrupt[8], &otherBlocks, sizeof(otherBlocks));
+    Test::writeFile(path, corrupt);
+    AF_CHECK(HashFilter::load(path, 1000) == nullptr);
+
+    Test::writeFile(path, good);
+    AF_CHECK(HashFilter::load(path, 1000) != nullptr);
+}
@@ -0,0 +1,112 @@
+#include "TestHarness.h"
+#include "storage/HashIndex.h"
+#include <cstring>
+
+using namespace AudioFingerprinting;
+
+namespace {
+
+// Header fields corrupted below, by byte offset
+const size_t NUM_KEYS_AT = 24;
+const size_t NUM_POSTINGS_AT = 32;
+const size_t POSTINGS_OFFSET_AT = 48;
+const size_t STARTS_OFFSET_AT = 64;
+const size_t DIRECTORY_OFFSET_AT = 72;
+const size_t DIRECTORY_SHIFT_AT = 16;
+
+// 300 hashes, each held by songs 1-3 at the hash's own frame
+std::string writeIndex() {
+    std::string path = Test::scratchDir() + "/catalog.idx";
+    HashIndex::RowSource rows = [](const HashIndex::RowCallback& callback) {
+        for (long hash = 1; hash <= 300; ++hash) {
+            for (uint32_t songIdx = 1; songIdx <= 3; ++songIdx) {
+                if (!callback(hash * 1000, static_cast<uint32_t>(hash), songIdx)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+    AF_CHECK(HashIndex::write(rows, 3, path, FingerprintProfile::Catalog));
+    return path;
+}
+
+uint64_t getField(const std::string& data, size_t at) {
+    uint64_t value;
+    std::memcpy(&value, &data[at], sizeof(value));
+    return value;
+}
+
+std::string withField(std::string data, size_t at, uint64_t value) {
+    std::memcpy(&data[at], &value, sizeof(value));
+    return data;
+}
+
+bool opens(const std::string& path, const std::string& data) {
+    Test::writeFile(path, data);
+    HashIndex index;
+    return index.open(path, FingerprintProfile::Catalog);
+}
+
+} // namespace
+
+AF_TEST(hash_index, RoundTrip) {
+    std::string path = writeIndex();
+    HashIndex index;
+    AF_CHECK(index.open(path, FingerprintProfile::Catalog));
+    AF_CHECK(index.hashCount() == 300);
+    AF_CHECK(index.postingCount() == 900);
+    AF_CHECK(index.songCount() == 3);
+
+    auto postings = index.lookup(42000);
+    AF_CHECK(postings.second - postings.first == 3);
+    for (auto p = postings.first; p != postings.second; ++p) {
+        AF_CHECK(p->offsetFrame == 42);
+    }
+    AF_CHECK(index.lookup(42001).first == index.lookup(42001).second);
+}
+
+AF_TEST(hash_index, RejectsCorruptHeaders) {
+    std::string path = writeIndex();
+    std::string good = Test::readFile(path);
+    uint64_t numKeys = getField(good, NUM_KEYS_AT);
+    uint64_t numPostings = getField(good, NUM_POSTINGS_AT);
+    uint64_t startsOffset = getField(good, STARTS_OFFSET_AT);
+    uint64_t directoryOffset = getField(good, DIRECTORY_OFFSET_AT);
+
+    // Sizes whose byte counts wrap around 2^64
+    AF_CHECK(!opens(path, withField(good, NUM_POSTINGS_AT, (~static_cast<uint64_t>(0) >> 3) + 1)));
+    AF_CHECK(!opens(path, withField(good, NUM_KEYS_AT, ~static_cast<uint64_t>(0))));
+    AF_CHECK(!opens(path, withField(good, POSTINGS_OFFSET_AT, ~static_cast<uint64_t>(0) - 7)));
+    AF_CHECK(!opens(path, withField(good, POSTINGS_OFFSET_AT, 3))); // Misaligned
+
+    std::string shift = good;
+    uint32_t wideShift = 64;
+    std::memcpy(&shift[DIRECTORY_SHIFT_AT], &wideShift, sizeof(wideShift));
+    AF_CHECK(!opens(path, shift));
+
+    // starts must rise from 0 to numPostings
+    AF_CHECK(!opens(path, withField(good, startsOffset + 8 * 10, numPostings + 1)));
+    AF_CHECK(!opens(path, withField(good, startsOffset + 8 * numKeys, numPostings - 1)));
+    AF_CHECK(!opens(path, withField(good, startsOffset, 1)));
+
+    // and the directory from 0 to numKeys
+    AF_CHECK(!opens(path, withField(good, directoryOffset + 8 * 5, numKeys + 100)));
+    AF_CHECK(!opens(path, withField(good, directoryOffset, 1)));
+
+    AF_CHECK(!opens(path, good.substr(0, good.size() - 8)));
+    AF_CHECK(!opens(path, good.substr(0, 16)));
+    AF_CHECK(opens(path, good));
+}
+
+AF_TEST(hash_index, RejectsOtherProfiles) {
+    std::string path = writeIndex();
+    std::string good = Test::readFile(path);
+
+    // profile is the fourth 32-bit header field; 0 and 1 predate catalog-v2
+    for (uint32_t profile : {0u, 1u, 7u}) {
+        std::string other = good;
+        std::memcpy(&other[20], &profile, sizeof(profile));
+        AF_CHECK(!opens(path, other));
+    }
+}
@@ -0,0 +1,218 @@
+#include "TestHarness.h"
+#include "storage/SegmentedIndex.h"
+#include <set>
+#include <vector>
+
+using namespace AudioFingerprinting;
+
+namespace {
+
+// Song songIdx holds hashes songIdx * 100000 + [0, count), one frame apart
+PendingSong makeSong(uint32_t songIdx, int count) {
+    PendingSong song;
+    song.info.songIdx = songIdx;
+    for (int i = 0; i < count; ++i) {
+        song.hashes.emplace_back(static_cast<long>(songIdx) * 100000 + i, static_cast<uint32_t>(i));
+    }
+    return song;
+}
+
+std::vector<long> hashesOf(const std::vector<uint32_t>& songIdxs, int count) {
+    std::vector<long> hashes;
+    for (uint32_t songIdx : songIdxs) {
+        for (const HashResult& hash : makeSong(songIdx, count).hashes) {
+            hashes.push_back(hash.hash);
+        }
+    }
+    return hashes;
+}
+
+// Songs with at least one posting for hashes in the current snapshot
+std::set<uint32_t> songsFound(const SegmentedIndex& index, const std::vector<long>& hashes) {
+    std::set<uint32_t> songs;
+    index.snapshot()->forEachHashMatch(hashes, [&songs](long, uint32_t songIdx, uint32_t) {
+        songs.insert(songIdx);
+    });
+    return songs;
+}
+
+std::string basePath() {
+    return Test::scratchDir() + "/catalog.idx";
+}
+
+// Songs 1-4 with 100 hashes each, folded into a base index
+void buildBase(SegmentedIndex& index) {
+    AF_CHECK(index.open());
+    index.add({makeSong(1, 100), makeSong(2, 100), makeSong(3, 100), makeSong(4, 100)});
+    AF_CHECK(index.flush());
+    AF_CHECK(index.compact());
+    AF_CHECK(SegmentedIndex::existsFor(basePath()));
+}
+
+} // namespace
+
+AF_TEST(segmented_index, ManifestRoundTrip) {
+    std::vector<long> hashes = hashesOf({1, 2, 3, 4}, 50);
+    {
+        SegmentedIndex writer(basePath(), FingerprintProfile::Catalog);
+        AF_CHECK(writer.open());
+        writer.add({makeSong(1, 50), makeSong(2, 50), makeSong(3, 50)});
+        AF_CHECK(writer.flush());
+        writer.add({makeSong(4, 50)});
+        AF_CHECK(writer.flush());
+        AF_CHECK(writer.remove({2}));
+    }
+
+    SegmentedIndex reader(basePath(), FingerprintProfile::Catalog);
+    AF_CHECK(reader.open());
+    AF_CHECK(reader.snapshot()->songCount() == 3);
+    AF_CHECK(songsFound(reader, hashes) == std::set<uint32_t>({1, 3, 4}));
+    AF_CHECK(!reader.refresh());
+
+    // Another process's flush shows up on refresh
+    {
+        SegmentedIndex writer(basePath(), FingerprintProfile::Catalog);
+        AF_CHECK(writer.open());
+        writer.add({makeSong(5, 50)});
+        AF_CHECK(writer.flush());
+    }
+    AF_CHECK(reader.refresh());
+    AF_CHECK(songsFound(reader, hashesOf({1, 2, 3, 4, 5}, 50)) == std::set<uint32_t>({1, 3, 4, 5}));
+}
+
+AF_TEST(segmented_index, RejectsCorruptManifest) {
+    std::string manifest = SegmentedIndex::manifestPathFor(basePath());
+    const char* corrupt[] = {
+        "AFSEG 9\nnext 2\n1\n",
+        "AFSEG 2\nnext\n",
+        "AFSEG 2\nnext 3\n1\nsegment\n",
+        "AFSEG 2\nnext 3\n1\nremoved x\n",
+        "garbage",
+    };
+    for (const char* text : corrupt) {
+        Test::writeFile(manifest, text);
+        SegmentedIndex index(basePath(), FingerprintProfile::Catalog);
+        AF_CHECK(!index.open());
+    }
+}
+
+AF_TEST(segmented_index, TombstoneAcrossFlush) {
+    std::vector<long> hashes = hashesOf({1, 2, 3}, 100);
+    {
+        SegmentedIndex index(basePath(), FingerprintProfile::Catalog);
+        AF_CHECK(index.open());
+        index.add({makeSong(1, 100), makeSong(2, 100), makeSong(3, 100)});
+
+        // The unflushed runs are flushed first, so the tombstone names a song in the files
+        AF_CHECK(index.remove({2}));
+        AF_CHECK(songsFound(index, hashes) == std::set<uint32_t>({1, 3}));
+        AF_CHECK(index.flush());
+        AF_CHECK(songsFound(index, hashes) == std::set<uint32_t>({1, 3}));
+    }
+
+    SegmentedIndex reopened(basePath(), FingerprintProfile::Catalog);
+    AF_CHECK(reopened.open());
+    AF_CHECK(songsFound(reopened, hashes) == std::set<uint32_t>({1, 3}));
+    AF_CHECK(reopened.snapshot()->songCount() == 2);
+}
+
+AF_TEST(segmented_index, TombstoneAcrossCompaction) {
+    SegmentedIndex index(basePath(), FingerprintProfile::Catalog);
+    buildBase(index);
+
+    // Two small segments: merged with each other, not folded into the base
+    index.add({makeSong(5, 10)});
+    AF_CHECK(index.flush());
+    index.add({makeSong(6, 10)});
+    AF_CHECK(index.flush());
+    AF_CHECK(index.remove({5}));
+    AF_CHECK(index.compact());
+
+    std::vector<long> hashes = hashesOf({1, 2, 3, 4, 5, 6}, 100);
+    std::set<uint32_t> expected = {1, 2, 3, 4, 6};
+    AF_CHECK(songsFound(index, hashes) == expected);
+    AF_CHECK(index.snapshot()->postingCount() == 410);
+
+    SegmentedIndex reopened(basePath(), FingerprintProfile::Catalog);
+    AF_CHECK(reopened.open());
+    AF_CHECK(songsFound(reopened, hashes) == expected);
+    AF_CHECK(reopened.snapshot()->songCount() == expected.size());
+}
+
+AF_TEST(segmented_index, FoldIntoBaseAppliesTombstonesOnce) {
+    std::string manifest = SegmentedIndex::manifestPathFor(basePath());
+    std::vector<long> hashes = hashesOf({1, 2, 3, 4}, 100);
+    std::vector<long> song5 = hashesOf({5}, 200);
+    hashes.insert(hashes.end(), song5.begin(), song5.end());
+    std::set<uint32_t> expected = {1, 3, 4, 5};
+    std::string beforeFold;
+    {
+        SegmentedIndex index(basePath(), FingerprintProfile::Catalog);
+        buildBase(index);
+        AF_CHECK(index.remove({2}));
+
+        // Half the base's postings: enough to fold into it
+        index.add({makeSong(5, 200)});
+        AF_CHECK(index.flush());
+        beforeFold = Test::readFile(manifest);
+        AF_CHECK(beforeFold.find("removed 2") != std::string::npos);
+
+        AF_CHECK(index.compact());
+        AF_CHECK(songsFound(index, hashes) == expected);
+        AF_CHECK(index.snapshot()->postingCount() == 500);
+    }
+
+    // The fold cleared the tombstone it applied, and the base lists the song as dropped
+    AF_CHECK(Test::readFile(manifest).find("removed") == std::string::npos);
+    HashIndex base;
+    AF_CHECK(base.open(basePath(), FingerprintProfile::Catalog));
+    AF_CHECK(base.hasDropped(2));
+    AF_CHECK(!base.hasDropped(1));
+    base.close();
+
+    {
+        SegmentedIndex reopened(basePath(), FingerprintProfile::Catalog);
+        AF_CHECK(reopened.open());
+        AF_CHECK(songsFound(reopened, hashes) == expected);
+        AF_CHECK(reopened.snapshot()->songCount() == expected.size());
+    }
+
+    // A crash between writing the base and the manifest leaves the folded
+    // segment and the tombstone listed: neither may count twice
+    Test::writeFile(manifest, beforeFold);
+    SegmentedIndex recovered(basePath(), FingerprintProfile::Catalog);
+    AF_CHECK(recovered.open());
+    AF_CHECK(songsFound(recovered, hashes) == expected);
+    AF_CHECK(recovered.snapshot()->songCount() == expected.size());
+    AF_CHECK(recovered.snapshot()->postingCount() == 500);
+}
+
+AF_TEST(segmented_index, FilterHasNoFalseNegatives) {
+    std::vector<long> hashes = hashesOf({1, 2, 3, 4, 5, 6}, 100);
+    {
+        SegmentedIndex index(basePath(), FingerprintProfile::Catalog);
+        buildBase(index);
+        index.add({makeSong(5, 100)});
+        AF_CHECK(index.flush());
+        index.add({makeSong(6, 100)}); // Left in memory
+
+        auto snapshot = index.snapshot();
+        AF_CHECK(snapshot->filter != nullptr);
+        size_t missed = 0;
+        for (long hash : hashes) {
+            missed += snapshot->mayContain(hash) ? 0 : 1;
+        }
+        AF_CHECK(missed == 0);
+        AF_CHECK(index.flush());
+    }
+
+    // The base's filter is read back from its file
+    SegmentedIndex reopened(basePath(), FingerprintProfile::Catalog);
+    AF_CHECK(reopened.open());
+    size_t missed = 0;
+    for (long hash : hashes) {
+        missed += reopened.snapshot()->mayContain(hash) ? 0 : 1;
+    }
+    AF_CHECK(missed == 0);
+    AF_CHECK(songsFound(reopened, hashes) == std::set<uint32_t>({1, 2, 3, 4, 5, 6}));
+}
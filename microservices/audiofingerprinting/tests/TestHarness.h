@@ -0,0 +1,53 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace AudioFingerprinting {
+namespace Test {
+
+// Minimal registry behind AF_TEST: every test of a suite runs when the
+// suite's name is passed on the command line (one ctest entry per suite)
+struct TestCase {
+    std::string suite;
+    std::string name;
+    std::function<void()> body;
+};
+
+std::vector<TestCase>& registry();
+
+struct Registrar {
+    Registrar(const char* suite, const char* name, std::function<void()> body) {
+        registry().push_back({suite, name, std::move(body)});
+    }
+};
+
+// A failed AF_CHECK marks the running test failed; the test carries on
+void reportFailure(const char* file, int line, const char* expression);
+
+// Empty directory for the running test's files, removed after it
+const std::string& scratchDir();
+
+// Whole-file helpers for corrupting the formats under test
+std::string readFile(const std::string& path);
+void writeFile(const std::string& path, const std::string& data);
+
+} // namespace Test
+} // namespace AudioFingerprinting
+
+#define AF_TEST(suite, name)                                                                      \
+    static void suite##_##name();                                                                 \
+    static ::AudioFingerprinting::Test::Registrar suite##_##name##_registrar(#suite, #name,      \
+                                                                             suite##_##name);     \
+    static void suite##_##name()
+
+#define AF_CHECK(condition)                                                                       \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            ::AudioFingerprinting::Test::reportFailure(__FILE__, __LINE__, #condition);           \
+        }                                                                                         \
+    } while (0)
+
+#endif
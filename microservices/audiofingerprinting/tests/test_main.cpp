@@ -0,0 +1,92 @@
+#include "TestHarness.h"
+#include "utils/Log.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unistd.h>
+
+namespace AudioFingerprinting {
+namespace Test {
+
+namespace {
+
+std::string currentScratch;
+int currentFailures = 0;
+
+} // namespace
+
+std::vector<TestCase>& registry() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+void reportFailure(const char* file, int line, const char* expression) {
+    std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+    currentFailures++;
+}
+
+const std::string& scratchDir() {
+    return currentScratch;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+} // namespace Test
+} // namespace AudioFingerprinting
+
+// Usage: audioFingerprintingTests [suite]; runs every suite when none is given
+int main(int argc, char* argv[]) {
+    using namespace AudioFingerprinting;
+    namespace fs = std::filesystem;
+
+    // Rejecting corrupt files is expected here; only the verdicts are of interest
+    setLogLevel(LogLevel::Error);
+
+    std::string suite = argc > 1 ? argv[1] : "";
+    int run = 0;
+    int failed = 0;
+    for (const Test::TestCase& test : Test::registry()) {
+        if (!suite.empty() && test.suite != suite) {
+            continue;
+        }
+
+        fs::path scratch = fs::temp_directory_path() /
+                           ("af-test-" + test.suite + "-" + test.name + "-" + std::to_string(getpid()));
+        fs::remove_all(scratch);
+        fs::create_directories(scratch);
+        Test::currentScratch = scratch.string();
+        Test::currentFailures = 0;
+
+        try {
+            test.body();
+        } catch (const std::exception& e) {
+            Test::reportFailure(__FILE__, __LINE__, e.what());
+        }
+
+        std::error_code ignored;
+        fs::remove_all(scratch, ignored);
+
+        run++;
+        if (Test::currentFailures > 0) {
+            failed++;
+        }
+        std::cout << (Test::currentFailures > 0 ? "[FAIL] " : "[ OK ] ") << test.suite << "." << test.name
+                  << std::endl;
+    }
+
+    if (run == 0) {
+        std::cerr << "No tests in suite: " << suite << std::endl;
+        return 1;
+    }
+    std::cout << run - failed << " of " << run << " tests passed" << std::endl;
+    return failed > 0 ? 1 : 0;
+}